@@ -0,0 +1,85 @@
+#include <stdlib.h>
+
+#include <iostream>
+
+#include "fiber/context.h"
+#include "fiber/fiber.h"
+#include "fiber/stack_allocator.h"
+#include "utils/utils.h"
+
+/**
+ * 两个上下文之间来回切换，统计每秒切换次数
+ * 用法：context_switch_benchmark [切换次数]
+ */
+
+static const size_t STACK_SIZE = 64 * 1024;
+static uint64_t s_switch_counts = 10000000;
+
+template <typename Context>
+struct PingPong {
+    static Context main_ctx;
+    static Context fiber_ctx;
+
+    static void Entry() {
+        while (true) {
+            fiber_ctx.swapTo(main_ctx);
+        }
+    }
+
+    static double Run() {
+        void* stack = tihi::StackAllocator::Alloc(STACK_SIZE);
+        fiber_ctx.make(stack, STACK_SIZE, &PingPong::Entry);
+
+        uint64_t start = tihi::US();
+        /**
+         * 每次循环切入切出各一次
+         */
+        for (uint64_t i = 0; i < s_switch_counts / 2; ++i) {
+            main_ctx.swapTo(fiber_ctx);
+        }
+        uint64_t used = tihi::US() - start;
+
+        tihi::StackAllocator::Dealloc(stack, STACK_SIZE);
+        return used ? s_switch_counts * 1000000.0 / used : 0;
+    }
+};
+
+template <typename Context>
+Context PingPong<Context>::main_ctx;
+template <typename Context>
+Context PingPong<Context>::fiber_ctx;
+
+static double FiberRun() {
+    tihi::Fiber::This();
+    tihi::Fiber::ptr fiber(new tihi::Fiber(
+        []() {
+            while (true) {
+                tihi::Fiber::YieldToHold();
+            }
+        },
+        STACK_SIZE));
+
+    uint64_t start = tihi::US();
+    for (uint64_t i = 0; i < s_switch_counts / 2; ++i) {
+        fiber->swapIn();
+    }
+    uint64_t used = tihi::US() - start;
+    return used ? s_switch_counts * 1000000.0 / used : 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_switch_counts = strtoull(argv[1], nullptr, 10);
+    }
+
+    std::cout << "switches: " << s_switch_counts << std::endl;
+    std::cout << "ucontext: " << (uint64_t)PingPong<tihi::UContext>::Run()
+              << " switches/s" << std::endl;
+#ifdef TIHI_HAVE_ASM_CONTEXT
+    std::cout << "asm:      " << (uint64_t)PingPong<tihi::AsmContext>::Run()
+              << " switches/s" << std::endl;
+#endif
+    std::cout << "Fiber(" << tihi::FiberContextName()
+              << "): " << (uint64_t)FiberRun() << " switches/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "utils/utils.h"
+
+/**
+ * 过载时按到达顺序执行和按截止时间执行（EDF，过期丢弃或快速失败）的有效吞吐量
+ * 每个任务占用 CPU work_us，要在提交后 deadline_ms 内完成才算有效；
+ * 先测出调度器每秒能完成多少任务，再按它的 overload 倍提交
+ * 用法：deadline_benchmark [线程数] [work_us] [deadline_ms] [秒数] [overload]
+ */
+
+static uint32_t s_threads = 1;
+static uint32_t s_work_us = 200;
+static uint32_t s_deadline_ms = 50;
+static uint32_t s_seconds = 2;
+static double s_overload = 2;
+
+static std::atomic<uint64_t> s_completed{0};
+static std::atomic<uint64_t> s_on_time{0};
+static std::atomic<uint64_t> s_failed{0};
+
+static void Work(uint64_t deadline_us) {
+    uint64_t end = tihi::US() + s_work_us;
+    while (tihi::US() < end) {
+    }
+    ++s_completed;
+    if (tihi::US() <= deadline_us) {
+        ++s_on_time;
+    }
+}
+
+/**
+ * mode：fifo 普通提交；edf 带截止时间，过期丢弃；edf_fail 过期时执行失败回调
+ */
+static void Run(const std::string& mode, double rate) {
+    s_completed = 0;
+    s_on_time = 0;
+    s_failed = 0;
+
+    uint64_t submitted = 0;
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(s_threads, false, "deadline_bench");
+        uint64_t start = tihi::US();
+        uint64_t duration = s_seconds * 1000 * 1000ull;
+        uint64_t now = start;
+        while (now - start < duration) {
+            /**
+             * 按经过的时间补齐应该提交的任务数，平滑地匀速提交
+             */
+            uint64_t target = (uint64_t)((now - start) * rate / 1000000);
+            for (; submitted < target; ++submitted) {
+                uint64_t deadline = tihi::US() + s_deadline_ms * 1000ull;
+                if (mode == "fifo") {
+                    iom.schedule(std::bind(&Work, deadline));
+                } else if (mode == "edf") {
+                    iom.scheduleWithDeadline(std::bind(&Work, deadline),
+                                             deadline);
+                } else {
+                    iom.scheduleWithDeadline(std::bind(&Work, deadline),
+                                             deadline, []() { ++s_failed; });
+                }
+            }
+            ::usleep(1000);
+            now = tihi::US();
+        }
+        stats = iom.stats();
+    }
+
+    uint64_t expired = 0;
+    for (auto& lane : stats.lanes) {
+        expired += lane.expired;
+    }
+    std::cout << mode << "\tsubmitted=" << submitted
+              << "\tcompleted=" << s_completed << "\ton_time=" << s_on_time
+              << "\texpired=" << expired << "\tfailed_fast=" << s_failed
+              << "\tgoodput/s=" << s_on_time / s_seconds << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_threads = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        s_work_us = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3) {
+        s_deadline_ms = strtoul(argv[3], nullptr, 10);
+    }
+    if (argc > 4) {
+        s_seconds = strtoul(argv[4], nullptr, 10);
+    }
+    if (argc > 5) {
+        s_overload = strtod(argv[5], nullptr);
+    }
+
+    /**
+     * 调度器每次 tickle 都会打日志
+     */
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+
+    /**
+     * 一次性放进足够多的任务，测出饱和时每秒完成的任务数
+     */
+    uint64_t counts = 1000000 / s_work_us * s_threads / 2;
+    uint64_t start = tihi::US();
+    {
+        tihi::IOManager iom(s_threads, false, "deadline_capacity");
+        for (uint64_t i = 0; i < counts; ++i) {
+            iom.schedule(std::bind(&Work, ~0ull));
+        }
+    }
+    double capacity = counts * 1000000.0 / (tihi::US() - start);
+    double rate = capacity * s_overload;
+    std::cout << "capacity=" << (uint64_t)capacity << "/s\toffered="
+              << (uint64_t)rate << "/s\tdeadline=" << s_deadline_ms << "ms"
+              << std::endl;
+
+    Run("fifo", rate);
+    Run("edf", rate);
+    Run("edf_fail", rate);
+    return 0;
+}
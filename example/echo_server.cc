@@ -70,8 +70,8 @@ void run() {
 
 int main(int argv, char** argc) {
 
-    if (argv != 2) {
-        std::cout << "Usage: " << argc[0] << " -b/-t\n";
+    if (argv != 2 && argv != 3) {
+        std::cout << "Usage: " << argc[0] << " -b/-t [epoll/io_uring]\n";
         return -1;
     }
 
@@ -79,7 +79,12 @@ int main(int argv, char** argc) {
         type = 2;
     }
 
-    tihi::IOManager iom(1);
+    tihi::IOManager::Backend backend = tihi::IOManager::DefaultBackend();
+    if (argv == 3) {
+        backend = tihi::IOManager::BackendFromString(argc[2]);
+    }
+
+    tihi::IOManager iom(1, true, "", backend);
     iom.schedule(run);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,183 @@
+#include <sched.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include "thread/thread.h"
+#include "utils/fd_table.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+/**
+ * 对比原来 FdManager / IOManager 用的 RWMutex + std::vector 和 FdTable
+ * 按 fd 查找的开销，线程数为 1、8、32，每个线程轮流查 s_fds 个 fd
+ * 用法：fd_table_benchmark [每个线程的查找次数] [fd 个数]
+ */
+
+static uint64_t s_lookups = 2000000;
+static int s_fds = 1024;
+
+using Item = std::shared_ptr<int>;
+
+/**
+ * 原来的表：查找加读锁，扩容加写锁
+ */
+class LockedTable {
+public:
+    LockedTable() : items_(32) {}
+
+    Item get(int fd) {
+        tihi::RWMutex::read_lock lock(mutex_);
+        if (items_.size() <= (size_t)fd) {
+            return nullptr;
+        }
+        return items_[fd];
+    }
+
+    void set(int fd, const Item& item) {
+        tihi::RWMutex::write_lock lock(mutex_);
+        if (items_.size() <= (size_t)fd) {
+            items_.resize(fd * 1.5 + 1);
+        }
+        items_[fd] = item;
+    }
+
+private:
+    tihi::RWMutex mutex_;
+    std::vector<Item> items_;
+};
+
+/**
+ * 槽位里放 shared_ptr，用 std::atomic_load 读，
+ * libstdc++ 的实现按地址哈希到一把全局锁上，查找并不是无锁的
+ */
+class SharedTable {
+public:
+    Item get(int fd) {
+        Item* slot = table_.get(fd);
+        return slot ? std::atomic_load(slot) : nullptr;
+    }
+
+    void set(int fd, const Item& item) {
+        std::atomic_store(table_.getOrCreate(fd), item);
+    }
+
+private:
+    tihi::FdTable<Item> table_;
+};
+
+/**
+ * FdManager 的用法：槽位里是裸指针，查找只是一次 acquire 读
+ */
+class PointerTable {
+public:
+    PointerTable()
+        : table_([](std::atomic<int*>& item, int) { item = nullptr; }) {}
+
+    Item get(int fd) {
+        std::atomic<int*>* slot = table_.get(fd);
+        return slot && slot->load(std::memory_order_acquire) ? s_item
+                                                              : nullptr;
+    }
+
+    void set(int fd, const Item& item) {
+        table_.getOrCreate(fd)->store(item.get(), std::memory_order_release);
+    }
+
+private:
+    static Item s_item;
+    tihi::FdTable<std::atomic<int*>> table_;
+};
+
+Item PointerTable::s_item(new int(1));
+
+/**
+ * IOManager 的用法：元素就在槽位里，只取地址
+ */
+class RawTable {
+public:
+    Item get(int fd) {
+        int* item = table_.get(fd);
+        return item && *item ? s_item : nullptr;
+    }
+
+    void set(int fd, const Item& item) { *table_.getOrCreate(fd) = *item; }
+
+private:
+    static Item s_item;
+    tihi::FdTable<int> table_;
+};
+
+Item RawTable::s_item(new int(1));
+
+/**
+ * 返回每次查找的平均耗时（ns）
+ */
+template <typename Table>
+static double Run(size_t threads) {
+    Table table;
+    Item item(new int(1));
+    for (int fd = 0; fd < s_fds; ++fd) {
+        table.set(fd, item);
+    }
+
+    std::atomic<size_t> ready{0};
+    std::atomic<uint64_t> found{0};
+    std::vector<tihi::Thread::ptr> workers;
+    uint64_t start = tihi::US();
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back(new tihi::Thread(
+            [&table, &ready, &found, threads, t]() {
+                ++ready;
+                while (ready != threads) {
+                    sched_yield();
+                }
+                uint64_t counts = 0;
+                int fd = t * 7 % s_fds;
+                for (uint64_t i = 0; i < s_lookups; ++i) {
+                    if (table.get(fd)) {
+                        ++counts;
+                    }
+                    if (++fd == s_fds) {
+                        fd = 0;
+                    }
+                }
+                found += counts;
+            },
+            "lookup"));
+    }
+    for (auto& w : workers) {
+        w->join();
+    }
+    uint64_t used_us = tihi::US() - start;
+    if (found != threads * s_lookups) {
+        std::cerr << "lookup failed" << std::endl;
+        exit(1);
+    }
+    return used_us * 1000.0 / (threads * s_lookups);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_lookups = strtoull(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        s_fds = atoi(argv[2]);
+    }
+
+    std::cout << "lookups per thread: " << s_lookups << " fds: " << s_fds
+              << " (ns/lookup, wall time over all lookups)" << std::endl;
+    std::cout << "threads\trwlock+vector\tfd_table shared_ptr\tfd_table pointer"
+                 "\tfd_table raw"
+              << std::endl;
+    for (size_t threads : {1, 8, 32}) {
+        std::cout << threads << "\t" << Run<LockedTable>(threads) << "\t\t"
+                  << Run<SharedTable>(threads) << "\t\t\t"
+                  << Run<PointerTable>(threads) << "\t\t\t"
+                  << Run<RawTable>(threads) << std::endl;
+    }
+    return 0;
+}
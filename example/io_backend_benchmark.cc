@@ -0,0 +1,158 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <iostream>
+
+#include "config/config.h"
+#include "hook/syscall_stats.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+/**
+ * 在回环地址上跑 echo，对比 epoll（共用一个 epoll 实例、每个线程一个 reactor、
+ * 常驻注册）
+ * 和 io_uring 后端处理一个请求（客户端写、服务端读、服务端写、客户端读）
+ * 花掉的系统调用次数和吞吐量
+ * 用法：io_backend_benchmark [连接数] [每个连接的请求数] [线程数]
+ *                            [sqpoll_idle_ms]
+ */
+
+static uint32_t s_conns = 16;
+static uint32_t s_requests = 5000;
+static uint32_t s_threads = 1;
+static uint32_t s_sqpoll_idle_ms = 0;
+
+static std::atomic<uint32_t> s_done{0};
+
+static void Echo(int fd) {
+    char buf[128];
+    while (true) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        send(fd, buf, n, 0);
+    }
+    close(fd);
+}
+
+static void Client(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    TIHI_ASSERT((connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0));
+    char buf[64] = "ping";
+    for (uint32_t i = 0; i < s_requests; ++i) {
+        send(fd, buf, sizeof(buf), 0);
+        size_t got = 0;
+        while (got < sizeof(buf)) {
+            ssize_t n = recv(fd, buf + got, sizeof(buf) - got, 0);
+            TIHI_ASSERT((n > 0));
+            got += n;
+        }
+    }
+    close(fd);
+    ++s_done;
+}
+
+static void Server() {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TIHI_ASSERT((bind(lfd, (sockaddr*)&addr, sizeof(addr)) == 0));
+    TIHI_ASSERT((listen(lfd, 1024) == 0));
+    socklen_t len = sizeof(addr);
+    getsockname(lfd, (sockaddr*)&addr, &len);
+    uint16_t port = ntohs(addr.sin_port);
+
+    tihi::IOManager* iom = tihi::IOManager::This();
+    for (uint32_t i = 0; i < s_conns; ++i) {
+        iom->schedule(std::bind(&Client, port));
+    }
+    for (uint32_t i = 0; i < s_conns; ++i) {
+        int fd = accept(lfd, nullptr, nullptr);
+        TIHI_ASSERT((fd >= 0));
+        /**
+         * 不是 reactor-per-thread 模式时 reactorThread 返回 -1，不指定线程
+         */
+        pid_t thread_id = iom->reactorThread(iom->bindFd(fd));
+        iom->schedule(std::bind(&Echo, fd), thread_id);
+    }
+    close(lfd);
+}
+
+static void Run(tihi::IOManager::Backend backend, uint32_t sqpoll_idle_ms,
+                bool sharded = false, bool persistent = false) {
+    tihi::Config::Lookup<uint32_t>("iomanager.io_uring.sqpoll_idle_ms")
+        ->set_value(sqpoll_idle_ms);
+    tihi::Config::Lookup<bool>("iomanager.reactor_per_thread")
+        ->set_value(sharded);
+    tihi::Config::Lookup<bool>("iomanager.epoll_persistent")
+        ->set_value(persistent);
+    s_done = 0;
+    tihi::SyscallStats::Snapshot before = tihi::SyscallStats::Get();
+    uint64_t start = tihi::US();
+    tihi::IOManager::Backend actual;
+    {
+        tihi::IOManager iom(s_threads, false, "io_bench", backend);
+        actual = iom.backend();
+        sharded = iom.sharded();
+        persistent = iom.persistent();
+        iom.schedule(&Server);
+    }
+    uint64_t used = tihi::US() - start;
+    tihi::SyscallStats::Snapshot diff = tihi::SyscallStats::Get() - before;
+
+    double requests = (double)s_conns * s_requests;
+    std::cout << tihi::IOManager::BackendToString(actual)
+              << (sqpoll_idle_ms ? "+sqpoll" : "")
+              << (sharded ? "+reactors" : "")
+              << (persistent ? "+persistent" : "")
+              << "\trequests/s=" << (uint64_t)(requests * 1000000 / used)
+              << "\tsyscalls/request=" << diff.total() / requests;
+    for (int i = 0; i < tihi::SyscallStats::TYPE_COUNTS; ++i) {
+        std::cout << "\t"
+                  << tihi::SyscallStats::ToString((tihi::SyscallStats::Type)i)
+                  << "=" << diff.counts[i] / requests;
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_conns = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        s_requests = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3) {
+        s_threads = strtoul(argv[3], nullptr, 10);
+    }
+    if (argc > 4) {
+        s_sqpoll_idle_ms = strtoul(argv[4], nullptr, 10);
+    }
+
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+
+    Run(tihi::IOManager::Backend::EPOLL, 0);
+    Run(tihi::IOManager::Backend::EPOLL, 0, true);
+    Run(tihi::IOManager::Backend::EPOLL, 0, false, true);
+    Run(tihi::IOManager::Backend::EPOLL, 0, true, true);
+    Run(tihi::IOManager::Backend::IO_URING, 0);
+    if (s_sqpoll_idle_ms) {
+        Run(tihi::IOManager::Backend::IO_URING, s_sqpoll_idle_ms);
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <vector>
+
+#include "thread/thread.h"
+#include "utils/mpmc_queue.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+/**
+ * 对比 MPMCQueue 和原来调度器使用的 Mutex + std::list 的吞吐量
+ * 生产者线程数从 1 增加到 64，消费者线程数固定
+ * 用法：mpmc_queue_benchmark [总元素数] [消费者线程数]
+ */
+
+static uint64_t s_total = 2000000;
+static size_t s_consumers = 4;
+
+/**
+ * 原来的全局任务队列
+ */
+class LockedList {
+public:
+    void push(uint64_t&& v) {
+        tihi::Mutex::mutex lock(mutex_);
+        list_.push_back(v);
+    }
+
+    void pushBulk(uint64_t* items, size_t counts) {
+        tihi::Mutex::mutex lock(mutex_);
+        for (size_t i = 0; i < counts; ++i) {
+            list_.push_back(items[i]);
+        }
+    }
+
+    bool pop(uint64_t& v) {
+        tihi::Mutex::mutex lock(mutex_);
+        if (list_.empty()) {
+            return false;
+        }
+        v = list_.front();
+        list_.pop_front();
+        return true;
+    }
+
+private:
+    tihi::Mutex mutex_;
+    std::list<uint64_t> list_;
+};
+
+/**
+ * bulk 为 0 时逐个入队，否则每次入队 bulk 个
+ */
+template <typename Queue>
+static double Run(size_t producers, size_t bulk) {
+    Queue queue;
+    uint64_t per_producer = s_total / producers;
+    uint64_t total = per_producer * producers;
+    std::atomic<uint64_t> popped{0};
+
+    uint64_t start = tihi::US();
+    std::vector<tihi::Thread::ptr> threads;
+    for (size_t p = 0; p < producers; ++p) {
+        threads.emplace_back(new tihi::Thread(
+            [&queue, per_producer, bulk]() {
+                std::vector<uint64_t> items(bulk ? bulk : 1);
+                uint64_t i = 0;
+                while (i < per_producer) {
+                    if (!bulk) {
+                        uint64_t v = i++;
+                        queue.push(std::move(v));
+                        continue;
+                    }
+                    size_t n = 0;
+                    while (n < bulk && i < per_producer) {
+                        items[n++] = i++;
+                    }
+                    queue.pushBulk(items.data(), n);
+                }
+            },
+            "producer"));
+    }
+    for (size_t c = 0; c < s_consumers; ++c) {
+        threads.emplace_back(new tihi::Thread(
+            [&queue, &popped, total]() {
+                uint64_t v;
+                while (popped < total) {
+                    if (queue.pop(v)) {
+                        ++popped;
+                    }
+                }
+            },
+            "consumer"));
+    }
+    for (auto& t : threads) {
+        t->join();
+    }
+    return total * 1.0 / (tihi::US() - start);
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_total = strtoull(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        s_consumers = strtoul(argv[2], nullptr, 10);
+    }
+
+    std::cout << "items: " << s_total << " consumers: " << s_consumers
+              << " (M ops/s)" << std::endl;
+    std::cout << "producers\tmutex+list\tmpmc\tmutex+list bulk32\tmpmc bulk32"
+              << std::endl;
+    for (size_t producers : {1, 2, 4, 8, 16, 32, 64}) {
+        std::cout << producers << "\t\t" << Run<LockedList>(producers, 0)
+                  << "\t\t" << Run<tihi::MPMCQueue<uint64_t>>(producers, 0)
+                  << "\t" << Run<LockedList>(producers, 32) << "\t\t\t"
+                  << Run<tihi::MPMCQueue<uint64_t>>(producers, 32)
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+#include "config/config.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "utils/utils.h"
+
+/**
+ * 对比全局任务队列和每线程任务队列 + 任务窃取的吞吐量和调度延迟
+ * 每个根任务向下派生一棵二叉任务树，除了根任务，其余任务都是在调度线程里提交的
+ * 用法：scheduler_benchmark [树的深度] [根任务数] [scheduler.stats_sample_period]
+ */
+
+static uint32_t s_depth = 14;
+static uint32_t s_roots = 16;
+
+static std::atomic<uint32_t> s_next_id{0};
+static std::vector<uint32_t> s_latency;
+static std::atomic<uint64_t> s_end_us{0};
+
+static void Node(uint64_t scheduled_us, uint32_t depth);
+
+static void Spawn(uint32_t depth) {
+    tihi::Scheduler::This()->schedule(std::bind(&Node, tihi::US(), depth));
+}
+
+static void Node(uint64_t scheduled_us, uint32_t depth) {
+    uint32_t id = s_next_id++;
+    if (id < s_latency.size()) {
+        s_latency[id] = tihi::US() - scheduled_us;
+    }
+    if (id + 1 == s_latency.size()) {
+        s_end_us = tihi::US();
+    }
+    if (depth > 0) {
+        Spawn(depth - 1);
+        Spawn(depth - 1);
+    }
+}
+
+static void Run(const std::string& run_queue, size_t threads) {
+    tihi::Config::Lookup<std::string>("scheduler.run_queue")
+        ->set_value(run_queue);
+    uint64_t total = (uint64_t)s_roots * ((2ull << s_depth) - 1);
+    s_next_id = 0;
+    s_latency.assign(total, 0);
+
+    /**
+     * 只统计到最后一个任务开始执行，不包括调度器停止的时间
+     */
+    uint64_t start = tihi::US();
+    {
+        tihi::IOManager iom(threads, false, "sched_bench");
+        for (uint32_t i = 0; i < s_roots; ++i) {
+            iom.schedule(std::bind(&Node, tihi::US(), s_depth));
+        }
+    }
+    uint64_t used = s_end_us - start;
+
+    std::sort(s_latency.begin(), s_latency.end());
+    auto percentile = [](double p) {
+        return s_latency[(size_t)(p * (s_latency.size() - 1))];
+    };
+    std::cout << run_queue << "\tthreads=" << threads
+              << "\ttasks/s=" << (uint64_t)(total * 1000000.0 / used)
+              << "\tp50=" << percentile(0.5) << "us"
+              << "\tp99=" << percentile(0.99) << "us"
+              << "\tp999=" << percentile(0.999) << "us" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_depth = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        s_roots = strtoul(argv[2], nullptr, 10);
+    }
+    if (argc > 3) {
+        tihi::Config::Lookup<uint32_t>("scheduler.stats_sample_period")
+            ->set_value(strtoul(argv[3], nullptr, 10));
+    }
+
+    /**
+     * 调度器每次 tickle 都会打日志
+     */
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+
+    std::cout << "tasks: " << (uint64_t)s_roots * ((2ull << s_depth) - 1)
+              << std::endl;
+    for (size_t threads : {1, 2, 4, 8}) {
+        Run("global", threads);
+        Run("steal", threads);
+    }
+    return 0;
+}
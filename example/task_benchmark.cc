@@ -0,0 +1,118 @@
+#include <stdlib.h>
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <new>
+
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/task.h"
+#include "utils/utils.h"
+
+/**
+ * 对比 std::function 和 Task 保存调度器回调时的内存分配次数和耗时
+ * 用法：task_benchmark [任务数]
+ */
+
+static std::atomic<uint64_t> s_alloc_counts{0};
+
+void* operator new(size_t size) {
+    ++s_alloc_counts;
+    void* ptr = malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+static uint64_t s_task_counts = 1000000;
+
+/**
+ * 与 TcpServer 接受连接后调度的回调形状相同：
+ * std::bind(&TcpServer::handleClient, shared_from_this(), client)
+ */
+struct Server {
+    void handleClient(std::shared_ptr<int> client) { sum += *client; }
+
+    uint64_t sum = 0;
+};
+
+struct Result {
+    double allocs_per_op;
+    double ns_per_op;
+};
+
+template <typename F>
+static Result Measure(F f) {
+    uint64_t allocs = s_alloc_counts;
+    uint64_t start = tihi::US();
+    f();
+    uint64_t used = tihi::US() - start;
+    return Result{(double)(s_alloc_counts - allocs) / s_task_counts,
+                  used * 1000.0 / s_task_counts};
+}
+
+static void Print(const char* name, const Result& r) {
+    std::cout << name << r.allocs_per_op << " allocs/op, " << r.ns_per_op
+              << " ns/op" << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_task_counts = strtoull(argv[1], nullptr, 10);
+    }
+
+    /**
+     * 调度器每次 tickle 都会打日志
+     */
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+
+    std::shared_ptr<Server> server(new Server);
+    std::shared_ptr<int> client(new int(1));
+
+    std::cout << "tasks: " << s_task_counts << std::endl;
+
+    /**
+     * 只构造、调用、析构回调
+     */
+    Print("construct std::function: ", Measure([&]() {
+              for (uint64_t i = 0; i < s_task_counts; ++i) {
+                  std::function<void()> cb =
+                      std::bind(&Server::handleClient, server, client);
+                  cb();
+              }
+          }));
+    Print("construct Task:          ", Measure([&]() {
+              for (uint64_t i = 0; i < s_task_counts; ++i) {
+                  tihi::Task cb =
+                      std::bind(&Server::handleClient, server, client);
+                  cb();
+              }
+          }));
+
+    /**
+     * 经过调度器执行，包括任务队列和协程池自己的分配
+     */
+    tihi::Scheduler sc(1, false, "task_benchmark");
+    sc.start();
+    Print("schedule std::function:  ", Measure([&]() {
+              for (uint64_t i = 0; i < s_task_counts; ++i) {
+                  std::function<void()> cb =
+                      std::bind(&Server::handleClient, server, client);
+                  sc.schedule(cb);
+              }
+          }));
+    Print("schedule Task:           ", Measure([&]() {
+              for (uint64_t i = 0; i < s_task_counts; ++i) {
+                  sc.schedule(std::bind(&Server::handleClient, server, client));
+              }
+          }));
+    sc.stop();
+
+    std::cout << "sum: " << server->sum << std::endl;
+    return 0;
+}
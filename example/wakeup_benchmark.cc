@@ -0,0 +1,91 @@
+#include <sched.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#include "config/config.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "utils/utils.h"
+
+/**
+ * 对比空闲线程直接阻塞和先自旋一会儿时，把任务交给空闲线程的延迟
+ * 外部线程提交一个任务，等它开始执行后间隔一小段时间再提交下一个，
+ * 统计从提交到开始执行的时间
+ * 用法：wakeup_benchmark [轮数] [两轮之间的间隔 us] [scheduler.spin_us ...]
+ */
+
+static uint32_t s_rounds = 20000;
+static uint32_t s_gap_us = 20;
+
+static std::atomic<uint64_t> s_started_us{0};
+
+static void Run(uint32_t spin_us, size_t threads) {
+    tihi::Config::Lookup<uint32_t>("scheduler.spin_us")->set_value(spin_us);
+    std::vector<uint64_t> latency;
+    latency.reserve(s_rounds);
+
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(threads, false, "wakeup_bench");
+        for (uint32_t i = 0; i < s_rounds; ++i) {
+            s_started_us = 0;
+            uint64_t scheduled = tihi::US();
+            iom.schedule([]() { s_started_us = tihi::US(); });
+            while (!s_started_us) {
+                sched_yield();
+            }
+            latency.push_back(s_started_us - scheduled);
+
+            uint64_t end = tihi::US() + s_gap_us;
+            while (tihi::US() < end) {
+            }
+        }
+        stats = iom.stats();
+    }
+
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&latency](double p) {
+        return latency[(size_t)(p * (latency.size() - 1))];
+    };
+    std::cout << "spin_us=" << spin_us << "\tthreads=" << threads
+              << "\tp50=" << percentile(0.5) << "us"
+              << "\tp99=" << percentile(0.99) << "us"
+              << "\tp999=" << percentile(0.999) << "us"
+              << "\ttickles_requested=" << stats.tickles_requested
+              << "\ttickles_sent=" << stats.tickles_sent
+              << "\ttickles_coalesced=" << stats.tickles_coalesced
+              << "\ttickles_skipped=" << stats.tickles_skipped
+              << "\tspin_hit_rate=" << stats.spinHitRate() << std::endl;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        s_rounds = strtoul(argv[1], nullptr, 10);
+    }
+    if (argc > 2) {
+        s_gap_us = strtoul(argv[2], nullptr, 10);
+    }
+    std::vector<uint32_t> spins;
+    for (int i = 3; i < argc; ++i) {
+        spins.push_back(strtoul(argv[i], nullptr, 10));
+    }
+    if (spins.empty()) {
+        spins = {0, 50, 200};
+    }
+
+    /**
+     * 调度器每次 tickle 都会打日志
+     */
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+
+    for (size_t threads : {1, 2}) {
+        for (uint32_t spin_us : spins) {
+            Run(spin_us, threads);
+        }
+    }
+    return 0;
+}
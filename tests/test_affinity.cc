@@ -0,0 +1,95 @@
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "thread/affinity.h"
+#include "thread/thread.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+void test_parse() {
+    std::vector<int> cpus = tihi::ParseCpuList("0-3,8,10-11,x,5-4");
+    std::vector<int> expect = {0, 1, 2, 3, 8, 10, 11};
+    TIHI_ASSERT((cpus == expect));
+    TIHI_ASSERT((tihi::ParseCpuList("").empty()));
+    TIHI_ASSERT((tihi::CpuNode(0) == 0));
+    TIHI_ASSERT((tihi::CpuNode(-1) == -1));
+    TIHI_LOG_INFO(g_logger) << "test_parse success";
+}
+
+static std::atomic<int> s_checked{0};
+
+void check_placement() {
+    TIHI_ASSERT((tihi::Thread::This()->cpu() == 0));
+    TIHI_ASSERT((sched_getcpu() == 0));
+    int mode = -1;
+    syscall(SYS_get_mempolicy, &mode, nullptr, 0, nullptr, 0);
+    TIHI_ASSERT((mode == MPOL_LOCAL));
+    ++s_checked;
+}
+
+void test_placement() {
+    YAML::Node root = YAML::Load(
+        "scheduler:\n"
+        "  placement:\n"
+        "    pinned:\n"
+        "      cpus: [0]\n"
+        "      numa: local\n");
+    tihi::Config::LoadFromYAML(root);
+
+    {
+        tihi::Scheduler sc(2, false, "pinned");
+        sc.start();
+        for (int i = 0; i < 20; ++i) {
+            sc.schedule(&check_placement);
+        }
+        sc.stop();
+    }
+    TIHI_ASSERT((s_checked == 20));
+
+    /**
+     * 没有配置的调度器不绑核
+     */
+    {
+        tihi::Scheduler sc(1, false, "unpinned");
+        sc.start();
+        sc.schedule([]() { TIHI_ASSERT((tihi::Thread::This()->cpu() == -1)); });
+        sc.stop();
+    }
+    TIHI_LOG_INFO(g_logger) << "test_placement success";
+}
+
+void test_out_of_range() {
+    /**
+     * 无效的和超过 CPU_SETSIZE 的编号返回 false，不写出界
+     */
+    static std::atomic<bool> s_exit{false};
+    tihi::Thread::ptr thread(new tihi::Thread(
+        []() {
+            while (!s_exit) {
+                usleep(1000);
+            }
+        },
+        "affinity"));
+    TIHI_ASSERT((!thread->setAffinity(-1)));
+    TIHI_ASSERT((!thread->setAffinity(CPU_SETSIZE + 100)));
+    TIHI_ASSERT((thread->cpu() == -1));
+    TIHI_ASSERT((thread->setAffinity(0) && thread->cpu() == 0));
+    s_exit = true;
+    thread->join();
+    TIHI_LOG_INFO(g_logger) << "test_out_of_range success";
+}
+
+int main(int argc, char** argv) {
+    test_parse();
+    test_placement();
+    test_out_of_range();
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "sync/channel.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static const int kProducerCounts = 8;
+static const int kConsumerCounts = 8;
+static const int kItemCounts = 10000;
+
+void test_pipeline(size_t capacity) {
+    tihi::Channel<int> channel(capacity);
+    std::atomic<int64_t> sum{0};
+    std::atomic<int> received{0};
+    std::atomic<int> producers{kProducerCounts};
+    {
+        tihi::IOManager iom(4, false, "channel");
+        for (int i = 0; i < kConsumerCounts; ++i) {
+            iom.schedule([&]() {
+                int v = 0;
+                while (channel.recv(v)) {
+                    sum += v;
+                    ++received;
+                }
+            });
+        }
+        for (int i = 0; i < kProducerCounts; ++i) {
+            iom.schedule([&]() {
+                for (int j = 1; j <= kItemCounts; ++j) {
+                    TIHI_ASSERT((channel.send(j)));
+                }
+                if (--producers == 0) {
+                    channel.close();
+                }
+            });
+        }
+    }
+    TIHI_ASSERT((received == kProducerCounts * kItemCounts));
+    TIHI_ASSERT((sum == (int64_t)kProducerCounts * kItemCounts *
+                            (kItemCounts + 1) / 2));
+    TIHI_LOG_INFO(g_logger) << "test_pipeline capacity=" << capacity
+                            << " success";
+}
+
+void test_try_and_close() {
+    tihi::Channel<std::string> channel(2);
+    TIHI_ASSERT((channel.capacity() == 2));
+    TIHI_ASSERT((channel.trySend("a")));
+    TIHI_ASSERT((channel.trySend("b")));
+    TIHI_ASSERT((!channel.trySend("c")));
+
+    std::string v;
+    TIHI_ASSERT((channel.tryRecv(v) && v == "a"));
+    channel.close();
+    TIHI_ASSERT((!channel.trySend("d")));
+    /**
+     * 关闭之后还能取出剩余的元素
+     */
+    TIHI_ASSERT((channel.tryRecv(v) && v == "b"));
+    TIHI_ASSERT((!channel.tryRecv(v)));
+    TIHI_LOG_INFO(g_logger) << "test_try_and_close success";
+}
+
+void test_capacity_one() {
+    tihi::Channel<int> channel(1);
+    TIHI_ASSERT((channel.capacity() == 1));
+    int v = 0;
+    for (int i = 0; i < 3; ++i) {
+        TIHI_ASSERT((channel.trySend(i)));
+        TIHI_ASSERT((!channel.trySend(-1)));
+        TIHI_ASSERT((channel.tryRecv(v) && v == i));
+        TIHI_ASSERT((!channel.tryRecv(v)));
+    }
+    TIHI_LOG_INFO(g_logger) << "test_capacity_one success";
+}
+
+void test_timeout() {
+    tihi::Channel<int> channel(2);
+    {
+        tihi::IOManager iom(2, false, "timeout");
+        iom.schedule([&]() {
+            int v = 0;
+            uint64_t start = tihi::MS();
+            TIHI_ASSERT((!channel.recvFor(v, 50)));
+            TIHI_ASSERT((tihi::MS() - start >= 50));
+
+            TIHI_ASSERT((channel.sendFor(1, 10)));
+            TIHI_ASSERT((channel.sendFor(2, 10)));
+            TIHI_ASSERT((!channel.sendFor(3, 20)));
+            /**
+             * 挂起中的发送方在通道关闭时被唤醒
+             */
+            iom.schedule([&]() { channel.close(); });
+            TIHI_ASSERT((!channel.send(4)));
+        });
+    }
+    TIHI_LOG_INFO(g_logger) << "test_timeout success";
+}
+
+void test_select() {
+    tihi::Channel<int> ints(4);
+    tihi::Channel<std::string> strs;
+    {
+        tihi::IOManager iom(2, false, "select");
+        iom.schedule([&]() {
+            int i = 0;
+            std::string s;
+            std::vector<tihi::SelectCase> cases;
+            cases.push_back(tihi::RecvCase(ints, i));
+            cases.push_back(tihi::RecvCase(strs, s));
+
+            uint64_t start = tihi::MS();
+            TIHI_ASSERT((tihi::Select(cases, 30) == -1));
+            TIHI_ASSERT((tihi::MS() - start >= 30));
+            TIHI_ASSERT((tihi::Select(cases, 0) == -1));
+
+            iom.schedule([&]() { strs.send("hello"); });
+            TIHI_ASSERT((tihi::Select(cases) == 1));
+            TIHI_ASSERT((cases[1].ok && s == "hello"));
+
+            iom.schedule([&]() { ints.send(42); });
+            TIHI_ASSERT((tihi::Select(cases, 1000) == 0));
+            TIHI_ASSERT((cases[0].ok && i == 42));
+
+            ints.close();
+            TIHI_ASSERT((tihi::Select(cases) == 0));
+            TIHI_ASSERT((!cases[0].ok));
+        });
+    }
+    TIHI_LOG_INFO(g_logger) << "test_select success";
+}
+
+void test_select_fan_in() {
+    static const int kChannelCounts = 4;
+    std::vector<tihi::Channel<int>*> channels;
+    for (int i = 0; i < kChannelCounts; ++i) {
+        channels.push_back(new tihi::Channel<int>(8));
+    }
+    int64_t sum = 0;
+    {
+        tihi::IOManager iom(4, false, "fan_in");
+        for (int i = 0; i < kChannelCounts; ++i) {
+            iom.schedule([&channels, i]() {
+                for (int j = 1; j <= kItemCounts; ++j) {
+                    channels[i]->send(j);
+                }
+                channels[i]->close();
+            });
+        }
+        iom.schedule([&]() {
+            std::vector<int> values(kChannelCounts);
+            std::vector<tihi::SelectCase> cases;
+            for (int i = 0; i < kChannelCounts; ++i) {
+                cases.push_back(tihi::RecvCase(*channels[i], values[i]));
+            }
+            int open = kChannelCounts;
+            while (open > 0) {
+                int index = tihi::Select(cases);
+                TIHI_ASSERT((index >= 0));
+                if (cases[index].ok) {
+                    sum += *static_cast<int*>(cases[index].value);
+                } else {
+                    cases.erase(cases.begin() + index);
+                    --open;
+                }
+            }
+        });
+    }
+    TIHI_ASSERT((sum == (int64_t)kChannelCounts * kItemCounts *
+                            (kItemCounts + 1) / 2));
+    for (auto c : channels) {
+        delete c;
+    }
+    TIHI_LOG_INFO(g_logger) << "test_select_fan_in success";
+}
+
+int main(int argc, char** argv) {
+    test_pipeline(16);
+    test_pipeline(1);
+    test_pipeline(tihi::Channel<int>::UNBOUNDED);
+    test_try_and_close();
+    test_capacity_one();
+    test_timeout();
+    test_select();
+    test_select_fan_in();
+    return 0;
+}
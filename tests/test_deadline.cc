@@ -0,0 +1,134 @@
+#include <atomic>
+#include <vector>
+
+#include "fiber/fiber.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static tihi::Mutex s_mutex;
+static std::vector<int> s_order;
+
+static void Record(int v) {
+    tihi::Mutex::mutex lock(s_mutex);
+    s_order.push_back(v);
+}
+
+void test_order() {
+    /**
+     * 只有一个线程，启动前放好任务，执行顺序就是出队顺序
+     */
+    s_order.clear();
+    tihi::Scheduler sc(1, false, "deadline_order");
+    uint64_t now = tihi::US();
+    sc.schedule(std::bind(&Record, 100));
+    for (int v : {5, 3, 4, 1, 2}) {
+        sc.scheduleWithDeadline(std::bind(&Record, v),
+                                now + v * 1000 * 1000ull);
+    }
+    sc.schedule(std::bind(&Record, 101));
+    sc.start();
+    sc.stop();
+
+    /**
+     * 有截止时间的按截止时间先执行，其余的仍然按提交顺序
+     */
+    std::vector<int> expect = {1, 2, 3, 4, 5, 100, 101};
+    TIHI_ASSERT((s_order == expect));
+    TIHI_ASSERT((sc.stats().lanes[1].expired == 0));
+    TIHI_LOG_INFO(g_logger) << "test_order success";
+}
+
+void test_expired() {
+    static std::atomic<int> s_ran{0};
+    static std::atomic<int> s_failed{0};
+    tihi::Scheduler sc(1, false, "deadline_expired");
+    uint64_t past = tihi::US() - 1;
+    /**
+     * 过期后丢弃
+     */
+    for (int i = 0; i < 10; ++i) {
+        sc.scheduleWithDeadline([]() { ++s_ran; }, past);
+    }
+    /**
+     * 过期后快速失败
+     */
+    for (int i = 0; i < 5; ++i) {
+        sc.scheduleWithDeadline([]() { ++s_ran; }, past,
+                                []() { ++s_failed; });
+    }
+    /**
+     * 没开始执行的协程也可以丢弃
+     */
+    tihi::Fiber::ptr fiber(new tihi::Fiber([]() { ++s_ran; }));
+    sc.scheduleWithDeadline(fiber, past, nullptr,
+                            tihi::Scheduler::Priority::HIGH);
+    fiber.reset();
+    sc.scheduleWithDeadline([]() { ++s_ran; }, tihi::US() + 1000 * 1000);
+    sc.start();
+    sc.stop();
+
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((s_ran == 1 && s_failed == 5));
+    TIHI_ASSERT((stats.lanes[1].expired == 15));
+    TIHI_ASSERT((stats.lanes[0].expired == 1));
+    TIHI_ASSERT((stats.lanes[1].dequeued == 6));
+    TIHI_LOG_INFO(g_logger) << "test_expired success";
+}
+
+void test_started_fiber() {
+    /**
+     * 让出过的协程重新排队时不带截止时间，一定会执行完
+     */
+    static std::atomic<bool> s_done{false};
+    tihi::Scheduler sc(2, false, "deadline_fiber");
+    sc.start();
+    sc.scheduleWithDeadline(
+        []() {
+            uint64_t end = tihi::US() + 20 * 1000;
+            while (tihi::US() < end) {
+                tihi::Fiber::YieldToReady();
+            }
+            s_done = true;
+        },
+        tihi::US() + 10 * 1000);
+    sc.stop();
+    TIHI_ASSERT((s_done));
+    TIHI_LOG_INFO(g_logger) << "test_started_fiber success";
+}
+
+void test_concurrent() {
+    /**
+     * 多个线程同时提交和执行，过期的和执行的加起来不多不少
+     */
+    static std::atomic<int> s_ran{0};
+    static std::atomic<int> s_failed{0};
+    tihi::Scheduler sc(4, false, "deadline_mt");
+    sc.start();
+    for (int i = 0; i < 2000; ++i) {
+        sc.schedule([i]() {
+            uint64_t now = tihi::US();
+            tihi::Scheduler::This()->scheduleWithDeadline(
+                []() { ++s_ran; }, i % 2 ? now + 1000 * 1000 : now - 1,
+                []() { ++s_failed; });
+        });
+    }
+    sc.stop();
+    TIHI_ASSERT((s_ran == 1000 && s_failed == 1000));
+    TIHI_ASSERT((sc.stats().lanes[1].expired == 1000));
+    TIHI_LOG_INFO(g_logger) << "test_concurrent success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    test_order();
+    test_expired();
+    test_started_fiber();
+    test_concurrent();
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include <unistd.h>
+
+#include <atomic>
+#include <set>
+#include <vector>
+
+#include "config/config.h"
+#include "fiber/fiber.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static void BusySpin(uint64_t ms) {
+    uint64_t end = tihi::MS() + ms;
+    while (tihi::MS() < end) {
+    }
+}
+
+/**
+ * 等到线程数降到 threads，最多等 timeout_ms
+ */
+static bool WaitThreads(tihi::Scheduler& sc, size_t threads,
+                        uint64_t timeout_ms) {
+    uint64_t end = tihi::MS() + timeout_ms;
+    while (tihi::MS() < end) {
+        if (sc.stats().threads == threads) {
+            return true;
+        }
+        ::usleep(10 * 1000);
+    }
+    return false;
+}
+
+/**
+ * 一直占着线程的任务，线程数涨到上限，空闲之后再降回下限
+ */
+static void Burst(tihi::Scheduler& sc, std::atomic<int>& done, int counts) {
+    for (int i = 0; i < counts; ++i) {
+        sc.schedule([&done]() {
+            BusySpin(20);
+            ++done;
+        });
+    }
+    size_t max_threads = 0;
+    while (done < counts) {
+        max_threads = std::max(max_threads, sc.stats().threads);
+        ::usleep(5 * 1000);
+    }
+    TIHI_LOG_INFO(g_logger) << "max threads: " << max_threads;
+    TIHI_ASSERT((max_threads > 1 && max_threads <= 4));
+}
+
+void test_grow_shrink() {
+    static std::atomic<int> s_done{0};
+    tihi::Scheduler sc(1, false, "elastic");
+    sc.start();
+    TIHI_ASSERT((sc.stats().threads == 1));
+
+    Burst(sc, s_done, 40);
+    TIHI_ASSERT((WaitThreads(sc, 1, 3000)));
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.threads_started >= 1));
+    TIHI_ASSERT((stats.threads_retired == stats.threads_started));
+
+    /**
+     * 退出的线程的位置可以再用
+     */
+    s_done = 0;
+    Burst(sc, s_done, 40);
+    sc.stop();
+    TIHI_ASSERT((s_done == 40));
+    TIHI_LOG_INFO(g_logger) << "test_grow_shrink success";
+}
+
+void test_iomanager() {
+    static std::atomic<int> s_done{0};
+    {
+        tihi::IOManager iom(1, false, "elastic_io");
+        Burst(iom, s_done, 40);
+        TIHI_ASSERT((WaitThreads(iom, 1, 3000)));
+        TIHI_LOG_INFO(g_logger) << iom.stats().toString();
+
+        /**
+         * 缩回去之后定时器照样能触发
+         */
+        static std::atomic<bool> s_fired{false};
+        iom.addTimer(10, []() { s_fired = true; });
+        ::usleep(100 * 1000);
+        TIHI_ASSERT((s_fired));
+    }
+    TIHI_ASSERT((s_done == 40));
+    TIHI_LOG_INFO(g_logger) << "test_iomanager success";
+}
+
+void test_stop_while_growing() {
+    /**
+     * stop() 的同时监控线程还在加线程，所有线程都要被 join，任务一个不少
+     */
+    static std::atomic<int> s_done{0};
+    for (int round = 0; round < 5; ++round) {
+        tihi::Scheduler sc(1, false, "elastic");
+        sc.start();
+        for (int i = 0; i < 20; ++i) {
+            sc.schedule([]() {
+                BusySpin(5);
+                ++s_done;
+            });
+        }
+        ::usleep(round * 10 * 1000);
+        sc.stop();
+    }
+    TIHI_ASSERT((s_done == 5 * 20));
+    TIHI_LOG_INFO(g_logger) << "test_stop_while_growing success";
+}
+
+void test_shared_stack() {
+    /**
+     * 共享栈协程挂起期间空闲的线程也不能退出，它们只能在绑定的线程上恢复
+     */
+    static std::atomic<int> s_parked{0};
+    static std::atomic<int> s_done{0};
+    tihi::Scheduler sc(1, false, "elastic");
+    sc.start();
+
+    std::vector<tihi::Fiber::ptr> fibers;
+    for (int i = 0; i < 40; ++i) {
+        tihi::Fiber::ptr fiber(new tihi::Fiber(
+            []() {
+                BusySpin(20);
+                ++s_parked;
+                tihi::Fiber::YieldToHold();
+                ++s_done;
+            },
+            0, false, true));
+        fibers.push_back(fiber);
+        sc.schedule(fiber);
+    }
+    while (s_parked < 40) {
+        ::usleep(5 * 1000);
+    }
+
+    std::set<pid_t> bound;
+    for (auto& fiber : fibers) {
+        bound.insert(fiber->bound_thread());
+    }
+    ::usleep(1000 * 1000);
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_LOG_INFO(g_logger) << "bound threads: " << bound.size() << " "
+                            << stats.toString();
+    TIHI_ASSERT((bound.size() > 1));
+    TIHI_ASSERT((stats.threads >= bound.size()));
+
+    for (auto& fiber : fibers) {
+        sc.schedule(fiber);
+    }
+    while (s_done < 40) {
+        ::usleep(5 * 1000);
+    }
+    /**
+     * 协程运行结束后解除绑定，线程又能退出了
+     */
+    TIHI_ASSERT((WaitThreads(sc, 1, 3000)));
+    for (auto& fiber : fibers) {
+        TIHI_ASSERT((fiber->bound_thread() == -1));
+    }
+    fibers.clear();
+    sc.stop();
+    TIHI_LOG_INFO(g_logger) << "test_shared_stack success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    YAML::Node root = YAML::Load(
+        "scheduler:\n"
+        "  elastic:\n"
+        "    elastic:\n"
+        "      min_threads: 1\n"
+        "      max_threads: 4\n"
+        "      delay_ms: 5\n"
+        "      idle_ms: 200\n"
+        "    elastic_io:\n"
+        "      min_threads: 1\n"
+        "      max_threads: 4\n"
+        "      delay_ms: 5\n"
+        "      idle_ms: 200\n");
+    tihi::Config::LoadFromYAML(root);
+
+    test_grow_shrink();
+    test_iomanager();
+    test_stop_while_growing();
+    test_shared_stack();
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include <sched.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <vector>
+
+#include "hook/fd_manager.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "thread/thread.h"
+#include "utils/fd_table.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+using IntTable = tihi::FdTable<int>;
+
+void test_single_thread() {
+    IntTable table([](int& item, int fd) { item = fd; });
+    TIHI_ASSERT((table.capacity() == 0));
+    TIHI_ASSERT((!table.get(0) && !table.get(-1)));
+    TIHI_ASSERT((!table.getOrCreate(-1)));
+    TIHI_ASSERT((!table.getOrCreate(IntTable::MAX_FDS)));
+
+    int* first = table.getOrCreate(3);
+    TIHI_ASSERT((first && *first == 3 && table.get(3) == first));
+    TIHI_ASSERT((table.capacity() == IntTable::SEGMENT_SIZE));
+    *first = 100;
+
+    /**
+     * 分配后面的段，已有的元素不移动，中间的段不分配
+     */
+    int last_fd = IntTable::MAX_FDS - 1;
+    int* last = table.getOrCreate(last_fd);
+    TIHI_ASSERT((last && *last == last_fd));
+    TIHI_ASSERT((table.capacity() == IntTable::SEGMENT_SIZE * 2));
+    TIHI_ASSERT((table.get(3) == first && *first == 100));
+    TIHI_ASSERT((!table.get(IntTable::SEGMENT_SIZE)));
+
+    size_t counts = 0;
+    table.forEach([&counts](int&) { ++counts; });
+    TIHI_ASSERT((counts == table.capacity()));
+    TIHI_LOG_INFO(g_logger) << "test_single_thread success";
+}
+
+void test_concurrent() {
+    /**
+     * 多个线程同时分配同一批段，每个段只装进去一个，计数一个都不丢
+     */
+    static const int THREADS = 8;
+    static const int FDS = 4096;
+    tihi::FdTable<std::atomic<int>> table(
+        [](std::atomic<int>& item, int) { item = 0; });
+    std::atomic<int> ready{0};
+    std::vector<tihi::Thread::ptr> threads;
+    for (int t = 0; t < THREADS; ++t) {
+        threads.emplace_back(new tihi::Thread(
+            [&table, &ready]() {
+                ++ready;
+                while (ready != THREADS) {
+                    sched_yield();
+                }
+                for (int fd = 0; fd < FDS; ++fd) {
+                    ++*table.getOrCreate(fd);
+                }
+            },
+            "fd_table"));
+    }
+    for (auto& t : threads) {
+        t->join();
+    }
+    TIHI_ASSERT((table.capacity() == FDS));
+    for (int fd = 0; fd < FDS; ++fd) {
+        TIHI_ASSERT((*table.get(fd) == THREADS));
+    }
+    TIHI_LOG_INFO(g_logger) << "test_concurrent success";
+}
+
+void test_fd_manager() {
+    auto mgr = tihi::FdMgr::GetInstance();
+    TIHI_ASSERT((!mgr->fd(-1, true)));
+
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    TIHI_ASSERT((sock >= 0));
+    /**
+     * 远大于初始容量的 fd
+     */
+    int fd = dup2(sock, 5000);
+    TIHI_ASSERT((fd == 5000));
+    close(sock);
+
+    TIHI_ASSERT((!mgr->fd(fd)));
+    tihi::FdCtx* ctx = mgr->fd(fd, true);
+    TIHI_ASSERT((ctx && ctx->is_socket() && ctx->sys_nonblock()));
+    TIHI_ASSERT((mgr->fd(fd) == ctx && mgr->fd(fd, true) == ctx));
+    ctx->set_user_nonblock(true);
+    mgr->delFd(fd);
+    TIHI_ASSERT((!mgr->fd(fd)));
+    TIHI_ASSERT((ctx->is_closed()));
+
+    /**
+     * 编号复用时复用原来的 FdCtx，重新初始化
+     */
+    TIHI_ASSERT((mgr->fd(fd, true) == ctx));
+    TIHI_ASSERT((!ctx->is_closed() && !ctx->user_nonblock()));
+    mgr->delFd(fd);
+    close(fd);
+    TIHI_LOG_INFO(g_logger) << "test_fd_manager success";
+}
+
+void test_iomanager() {
+    /**
+     * 大号 fd 上的事件照常触发
+     */
+    static int s_fds[2];
+    static std::atomic<bool> s_triggered{false};
+    int fds[2];
+    TIHI_ASSERT((pipe(fds) == 0));
+    s_fds[0] = dup2(fds[0], 6000);
+    s_fds[1] = dup2(fds[1], 6001);
+    close(fds[0]);
+    close(fds[1]);
+    {
+        tihi::IOManager iom(1, false, "fd_table");
+        iom.schedule([]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            TIHI_ASSERT((iom->addEvent(s_fds[0], tihi::IOManager::READ,
+                                       []() { s_triggered = true; }) == 0));
+            TIHI_ASSERT((write(s_fds[1], "x", 1) == 1));
+        });
+    }
+    TIHI_ASSERT((s_triggered));
+    close(s_fds[0]);
+    close(s_fds[1]);
+    TIHI_LOG_INFO(g_logger) << "test_iomanager success";
+}
+
+int main(int argc, char** argv) {
+    test_single_thread();
+    test_concurrent();
+    test_fd_manager();
+    test_iomanager();
+    return 0;
+}
@@ -1,5 +1,10 @@
+#include <string.h>
+
+#include <vector>
+
 #include "fiber/fiber.h"
 #include "log/log.h"
+#include "utils/macro.h"
 
 tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
 
@@ -9,6 +14,41 @@ void func1() {
     TIHI_LOG_DEBUG(g_logger) << "sub fiber end";
 }
 
+void func2(int id) {
+    /**
+     * 栈上的数据在其他协程占用共享栈之后必须原样恢复
+     */
+    char buffer[4096];
+    memset(buffer, id, sizeof(buffer));
+    for (int i = 0; i < 3; ++i) {
+        tihi::Fiber::YieldToHold();
+        for (size_t j = 0; j < sizeof(buffer); ++j) {
+            TIHI_ASSERT((buffer[j] == id));
+        }
+    }
+}
+
+void test_shared_stack() {
+    std::vector<tihi::Fiber::ptr> fibers;
+    for (int i = 0; i < 10; ++i) {
+        fibers.push_back(tihi::Fiber::ptr(
+            new tihi::Fiber(std::bind(&func2, i), 0, false, true)));
+    }
+
+    bool done = false;
+    while (!done) {
+        done = true;
+        for (auto& f : fibers) {
+            if (f->state() != tihi::Fiber::TERM) {
+                f->swapIn();
+                done = false;
+            }
+        }
+    }
+    TIHI_LOG_DEBUG(g_logger) << "shared stack fiber saved "
+                             << fibers[0]->saved_stack_size() << " bytes";
+}
+
 int main(int argc, char** argv) {
     tihi::Thread::SetName("main");
     tihi::Fiber::This(); // 初始化主协程
@@ -18,5 +58,6 @@ int main(int argc, char** argv) {
     TIHI_LOG_DEBUG(g_logger) << "main fiber mid";
     fiber->swapIn();
     TIHI_LOG_DEBUG(g_logger) << "main fiber end";
+    test_shared_stack();
     return 0;
 }
\ No newline at end of file
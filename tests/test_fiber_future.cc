@@ -0,0 +1,119 @@
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "sync/fiber_future.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+void test_get() {
+    tihi::IOManager iom(4, false, "future");
+    tihi::FiberFuture<int> f1 = iom.scheduleFuture([]() { return 42; });
+    tihi::FiberFuture<std::string> f2 =
+        iom.scheduleFuture([]() { return std::string("hello"); });
+    tihi::FiberFuture<void> f3 = iom.scheduleFuture([]() {});
+    /**
+     * 在普通线程中等待会阻塞线程
+     */
+    TIHI_ASSERT((f1.get() == 42));
+    TIHI_ASSERT((f2.get() == "hello"));
+    f3.get();
+    TIHI_ASSERT((f3.ready()));
+
+    tihi::FiberFuture<int> f4 = iom.scheduleFuture([]() -> int {
+        throw std::runtime_error("boom");
+    });
+    bool caught = false;
+    try {
+        f4.get();
+    } catch (std::runtime_error& e) {
+        caught = std::string(e.what()) == "boom";
+    }
+    TIHI_ASSERT(caught);
+    TIHI_LOG_INFO(g_logger) << "test_get success";
+}
+
+/**
+ * 任务没有执行就被销毁，等待的一方拿到 broken_promise
+ */
+void test_broken_promise() {
+    bool ran = false;
+    auto fn = [&ran]() {
+        ran = true;
+        return 1;
+    };
+    auto* task = new tihi::FiberFutureTask<int, decltype(fn)>(std::move(fn));
+    task->ref();
+    tihi::FiberFuture<int> f(task);
+    {
+        tihi::Task cb{tihi::FiberFutureRunner(task)};
+        tihi::Task moved(std::move(cb));
+    }
+    TIHI_ASSERT((f.ready()));
+    bool caught = false;
+    try {
+        f.get();
+    } catch (std::future_error& e) {
+        caught = e.code() == std::future_errc::broken_promise;
+    }
+    TIHI_ASSERT(caught);
+    TIHI_ASSERT((!ran));
+    TIHI_LOG_INFO(g_logger) << "test_broken_promise success";
+}
+
+void test_fan_out() {
+    static const int kFanOut = 100;
+    std::atomic<int> done{0};
+    {
+        tihi::IOManager iom(4, false, "fan_out");
+        iom.schedule([&]() {
+            /**
+             * 在协程中等待只挂起当前协程
+             */
+            std::vector<tihi::FiberFuture<int>> futures;
+            for (int i = 0; i < kFanOut; ++i) {
+                futures.push_back(tihi::Scheduler::This()->scheduleFuture([i]() {
+                    tihi::Fiber::YieldToReady();
+                    return i * i;
+                }));
+            }
+            tihi::WhenAll(futures).get();
+            int sum = 0;
+            for (int i = 0; i < kFanOut; ++i) {
+                TIHI_ASSERT((futures[i].ready()));
+                sum += futures[i].get();
+            }
+            TIHI_ASSERT((sum == (kFanOut - 1) * kFanOut * (2 * kFanOut - 1) / 6));
+            ++done;
+        });
+
+        iom.schedule([&]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            tihi::FiberFuture<int> slow = iom->scheduleFuture([]() {
+                usleep(200 * 1000);
+                return 1;
+            });
+            tihi::FiberFuture<std::string> fast = iom->scheduleFuture(
+                []() { return std::string("fast"); });
+            TIHI_ASSERT((tihi::WhenAny(slow, fast).get() == 1));
+            TIHI_ASSERT((!slow.waitFor(10)));
+            tihi::WhenAll(slow, fast).get();
+            TIHI_ASSERT((slow.get() == 1));
+            ++done;
+        });
+    }
+    TIHI_ASSERT((done == 2));
+    TIHI_LOG_INFO(g_logger) << "test_fan_out success";
+}
+
+int main(int argc, char** argv) {
+    test_get();
+    test_broken_promise();
+    test_fan_out();
+    return 0;
+}
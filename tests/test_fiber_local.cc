@@ -0,0 +1,139 @@
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "fiber/fiber.h"
+#include "fiber/fiber_local.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+struct Counted {
+    Counted() { ++s_alive; }
+    ~Counted() { --s_alive; }
+
+    static int s_alive;
+    int value = 0;
+};
+
+int Counted::s_alive = 0;
+
+struct Big {
+    char data[1024];
+};
+
+/**
+ * s_throw 为 true 时构造失败
+ */
+template <size_t N>
+struct Throwing {
+    Throwing() {
+        if (s_throw) {
+            throw std::runtime_error("Throwing");
+        }
+    }
+
+    static bool s_throw;
+    char data[N];
+};
+
+template <size_t N>
+bool Throwing<N>::s_throw = false;
+
+static tihi::FiberLocal<int> s_request_id;
+static tihi::FiberLocal<std::string> s_name;
+static tihi::FiberLocal<Counted> s_counted;
+static tihi::FiberLocal<Big> s_big;
+static tihi::FiberLocal<Throwing<8>> s_throwing_inline;
+static tihi::FiberLocal<Throwing<4096>> s_throwing_heap;
+
+void test_isolation() {
+    s_request_id.set(1);
+    tihi::Fiber::ptr fiber(new tihi::Fiber([]() {
+        TIHI_ASSERT((!s_request_id.has()));
+        TIHI_ASSERT((*s_request_id == 0));
+        s_request_id.set(2);
+        s_name->assign("sub");
+        s_counted->value = 42;
+        s_big->data[1023] = 'x';
+        TIHI_ASSERT((Counted::s_alive == 1));
+        tihi::Fiber::YieldToHold();
+
+        /**
+         * 切出再切回来之后值保持不变
+         */
+        TIHI_ASSERT((*s_request_id == 2));
+        TIHI_ASSERT((*s_name == "sub"));
+        TIHI_ASSERT((s_counted->value == 42));
+        TIHI_ASSERT((s_big->data[1023] == 'x'));
+    }));
+    fiber->swapIn();
+    TIHI_ASSERT((*s_request_id == 1));
+    TIHI_ASSERT((!s_name.has()));
+    fiber->swapIn();
+    /**
+     * 协程结束时局部变量已经析构
+     */
+    TIHI_ASSERT((fiber->state() == tihi::Fiber::TERM));
+    TIHI_ASSERT((Counted::s_alive == 0));
+
+    fiber->reset([]() { TIHI_ASSERT((!s_counted.has())); });
+    fiber->swapIn();
+    TIHI_LOG_INFO(g_logger) << "test_isolation success";
+}
+
+void test_scheduler() {
+    static const int kFiberCounts = 1000;
+    tihi::Scheduler sc(4, false, "fiber_local");
+    sc.start();
+    for (int i = 0; i < kFiberCounts; ++i) {
+        sc.schedule([i]() {
+            s_request_id.set(i);
+            s_counted->value = i;
+            tihi::Fiber::YieldToReady();
+            TIHI_ASSERT((*s_request_id == i));
+            TIHI_ASSERT((s_counted->value == i));
+        });
+    }
+    sc.stop();
+    TIHI_ASSERT((Counted::s_alive == 0));
+    TIHI_LOG_INFO(g_logger) << "test_scheduler success";
+}
+
+/**
+ * 构造抛异常时变量保持未构造，堆上的内存退还，之后还能再构造
+ */
+template <size_t N>
+static void CheckThrowing(tihi::FiberLocal<Throwing<N>>& local) {
+    Throwing<N>::s_throw = true;
+    bool thrown = false;
+    try {
+        local.get();
+    } catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    TIHI_ASSERT((thrown && !local.has()));
+    Throwing<N>::s_throw = false;
+    local->data[N - 1] = 'x';
+    TIHI_ASSERT((local.has() && local->data[N - 1] == 'x'));
+}
+
+void test_throwing() {
+    tihi::Fiber::ptr fiber(new tihi::Fiber([]() {
+        CheckThrowing(s_throwing_inline);
+        CheckThrowing(s_throwing_heap);
+    }));
+    fiber->swapIn();
+    TIHI_ASSERT((fiber->state() == tihi::Fiber::TERM));
+    TIHI_LOG_INFO(g_logger) << "test_throwing success";
+}
+
+int main(int argc, char** argv) {
+    tihi::Fiber::This();
+    test_isolation();
+    test_scheduler();
+    test_throwing();
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include <atomic>
+
+#include "fiber/fiber_pool.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+void test_get_put() {
+    tihi::Fiber::This();
+    uint64_t hits = tihi::FiberPool::HitCount();
+    uint64_t misses = tihi::FiberPool::MissCount();
+
+    int counts = 0;
+    tihi::Fiber::ptr fiber = tihi::FiberPool::Get([&counts]() { ++counts; });
+    tihi::Fiber* raw = fiber.get();
+    fiber->swapIn();
+    TIHI_ASSERT((fiber->state() == tihi::Fiber::TERM));
+    tihi::FiberPool::Put(fiber);
+    TIHI_ASSERT((!fiber));
+    TIHI_ASSERT((tihi::FiberPool::MissCount() == misses + 1));
+
+    /**
+     * 同一线程上直接拿到刚放回去的协程
+     */
+    fiber = tihi::FiberPool::Get([&counts]() { ++counts; });
+    TIHI_ASSERT((fiber.get() == raw));
+    TIHI_ASSERT((tihi::FiberPool::HitCount() == hits + 1));
+    fiber->swapIn();
+    TIHI_ASSERT((counts == 2));
+
+    /**
+     * 还有别人持有引用的协程不会进池
+     */
+    tihi::Fiber::ptr other = fiber;
+    tihi::FiberPool::Put(fiber);
+    TIHI_ASSERT((tihi::FiberPool::Get([]() {}).get() != raw));
+    TIHI_LOG_INFO(g_logger) << "test_get_put success";
+}
+
+/**
+ * 不同栈大小的协程按级别分开缓存，不会串用
+ */
+void test_stack_class() {
+    static const size_t kStackSize = 256 * 1024;
+    tihi::Fiber::This();
+    uint64_t hits = tihi::FiberPool::HitCount();
+
+    tihi::Fiber::ptr fiber = tihi::FiberPool::Get([]() {}, kStackSize);
+    tihi::Fiber* raw = fiber.get();
+    TIHI_ASSERT((fiber->stack_size() == kStackSize));
+    fiber->swapIn();
+    tihi::FiberPool::Put(fiber);
+
+    fiber = tihi::FiberPool::Get([]() {});
+    TIHI_ASSERT((fiber.get() != raw));
+    TIHI_ASSERT((fiber->stack_size() == tihi::Fiber::DefaultStackSize()));
+    fiber.reset();
+
+    fiber = tihi::FiberPool::Get([]() {}, kStackSize);
+    TIHI_ASSERT((fiber.get() == raw));
+    TIHI_ASSERT((tihi::FiberPool::HitCount() == hits + 1));
+    TIHI_LOG_INFO(g_logger) << "test_stack_class success";
+}
+
+static std::atomic<int> s_remain{0};
+
+/**
+ * 让出之后协程不能再给下一个任务用，结束之后回到池中，
+ * 由它调度的下一个任务就能复用
+ */
+void chain_task() {
+    tihi::Fiber::YieldToReady();
+    if (--s_remain > 0) {
+        tihi::Scheduler::This()->schedule(chain_task);
+    }
+}
+
+void test_scheduler() {
+    static const int kTaskCounts = 10000;
+    static const int kChainCounts = 8;
+    uint64_t hits = tihi::FiberPool::HitCount();
+    uint64_t misses = tihi::FiberPool::MissCount();
+    s_remain = kTaskCounts;
+    {
+        tihi::Scheduler sc(2, false, "fiber_pool");
+        sc.start();
+        for (int i = 0; i < kChainCounts; ++i) {
+            sc.schedule(chain_task);
+        }
+        sc.stop();
+    }
+    uint64_t new_hits = tihi::FiberPool::HitCount() - hits;
+    uint64_t new_misses = tihi::FiberPool::MissCount() - misses;
+    TIHI_LOG_INFO(g_logger) << "test_scheduler hits=" << new_hits
+                            << " misses=" << new_misses;
+    TIHI_ASSERT((new_hits > new_misses));
+    TIHI_LOG_INFO(g_logger) << "test_scheduler success";
+}
+
+int main(int argc, char** argv) {
+    test_get_put();
+    test_stack_class();
+    test_scheduler();
+    return 0;
+}
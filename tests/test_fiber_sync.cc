@@ -0,0 +1,202 @@
+#include <atomic>
+
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "sync/fiber_sync.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static const int kFiberCounts = 200;
+static const int kLoopCounts = 200;
+
+void test_mutex() {
+    tihi::FiberMutex mutex;
+    int counter = 0;
+    {
+        tihi::IOManager iom(4, false, "mutex");
+        for (int i = 0; i < kFiberCounts; ++i) {
+            iom.schedule([&mutex, &counter]() {
+                for (int j = 0; j < kLoopCounts; ++j) {
+                    tihi::FiberMutex::mutex lock(mutex);
+                    int v = counter;
+                    /**
+                     * 持有锁时让出，其他协程只能排队
+                     */
+                    if (j % 50 == 0) {
+                        tihi::Fiber::YieldToReady();
+                    }
+                    counter = v + 1;
+                }
+            });
+        }
+    }
+    TIHI_ASSERT((counter == kFiberCounts * kLoopCounts));
+    TIHI_LOG_INFO(g_logger) << "test_mutex success";
+}
+
+void test_condition_variable() {
+    tihi::FiberMutex mutex;
+    tihi::FiberConditionVariable cond;
+    int produced = 0;
+    int consumed = 0;
+    int items = 0;
+    {
+        tihi::IOManager iom(4, false, "cond");
+        for (int i = 0; i < kFiberCounts; ++i) {
+            iom.schedule([&]() {
+                tihi::FiberMutex::mutex lock(mutex);
+                cond.wait(lock, [&items]() { return items > 0; });
+                --items;
+                ++consumed;
+            });
+        }
+        for (int i = 0; i < kFiberCounts; ++i) {
+            iom.schedule([&]() {
+                tihi::FiberMutex::mutex lock(mutex);
+                ++items;
+                ++produced;
+                cond.notifyOne();
+            });
+        }
+    }
+    TIHI_ASSERT((produced == kFiberCounts));
+    TIHI_ASSERT((consumed == kFiberCounts));
+    TIHI_ASSERT((items == 0));
+    TIHI_LOG_INFO(g_logger) << "test_condition_variable success";
+}
+
+void test_semaphore() {
+    tihi::FiberSemaphore sem(2);
+    std::atomic<int> inside{0};
+    std::atomic<int> done{0};
+    {
+        tihi::IOManager iom(4, false, "semaphore");
+        for (int i = 0; i < kFiberCounts; ++i) {
+            iom.schedule([&]() {
+                sem.wait();
+                TIHI_ASSERT((++inside <= 2));
+                tihi::Fiber::YieldToReady();
+                --inside;
+                ++done;
+                sem.notify();
+            });
+        }
+    }
+    TIHI_ASSERT((done == kFiberCounts));
+    TIHI_ASSERT((sem.count() == 2));
+    TIHI_LOG_INFO(g_logger) << "test_semaphore success";
+}
+
+void test_rwmutex() {
+    tihi::FiberRWMutex rwmutex;
+    std::atomic<int> readers{0};
+    std::atomic<int> writers{0};
+    int value = 0;
+    {
+        tihi::IOManager iom(4, false, "rwmutex");
+        for (int i = 0; i < kFiberCounts; ++i) {
+            if (i % 4 == 0) {
+                iom.schedule([&]() {
+                    tihi::FiberRWMutex::write_lock lock(rwmutex);
+                    TIHI_ASSERT((++writers == 1));
+                    TIHI_ASSERT((readers == 0));
+                    tihi::Fiber::YieldToReady();
+                    ++value;
+                    --writers;
+                });
+            } else {
+                iom.schedule([&]() {
+                    tihi::FiberRWMutex::read_lock lock(rwmutex);
+                    ++readers;
+                    TIHI_ASSERT((writers == 0));
+                    tihi::Fiber::YieldToReady();
+                    --readers;
+                });
+            }
+        }
+    }
+    TIHI_ASSERT((value == kFiberCounts / 4));
+    TIHI_LOG_INFO(g_logger) << "test_rwmutex success";
+}
+
+void test_timeout() {
+    tihi::FiberMutex mutex;
+    tihi::FiberConditionVariable cond;
+    tihi::FiberSemaphore sem;
+    tihi::FiberSemaphore done;
+    tihi::FiberRWMutex rwmutex;
+    {
+        tihi::IOManager iom(2, false, "timeout");
+        iom.schedule([&]() {
+            uint64_t start = tihi::MS();
+            TIHI_ASSERT((!sem.waitFor(50)));
+            TIHI_ASSERT((tihi::MS() - start >= 50));
+
+            tihi::FiberMutex::mutex lock(mutex);
+            TIHI_ASSERT((!cond.waitFor(lock, 20)));
+
+            /**
+             * 锁被别的协程拿着时超时返回
+             */
+            iom.schedule([&]() {
+                TIHI_ASSERT((!mutex.tryLockFor(20)));
+                done.notify();
+            });
+
+            tihi::FiberRWMutex::read_lock rlock(rwmutex);
+            iom.schedule([&]() {
+                TIHI_ASSERT((!rwmutex.tryWrlockFor(100)));
+                done.notify();
+            });
+            /**
+             * 排在写者后面的读者在写者超时离开之后就能进来
+             */
+            iom.schedule([&]() {
+                uint64_t start = tihi::MS();
+                TIHI_ASSERT((rwmutex.tryRdlockFor(1000)));
+                TIHI_ASSERT((tihi::MS() - start < 500));
+                rwmutex.unlock();
+                done.notify();
+            });
+            for (int i = 0; i < 3; ++i) {
+                TIHI_ASSERT((done.waitFor(1000)));
+            }
+        });
+    }
+    TIHI_LOG_INFO(g_logger) << "test_timeout success";
+}
+
+void test_waiter_reset() {
+    /**
+     * 同一个等待者 reset() 之后可以反复等待和唤醒
+     */
+    static const int kRounds = 100;
+    int woken = 0;
+    {
+        tihi::IOManager iom(2, false, "waiter_reset");
+        iom.schedule([&iom, &woken]() {
+            tihi::FiberWaiter waiter;
+            for (int i = 0; i < kRounds; ++i) {
+                iom.schedule([&waiter]() { TIHI_ASSERT((waiter.wake())); });
+                waiter.yield();
+                TIHI_ASSERT((!waiter.fire()));
+                ++woken;
+                waiter.reset();
+            }
+        });
+    }
+    TIHI_ASSERT((woken == kRounds));
+    TIHI_LOG_INFO(g_logger) << "test_waiter_reset success";
+}
+
+int main(int argc, char** argv) {
+    test_mutex();
+    test_condition_variable();
+    test_semaphore();
+    test_rwmutex();
+    test_timeout();
+    test_waiter_reset();
+    return 0;
+}
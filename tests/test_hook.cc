@@ -61,7 +61,14 @@ void test_log() {
 
 int main(int argc, char** argv) {
     // test_sleep();
-    tihi::IOManager iom(1, true);
+    /**
+     * 第一个参数可以指定 IO 后端：epoll 或 io_uring
+     */
+    tihi::IOManager::Backend backend = tihi::IOManager::DefaultBackend();
+    if (argc > 1) {
+        backend = tihi::IOManager::BackendFromString(argv[1]);
+    }
+    tihi::IOManager iom(1, true, "", backend);
     iom.schedule(&test_socket);
     return 0;
 }
\ No newline at end of file
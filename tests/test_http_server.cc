@@ -23,7 +23,14 @@ void run() {
 }
 
 int main(int argc, char** argv) {
-    tihi::IOManager iom;
+    /**
+     * 第一个参数可以指定 IO 后端：epoll 或 io_uring
+     */
+    tihi::IOManager::Backend backend = tihi::IOManager::DefaultBackend();
+    if (argc > 1) {
+        backend = tihi::IOManager::BackendFromString(argv[1]);
+    }
+    tihi::IOManager iom(1, true, "", backend);
     iom.schedule(&run);
 
     return 0;
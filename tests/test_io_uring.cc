@@ -0,0 +1,371 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+#include "config/config.h"
+#include "hook/hook.h"
+#include "hook/syscall_stats.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+#include "test_util.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+using Backend = tihi::IOManager::Backend;
+
+using tihi::test::Connect;
+using tihi::test::Echo;
+using tihi::test::Listen;
+using tihi::test::PingPong;
+
+static void test_echo(Backend backend) {
+    static const int CONNS = 4;
+    static const int ROUNDS = 200;
+    static std::atomic<int> s_done{0};
+    s_done = 0;
+
+    tihi::SyscallStats::Snapshot before = tihi::SyscallStats::Get();
+    {
+        tihi::IOManager iom(2, false, "io_echo", backend);
+        TIHI_ASSERT((iom.backend() == backend));
+        iom.schedule([]() {
+            uint16_t port = 0;
+            int lfd = Listen(port);
+            for (int i = 0; i < CONNS; ++i) {
+                tihi::IOManager::This()->schedule([port]() {
+                    int fd = Connect(port);
+                    PingPong(fd, ROUNDS);
+                    close(fd);
+                    ++s_done;
+                });
+            }
+            for (int i = 0; i < CONNS; ++i) {
+                sockaddr_in peer;
+                socklen_t len = sizeof(peer);
+                int fd = accept(lfd, (sockaddr*)&peer, &len);
+                TIHI_ASSERT((fd >= 0));
+                TIHI_ASSERT((peer.sin_addr.s_addr == htonl(INADDR_LOOPBACK)));
+                tihi::IOManager::This()->schedule(std::bind(&Echo, fd));
+            }
+            close(lfd);
+        });
+    }
+    tihi::SyscallStats::Snapshot diff = tihi::SyscallStats::Get() - before;
+
+    TIHI_ASSERT((s_done == CONNS));
+    TIHI_LOG_INFO(g_logger)
+        << tihi::IOManager::BackendToString(backend) << " syscalls/request="
+        << (double)diff.total() / (CONNS * ROUNDS) << " " << diff.toString();
+    if (backend == Backend::IO_URING) {
+        TIHI_ASSERT((diff.counts[tihi::SyscallStats::EPOLL_CTL] == 0));
+        TIHI_ASSERT((diff.counts[tihi::SyscallStats::EPOLL_WAIT] == 0));
+        TIHI_ASSERT((diff.counts[tihi::SyscallStats::IO_URING_ENTER] > 0));
+    } else {
+        TIHI_ASSERT((diff.counts[tihi::SyscallStats::IO_URING_ENTER] == 0));
+    }
+    TIHI_LOG_INFO(g_logger) << "test_echo success";
+}
+
+static void test_timeout_and_cancel(Backend backend) {
+    static std::atomic<int> s_done{0};
+    s_done = 0;
+    {
+        tihi::IOManager iom(1, false, "io_cancel", backend);
+        iom.schedule([]() {
+            uint16_t port = 0;
+            int lfd = Listen(port);
+            int cfd = Connect(port);
+            int sfd = accept(lfd, nullptr, nullptr);
+            TIHI_ASSERT((sfd >= 0));
+
+            /**
+             * 对端一直不发数据，读超时
+             */
+            timeval tv = {0, 50 * 1000};
+            setsockopt(cfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            char buf[16];
+            uint64_t start = tihi::MS();
+            TIHI_ASSERT((recv(cfd, buf, sizeof(buf), 0) == -1));
+            TIHI_ASSERT((errno == ETIMEDOUT));
+            uint64_t used = tihi::MS() - start;
+            TIHI_ASSERT((used >= 40 && used < 1000));
+            ++s_done;
+
+            /**
+             * 等待中的 fd 被别的协程关掉
+             */
+            tihi::IOManager::This()->schedule([sfd]() {
+                usleep(20 * 1000);
+                close(sfd);
+            });
+            TIHI_ASSERT((read(sfd, buf, sizeof(buf)) == -1));
+            ++s_done;
+
+            /**
+             * 超时之后连接照样能用
+             */
+            TIHI_ASSERT((send(cfd, "x", 1, 0) == 1));
+            close(cfd);
+            close(lfd);
+        });
+    }
+    TIHI_ASSERT((s_done == 2));
+    TIHI_LOG_INFO(g_logger) << "test_timeout_and_cancel success";
+}
+
+static void test_events(Backend backend) {
+    /**
+     * addEvent 的回调、delEvent 和 cancelEvent 在两种后端上行为一致
+     */
+    static std::atomic<int> s_readable{0};
+    static std::atomic<int> s_cancelled{0};
+    static int s_fds[2];
+    s_readable = 0;
+    s_cancelled = 0;
+    TIHI_ASSERT((::pipe(s_fds) == 0));
+    {
+        tihi::IOManager iom(1, false, "io_events", backend);
+        iom.schedule([]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            TIHI_ASSERT((iom->addEvent(s_fds[0], tihi::IOManager::READ,
+                                       []() { ++s_readable; }) == 0));
+            TIHI_ASSERT((::write(s_fds[1], "x", 1) == 1));
+        });
+        ::usleep(50 * 1000);
+        TIHI_ASSERT((s_readable == 1));
+
+        char c;
+        TIHI_ASSERT((::read(s_fds[0], &c, 1) == 1));
+        iom.schedule([]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            iom->addEvent(s_fds[0], tihi::IOManager::READ,
+                          []() { ++s_readable; });
+            TIHI_ASSERT((iom->delEvent(s_fds[0], tihi::IOManager::READ)));
+            iom->addEvent(s_fds[0], tihi::IOManager::READ,
+                          []() { ++s_cancelled; });
+            TIHI_ASSERT((iom->cancelEvent(s_fds[0], tihi::IOManager::READ)));
+            TIHI_ASSERT((!iom->cancelEvent(s_fds[0], tihi::IOManager::READ)));
+        });
+        ::usleep(50 * 1000);
+        TIHI_ASSERT((::write(s_fds[1], "x", 1) == 1));
+        ::usleep(50 * 1000);
+    }
+    ::close(s_fds[0]);
+    ::close(s_fds[1]);
+    TIHI_ASSERT((s_readable == 1 && s_cancelled == 1));
+    TIHI_LOG_INFO(g_logger) << "test_events success";
+}
+
+static void test_fixed_buffers() {
+    static char s_buffer[4096];
+    static std::atomic<bool> s_done{false};
+    tihi::IOManager iom(1, false, "io_fixed", Backend::IO_URING);
+    iovec iov = {s_buffer, sizeof(s_buffer)};
+    TIHI_ASSERT((iom.registerBuffers(&iov, 1) == 0));
+    iom.schedule([]() {
+        uint16_t port = 0;
+        int lfd = Listen(port);
+        int cfd = Connect(port);
+        int sfd = accept(lfd, nullptr, nullptr);
+        /**
+         * 先读，数据还没来，读操作用注册的缓冲区交给内核
+         */
+        tihi::IOManager::This()->schedule([cfd]() {
+            usleep(10 * 1000);
+            memcpy(s_buffer + 1024, "fixed", 5);
+            TIHI_ASSERT((tihi::write_fixed(cfd, s_buffer + 1024, 5, 0) == 5));
+        });
+        TIHI_ASSERT((tihi::read_fixed(sfd, s_buffer, 1024, 0) == 5));
+        TIHI_ASSERT((memcmp(s_buffer, "fixed", 5) == 0));
+        close(sfd);
+        close(cfd);
+        close(lfd);
+        s_done = true;
+    });
+    iom.stop();
+    TIHI_ASSERT((s_done));
+    TIHI_ASSERT((iom.unregisterBuffers() == 0));
+    TIHI_LOG_INFO(g_logger) << "test_fixed_buffers success";
+}
+
+static void SetRecvConfig(uint32_t buffers, uint32_t buffer_size,
+                          uint32_t limit) {
+    tihi::Config::Lookup<uint32_t>("iomanager.io_uring.recv_buffers")
+        ->set_value(buffers);
+    tihi::Config::Lookup<uint32_t>("iomanager.io_uring.recv_buffer_size")
+        ->set_value(buffer_size);
+    tihi::Config::Lookup<uint32_t>("iomanager.io_uring.recv_queue_limit")
+        ->set_value(limit);
+}
+
+static char Pattern(size_t i) { return (char)(i * 7 + i / 251); }
+
+static void test_multishot_recv() {
+    static const size_t TOTAL = 1 << 20;
+    static std::atomic<int> s_done{0};
+    s_done = 0;
+    /**
+     * 缓冲区很少、积压上限很小，会遇到 ENOBUFS 和积压时的取消
+     */
+    SetRecvConfig(4, 1024, 8 * 1024);
+    {
+        tihi::IOManager iom(2, false, "io_recv", Backend::IO_URING);
+        TIHI_ASSERT((iom.multishotRecv()));
+        iom.schedule([]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            uint16_t port = 0;
+            int lfd = Listen(port);
+            int cfd = Connect(port);
+            int sfd = accept(lfd, nullptr, nullptr);
+            TIHI_ASSERT((sfd >= 0));
+            char buf[3000];
+
+            /**
+             * 第一次读的时候没有数据，挂上 multishot recv
+             */
+            TIHI_ASSERT((!iom->recvQueued(sfd)));
+            iom->schedule([cfd]() {
+                usleep(10 * 1000);
+                TIHI_ASSERT((send(cfd, "hello", 5, 0) == 5));
+            });
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == 5));
+            TIHI_ASSERT((memcmp(buf, "hello", 5) == 0));
+            TIHI_ASSERT((iom->recvQueued(sfd)));
+
+            /**
+             * MSG_PEEK 不取走，MSG_WAITALL 攒够了才返回
+             */
+            TIHI_ASSERT((send(cfd, "abc", 3, 0) == 3));
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), MSG_PEEK) == 3));
+            TIHI_ASSERT((recv(sfd, buf, 2, 0) == 2));
+            TIHI_ASSERT((memcmp(buf, "ab", 2) == 0));
+            TIHI_ASSERT((read(sfd, buf, sizeof(buf)) == 1 && buf[0] == 'c'));
+            iom->schedule([cfd]() {
+                TIHI_ASSERT((send(cfd, "12", 2, 0) == 2));
+                usleep(10 * 1000);
+                TIHI_ASSERT((send(cfd, "345", 3, 0) == 3));
+            });
+            TIHI_ASSERT((recv(sfd, buf, 5, MSG_WAITALL) == 5));
+            TIHI_ASSERT((memcmp(buf, "12345", 5) == 0));
+
+            /**
+             * 用户设置的非阻塞也从队列中取
+             */
+            int flags = fcntl(sfd, F_GETFL, 0);
+            TIHI_ASSERT((fcntl(sfd, F_SETFL, flags | O_NONBLOCK) == 0));
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == -1));
+            TIHI_ASSERT((errno == EAGAIN));
+            TIHI_ASSERT((send(cfd, "y", 1, 0) == 1));
+            usleep(20 * 1000);
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == 1 && buf[0] == 'y'));
+            TIHI_ASSERT((fcntl(sfd, F_SETFL, flags) == 0));
+
+            /**
+             * 超时只取消等待，之后的数据照常收到
+             */
+            timeval tv = {0, 50 * 1000};
+            setsockopt(sfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == -1));
+            TIHI_ASSERT((errno == ETIMEDOUT));
+            TIHI_ASSERT((send(cfd, "z", 1, 0) == 1));
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == 1 && buf[0] == 'z'));
+
+            close(cfd);
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == 0));
+            TIHI_ASSERT((read(sfd, buf, sizeof(buf)) == 0));
+            close(sfd);
+            ++s_done;
+
+            /**
+             * 大量数据换着用几种读法小块地读，顺序不能乱
+             */
+            cfd = Connect(port);
+            sfd = accept(lfd, nullptr, nullptr);
+            TIHI_ASSERT((sfd >= 0));
+            iom->schedule([cfd]() {
+                std::string data(TOTAL, 0);
+                for (size_t i = 0; i < TOTAL; ++i) {
+                    data[i] = Pattern(i);
+                }
+                size_t sent = 0;
+                while (sent < TOTAL) {
+                    ssize_t n = send(cfd, &data[sent],
+                                     std::min<size_t>(16384, TOTAL - sent), 0);
+                    TIHI_ASSERT((n > 0));
+                    sent += n;
+                }
+                close(cfd);
+            });
+            size_t got = 0;
+            for (int round = 0; got < TOTAL; ++round) {
+                size_t want = 1 + round * 37 % sizeof(buf);
+                iovec iov[2] = {{buf, want / 2}, {buf + want / 2, want - want / 2}};
+                msghdr msg;
+                memset(&msg, 0, sizeof(msg));
+                msg.msg_iov = iov;
+                msg.msg_iovlen = 2;
+                ssize_t n = 0;
+                switch (round % 4) {
+                    case 0:
+                        n = recv(sfd, buf, want, 0);
+                        break;
+                    case 1:
+                        n = read(sfd, buf, want);
+                        break;
+                    case 2:
+                        n = readv(sfd, iov, 2);
+                        break;
+                    default:
+                        n = recvmsg(sfd, &msg, 0);
+                        break;
+                }
+                TIHI_ASSERT((n > 0));
+                for (ssize_t i = 0; i < n; ++i) {
+                    TIHI_ASSERT((buf[i] == Pattern(got + i)));
+                }
+                got += n;
+                /**
+                 * 时不时停一下，让数据积压起来
+                 */
+                if (round % 64 == 0) {
+                    usleep(1000);
+                }
+            }
+            TIHI_ASSERT((recv(sfd, buf, sizeof(buf), 0) == 0));
+            close(sfd);
+            close(lfd);
+            ++s_done;
+        });
+    }
+    SetRecvConfig(256, 4096, 256 * 1024);
+    TIHI_ASSERT((s_done == 2));
+    TIHI_LOG_INFO(g_logger) << "test_multishot_recv success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    TIHI_ASSERT((tihi::IOManager::BackendFromString("io_uring") ==
+                 Backend::IO_URING));
+    TIHI_ASSERT((tihi::IOManager::DefaultBackend() == Backend::EPOLL));
+
+    for (Backend backend : {Backend::EPOLL, Backend::IO_URING}) {
+        TIHI_LOG_INFO(g_logger) << "backend "
+                                << tihi::IOManager::BackendToString(backend);
+        test_echo(backend);
+        test_timeout_and_cancel(backend);
+        test_events(backend);
+    }
+    test_fixed_buffers();
+    test_multishot_recv();
+    return 0;
+}
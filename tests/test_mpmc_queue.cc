@@ -0,0 +1,166 @@
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "thread/thread.h"
+#include "utils/macro.h"
+#include "utils/mpmc_queue.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+/**
+ * 高 16 位是生产者编号，低 48 位是该生产者的序号
+ */
+static uint64_t MakeValue(uint64_t producer, uint64_t seq) {
+    return (producer << 48) | seq;
+}
+
+void test_single_thread() {
+    tihi::MPMCQueue<int> queue;
+    int v = 0;
+    TIHI_ASSERT((queue.empty() && !queue.pop(v)));
+
+    /**
+     * 跨过好几个块，顺序不变
+     */
+    for (int i = 0; i < 100; ++i) {
+        queue.push(int(i));
+    }
+    std::vector<int> bulk(70);
+    for (int i = 0; i < 70; ++i) {
+        bulk[i] = 100 + i;
+    }
+    queue.pushBulk(bulk.data(), bulk.size());
+    TIHI_ASSERT((queue.size() == 170));
+    for (int i = 0; i < 170; ++i) {
+        TIHI_ASSERT((queue.pop(v) && v == i));
+    }
+    TIHI_ASSERT((queue.empty() && queue.size() == 0 && !queue.pop(v)));
+
+    /**
+     * 析构时释放队列中剩下的元素
+     */
+    std::shared_ptr<int> counted(new int(1));
+    {
+        tihi::MPMCQueue<std::shared_ptr<int>> shared;
+        for (int i = 0; i < 50; ++i) {
+            std::shared_ptr<int> p = counted;
+            shared.push(std::move(p));
+        }
+        TIHI_ASSERT((counted.use_count() == 51));
+    }
+    TIHI_ASSERT((counted.use_count() == 1));
+    TIHI_LOG_INFO(g_logger) << "test_single_thread success";
+}
+
+void test_stress() {
+    static const int kProducers = 8;
+    static const int kConsumers = 8;
+    static const uint64_t kPerProducer = 200000;
+
+    tihi::MPMCQueue<uint64_t> queue;
+    std::atomic<uint64_t> popped{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<bool> failed{false};
+
+    std::vector<tihi::Thread::ptr> threads;
+    for (int p = 0; p < kProducers; ++p) {
+        threads.emplace_back(new tihi::Thread(
+            [&queue, p]() {
+                uint64_t seq = 0;
+                uint64_t bulk[17];
+                while (seq < kPerProducer) {
+                    /**
+                     * 单个和批量入队交替进行
+                     */
+                    if (seq % 3 == 0) {
+                        uint64_t v = MakeValue(p, seq++);
+                        queue.push(std::move(v));
+                        continue;
+                    }
+                    size_t n = 0;
+                    while (n < 17 && seq < kPerProducer) {
+                        bulk[n++] = MakeValue(p, seq++);
+                    }
+                    queue.pushBulk(bulk, n);
+                }
+            },
+            "producer_" + std::to_string(p)));
+    }
+
+    for (int c = 0; c < kConsumers; ++c) {
+        threads.emplace_back(new tihi::Thread(
+            [&]() {
+                /**
+                 * 同一个生产者的元素必须按入队顺序出队
+                 */
+                std::vector<int64_t> last(kProducers, -1);
+                uint64_t v = 0;
+                while (popped < kProducers * kPerProducer) {
+                    if (!queue.pop(v)) {
+                        continue;
+                    }
+                    uint64_t producer = v >> 48;
+                    int64_t seq = v & ((1ull << 48) - 1);
+                    if (producer >= (uint64_t)kProducers ||
+                        seq <= last[producer]) {
+                        failed = true;
+                    } else {
+                        last[producer] = seq;
+                    }
+                    sum += seq;
+                    ++popped;
+                }
+            },
+            "consumer_" + std::to_string(c)));
+    }
+
+    for (auto& t : threads) {
+        t->join();
+    }
+    TIHI_ASSERT((!failed));
+    TIHI_ASSERT((popped == kProducers * kPerProducer));
+    TIHI_ASSERT((sum == kProducers * kPerProducer * (kPerProducer - 1) / 2));
+    TIHI_ASSERT((queue.empty()));
+    TIHI_LOG_INFO(g_logger) << "test_stress success";
+}
+
+static std::atomic<int> s_executed{0};
+
+void test_scheduler() {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    {
+        tihi::Scheduler sc(4, false, "mpmc");
+        sc.start();
+        std::vector<tihi::Thread::ptr> threads;
+        for (int p = 0; p < 4; ++p) {
+            threads.emplace_back(new tihi::Thread(
+                [&sc]() {
+                    for (int i = 0; i < 1000; ++i) {
+                        std::vector<tihi::Task> tasks;
+                        for (int j = 0; j < 10; ++j) {
+                            tasks.push_back([]() { ++s_executed; });
+                        }
+                        sc.schedule(tasks.begin(), tasks.end());
+                        sc.schedule([]() { ++s_executed; });
+                    }
+                },
+                "submitter_" + std::to_string(p)));
+        }
+        for (auto& t : threads) {
+            t->join();
+        }
+        sc.stop();
+    }
+    TIHI_ASSERT((s_executed == 4 * 1000 * 11));
+    TIHI_LOG_INFO(g_logger) << "test_scheduler success";
+}
+
+int main(int argc, char** argv) {
+    test_single_thread();
+    test_stress();
+    test_scheduler();
+    return 0;
+}
@@ -0,0 +1,169 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+
+#include "config/config.h"
+#include "hook/syscall_stats.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+#include "test_util.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static const int CONNS = 4;
+static const int ROUNDS = 200;
+
+using tihi::test::Connect;
+using tihi::test::Echo;
+using tihi::test::Listen;
+using tihi::test::PingPong;
+
+static void SetPersistent(bool v) {
+    tihi::Config::Lookup<bool>("iomanager.epoll_persistent")->set_value(v);
+}
+
+/**
+ * CONNS 个连接各做 ROUNDS 次一问一答，返回期间的 epoll_ctl 次数
+ */
+static uint64_t RunEcho(bool persistent) {
+    static std::atomic<int> s_done{0};
+    s_done = 0;
+    SetPersistent(persistent);
+    tihi::SyscallStats::Snapshot before = tihi::SyscallStats::Get();
+    {
+        tihi::IOManager iom(2, false, "persistent_echo",
+                            tihi::IOManager::Backend::EPOLL);
+        TIHI_ASSERT((iom.persistent() == persistent));
+        iom.schedule([]() {
+            uint16_t port = 0;
+            int lfd = Listen(port);
+            for (int i = 0; i < CONNS; ++i) {
+                tihi::IOManager::This()->schedule([port]() {
+                    int fd = Connect(port);
+                    PingPong(fd, ROUNDS);
+                    close(fd);
+                    ++s_done;
+                });
+            }
+            for (int i = 0; i < CONNS; ++i) {
+                int fd = accept(lfd, nullptr, nullptr);
+                TIHI_ASSERT((fd >= 0));
+                tihi::IOManager::This()->schedule(std::bind(&Echo, fd));
+            }
+            close(lfd);
+        });
+    }
+    SetPersistent(false);
+    tihi::SyscallStats::Snapshot diff = tihi::SyscallStats::Get() - before;
+    TIHI_ASSERT((s_done == CONNS));
+    TIHI_LOG_INFO(g_logger)
+        << "persistent=" << persistent << " syscalls/request="
+        << (double)diff.total() / (CONNS * ROUNDS) << " " << diff.toString();
+    return diff.counts[tihi::SyscallStats::EPOLL_CTL];
+}
+
+static void test_syscalls() {
+    uint64_t rearm = RunEcho(false);
+    uint64_t persistent = RunEcho(true);
+    /**
+     * 每个 fd（监听的、两端的连接）最多注册和删除各一次，和请求数无关；
+     * 原来的方式每次阻塞的读都要注册一次、触发后再删一次
+     */
+    TIHI_ASSERT2((persistent <= 2 * (2 * CONNS + 1)),
+                 std::to_string(persistent));
+    TIHI_ASSERT2((rearm >= CONNS * ROUNDS), std::to_string(rearm));
+    TIHI_LOG_INFO(g_logger) << "test_syscalls success, epoll_ctl " << rearm
+                            << " -> " << persistent;
+}
+
+static void test_sticky() {
+    static int s_fds[2];
+    static std::atomic<bool> s_fired{false};
+    static std::atomic<bool> s_done{false};
+    s_fired = false;
+    s_done = false;
+    SetPersistent(true);
+    {
+        tihi::IOManager iom(1, false, "persistent_sticky",
+                            tihi::IOManager::Backend::EPOLL);
+        iom.schedule([]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            TIHI_ASSERT((socketpair(AF_UNIX, SOCK_STREAM, 0, s_fds) == 0));
+            char c;
+            /**
+             * 第一次等的时候注册，已经可读的 fd 注册后马上触发
+             */
+            TIHI_ASSERT((write(s_fds[1], "a", 1) == 1));
+            TIHI_ASSERT((iom->waitEvent(s_fds[0], tihi::IOManager::READ) == 0));
+            TIHI_ASSERT((read(s_fds[0], &c, 1) == 1 && c == 'a'));
+
+            /**
+             * 没人等的时候来的边沿留下就绪标志，之后来等的不再调用 epoll_ctl
+             */
+            TIHI_ASSERT((write(s_fds[1], "b", 1) == 1));
+            usleep(20 * 1000);
+            tihi::SyscallStats::Snapshot before = tihi::SyscallStats::Get();
+            TIHI_ASSERT((iom->addEvent(s_fds[0], tihi::IOManager::READ,
+                                       []() { s_fired = true; }) == 0));
+            usleep(20 * 1000);
+            TIHI_ASSERT((s_fired));
+            TIHI_ASSERT((read(s_fds[0], &c, 1) == 1 && c == 'b'));
+
+            TIHI_ASSERT((write(s_fds[1], "c", 1) == 1));
+            usleep(20 * 1000);
+            uint64_t start = tihi::MS();
+            TIHI_ASSERT((iom->waitEvent(s_fds[0], tihi::IOManager::READ) == 0));
+            TIHI_ASSERT((tihi::MS() - start < 10));
+            TIHI_ASSERT((read(s_fds[0], &c, 1) == 1 && c == 'c'));
+            tihi::SyscallStats::Snapshot diff =
+                tihi::SyscallStats::Get() - before;
+            TIHI_ASSERT((diff.counts[tihi::SyscallStats::EPOLL_CTL] == 0));
+
+            /**
+             * 标志用掉之后没有数据就真正等待
+             */
+            iom->schedule([]() {
+                usleep(20 * 1000);
+                TIHI_ASSERT((write(s_fds[1], "d", 1) == 1));
+            });
+            TIHI_ASSERT((iom->waitEvent(s_fds[0], tihi::IOManager::READ) == 0));
+            TIHI_ASSERT((read(s_fds[0], &c, 1) == 1 && c == 'd'));
+
+            /**
+             * close 时删掉注册，编号复用后重新注册
+             */
+            int old_fd = s_fds[0];
+            close(s_fds[0]);
+            close(s_fds[1]);
+            TIHI_ASSERT((socketpair(AF_UNIX, SOCK_STREAM, 0, s_fds) == 0));
+            TIHI_ASSERT((s_fds[0] == old_fd));
+            iom->schedule([]() {
+                usleep(20 * 1000);
+                TIHI_ASSERT((write(s_fds[1], "e", 1) == 1));
+            });
+            TIHI_ASSERT((iom->waitEvent(s_fds[0], tihi::IOManager::READ) == 0));
+            TIHI_ASSERT((read(s_fds[0], &c, 1) == 1 && c == 'e'));
+            close(s_fds[0]);
+            close(s_fds[1]);
+            s_done = true;
+        });
+    }
+    SetPersistent(false);
+    TIHI_ASSERT((s_done));
+    TIHI_LOG_INFO(g_logger) << "test_sticky success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    test_syscalls();
+    test_sticky();
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include <atomic>
+#include <vector>
+
+#include "fiber/fiber.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+using Priority = tihi::Scheduler::Priority;
+
+static std::vector<Priority> s_order;
+
+void test_weighted() {
+    /**
+     * 默认权重 8:4:1，两条 lane 都积压时每 9 个任务里有 1 个低优先级的
+     */
+    tihi::Scheduler sc(1, false, "priority");
+    for (int i = 0; i < 100; ++i) {
+        sc.schedule([]() { s_order.push_back(Priority::LOW); }, Priority::LOW);
+    }
+    for (int i = 0; i < 100; ++i) {
+        sc.schedule([]() { s_order.push_back(Priority::HIGH); },
+                    Priority::HIGH);
+    }
+    sc.start();
+    sc.stop();
+
+    TIHI_ASSERT((s_order.size() == 200));
+    int high = 0;
+    for (size_t i = 0; i < 45; ++i) {
+        high += s_order[i] == Priority::HIGH;
+    }
+    TIHI_LOG_INFO(g_logger) << "high in first 45: " << high;
+    TIHI_ASSERT((high == 40));
+
+    std::vector<tihi::Scheduler::LaneStats> stats = sc.laneStats();
+    TIHI_ASSERT((stats[0].dequeued == 100 && stats[2].dequeued == 100));
+    TIHI_ASSERT((stats[2].max_delay_us >= stats[2].total_delay_us / 100));
+    TIHI_LOG_INFO(g_logger) << "test_weighted success";
+}
+
+void test_yield_keeps_lane() {
+    tihi::Scheduler sc(2, false, "priority");
+    sc.start();
+    sc.schedule(
+        []() {
+            for (int i = 0; i < 5; ++i) {
+                tihi::Fiber::YieldToReady();
+            }
+        },
+        Priority::LOW);
+    sc.stop();
+    /**
+     * 每次让出都在低优先级的 lane 里重新排队
+     */
+    std::vector<tihi::Scheduler::LaneStats> stats = sc.laneStats();
+    TIHI_ASSERT((stats[2].dequeued == 6));
+    TIHI_ASSERT((stats[0].dequeued == 0 && stats[1].dequeued == 0));
+    TIHI_LOG_INFO(g_logger) << "test_yield_keeps_lane success";
+}
+
+void test_timer_lane() {
+    std::vector<tihi::Scheduler::LaneStats> stats;
+    {
+        tihi::IOManager iom(1, false, "priority");
+        iom.addTimer(10, []() {});
+        iom.addTimer(20, []() {});
+        iom.stop();
+        stats = iom.laneStats();
+    }
+    TIHI_ASSERT((stats[0].dequeued == 2));
+    TIHI_LOG_INFO(g_logger) << "test_timer_lane success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    test_weighted();
+    test_yield_keeps_lane();
+    test_timer_lane();
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <set>
+#include <string>
+
+#include "config/config.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "tcp_server/tcp_server.h"
+#include "utils/macro.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+#include "test_util.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static const int THREADS = 3;
+
+using tihi::test::Connect;
+using tihi::test::Listen;
+using tihi::test::PingPong;
+
+static tihi::Mutex s_mutex;
+static std::set<pid_t> s_threads;
+static std::atomic<int> s_done{0};
+
+/**
+ * 每次 recv 醒来都应该还在绑定的 reactor 线程上
+ */
+static void BoundEcho(int fd, pid_t thread_id) {
+    TIHI_ASSERT((tihi::ThreadId() == thread_id));
+    {
+        tihi::Mutex::mutex lock(s_mutex);
+        s_threads.insert(thread_id);
+    }
+    char buf[256];
+    while (true) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        TIHI_ASSERT((tihi::ThreadId() == thread_id));
+        if (n <= 0) {
+            break;
+        }
+        TIHI_ASSERT((send(fd, buf, n, 0) == n));
+    }
+    close(fd);
+    ++s_done;
+}
+
+static void test_binding() {
+    static const int CONNS = 6;
+    s_threads.clear();
+    s_done = 0;
+    {
+        tihi::IOManager iom(THREADS, false, "reactor");
+        TIHI_ASSERT((iom.sharded()));
+        TIHI_ASSERT((iom.reactorCount() == THREADS));
+        std::set<pid_t> tids;
+        for (int i = 0; i < THREADS; ++i) {
+            TIHI_ASSERT((iom.reactorThread(i) != -1));
+            tids.insert(iom.reactorThread(i));
+        }
+        TIHI_ASSERT((tids.size() == THREADS));
+
+        iom.schedule([]() {
+            tihi::IOManager* iom = tihi::IOManager::This();
+            uint16_t port = 0;
+            int lfd = Listen(port);
+            for (int i = 0; i < CONNS; ++i) {
+                iom->schedule([port]() {
+                    int fd = Connect(port);
+                    PingPong(fd, 100);
+                    close(fd);
+                });
+            }
+            for (int i = 0; i < CONNS; ++i) {
+                int fd = accept(lfd, nullptr, nullptr);
+                TIHI_ASSERT((fd >= 0));
+                int index = iom->bindFd(fd);
+                TIHI_ASSERT((iom->fdReactor(fd) == index));
+                pid_t thread_id = iom->reactorThread(index);
+                iom->schedule(std::bind(&BoundEcho, fd, thread_id), thread_id);
+            }
+            close(lfd);
+        });
+    }
+    TIHI_ASSERT((s_done == CONNS));
+    /**
+     * 轮流绑定，每个 reactor 都分到了连接
+     */
+    TIHI_ASSERT((s_threads.size() == THREADS));
+    TIHI_LOG_INFO(g_logger) << "test_binding success";
+}
+
+static void test_cross_reactor() {
+    /**
+     * 在一个线程上等另一个 reactor 的 fd，醒来时已经换到了 fd 所在的线程，
+     * 回调也在那个线程上执行
+     */
+    static int s_fds[2];
+    static std::atomic<pid_t> s_cb_thread{-1};
+    static std::atomic<bool> s_done{false};
+    s_cb_thread = -1;
+    s_done = false;
+    TIHI_ASSERT((::pipe(s_fds) == 0));
+    {
+        tihi::IOManager iom(THREADS, false, "reactor_cross");
+        pid_t waiter = iom.reactorThread(0);
+        pid_t owner = iom.reactorThread(1);
+        iom.schedule(
+            [owner]() {
+                tihi::IOManager* iom = tihi::IOManager::This();
+                TIHI_ASSERT((iom->bindFd(s_fds[0], 1) == 1));
+                TIHI_ASSERT((iom->waitEvent(s_fds[0], tihi::IOManager::READ) ==
+                             0));
+                TIHI_ASSERT((tihi::ThreadId() == owner));
+                char c;
+                TIHI_ASSERT((::read(s_fds[0], &c, 1) == 1));
+
+                iom->addEvent(s_fds[0], tihi::IOManager::READ,
+                              []() { s_cb_thread = tihi::ThreadId(); });
+                TIHI_ASSERT((::write(s_fds[1], "y", 1) == 1));
+                s_done = true;
+            },
+            waiter);
+        iom.schedule(
+            []() {
+                usleep(20 * 1000);
+                TIHI_ASSERT((::write(s_fds[1], "x", 1) == 1));
+            },
+            iom.reactorThread(2));
+        while (!s_done || s_cb_thread == -1) {
+            usleep(1000);
+        }
+        TIHI_ASSERT((s_cb_thread == owner));
+    }
+    ::close(s_fds[0]);
+    ::close(s_fds[1]);
+    TIHI_LOG_INFO(g_logger) << "test_cross_reactor success";
+}
+
+class EchoServer : public tihi::TcpServer {
+public:
+    using ptr = std::shared_ptr<EchoServer>;
+    EchoServer(tihi::IOManager* iom) : tihi::TcpServer(iom, iom) {}
+
+protected:
+    void handleClient(tihi::Socket::ptr sock) override {
+        pid_t thread_id = tihi::ThreadId();
+        {
+            tihi::Mutex::mutex lock(s_mutex);
+            s_threads.insert(thread_id);
+        }
+        char buf[256];
+        while (true) {
+            int n = sock->recv(buf, sizeof(buf));
+            TIHI_ASSERT((tihi::ThreadId() == thread_id));
+            if (n <= 0) {
+                break;
+            }
+            sock->send(buf, n);
+        }
+        ++s_done;
+    }
+};
+
+static void test_tcp_server() {
+    static const int CONNS = 6;
+    static const uint16_t PORT = 18922;
+    s_threads.clear();
+    s_done = 0;
+    tihi::IOManager iom(THREADS, false, "reactor_server");
+    iom.schedule([]() {
+        tihi::IOManager* iom = tihi::IOManager::This();
+        EchoServer::ptr server(new EchoServer(iom));
+        sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(PORT);
+        TIHI_ASSERT((server->bind(
+            tihi::Address::Create((sockaddr*)&addr, sizeof(addr)))));
+        server->start();
+        for (int i = 0; i < CONNS; ++i) {
+            int fd = Connect(PORT);
+            PingPong(fd, 50);
+            close(fd);
+        }
+        while (s_done != CONNS) {
+            usleep(1000);
+        }
+        server->stop();
+    });
+    iom.stop();
+    TIHI_ASSERT((s_done == CONNS));
+    TIHI_ASSERT((s_threads.size() == THREADS));
+    TIHI_LOG_INFO(g_logger) << "test_tcp_server success";
+}
+
+static void test_stop() {
+    /**
+     * 每个线程等自己的 epoll，停止时都要被叫醒，不能等到超时
+     */
+    uint64_t start = tihi::MS();
+    {
+        tihi::IOManager iom(4, false, "reactor_stop");
+        usleep(20 * 1000);
+    }
+    uint64_t used = tihi::MS() - start;
+    TIHI_ASSERT2((used < 1000), std::to_string(used));
+    TIHI_LOG_INFO(g_logger) << "test_stop success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    tihi::Config::Lookup<bool>("iomanager.reactor_per_thread")->set_value(true);
+
+    test_binding();
+    test_cross_reactor();
+    test_tcp_server();
+    test_stop();
+    return 0;
+}
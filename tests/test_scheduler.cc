@@ -1,5 +1,10 @@
+#include <string.h>
+
+#include <atomic>
+
 #include "scheduler/scheduler.h"
 #include "log/log.h"
+#include "utils/macro.h"
 
 static tihi::Logger::ptr t_logger = TIHI_LOG_ROOT();
 
@@ -26,6 +31,64 @@ void f2() {
 
 }
 
+void f3(int id) {
+    char buffer[1024];
+    memset(buffer, id, sizeof(buffer));
+    pid_t tid = tihi::ThreadId();
+    for (int i = 0; i < 5; ++i) {
+        tihi::Fiber::YieldToReady();
+        /**
+         * 共享栈协程只会在绑定的线程上恢复
+         */
+        TIHI_ASSERT((tid == tihi::ThreadId()));
+        TIHI_ASSERT((buffer[0] == id && buffer[sizeof(buffer) - 1] == id));
+    }
+}
+
+void test_shared_stack() {
+    tihi::Scheduler sc(3, false);
+    sc.set_shared_stack(true);
+    sc.start();
+    for (int i = 0; i < 20; ++i) {
+        sc.schedule(std::bind(&f3, i));
+    }
+    sc.stop();
+    TIHI_LOG_DEBUG(t_logger) << "test_shared_stack end";
+}
+
+static std::atomic<int> s_pinned_counts{0};
+
+void pinned(pid_t tid) {
+    TIHI_ASSERT((tid == tihi::ThreadId()));
+    ++s_pinned_counts;
+}
+
+void test_pinned() {
+    {
+        tihi::Scheduler sc(4, false);
+        sc.start();
+        /**
+         * 每个线程给自己和其他线程派发指定了线程的任务
+         */
+        for (int i = 0; i < 8; ++i) {
+            sc.schedule([]() {
+                pid_t tid = tihi::ThreadId();
+                for (int j = 0; j < 100; ++j) {
+                    tihi::Scheduler::This()->schedule(std::bind(&pinned, tid),
+                                                      tid);
+                }
+            });
+        }
+        /**
+         * 不属于调度器的线程，任务在任意线程上执行
+         */
+        sc.schedule([]() { ++s_pinned_counts; }, tihi::ThreadId());
+        sc.stop();
+    }
+    TIHI_ASSERT((s_pinned_counts == 8 * 100 + 1));
+    TIHI_LOG_DEBUG(t_logger) << "test_pinned end";
+}
+
 int main(int argc, char** argv) {
 
     TIHI_LOG_DEBUG(t_logger) << "main start";
@@ -36,6 +99,9 @@ int main(int argc, char** argv) {
     sc.schedule(f);
     sc.stop();
 
+    test_shared_stack();
+    test_pinned();
+
     TIHI_LOG_DEBUG(t_logger) << "main end";
 
     return 0;
@@ -0,0 +1,283 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config/config.h"
+#include "fiber/fiber.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/histogram.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static void SetSamplePeriod(uint32_t v) {
+    tihi::Config::Lookup<uint32_t>("scheduler.stats_sample_period")
+        ->set_value(v);
+}
+
+void test_histogram() {
+    tihi::Histogram h;
+    TIHI_ASSERT((h.count() == 0 && h.percentile(0.5) == 0));
+
+    /**
+     * 每个值都落在上界不小于它、误差不超过 1/16 的桶里
+     */
+    for (uint64_t v : {0ull, 1ull, 31ull, 32ull, 33ull, 1000ull, 123456ull,
+                       (1ull << 39) + 12345, ~0ull}) {
+        size_t index = tihi::Histogram::BucketIndex(v);
+        TIHI_ASSERT((index < tihi::Histogram::BUCKET_COUNTS));
+        uint64_t bound = tihi::Histogram::BucketUpperBound(index);
+        if (v < (1ull << tihi::Histogram::MAX_BITS)) {
+            TIHI_ASSERT((bound >= v && bound - v <= v / 16));
+        }
+        if (index > 0) {
+            TIHI_ASSERT((tihi::Histogram::BucketUpperBound(index - 1) < v));
+        }
+    }
+
+    for (uint64_t v = 1; v <= 1000; ++v) {
+        h.record(v);
+    }
+    TIHI_ASSERT((h.count() == 1000 && h.sum() == 500500 && h.max() == 1000));
+    TIHI_ASSERT((h.percentile(0) == 1 && h.percentile(1) == 1000));
+    uint64_t p50 = h.percentile(0.5);
+    uint64_t p99 = h.percentile(0.99);
+    TIHI_ASSERT((p50 >= 500 && p50 <= 500 + 500 / 16));
+    TIHI_ASSERT((p99 >= 990 && p99 <= 1000));
+
+    tihi::Histogram merged(h);
+    merged.merge(h);
+    TIHI_ASSERT((merged.count() == 2000 && merged.percentile(0.5) == p50));
+    TIHI_LOG_INFO(g_logger) << "histogram: " << merged.toString();
+    TIHI_LOG_INFO(g_logger) << "test_histogram success";
+}
+
+void test_scheduler_stats() {
+    /**
+     * 每个任务都计时
+     */
+    SetSamplePeriod(1);
+    static std::atomic<int> s_done{0};
+    tihi::Scheduler sc(2, false, "stats");
+    sc.start();
+    for (int i = 0; i < 100; ++i) {
+        sc.schedule([]() {
+            ::usleep(100);
+            ++s_done;
+        });
+    }
+    /**
+     * 让出一次，这个任务会被切入两次
+     */
+    sc.schedule([]() {
+        tihi::Fiber::YieldToReady();
+        ++s_done;
+    });
+    sc.stop();
+    SetSamplePeriod(8);
+    TIHI_ASSERT((s_done == 101));
+
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.queue_delay_us.count() == 102));
+    TIHI_ASSERT((stats.run_slice_us.count() == 102));
+    TIHI_ASSERT((stats.run_slices == 102));
+    TIHI_ASSERT((stats.context_switches ==
+                 stats.run_slices + stats.idle_us.count()));
+    TIHI_ASSERT((stats.run_slice_us.max() >= 100));
+    TIHI_ASSERT((stats.run_slice_us.sum() >= 100 * 100));
+    TIHI_ASSERT((stats.lanes[1].dequeued == 102));
+    TIHI_ASSERT((stats.lanes[1].sampled == 102));
+    TIHI_ASSERT((stats.utilization() > 0 && stats.utilization() <= 1));
+    TIHI_ASSERT((stats.active_threads == 0));
+    TIHI_LOG_INFO(g_logger) << "test_scheduler_stats success";
+}
+
+void test_sampling() {
+    /**
+     * 默认每 8 个任务抽一个计时，次数仍然是精确的
+     */
+    tihi::Scheduler sc(1, false, "stats_sample");
+    for (int i = 0; i < 800; ++i) {
+        sc.schedule([]() {});
+    }
+    sc.start();
+    sc.stop();
+
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.run_slices == 800 && stats.lanes[1].dequeued == 800));
+    TIHI_ASSERT((stats.queue_delay_us.count() == 100));
+    TIHI_ASSERT((stats.run_slice_us.count() == 100));
+    TIHI_ASSERT((stats.lanes[1].sampled == 100));
+    TIHI_LOG_INFO(g_logger) << "test_sampling success";
+}
+
+void test_tickles() {
+    /**
+     * 两个线程都空闲时从外部提交任务，至少要发出并收到一次唤醒
+     */
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(2, false, "stats_io");
+        ::usleep(100 * 1000);
+        iom.schedule([]() {});
+        ::usleep(100 * 1000);
+        stats = iom.stats();
+    }
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.tickles_sent >= 1));
+    TIHI_ASSERT((stats.tickles_received >= 1));
+    TIHI_ASSERT((stats.idle_us.count() >= 1));
+    TIHI_LOG_INFO(g_logger) << "test_tickles success";
+}
+
+void test_coalesce(bool sharded) {
+    /**
+     * 连续点名唤醒同一个空闲线程，它读走 eventfd 之前的唤醒都合并成一次
+     */
+    static std::atomic<int> s_ran{0};
+    static std::atomic<pid_t> s_thread{-1};
+    static const int ROUNDS = 50;
+    static const int BURST = 100;
+    tihi::Config::Lookup<bool>("iomanager.reactor_per_thread")
+        ->set_value(sharded);
+    s_ran = 0;
+    s_thread = -1;
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(2, false, "stats_coalesce");
+        iom.schedule([]() { s_thread = tihi::ThreadId(); });
+        while (s_thread == -1) {
+            ::usleep(1000);
+        }
+        for (int r = 0; r < ROUNDS; ++r) {
+            ::usleep(1000);
+            for (int i = 0; i < BURST; ++i) {
+                iom.schedule([]() { ++s_ran; }, s_thread);
+            }
+        }
+        while (s_ran != ROUNDS * BURST) {
+            ::usleep(1000);
+        }
+        stats = iom.stats();
+    }
+    tihi::Config::Lookup<bool>("iomanager.reactor_per_thread")->set_value(false);
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.tickles_requested ==
+                 stats.tickles_sent + stats.tickles_coalesced));
+    TIHI_ASSERT((stats.tickles_sent >= 1));
+    TIHI_ASSERT((stats.tickles_coalesced > 0));
+    TIHI_ASSERT((stats.tickles_received <= stats.tickles_sent));
+    TIHI_LOG_INFO(g_logger) << "test_coalesce success, sharded=" << sharded;
+}
+
+void test_pinned_tickles(tihi::IOManager::Backend backend) {
+    /**
+     * 默认模式下点名唤醒空闲线程只叫醒它自己：每个任务大约一次唤醒，
+     * 其他空闲线程既不被叫醒也不转发
+     */
+    static const int THREADS = 4;
+    static const int TASKS = 200;
+    static std::atomic<int> s_ran{0};
+    static std::atomic<pid_t> s_thread{-1};
+    s_ran = 0;
+    s_thread = -1;
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(THREADS, false, "stats_pinned", backend);
+        iom.schedule([]() { s_thread = tihi::ThreadId(); });
+        while (s_thread == -1) {
+            ::usleep(1000);
+        }
+        for (int i = 0; i < TASKS; ++i) {
+            while (iom.stats().idle_threads != THREADS) {
+                ::usleep(100);
+            }
+            iom.schedule([]() { ++s_ran; }, s_thread);
+            while (s_ran != i + 1) {
+                ::usleep(100);
+            }
+        }
+        stats = iom.stats();
+    }
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.tickles_sent <= TASKS + TASKS / 10));
+    TIHI_ASSERT((stats.tickles_received <= stats.tickles_sent));
+    TIHI_ASSERT((stats.run_slices == TASKS + 1));
+    TIHI_LOG_INFO(g_logger)
+        << "test_pinned_tickles success, backend="
+        << tihi::IOManager::BackendToString(backend);
+}
+
+void test_burst() {
+    /**
+     * 默认模式下一连串的唤醒可以同时叫醒多个空闲线程：
+     * 每个任务都等到所有任务同时在跑
+     */
+    static const int THREADS = 3;
+    static std::atomic<int> s_running{0};
+    static std::atomic<int> s_met{0};
+    s_running = 0;
+    s_met = 0;
+    {
+        tihi::IOManager iom(THREADS, false, "stats_burst");
+        while (iom.stats().idle_threads != THREADS) {
+            ::usleep(1000);
+        }
+        for (int i = 0; i < THREADS; ++i) {
+            iom.schedule([]() {
+                ++s_running;
+                uint64_t start = tihi::MS();
+                while (s_running != THREADS && tihi::MS() - start < 2000) {
+                    sched_yield();
+                }
+                if (s_running == THREADS) {
+                    ++s_met;
+                }
+            });
+        }
+    }
+    TIHI_ASSERT((s_met == THREADS));
+    TIHI_LOG_INFO(g_logger) << "test_burst success";
+}
+
+void test_disabled() {
+    SetSamplePeriod(0);
+    tihi::Scheduler sc(1, false, "stats_off");
+    sc.start();
+    for (int i = 0; i < 10; ++i) {
+        sc.schedule([]() {});
+    }
+    sc.stop();
+    SetSamplePeriod(8);
+
+    /**
+     * 不计时，只剩次数
+     */
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_ASSERT((stats.queue_delay_us.count() == 0));
+    TIHI_ASSERT((stats.run_slice_us.count() == 0));
+    TIHI_ASSERT((stats.idle_us.count() == 0));
+    TIHI_ASSERT((stats.run_slices == 10 && stats.context_switches >= 10));
+    TIHI_LOG_INFO(g_logger) << "test_disabled success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    test_histogram();
+    test_scheduler_stats();
+    test_sampling();
+    test_tickles();
+    test_coalesce(false);
+    test_coalesce(true);
+    test_pinned_tickles(tihi::IOManager::Backend::EPOLL);
+    test_pinned_tickles(tihi::IOManager::Backend::IO_URING);
+    test_burst();
+    test_disabled();
+    return 0;
+}
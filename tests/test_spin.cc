@@ -0,0 +1,129 @@
+#include <sched.h>
+#include <unistd.h>
+
+#include <atomic>
+
+#include "config/config.h"
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static void SetSpinUs(uint32_t v) {
+    tihi::Config::Lookup<uint32_t>("scheduler.spin_us")->set_value(v);
+}
+
+/**
+ * 外部线程一个接一个地提交任务，每个任务都交给刚空闲下来的线程
+ */
+static void PingPong(tihi::Scheduler& sc, int rounds) {
+    static std::atomic<bool> s_done{false};
+    for (int i = 0; i < rounds; ++i) {
+        s_done = false;
+        sc.schedule([]() { s_done = true; });
+        while (!s_done) {
+            sched_yield();
+        }
+    }
+}
+
+void test_spin_hits() {
+    SetSpinUs(500);
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(1, false, "spin");
+        PingPong(iom, 200);
+        stats = iom.stats();
+    }
+    SetSpinUs(0);
+
+    /**
+     * 自旋的线程自己会看到任务，外部线程不用写管道
+     */
+    TIHI_LOG_INFO(g_logger) << stats.toString();
+    TIHI_ASSERT((stats.spin_budget_us == 500));
+    TIHI_ASSERT((stats.spins > 0 && stats.spin_hits > 0));
+    TIHI_ASSERT((stats.spin_hits <= stats.spins));
+    TIHI_ASSERT((stats.spinHitRate() > 0.5));
+    TIHI_ASSERT((stats.tickles_skipped > 0));
+    TIHI_ASSERT((stats.tickles_sent < 200));
+    TIHI_LOG_INFO(g_logger) << "test_spin_hits success";
+}
+
+void test_wakeups() {
+    /**
+     * 自旋时也不能漏掉指定线程的任务、定时器和 IO 事件
+     */
+    static std::atomic<pid_t> s_thread{-1};
+    static std::atomic<int> s_pinned{0};
+    static std::atomic<bool> s_timer{false};
+    static std::atomic<bool> s_readable{false};
+    SetSpinUs(200);
+    uint64_t stop_ms = 0;
+    {
+        tihi::IOManager iom(2, false, "spin_wakeups");
+        iom.schedule([]() { s_thread = tihi::ThreadId(); });
+        while (s_thread == -1) {
+            sched_yield();
+        }
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule(
+                []() {
+                    if (tihi::ThreadId() == s_thread) {
+                        ++s_pinned;
+                    }
+                },
+                s_thread);
+            ::usleep(100);
+        }
+
+        iom.addTimer(20, []() { s_timer = true; });
+
+        static int s_fds[2];
+        TIHI_ASSERT((::pipe(s_fds) == 0));
+        iom.schedule([]() {
+            tihi::IOManager::This()->addEvent(s_fds[0], tihi::IOManager::READ,
+                                             []() { s_readable = true; });
+        });
+        ::usleep(10 * 1000);
+        TIHI_ASSERT((::write(s_fds[1], "x", 1) == 1));
+
+        ::usleep(100 * 1000);
+        TIHI_ASSERT((s_pinned == 100 && s_timer && s_readable));
+        ::close(s_fds[0]);
+        ::close(s_fds[1]);
+        stop_ms = tihi::MS();
+    }
+    SetSpinUs(0);
+
+    /**
+     * 停止时的唤醒不会被省掉，不用等 epoll_wait 超时
+     */
+    stop_ms = tihi::MS() - stop_ms;
+    TIHI_LOG_INFO(g_logger) << "stop used " << stop_ms << "ms";
+    TIHI_ASSERT((stop_ms < 1000));
+    TIHI_LOG_INFO(g_logger) << "test_wakeups success";
+}
+
+void test_disabled() {
+    tihi::Scheduler::Stats stats;
+    {
+        tihi::IOManager iom(1, false, "no_spin");
+        PingPong(iom, 50);
+        stats = iom.stats();
+    }
+    TIHI_ASSERT((stats.spin_budget_us == 0 && stats.spins == 0));
+    TIHI_ASSERT((stats.tickles_skipped == 0 && stats.tickles_sent > 0));
+    TIHI_LOG_INFO(g_logger) << "test_disabled success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    test_spin_hits();
+    test_wakeups();
+    test_disabled();
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "config/config.h"
+#include "fiber/fiber.h"
+#include "fiber/stack_allocator.h"
+#include "log/log.h"
+#include "thread/thread.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+void test_size_class() {
+    TIHI_ASSERT((tihi::StackAllocator::RoundUp(1) == 16 * 1024));
+    TIHI_ASSERT((tihi::StackAllocator::RoundUp(16 * 1024) == 16 * 1024));
+    TIHI_ASSERT((tihi::StackAllocator::RoundUp(16 * 1024 + 1) == 32 * 1024));
+    TIHI_ASSERT((tihi::StackAllocator::RoundUp(1024 * 1024) == 1024 * 1024));
+    TIHI_LOG_INFO(g_logger) << "test_size_class success";
+}
+
+void test_reuse() {
+    uint64_t in_use = tihi::StackAllocator::InUseCount();
+
+    void* p1 = tihi::StackAllocator::Alloc(64 * 1024);
+    TIHI_ASSERT((tihi::StackAllocator::InUseCount() == in_use + 1));
+    tihi::StackAllocator::Dealloc(p1, 64 * 1024);
+    TIHI_ASSERT((tihi::StackAllocator::InUseCount() == in_use));
+
+    /**
+     * 同一线程同一级别的栈会被直接复用
+     */
+    uint64_t pooled = tihi::StackAllocator::PooledCount();
+    void* p2 = tihi::StackAllocator::Alloc(60 * 1024);
+    TIHI_ASSERT((p1 == p2));
+    TIHI_ASSERT((tihi::StackAllocator::PooledCount() == pooled - 1));
+    tihi::StackAllocator::Dealloc(p2, 60 * 1024);
+
+    /**
+     * 交给全局池不裁剪，其他线程可以从全局池中拿到
+     */
+    uint64_t trimmed = tihi::StackAllocator::TrimmedCount();
+    TIHI_ASSERT((tihi::StackAllocator::Flush() >= 1));
+    TIHI_ASSERT((tihi::StackAllocator::TrimmedCount() == trimmed));
+
+    void* p3 = nullptr;
+    tihi::Thread::ptr thr(new tihi::Thread(
+        [&p3]() {
+            p3 = tihi::StackAllocator::Alloc(64 * 1024);
+            static_cast<char*>(p3)[0] = 1;
+            tihi::StackAllocator::Dealloc(p3, 64 * 1024);
+        },
+        "stack_test"));
+    thr->join();
+    TIHI_ASSERT((p3 == p1));
+
+    TIHI_LOG_INFO(g_logger)
+        << "test_reuse success in_use=" << tihi::StackAllocator::InUseCount()
+        << " pooled=" << tihi::StackAllocator::PooledCount()
+        << " trimmed=" << tihi::StackAllocator::TrimmedCount();
+}
+
+void test_trim() {
+    static const size_t SIZE = 32 * 1024;
+    static const int COUNTS = 4;
+    void* stacks[COUNTS];
+    for (int i = 0; i < COUNTS; ++i) {
+        stacks[i] = tihi::StackAllocator::Alloc(SIZE);
+        memset(stacks[i], 0xab, SIZE);
+    }
+    for (int i = 0; i < COUNTS; ++i) {
+        tihi::StackAllocator::Dealloc(stacks[i], SIZE);
+    }
+    tihi::StackAllocator::Flush();
+
+    /**
+     * 刚放进全局池的栈还不算闲置
+     */
+    uint64_t trimmed = tihi::StackAllocator::TrimmedCount();
+    TIHI_ASSERT((tihi::StackAllocator::Trim(60 * 1000) == 0));
+    TIHI_ASSERT((tihi::StackAllocator::TrimmedCount() == trimmed));
+
+    size_t counts = tihi::StackAllocator::Trim(0);
+    TIHI_ASSERT((counts >= COUNTS));
+    TIHI_ASSERT((tihi::StackAllocator::TrimmedCount() == trimmed + counts));
+    TIHI_ASSERT((tihi::StackAllocator::Trim(0) == 0));
+
+    /**
+     * 裁剪过的栈内容被清零，照样能用
+     */
+    void* p = tihi::StackAllocator::Alloc(SIZE);
+    TIHI_ASSERT((static_cast<char*>(p)[SIZE - 1] == 0));
+    static_cast<char*>(p)[SIZE - 1] = 1;
+    tihi::StackAllocator::Dealloc(p, SIZE);
+    tihi::StackAllocator::Flush();
+
+    /**
+     * 按配置的闲置时长自动裁剪，两次检查之间至少隔这么久
+     */
+    tihi::Config::Lookup<uint32_t>("fiber.stack_pool.trim_idle_ms")
+        ->set_value(50);
+    ::usleep(100 * 1000);
+    TIHI_ASSERT((tihi::StackAllocator::MaybeTrim() == 1));
+    TIHI_ASSERT((tihi::StackAllocator::MaybeTrim() == 0));
+    TIHI_LOG_INFO(g_logger) << "test_trim success";
+}
+
+void test_guard_page() {
+    pid_t pid = fork();
+    if (pid == 0) {
+        char* stack = static_cast<char*>(tihi::StackAllocator::Alloc(16 * 1024));
+        /**
+         * 写到栈底之下的保护页
+         */
+        stack[-1] = 1;
+        _exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    TIHI_ASSERT((WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV));
+    TIHI_LOG_INFO(g_logger) << "test_guard_page success";
+}
+
+void test_fiber() {
+    uint64_t in_use = tihi::StackAllocator::InUseCount();
+    tihi::Fiber::This();
+    {
+        tihi::Fiber::ptr fiber(new tihi::Fiber([]() {}));
+        TIHI_ASSERT((tihi::StackAllocator::InUseCount() == in_use + 1));
+    }
+    TIHI_ASSERT((tihi::StackAllocator::InUseCount() == in_use));
+    TIHI_LOG_INFO(g_logger) << "test_fiber success";
+}
+
+int main(int argc, char** argv) {
+    test_size_class();
+    test_reuse();
+    test_trim();
+    test_guard_page();
+    test_fiber();
+    return 0;
+}
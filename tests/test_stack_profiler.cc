@@ -0,0 +1,136 @@
+#include <string.h>
+
+#include <atomic>
+
+#include "config/config.h"
+#include "fiber/fiber.h"
+#include "fiber/stack_profiler.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+/**
+ * 每层至少用掉 1K 的栈
+ */
+static void use_stack(int kb) {
+    volatile char buf[1024];
+    memset((char*)buf, 1, sizeof(buf));
+    if (kb > 1) {
+        use_stack(kb - 1);
+    }
+}
+
+void test_measure() {
+    tihi::Config::Lookup<std::string>("fiber.stack_profile")
+        ->set_value("record");
+    TIHI_ASSERT((tihi::StackProfiler::GetMode() == tihi::StackProfiler::RECORD));
+    tihi::Fiber::This();
+
+    tihi::Fiber::ptr fiber(new tihi::Fiber([]() { use_stack(64); }));
+    fiber->set_tag("test.measure");
+    fiber->swapIn();
+    size_t deep = fiber->stack_peak();
+    TIHI_LOG_INFO(g_logger) << "deep peak=" << deep;
+    TIHI_ASSERT((deep >= 64 * 1024 && deep < 128 * 1024));
+
+    /**
+     * 复用同一个栈，上次弄脏的部分要重新清零
+     */
+    fiber->reset([]() { use_stack(4); });
+    fiber->swapIn();
+    size_t shallow = fiber->stack_peak();
+    TIHI_LOG_INFO(g_logger) << "shallow peak=" << shallow;
+    TIHI_ASSERT((shallow >= 4 * 1024 && shallow < 32 * 1024));
+
+    TIHI_LOG_INFO(g_logger) << "\n" << tihi::StackProfiler::Report();
+    TIHI_LOG_INFO(g_logger) << "test_measure success";
+}
+
+static std::atomic<int> s_checked{0};
+
+void test_auto() {
+    static const int kTaskCounts = 32;
+    tihi::StackProfiler::Reset();
+    tihi::Config::Lookup<std::string>("fiber.stack_profile")
+        ->set_value("auto");
+
+    {
+        tihi::Scheduler sc(2, false, "stack_profiler");
+        sc.start();
+        for (int i = 0; i < kTaskCounts; ++i) {
+            sc.schedule([]() { use_stack(32); }, -1, "test.auto");
+        }
+        sc.stop();
+    }
+    size_t suggest = tihi::StackProfiler::SuggestStackSize("test.auto");
+    TIHI_LOG_INFO(g_logger) << "suggest=" << suggest << "\n"
+                            << tihi::StackProfiler::Report();
+    TIHI_ASSERT((suggest >= 64 * 1024 &&
+                 suggest < tihi::Fiber::DefaultStackSize()));
+    TIHI_ASSERT((tihi::StackProfiler::SuggestStackSize("test.unknown") == 0));
+
+    /**
+     * 样本足够之后带同一标签的任务用建议的栈大小执行，不带标签的仍用默认大小
+     */
+    {
+        tihi::Scheduler sc(2, false, "stack_profiler");
+        sc.start();
+        for (int i = 0; i < kTaskCounts; ++i) {
+            sc.schedule(
+                [suggest]() {
+                    TIHI_ASSERT((tihi::Fiber::This()->stack_size() == suggest));
+                    use_stack(32);
+                    ++s_checked;
+                },
+                -1, "test.auto");
+            sc.schedule([]() {
+                TIHI_ASSERT((tihi::Fiber::This()->stack_size() ==
+                             tihi::Fiber::DefaultStackSize()));
+                ++s_checked;
+            });
+        }
+        sc.stop();
+    }
+    TIHI_ASSERT((s_checked == kTaskCounts * 2));
+
+    tihi::Config::Lookup<std::string>("fiber.stack_profile")
+        ->set_value("off");
+    TIHI_LOG_INFO(g_logger) << "test_auto success";
+}
+
+/**
+ * 建议的栈大小不小于 fiber.auto_stack_min_size
+ */
+void test_min_size() {
+    static const uint32_t kMinSize = 256 * 1024;
+    tihi::StackProfiler::Reset();
+    tihi::Config::Lookup<uint32_t>("fiber.auto_stack_min_size")
+        ->set_value(kMinSize);
+    tihi::Config::Lookup<std::string>("fiber.stack_profile")
+        ->set_value("auto");
+    {
+        tihi::Scheduler sc(2, false, "stack_profiler");
+        sc.start();
+        for (uint64_t i = 0; i < tihi::StackProfiler::MIN_SAMPLES; ++i) {
+            sc.schedule([]() { use_stack(4); }, -1, "test.min_size");
+        }
+        sc.stop();
+    }
+    size_t suggest = tihi::StackProfiler::SuggestStackSize("test.min_size");
+    TIHI_LOG_INFO(g_logger) << "suggest=" << suggest << "\n"
+                            << tihi::StackProfiler::Report();
+    TIHI_ASSERT((suggest == kMinSize));
+
+    tihi::Config::Lookup<std::string>("fiber.stack_profile")
+        ->set_value("off");
+    TIHI_LOG_INFO(g_logger) << "test_min_size success";
+}
+
+int main(int argc, char** argv) {
+    test_measure();
+    test_auto();
+    test_min_size();
+    return 0;
+}
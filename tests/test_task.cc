@@ -0,0 +1,145 @@
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "iomanager/iomanager.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "utils/macro.h"
+#include "utils/task.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+static int s_alive = 0;
+static int s_calls = 0;
+
+/**
+ * 统计存活对象个数的回调，Size 控制回调的大小
+ */
+template <size_t Size>
+struct Counted {
+    Counted() { ++s_alive; }
+    Counted(const Counted&) { ++s_alive; }
+    Counted(Counted&&) noexcept { ++s_alive; }
+    ~Counted() { --s_alive; }
+
+    void operator()() { ++s_calls; }
+
+    char padding[Size];
+};
+
+static void noop() { ++s_calls; }
+
+void test_storage() {
+    s_alive = 0;
+    s_calls = 0;
+    {
+        tihi::Task small(Counted<48>{});
+        TIHI_ASSERT((small.stored_inline()));
+        tihi::Task big(Counted<128>{});
+        TIHI_ASSERT((!big.stored_inline()));
+        TIHI_ASSERT((s_alive == 2));
+
+        /**
+         * 移动之后原来的 Task 为空，回调不会多也不会少
+         */
+        tihi::Task moved_small(std::move(small));
+        tihi::Task moved_big(std::move(big));
+        TIHI_ASSERT((!small && !big));
+        TIHI_ASSERT((s_alive == 2));
+        moved_small();
+        moved_big();
+        TIHI_ASSERT((s_calls == 2));
+
+        tihi::Task copy = moved_small.clone();
+        TIHI_ASSERT((s_alive == 3));
+        copy();
+        TIHI_ASSERT((s_calls == 3));
+
+        moved_big = nullptr;
+        TIHI_ASSERT((s_alive == 2));
+        moved_big.swap(moved_small);
+        TIHI_ASSERT((!moved_small && moved_big.stored_inline()));
+    }
+    TIHI_ASSERT((s_alive == 0));
+
+    /**
+     * std::bind(成员函数, shared_ptr, shared_ptr) 可以放进内联缓冲区
+     */
+    std::shared_ptr<int> a(new int(1));
+    std::shared_ptr<int> b(new int(2));
+    auto bound = std::bind(
+        [](std::shared_ptr<int> x, std::shared_ptr<int> y) { s_calls += *x + *y; },
+        a, b);
+    tihi::Task bind_task(bound);
+    TIHI_ASSERT((bind_task.stored_inline()));
+
+    /**
+     * 空的 std::function 和函数指针得到空的 Task
+     */
+    std::function<void()> empty;
+    void (*null_fn)() = nullptr;
+    TIHI_ASSERT((!tihi::Task(empty) && !tihi::Task(null_fn)));
+    TIHI_ASSERT((tihi::Task(noop) && tihi::Task(&noop).copyable()));
+    TIHI_LOG_INFO(g_logger) << "test_storage success";
+}
+
+static std::atomic<int> s_scheduled{0};
+static std::atomic<int> s_fired{0};
+
+/**
+ * 只能移动的回调，std::function 放不下
+ */
+struct MoveOnly {
+    explicit MoveOnly(int v) : value(new int(v)) {}
+
+    void operator()() { s_scheduled += *value; }
+
+    std::unique_ptr<int> value;
+};
+
+void test_move_only() {
+    tihi::Task task(MoveOnly(42));
+    TIHI_ASSERT((task.stored_inline() && !task.copyable()));
+    tihi::Task other(std::move(task));
+    other();
+    TIHI_ASSERT((s_scheduled == 42));
+    s_scheduled = 0;
+    TIHI_LOG_INFO(g_logger) << "test_move_only success";
+}
+
+void test_scheduler() {
+    {
+        tihi::IOManager iom(2, false, "task");
+        for (int i = 0; i < 100; ++i) {
+            iom.schedule(MoveOnly(i));
+        }
+        std::vector<tihi::Task> tasks;
+        for (int i = 0; i < 100; ++i) {
+            tasks.push_back([]() { ++s_scheduled; });
+        }
+        iom.schedule(tasks.begin(), tasks.end());
+
+        /**
+         * 循环定时器每次到期复制一份回调
+         */
+        tihi::Timer::ptr timer = iom.addTimer(
+            10,
+            [&timer]() {
+                if (++s_fired == 3) {
+                    timer->cancel();
+                }
+            },
+            true);
+    }
+    TIHI_ASSERT((s_scheduled == 4950 + 100));
+    TIHI_ASSERT((s_fired == 3));
+    TIHI_LOG_INFO(g_logger) << "test_scheduler success";
+}
+
+int main(int argc, char** argv) {
+    test_storage();
+    test_move_only();
+    test_scheduler();
+    return 0;
+}
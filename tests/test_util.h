@@ -0,0 +1,94 @@
+#ifndef TIHI_TESTS_TEST_UTIL_H_
+#define TIHI_TESTS_TEST_UTIL_H_
+
+/**
+ * 几个网络测试共用的回环连接工具，fd 都走 hook，需要在 IOManager 的协程里调用
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "utils/macro.h"
+
+namespace tihi {
+namespace test {
+
+/**
+ * 在 127.0.0.1 的随机端口上监听，端口写到 port
+ */
+inline int Listen(uint16_t& port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    TIHI_ASSERT((fd >= 0));
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    TIHI_ASSERT((bind(fd, (sockaddr*)&addr, sizeof(addr)) == 0));
+    TIHI_ASSERT((listen(fd, 128) == 0));
+    socklen_t len = sizeof(addr);
+    TIHI_ASSERT((getsockname(fd, (sockaddr*)&addr, &len) == 0));
+    port = ntohs(addr.sin_port);
+    return fd;
+}
+
+/**
+ * 连接 127.0.0.1:port
+ */
+inline int Connect(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    TIHI_ASSERT((fd >= 0));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    TIHI_ASSERT2((connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0),
+                 strerror(errno));
+    return fd;
+}
+
+/**
+ * 收到什么发回什么，对端关闭后关掉 fd
+ */
+inline void Echo(int fd) {
+    char buf[256];
+    while (true) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            break;
+        }
+        TIHI_ASSERT((send(fd, buf, n, 0) == n));
+    }
+    close(fd);
+}
+
+/**
+ * 发 rounds 次消息，每次等对端原样发回来
+ */
+inline void PingPong(int fd, int rounds) {
+    char buf[64];
+    for (int r = 0; r < rounds; ++r) {
+        std::string msg = "ping " + std::to_string(r);
+        TIHI_ASSERT(
+            (write(fd, msg.c_str(), msg.size()) == (ssize_t)msg.size()));
+        size_t got = 0;
+        while (got < msg.size()) {
+            ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+            TIHI_ASSERT((n > 0));
+            got += n;
+        }
+        TIHI_ASSERT((std::string(buf, got) == msg));
+    }
+}
+
+}  // namespace test
+}  // namespace tihi
+
+#endif  // TIHI_TESTS_TEST_UTIL_H_
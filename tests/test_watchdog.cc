@@ -0,0 +1,205 @@
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "config/config.h"
+#include "fiber/fiber.h"
+#include "log/log.h"
+#include "scheduler/scheduler.h"
+#include "thread/thread.h"
+#include "utils/macro.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+static tihi::Logger::ptr g_logger = TIHI_LOG_ROOT();
+
+/**
+ * 记下 system 日志的内容，用来检查 watchdog 的输出
+ */
+class CaptureLogAppender : public tihi::LogAppender {
+public:
+    using ptr = std::shared_ptr<CaptureLogAppender>;
+
+    void log(std::shared_ptr<tihi::Logger> logger, tihi::LogLevel::Level level,
+             tihi::LogEvent::ptr event) override {
+        mutex_type::mutex lock(mutex_);
+        messages_.push_back(event->kContent());
+    }
+
+    const std::string toYAMLString() override { return ""; }
+
+    std::vector<std::string> messages() {
+        mutex_type::mutex lock(mutex_);
+        return messages_;
+    }
+
+private:
+    std::vector<std::string> messages_;
+};
+
+static void SetMs(const std::string& name, uint32_t v) {
+    tihi::Config::Lookup<uint32_t>(name)->set_value(v);
+}
+
+/**
+ * 不是 static 函数，-rdynamic 之后 backtrace 里能看到名字
+ */
+void BusySpin(uint64_t ms) {
+    uint64_t end = tihi::MS() + ms;
+    while (tihi::MS() < end) {
+    }
+}
+
+void test_stall() {
+    CaptureLogAppender::ptr appender(new CaptureLogAppender);
+    TIHI_LOG_LOGGER("system")->addAppender(appender);
+
+    SetMs("scheduler.watchdog_ms", 50);
+    tihi::Scheduler sc(1, false, "watchdog");
+    SetMs("scheduler.watchdog_ms", 0);
+    sc.start();
+    for (int i = 0; i < 10; ++i) {
+        sc.schedule([]() {});
+    }
+    sc.schedule([]() { BusySpin(300); }, -1, "busy_spin");
+    sc.stop();
+    TIHI_LOG_LOGGER("system")->delAppender(appender);
+
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_ASSERT((stats.watchdog_stalls == 1));
+
+    std::string report;
+    for (auto& m : appender->messages()) {
+        if (m.find("busy_spin") != std::string::npos) {
+            report = m;
+        }
+    }
+    TIHI_LOG_INFO(g_logger) << "report: " << report;
+    TIHI_ASSERT((report.find("has been running fiber") != std::string::npos));
+    TIHI_ASSERT((report.find("BusySpin") != std::string::npos));
+    TIHI_LOG_INFO(g_logger) << "test_stall success";
+}
+
+void test_preempt() {
+    /**
+     * 只有一个线程，长任务不让出的话短任务要等它结束
+     */
+    static std::atomic<int> s_yields{0};
+    static std::atomic<bool> s_long_done{false};
+    static std::atomic<bool> s_short_ran_first{false};
+
+    SetMs("scheduler.preempt_ms", 20);
+    tihi::Scheduler sc(1, false, "preempt");
+    SetMs("scheduler.preempt_ms", 0);
+    sc.start();
+    sc.schedule([]() {
+        uint64_t end = tihi::MS() + 200;
+        while (tihi::MS() < end) {
+            if (tihi::Scheduler::ShouldYield()) {
+                ++s_yields;
+                tihi::Fiber::YieldToReady();
+            }
+        }
+        s_long_done = true;
+    });
+    sc.schedule([]() { s_short_ran_first = !s_long_done; });
+    sc.stop();
+
+    tihi::Scheduler::Stats stats = sc.stats();
+    TIHI_LOG_INFO(g_logger) << "yields: " << s_yields
+                            << " preempt_requests: " << stats.preempt_requests;
+    TIHI_ASSERT((s_yields >= 1 && s_short_ran_first));
+    TIHI_ASSERT((stats.preempt_requests == (uint64_t)s_yields));
+    TIHI_ASSERT((stats.watchdog_stalls == 0));
+    TIHI_LOG_INFO(g_logger) << "test_preempt success";
+}
+
+void test_disabled() {
+    static std::atomic<bool> s_should_yield{true};
+    tihi::Scheduler sc(1, false, "no_watchdog");
+    sc.start();
+    sc.schedule([]() {
+        BusySpin(50);
+        s_should_yield = tihi::Scheduler::ShouldYield();
+    });
+    sc.stop();
+    TIHI_ASSERT((!s_should_yield && !tihi::Scheduler::ShouldYield()));
+    TIHI_ASSERT((sc.stats().watchdog_stalls == 0));
+    TIHI_LOG_INFO(g_logger) << "test_disabled success";
+}
+
+static std::atomic<int> s_stage{0};
+static std::atomic<int> s_blocked{0};
+static pthread_t s_targets[2];
+
+/**
+ * 屏蔽取调用栈的信号，s_stage 到 stage 之后才放开，再等到 s_stage 为 -1
+ */
+static void BlockUntil(int index, int stage) {
+    s_targets[index] = pthread_self();
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGRTMIN);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    ++s_blocked;
+    while (s_stage < stage) {
+        usleep(1000);
+    }
+    pthread_sigmask(SIG_UNBLOCK, &set, nullptr);
+    while (s_stage != -1) {
+        usleep(1000);
+    }
+}
+
+void LateSignalTargetA() { BlockUntil(0, 1); }
+
+void LateSignalTargetB() { BlockUntil(1, 2); }
+
+void test_late_signal() {
+    /**
+     * 对 A 的请求超时之后，A 才收到信号，这时正在等 B 的结果，
+     * A 的调用栈不能当成 B 的
+     */
+    s_stage = 0;
+    s_blocked = 0;
+    tihi::Thread::ptr a(new tihi::Thread(&LateSignalTargetA, "late_a"));
+    tihi::Thread::ptr b(new tihi::Thread(&LateSignalTargetB, "late_b"));
+    while (s_blocked != 2) {
+        usleep(1000);
+    }
+    TIHI_ASSERT((tihi::ThreadBacktrace(s_targets[0], 32, "", 20).empty()));
+
+    std::string result;
+    tihi::Thread::ptr waiter(new tihi::Thread(
+        [&result]() {
+            result = tihi::ThreadBacktrace(s_targets[1], 32, "", 2000);
+        },
+        "late_waiter"));
+    usleep(50 * 1000);
+    s_stage = 1;
+    usleep(50 * 1000);
+    s_stage = 2;
+    waiter->join();
+    s_stage = -1;
+    a->join();
+    b->join();
+
+    TIHI_ASSERT2((result.find("LateSignalTargetB") != std::string::npos),
+                 result);
+    TIHI_ASSERT2((result.find("LateSignalTargetA") == std::string::npos),
+                 result);
+    TIHI_LOG_INFO(g_logger) << "test_late_signal success";
+}
+
+int main(int argc, char** argv) {
+    TIHI_LOG_LOGGER("system")->set_level(tihi::LogLevel::WARN);
+    test_stall();
+    test_preempt();
+    test_disabled();
+    test_late_signal();
+    return 0;
+}
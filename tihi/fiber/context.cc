@@ -0,0 +1,172 @@
+#include "context.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#include "utils/macro.h"
+
+namespace tihi {
+
+UContext::UContext() {
+    memset(&context_, 0, sizeof(context_));
+    TIHI_ASSERT2((0 == getcontext(&context_)), "getcontext");
+}
+
+void UContext::make(void* stack, size_t size, void (*entry)()) {
+    TIHI_ASSERT2((0 == getcontext(&context_)), "getcontext");
+    context_.uc_stack.ss_sp = stack;
+    context_.uc_stack.ss_size = size;
+    context_.uc_link = nullptr;
+    makecontext(&context_, entry, 0);
+}
+
+void UContext::swapTo(UContext& to) {
+    TIHI_ASSERT2((0 == swapcontext(&context_, &to.context_)), "swapcontext");
+}
+
+void* UContext::sp() const {
+#if defined(__x86_64__)
+    return reinterpret_cast<void*>(context_.uc_mcontext.gregs[REG_RSP]);
+#elif defined(__aarch64__)
+    return reinterpret_cast<void*>(context_.uc_mcontext.sp);
+#else
+    return nullptr;
+#endif
+}
+
+#ifdef TIHI_HAVE_ASM_CONTEXT
+
+extern "C" void tihi_swap_context(void** from_sp, void* to_sp)
+    __attribute__((visibility("hidden")));
+
+#if defined(__x86_64__)
+/**
+ * 栈帧（从保存的 sp 往高地址）：
+ *   +0  填充 +8 mxcsr +12 x87 控制字
+ *   +16 r15 +24 r14 +32 r13 +40 r12 +48 rbx +56 rbp +64 返回地址
+ */
+__asm__(
+    ".text\n"
+    ".globl tihi_swap_context\n"
+    ".hidden tihi_swap_context\n"
+    ".type tihi_swap_context,@function\n"
+    ".align 16\n"
+    "tihi_swap_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $16, %rsp\n"
+    "    stmxcsr 8(%rsp)\n"
+    "    fnstcw 12(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr 8(%rsp)\n"
+    "    fldcw 12(%rsp)\n"
+    "    addq $16, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size tihi_swap_context,.-tihi_swap_context\n");
+
+static const size_t CONTEXT_FRAME_SIZE = 96;
+
+void AsmContext::make(void* stack, size_t size, void (*entry)()) {
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~(uintptr_t)15;
+    /**
+     * sp 16 字节对齐，ret 之后 rsp = sp + 72，正好相当于 call entry 之后的状态
+     */
+    char* sp = reinterpret_cast<char*>(top - CONTEXT_FRAME_SIZE);
+    memset(sp, 0, CONTEXT_FRAME_SIZE);
+    uint32_t mxcsr = 0x1f80;
+    uint16_t fpucw = 0x037f;
+    memcpy(sp + 8, &mxcsr, sizeof(mxcsr));
+    memcpy(sp + 12, &fpucw, sizeof(fpucw));
+    void* ret = reinterpret_cast<void*>(entry);
+    memcpy(sp + 64, &ret, sizeof(ret));
+    sp_ = sp;
+}
+
+#elif defined(__aarch64__)
+/**
+ * 栈帧（从保存的 sp 往高地址）：
+ *   +0 x19..x28 +80 x29 +88 x30 +96 d8..d15
+ * 新协程第一次切入时 ret 到 tihi_context_entry，由它跳到 x19 中的入口函数
+ */
+__asm__(
+    ".text\n"
+    ".globl tihi_swap_context\n"
+    ".hidden tihi_swap_context\n"
+    ".type tihi_swap_context,%function\n"
+    ".align 4\n"
+    "tihi_swap_context:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size tihi_swap_context,.-tihi_swap_context\n"
+    ".type tihi_context_entry,%function\n"
+    ".align 4\n"
+    "tihi_context_entry:\n"
+    "    mov x29, #0\n"
+    "    mov x30, #0\n"
+    "    br x19\n"
+    ".size tihi_context_entry,.-tihi_context_entry\n");
+
+extern "C" void tihi_context_entry() __attribute__((visibility("hidden")));
+
+static const size_t CONTEXT_FRAME_SIZE = 160;
+
+void AsmContext::make(void* stack, size_t size, void (*entry)()) {
+    uintptr_t top = (reinterpret_cast<uintptr_t>(stack) + size) & ~(uintptr_t)15;
+    char* sp = reinterpret_cast<char*>(top - CONTEXT_FRAME_SIZE);
+    memset(sp, 0, CONTEXT_FRAME_SIZE);
+    void* fn = reinterpret_cast<void*>(entry);
+    void* ret = reinterpret_cast<void*>(&tihi_context_entry);
+    memcpy(sp + 0, &fn, sizeof(fn));
+    memcpy(sp + 88, &ret, sizeof(ret));
+    sp_ = sp;
+}
+#endif
+
+void AsmContext::swapTo(AsmContext& to) { tihi_swap_context(&sp_, to.sp_); }
+
+#endif  // TIHI_HAVE_ASM_CONTEXT
+
+const char* FiberContextName() {
+#if defined(TIHI_FIBER_USE_UCONTEXT) || !defined(TIHI_HAVE_ASM_CONTEXT)
+    return "ucontext";
+#else
+    return "asm";
+#endif
+}
+
+}  // namespace tihi
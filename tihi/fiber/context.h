@@ -0,0 +1,63 @@
+#ifndef TIHI_FIBER_CONTEXT_H_
+#define TIHI_FIBER_CONTEXT_H_
+
+#include <stddef.h>
+#include <ucontext.h>
+
+namespace tihi {
+
+/**
+ * 协程上下文后端
+ *
+ * make() 在给定的栈上准备好一个从 entry 开始执行的上下文（entry 不允许返回），
+ * swapTo(to) 把当前执行状态保存到 *this 并跳转到 to 保存的状态；
+ * 线程主协程的上下文不需要 make，第一次 swapTo 时自然会被保存下来。
+ */
+class UContext {
+public:
+    UContext();
+
+    void make(void* stack, size_t size, void (*entry)());
+    void swapTo(UContext& to);
+    /**
+     * 切出时保存的栈顶
+     */
+    void* sp() const;
+
+private:
+    ucontext_t context_;
+};
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define TIHI_HAVE_ASM_CONTEXT 1
+
+/**
+ * 手写的上下文切换，只保存 ABI 规定的被调用者保存寄存器（以及浮点控制字），
+ * 不像 swapcontext 那样每次都要 rt_sigprocmask 系统调用保存信号掩码
+ */
+class AsmContext {
+public:
+    void make(void* stack, size_t size, void (*entry)());
+    void swapTo(AsmContext& to);
+    void* sp() const { return sp_; }
+
+private:
+    void* sp_ = nullptr;
+};
+#endif
+
+/**
+ * 编译时定义 TIHI_FIBER_USE_UCONTEXT（cmake -DTIHI_FIBER_USE_UCONTEXT=ON）
+ * 或者在不支持的体系结构上退回 ucontext
+ */
+#if defined(TIHI_FIBER_USE_UCONTEXT) || !defined(TIHI_HAVE_ASM_CONTEXT)
+using FiberContext = UContext;
+#else
+using FiberContext = AsmContext;
+#endif
+
+const char* FiberContextName();
+
+}  // namespace tihi
+
+#endif  // TIHI_FIBER_CONTEXT_H_
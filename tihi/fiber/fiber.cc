@@ -1,8 +1,15 @@
 #include "fiber.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 #include <atomic>
+#include <vector>
 
 #include "config/config.h"
+#include "fiber/fiber_local.h"
+#include "fiber/stack_allocator.h"
+#include "fiber/stack_profiler.h"
 #include "scheduler/scheduler.h"
 #include "utils/macro.h"
 
@@ -19,52 +26,112 @@ static thread_local Fiber* t_fiber = nullptr;
 // 线程的主协程
 static thread_local Fiber::ptr t_threadFiber = nullptr;
 
+// 协程切出之后要执行的回调，见 Fiber::YieldToHold(after, arg)
+static thread_local void (*t_after_switch)(void*) = nullptr;
+static thread_local void* t_after_switch_arg = nullptr;
+
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>(
     "fiber.stack_size", 1024ul * 1024ul, "fiber stack size");
 
-class MallocAllocator {
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_size =
+    Config::Lookup<uint32_t>("fiber.shared_stack.size", 1024ul * 1024ul,
+                             "shared fiber stack size");
+
+static ConfigVar<uint32_t>::ptr g_fiber_shared_stack_counts =
+    Config::Lookup<uint32_t>("fiber.shared_stack.counts", 4,
+                             "shared fiber stacks per thread");
+
+struct SharedStack {
+    void* stack = nullptr;
+    size_t size = 0;
+    // 当前栈上的内容属于哪个协程
+    Fiber* owner = nullptr;
+};
+
+/**
+ * 线程的共享栈，第一次使用时才分配
+ */
+class SharedStacks {
 public:
-    static void* Alloc(size_t size) { return malloc(size); }
+    ~SharedStacks() {
+        for (auto& s : stacks_) {
+            StackAllocator::Dealloc(s.stack, s.size);
+        }
+    }
 
-    static void Dealloc(void* ptr, size_t size) { free(ptr); }
+    SharedStack* get(uint64_t id) {
+        if (stacks_.empty()) {
+            size_t counts = std::max(g_fiber_shared_stack_counts->value(), 1u);
+            size_t size =
+                StackAllocator::RoundUp(g_fiber_shared_stack_size->value());
+            stacks_.resize(counts);
+            for (auto& s : stacks_) {
+                s.stack = StackAllocator::Alloc(size);
+                s.size = size;
+            }
+        }
+        return &stacks_[id % stacks_.size()];
+    }
+
+private:
+    std::vector<SharedStack> stacks_;
 };
 
-using StackAllocator = MallocAllocator;
+static thread_local SharedStacks t_shared_stacks;
+// 绑定在本线程、还没有运行结束的共享栈协程数
+static thread_local uint32_t t_bound_shared_counts = 0;
+
+/**
+ * 子协程切出时要回到的协程：有调度器时是调度器的主协程，否则是线程的主协程
+ */
+static Fiber* SchedulerFiber() {
+    Fiber* fiber = Scheduler::MainFiber();
+    return fiber ? fiber : t_threadFiber.get();
+}
 
 Fiber::Fiber() {
     state_ = EXEC;
     SetThis(this);
 
-    TIHI_ASSERT2((0 == getcontext(&context_)), "getcontext");
-
     ++s_fiber_id;
     id_ = s_fiber_id;
     ++s_total_fiber_counts;
 }
 
-Fiber::Fiber(std::function<void()> cb, size_t stack_size, bool use_caller)
-    : id_(++s_fiber_id), cb_(cb) {
+Fiber::Fiber(Task cb, size_t stack_size, bool use_caller,
+             bool shared_stack)
+    : id_(++s_fiber_id), cb_(std::move(cb)) {
     ++s_total_fiber_counts;
 
-    TIHI_ASSERT2((0 == getcontext(&context_)), "getcontext");
+    if (shared_stack) {
+        TIHI_ASSERT2((!use_caller), "caller fiber can not use shared stack");
+        shared_stack_ = true;
+        need_make_ = true;
+        return;
+    }
 
-    stack_size_ = stack_size ? stack_size : g_fiber_stack_size->value();
+    stack_size_ = stack_size ? StackAllocator::RoundUp(stack_size)
+                             : DefaultStackSize();
     stack_ = StackAllocator::Alloc(stack_size_);
-    context_.uc_stack.ss_sp = stack_;
-    context_.uc_stack.ss_size = stack_size_;
-    context_.uc_link = nullptr;
+    paintStack();
 
     if (!use_caller) {
-        makecontext(&context_, Fiber::MainFunc, 0);
+        context_.make(stack_, stack_size_, Fiber::MainFunc);
     } else {
-        makecontext(&context_, Fiber::CallerMainFunc, 0);
+        context_.make(stack_, stack_size_, Fiber::CallerMainFunc);
     }
 }
 
 Fiber::~Fiber() {
-    if (stack_) {
-        TIHI_ASSERT((state_ == INIT || state_ == TERM));
-        StackAllocator::Dealloc(stack_, stack_size_);
+    destroyLocals();
+    if (stack_ || shared_stack_) {
+        TIHI_ASSERT((state_ == INIT || state_ == TERM || state_ == EXCEP));
+        if (shared_stack_) {
+            releaseSharedStack();
+            freeSavedStack();
+        } else {
+            StackAllocator::Dealloc(stack_, stack_size_);
+        }
         /*
         子协程的析构在主协程中完成
         */
@@ -91,17 +158,114 @@ Fiber::~Fiber() {
     --s_total_fiber_counts;
 }
 
-void Fiber::reset(std::function<void()> cb) {
-    TIHI_ASSERT((state_ == INIT || state_ == TERM));
+void Fiber::reset(Task cb) {
+    TIHI_ASSERT((state_ == INIT || state_ == TERM || state_ == EXCEP));
+
+    destroyLocals();
+    cb_ = std::move(cb);
+    if (shared_stack_) {
+        /**
+         * 上下文要等换入共享栈时再创建，堆上保存的旧栈已经没用了
+         */
+        need_make_ = true;
+        saved_size_ = 0;
+    } else {
+        paintStack();
+        context_.make(stack_, stack_size_, Fiber::MainFunc);
+    }
+    state_ = INIT;
+}
+
+void Fiber::paintStack() {
+    if (StackProfiler::GetMode() == StackProfiler::OFF) {
+        painted_ = false;
+        return;
+    }
+    if (!painted_) {
+        StackProfiler::Paint(stack_, stack_size_);
+        painted_ = true;
+    } else if (stack_peak_) {
+        /**
+         * 只有上次测到的范围被弄脏了，测量之后切出时的几层调用也算进去
+         */
+        size_t dirty = std::min<size_t>(stack_peak_ + 4096, stack_size_);
+        memset(static_cast<char*>(stack_) + stack_size_ - dirty, 0, dirty);
+    }
+    stack_peak_ = 0;
+}
+
+void Fiber::recordStack() {
+    if (!painted_) {
+        return;
+    }
+    stack_peak_ = StackProfiler::Measure(stack_, stack_size_);
+    StackProfiler::Record(tag_, stack_peak_, stack_size_);
+}
+
+void Fiber::switchInSharedStack() {
+    if (!shared_) {
+        shared_ = t_shared_stacks.get(id_);
+        bound_thread_ = ThreadId();
+        ++t_bound_shared_counts;
+        stack_size_ = shared_->size;
+    }
+    TIHI_ASSERT2((bound_thread_ == ThreadId()),
+                 "shared stack fiber resumed on another thread");
+
+    if (shared_->owner != this) {
+        if (shared_->owner) {
+            shared_->owner->saveSharedStack();
+        }
+        shared_->owner = this;
+        if (!need_make_ && saved_size_) {
+            char* top = static_cast<char*>(shared_->stack) + shared_->size;
+            memcpy(top - saved_size_, saved_stack_, saved_size_);
+        }
+    }
+
+    if (need_make_) {
+        context_.make(shared_->stack, shared_->size, Fiber::MainFunc);
+        need_make_ = false;
+    }
+}
+
+void Fiber::saveSharedStack() {
+    char* top = static_cast<char*>(shared_->stack) + shared_->size;
+    char* sp = static_cast<char*>(context_.sp());
+    TIHI_ASSERT((sp > static_cast<char*>(shared_->stack) && sp < top));
+    saved_size_ = top - sp;
+    /**
+     * 按实际用到的大小保存，缓冲区明显偏大时也收缩一下
+     */
+    if (saved_capacity_ < saved_size_ || saved_capacity_ > saved_size_ * 2) {
+        saved_stack_ = realloc(saved_stack_, saved_size_);
+        TIHI_ASSERT2((saved_stack_ != nullptr), "realloc shared stack");
+        saved_capacity_ = saved_size_;
+    }
+    memcpy(saved_stack_, sp, saved_size_);
+}
 
-    TIHI_ASSERT2((0 == getcontext(&context_)), "getcontext");
+void Fiber::releaseSharedStack() {
+    if (shared_ && shared_->owner == this) {
+        shared_->owner = nullptr;
+    }
+}
 
-    context_.uc_stack.ss_sp = stack_;
-    context_.uc_stack.ss_size = stack_size_;
-    context_.uc_link = nullptr;
+void Fiber::unbindSharedStack() {
+    if (!shared_) {
+        return;
+    }
+    releaseSharedStack();
+    shared_ = nullptr;
+    bound_thread_ = -1;
+    --t_bound_shared_counts;
+}
 
-    cb_ = cb;
-    makecontext(&context_, Fiber::MainFunc, 0);
+void Fiber::freeSavedStack() {
+    free(saved_stack_);
+    saved_stack_ = nullptr;
+    saved_size_ = 0;
+    saved_capacity_ = 0;
 }
 
 /**
@@ -109,24 +273,24 @@ void Fiber::reset(std::function<void()> cb) {
 */
 void Fiber::swapIn() {
     TIHI_ASSERT((state_ != EXEC));
+    if (shared_stack_) {
+        switchInSharedStack();
+    }
     state_ = EXEC;
 
     SetThis(this);
 
-    TIHI_ASSERT2(
-        (0 == swapcontext(&(Scheduler::MainFiber()->context_), &context_)),
-        "swapcontext");
+    SchedulerFiber()->context_.swapTo(context_);
 }
 
 /**
  * 从当前协程切换到调度器的主协程
 */
 void Fiber::swapOut() {
-    SetThis(Scheduler::MainFiber());
+    Fiber* fiber = SchedulerFiber();
+    SetThis(fiber);
 
-    TIHI_ASSERT2(
-        (0 == swapcontext(&context_, &(Scheduler::MainFiber()->context_))),
-        "swapcontext");
+    context_.swapTo(fiber->context_);
 }
 
 /**
@@ -135,8 +299,7 @@ void Fiber::swapOut() {
 void Fiber::call() {
     state_ = EXEC;
     SetThis(this);
-    TIHI_ASSERT2((0 == swapcontext(&(t_threadFiber->context_), &context_)),
-                 "swapcontext");
+    t_threadFiber->context_.swapTo(context_);
 }
 
 /**
@@ -145,8 +308,7 @@ void Fiber::call() {
 void Fiber::back() {
     SetThis(t_threadFiber.get());
 
-    TIHI_ASSERT2((0 == swapcontext(&context_, &(t_threadFiber->context_))),
-                 "swapcontext");
+    context_.swapTo(t_threadFiber->context_);
 }
 
 void Fiber::SetThis(Fiber* fiber) { t_fiber = fiber; }
@@ -166,6 +328,13 @@ Fiber::ptr Fiber::This() {
     return t_fiber->shared_from_this();
 }
 
+Fiber* Fiber::Current() {
+    if (t_fiber) {
+        return t_fiber;
+    }
+    return This().get();
+}
+
 void Fiber::YieldToReady() {
     Fiber::ptr curr = This();
     curr->state_ = READY;
@@ -178,8 +347,30 @@ void Fiber::YieldToHold() {
     curr->swapOut();
 }
 
+void Fiber::YieldToHold(void (*after)(void*), void* arg) {
+    Fiber::ptr curr = This();
+    curr->state_ = HOLD;
+    t_after_switch = after;
+    t_after_switch_arg = arg;
+    curr->swapOut();
+}
+
+void Fiber::RunAfterSwitch() {
+    if (t_after_switch) {
+        void (*after)(void*) = t_after_switch;
+        t_after_switch = nullptr;
+        after(t_after_switch_arg);
+    }
+}
+
 uint64_t Fiber::TotalFiberCounts() { return s_total_fiber_counts; }
 
+uint32_t Fiber::BoundSharedCounts() { return t_bound_shared_counts; }
+
+size_t Fiber::DefaultStackSize() {
+    return StackAllocator::RoundUp(g_fiber_stack_size->value());
+}
+
 uint64_t Fiber::FiberId() {
     if (t_fiber) {
         return t_fiber->id();
@@ -204,8 +395,15 @@ void Fiber::MainFunc() {
         curr->state_ = EXCEP;
         TIHI_LOG_FATAL(g_sys_logger) << "Fiber Exception";
     }
+    curr->destroyLocals();
+    curr->recordStack();
     Fiber* raw_ptr = curr.get();
     curr.reset();
+    /**
+     * 结束运行的协程不再占有共享栈，之后换入的协程不需要保存它的栈，
+     * 别的线程释放它时也不会碰到共享栈；线程也不用再为它留着
+     */
+    raw_ptr->unbindSharedStack();
     raw_ptr->swapOut();
 
     /*
@@ -227,6 +425,7 @@ void Fiber::CallerMainFunc() {
         curr->state_ = EXCEP;
         TIHI_LOG_FATAL(g_sys_logger) << "Fiber Exception";
     }
+    curr->destroyLocals();
     Fiber* raw_ptr = curr.get();
     curr.reset();
     raw_ptr->back();
@@ -237,4 +436,10 @@ void Fiber::CallerMainFunc() {
     TIHI_ASSERT2(false, "sub-fiber: never reach!!!");
 }
 
+void Fiber::destroyLocals() {
+    if (locals_mask_) {
+        FiberLocalBase::DestroyAll(this);
+    }
+}
+
 };  // namespace tihi
\ No newline at end of file
@@ -1,17 +1,30 @@
 #ifndef TIHI_FIBER_FIBER_H_
 #define TIHI_FIBER_FIBER_H_
 
-#include <ucontext.h>
+#include <sys/types.h>
 
 #include <functional>
 #include <memory>
 
+#include "fiber/context.h"
+#include "utils/task.h"
+
 namespace tihi {
 
+struct SharedStack;
+class FiberLocalBase;
+
 class Fiber : public std::enable_shared_from_this<Fiber> {
+    friend FiberLocalBase;
+
 public:
     using ptr = std::shared_ptr<Fiber>;
 
+    // 协程局部存储直接放在 Fiber 对象里的字节数，见 fiber/fiber_local.h
+    static const size_t LOCAL_STORAGE_SIZE = 256;
+    // 最多能定义的 FiberLocal 变量个数
+    static const size_t MAX_LOCAL_COUNTS = 64;
+
     enum State {
         INIT = 0,
         READY = 1,
@@ -31,18 +44,49 @@ public:
     /*
     制作一个新的协程，需要分配新的栈空间和指定执行函数，
     若成功，将在新的栈上执行指定函数，不会返回
+
+    shared_stack 为 true 时不分配私有栈，协程在所在线程的共享栈上运行，
+    切出后只有在共享栈被别的协程占用时才把用到的那部分栈拷贝到堆上，
+    适合大量长时间挂起的协程（比如空闲的长连接）。
+    共享栈协程第一次运行后就绑定在该线程上，之后只会在该线程上恢复执行，
+    运行结束后解除绑定，reset() 之后可以在别的线程上重新开始；
+    此时 stack_size 被忽略，栈大小由 fiber.shared_stack.size 决定
     */
-    Fiber(std::function<void()> cb, size_t stack_size = 0, bool use_caller = false);
+    Fiber(Task cb, size_t stack_size = 0, bool use_caller = false,
+          bool shared_stack = false);
     ~Fiber();
 
     uint64_t id() const { return id_; }
+    size_t stack_size() const { return stack_size_; }
+    bool shared_stack() const { return shared_stack_; }
+    /*
+    共享栈协程所绑定的线程，未绑定时为 -1
+    */
+    pid_t bound_thread() const { return bound_thread_; }
+    /*
+    共享栈协程切出后保存在堆上的栈大小
+    */
+    size_t saved_stack_size() const { return saved_size_; }
+    /*
+    协程的标签，用于按入口汇总栈用量，见 fiber/stack_profiler.h
+    */
+    const char* tag() const { return tag_; }
+    void set_tag(const char* tag) { tag_ = tag; }
+    /*
+    开启栈用量统计时，最近一次执行结束时测得的栈峰值
+    */
+    size_t stack_peak() const { return stack_peak_; }
     Fiber::State state() const { return state_; }
+    /*
+    是否是线程的主协程（直接使用线程自己的栈）
+    */
+    bool is_main() const { return !stack_ && !shared_stack_; }
     void set_state(Fiber::State state)  { state_ = state; }
     /*
-    改变当前协程的执行函数，必须处于 INIT（未开始执行） 或者 TERM（执行完毕）
-    状态
+    改变当前协程的执行函数，必须处于 INIT（未开始执行）、TERM（执行完毕）
+    或者 EXCEP 状态
     */
-    void reset(std::function<void()>);
+    void reset(Task cb);
     /*
     从其他协程（主协程）切换到当前协程（子协程）
     */
@@ -58,6 +102,10 @@ public:
     static void SetThis(Fiber* fiber);
     static ptr This();
     /*
+    与 This() 相同，但不增加引用计数
+    */
+    static Fiber* Current();
+    /*
     当前协程（子协程）让出线程资源，切换到其他协程（主协程），并将状态设置为 READY
     */
     static void YieldToReady();
@@ -65,22 +113,75 @@ public:
     当前协程（子协程）让出线程资源，切换到其他协程（主协程），并将状态设置为 HOLD
     */
     static void YieldToHold();
+    /*
+    与 YieldToHold() 相同，但 after(arg) 要等当前协程真正切出之后才由调度协程执行，
+    用来释放等待队列的锁：协程的上下文保存好之前不可能被别的线程唤醒
+    */
+    static void YieldToHold(void (*after)(void*), void* arg);
+    /*
+    执行上一个切出的协程留下的 after 回调，由调度器在处理完切回的协程之后调用
+    */
+    static void RunAfterSwitch();
     // 总的协程数
     static uint64_t TotalFiberCounts();
+    /*
+    绑定在当前线程、还没有运行结束的共享栈协程数，不为 0 时线程不能退出
+    */
+    static uint32_t BoundSharedCounts();
+    // stack_size 为 0 时协程实际使用的栈大小
+    static size_t DefaultStackSize();
     static uint64_t FiberId();
 
     static void MainFunc();
     static void CallerMainFunc();
 
+private:
+    /*
+    切入共享栈协程之前，把共享栈上的其他协程换出去，再把自己换进来
+    */
+    void switchInSharedStack();
+    void saveSharedStack();
+    void releaseSharedStack();
+    /*
+    运行结束时放开共享栈并解除和线程的绑定
+    */
+    void unbindSharedStack();
+    void freeSavedStack();
+    /*
+    析构所有已经构造的协程局部变量
+    */
+    void destroyLocals();
+    /*
+    开启栈用量统计时，在协程开始执行前清零私有栈，结束时测量并记录峰值
+    */
+    void paintStack();
+    void recordStack();
+
 private:
     uint64_t id_;
     uint32_t stack_size_ = 0;
     State state_ = INIT;
 
-    ucontext_t context_;
+    FiberContext context_;
     void* stack_ = nullptr;
 
-    std::function<void()> cb_;
+    bool shared_stack_ = false;
+    // 共享栈协程的上下文要等到确定了共享栈之后才能创建
+    bool need_make_ = false;
+    pid_t bound_thread_ = -1;
+    SharedStack* shared_ = nullptr;
+    void* saved_stack_ = nullptr;
+    size_t saved_size_ = 0;
+    size_t saved_capacity_ = 0;
+
+    Task cb_;
+
+    const char* tag_ = nullptr;
+    uint32_t stack_peak_ = 0;
+    bool painted_ = false;
+
+    uint64_t locals_mask_ = 0;
+    alignas(16) char locals_[LOCAL_STORAGE_SIZE];
 };
 
 };  // namespace tihi
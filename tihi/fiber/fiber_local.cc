@@ -0,0 +1,106 @@
+#include "fiber_local.h"
+
+#include "utils/macro.h"
+#include "utils/mutex.h"
+
+namespace tihi {
+
+struct FiberLocalSlot {
+    size_t offset;
+    size_t size;
+    bool on_heap;
+    FiberLocalBase::destroy_fun destroy;
+};
+
+/**
+ * 槽位登记表，只在 FiberLocal 变量构造时加锁修改，
+ * 某个槽位被某个协程用到时它的登记一定已经完成了
+ */
+static FiberLocalSlot s_slots[Fiber::MAX_LOCAL_COUNTS];
+static size_t s_slot_counts = 0;
+static size_t s_storage_used = 0;
+
+static Mutex& SlotMutex() {
+    static Mutex s_mutex;
+    return s_mutex;
+}
+
+FiberLocalBase::FiberLocalBase(size_t size, size_t align, destroy_fun destroy) {
+    Mutex::mutex lock(SlotMutex());
+    TIHI_ASSERT2((s_slot_counts < Fiber::MAX_LOCAL_COUNTS),
+                 "too many FiberLocal variables");
+
+    TIHI_ASSERT2((align <= alignof(max_align_t)),
+                 "over-aligned FiberLocal type");
+
+    size_t offset = (s_storage_used + align - 1) / align * align;
+    size_t used = size;
+    on_heap_ = offset + size > Fiber::LOCAL_STORAGE_SIZE;
+    if (on_heap_) {
+        offset = (s_storage_used + alignof(void*) - 1) / alignof(void*) *
+                 alignof(void*);
+        used = sizeof(void*);
+        TIHI_ASSERT2((offset + used <= Fiber::LOCAL_STORAGE_SIZE),
+                     "fiber local storage is full");
+    }
+
+    index_ = s_slot_counts++;
+    offset_ = offset;
+    s_storage_used = offset + used;
+
+    s_slots[index_].offset = offset_;
+    s_slots[index_].size = size;
+    s_slots[index_].on_heap = on_heap_;
+    s_slots[index_].destroy = destroy;
+}
+
+void* FiberLocalBase::prepare(Fiber* fiber) const {
+    char* p = fiber->locals_ + offset_;
+    if (!on_heap_) {
+        return p;
+    }
+    void* mem = ::operator new(s_slots[index_].size);
+    *reinterpret_cast<void**>(p) = mem;
+    return mem;
+}
+
+void FiberLocalBase::unprepare(Fiber* fiber) const {
+    if (!on_heap_) {
+        return;
+    }
+    void** p = reinterpret_cast<void**>(fiber->locals_ + offset_);
+    ::operator delete(*p);
+    *p = nullptr;
+}
+
+void FiberLocalBase::destroy(Fiber* fiber) const {
+    if (!constructed(fiber)) {
+        return;
+    }
+    fiber->locals_mask_ &= ~(1ull << index_);
+    void* p = address(fiber);
+    s_slots[index_].destroy(p);
+    if (on_heap_) {
+        ::operator delete(p);
+    }
+}
+
+void FiberLocalBase::DestroyAll(Fiber* fiber) {
+    /**
+     * 析构函数里可能又访问了别的协程局部变量，所以每次都重新看掩码
+     */
+    while (fiber->locals_mask_) {
+        size_t index = __builtin_ctzll(fiber->locals_mask_);
+        fiber->locals_mask_ &= ~(1ull << index);
+
+        const FiberLocalSlot& slot = s_slots[index];
+        char* p = fiber->locals_ + slot.offset;
+        void* obj = slot.on_heap ? *reinterpret_cast<void**>(p) : p;
+        slot.destroy(obj);
+        if (slot.on_heap) {
+            ::operator delete(obj);
+        }
+    }
+}
+
+}  // namespace tihi
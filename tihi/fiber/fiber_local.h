@@ -0,0 +1,109 @@
+#ifndef TIHI_FIBER_FIBER_LOCAL_H_
+#define TIHI_FIBER_FIBER_LOCAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <new>
+
+#include "fiber/fiber.h"
+#include "utils/noncopyable.h"
+
+namespace tihi {
+
+/**
+ * 协程局部变量的非模板部分，负责分配槽位
+ *
+ * 每个 FiberLocal 变量构造时分到一个下标和 Fiber 对象内存储区的一个偏移，
+ * 访问时只需要一次位运算和一次加法，不加锁也不分配内存；
+ * 存储区放不下的类型在槽位里只保存一个指针，第一次访问时才在堆上构造。
+ * 变量在当前协程第一次访问时默认构造，协程运行结束（TERM/EXCEP）、
+ * reset() 或者析构时析构。
+ *
+ * 槽位不会回收，FiberLocal 变量应当是全局或者静态的
+ */
+class FiberLocalBase : public Noncopyable {
+public:
+    using destroy_fun = void (*)(void*);
+
+    /**
+     * 析构协程中所有已经构造的局部变量
+     */
+    static void DestroyAll(Fiber* fiber);
+
+protected:
+    FiberLocalBase(size_t size, size_t align, destroy_fun destroy);
+
+    bool constructed(const Fiber* fiber) const {
+        return fiber->locals_mask_ & (1ull << index_);
+    }
+
+    void* address(Fiber* fiber) const {
+        char* p = fiber->locals_ + offset_;
+        return on_heap_ ? *reinterpret_cast<void**>(p) : p;
+    }
+
+    /**
+     * 返回用于构造变量的内存
+     */
+    void* prepare(Fiber* fiber) const;
+    /**
+     * 构造失败时退还 prepare() 在堆上分配的内存
+     */
+    void unprepare(Fiber* fiber) const;
+    void markConstructed(Fiber* fiber) const {
+        fiber->locals_mask_ |= (1ull << index_);
+    }
+    /**
+     * 只析构当前协程中的这一个变量
+     */
+    void destroy(Fiber* fiber) const;
+
+private:
+    size_t index_;
+    size_t offset_;
+    bool on_heap_;
+};
+
+template <typename T>
+class FiberLocal : public FiberLocalBase {
+public:
+    FiberLocal() : FiberLocalBase(sizeof(T), alignof(T), &FiberLocal::Destroy) {}
+
+    T& get() {
+        Fiber* fiber = Fiber::Current();
+        if (!constructed(fiber)) {
+            void* p = prepare(fiber);
+            try {
+                new (p) T();
+            } catch (...) {
+                unprepare(fiber);
+                throw;
+            }
+            markConstructed(fiber);
+        }
+        return *static_cast<T*>(address(fiber));
+    }
+
+    void set(const T& v) { get() = v; }
+
+    /**
+     * 当前协程是否访问过该变量
+     */
+    bool has() const { return constructed(Fiber::Current()); }
+
+    /**
+     * 提前析构当前协程中的变量，下次访问时重新构造
+     */
+    void reset() { destroy(Fiber::Current()); }
+
+    T& operator*() { return get(); }
+    T* operator->() { return &get(); }
+
+private:
+    static void Destroy(void* p) { static_cast<T*>(p)->~T(); }
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_FIBER_FIBER_LOCAL_H_
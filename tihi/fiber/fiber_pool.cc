@@ -0,0 +1,136 @@
+#include "fiber_pool.h"
+
+#include <atomic>
+#include <vector>
+
+#include "config/config.h"
+#include "fiber/stack_allocator.h"
+
+namespace tihi {
+
+static ConfigVar<uint32_t>::ptr g_fiber_pool_capacity =
+    Config::Lookup<uint32_t>("fiber.pool.capacity", 64,
+                             "terminated fibers cached per thread");
+
+static std::atomic<uint64_t> s_hit_counts{0};
+static std::atomic<uint64_t> s_miss_counts{0};
+static std::atomic<uint64_t> s_pooled_counts{0};
+
+static uint32_t s_pool_capacity = 64;
+
+struct __FiberPoolIniter {
+    __FiberPoolIniter() {
+        s_pool_capacity = g_fiber_pool_capacity->value();
+        g_fiber_pool_capacity->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_pool_capacity = new_value;
+            });
+    }
+};
+
+static __FiberPoolIniter s_fiber_pool_initer;
+
+/**
+ * 与 LocalStackCache 一样，析构之后归还的协程直接释放
+ */
+static thread_local bool t_fiber_pool_destroyed = false;
+
+class LocalFiberPool {
+public:
+    ~LocalFiberPool() {
+        s_pooled_counts -= counts_;
+        for (size_t i = 0; i < StackAllocator::CLASS_COUNTS; ++i) {
+            fibers_[i].clear();
+        }
+        counts_ = 0;
+        t_fiber_pool_destroyed = true;
+    }
+
+    Fiber::ptr pop(size_t cls) {
+        std::vector<Fiber::ptr>& fibers = fibers_[cls];
+        if (fibers.empty()) {
+            return nullptr;
+        }
+        Fiber::ptr fiber;
+        fiber.swap(fibers.back());
+        fibers.pop_back();
+        --counts_;
+        --s_pooled_counts;
+        return fiber;
+    }
+
+    void push(size_t cls, Fiber::ptr& fiber) {
+        if (counts_ >= s_pool_capacity) {
+            fiber.reset();
+            return;
+        }
+        std::vector<Fiber::ptr>& fibers = fibers_[cls];
+        fibers.push_back(nullptr);
+        fibers.back().swap(fiber);
+        ++counts_;
+        ++s_pooled_counts;
+    }
+
+private:
+    // 按栈大小级别分开，容量限制的是所有级别的总数
+    std::vector<Fiber::ptr> fibers_[StackAllocator::CLASS_COUNTS];
+    size_t counts_ = 0;
+};
+
+static thread_local LocalFiberPool t_fiber_pool;
+
+Fiber::ptr FiberPool::Get(Task cb, size_t stack_size) {
+    size_t size = stack_size ? StackAllocator::RoundUp(stack_size)
+                             : Fiber::DefaultStackSize();
+    size_t cls = StackAllocator::ClassOf(size);
+    Fiber::ptr fiber;
+    if (!t_fiber_pool_destroyed && cls < StackAllocator::CLASS_COUNTS) {
+        fiber = t_fiber_pool.pop(cls);
+        /**
+         * 默认栈大小可以不是级别的整数倍，同一级别里可能有更小的栈
+         */
+        if (fiber && fiber->stack_size() < size) {
+            fiber.reset();
+        }
+    }
+    if (fiber) {
+        ++s_hit_counts;
+        fiber->reset(std::move(cb));
+        return fiber;
+    }
+    ++s_miss_counts;
+    fiber.reset(new Fiber(std::move(cb), size));
+    return fiber;
+}
+
+void FiberPool::Put(Fiber::ptr& fiber) {
+    if (!fiber) {
+        return;
+    }
+    Fiber::State state = fiber->state();
+    /**
+     * 共享栈协程引用着线程的共享栈，线程退出时析构顺序不好保证，不缓存
+     */
+    size_t cls = StackAllocator::ClassOf(fiber->stack_size());
+    if (t_fiber_pool_destroyed || fiber.use_count() != 1 ||
+        fiber->is_main() || fiber->shared_stack() ||
+        cls >= StackAllocator::CLASS_COUNTS ||
+        (state != Fiber::INIT && state != Fiber::TERM &&
+         state != Fiber::EXCEP)) {
+        fiber.reset();
+        return;
+    }
+    /**
+     * 尽早释放回调捕获的资源
+     */
+    fiber->reset(nullptr);
+    t_fiber_pool.push(cls, fiber);
+}
+
+uint64_t FiberPool::HitCount() { return s_hit_counts; }
+
+uint64_t FiberPool::MissCount() { return s_miss_counts; }
+
+uint64_t FiberPool::PooledCount() { return s_pooled_counts; }
+
+}  // namespace tihi
@@ -0,0 +1,44 @@
+#ifndef TIHI_FIBER_FIBER_POOL_H_
+#define TIHI_FIBER_FIBER_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+
+#include "fiber/fiber.h"
+
+namespace tihi {
+
+/**
+ * 线程本地的协程对象池
+ *
+ * 调度器为回调任务创建的协程执行结束后不释放，连同栈一起放回
+ * 当前线程的池中，下一个任务直接复用，省掉 Fiber 对象、shared_ptr 控制块
+ * 和栈的分配。按栈的大小级别（StackAllocator::ClassOf）分开缓存私有栈协程，
+ * 自动栈大小模式下不同标签的任务也能复用，每个线程最多缓存 fiber.pool.capacity 个
+ */
+class FiberPool {
+public:
+    /**
+     * 返回一个执行 cb、栈大小为 stack_size 的协程，0 表示默认栈大小，
+     * 池中有同一大小级别的空闲协程时直接复用
+     */
+    static Fiber::ptr Get(Task cb, size_t stack_size = 0);
+    /**
+     * 归还执行结束（TERM/EXCEP）或者未开始执行的协程并清空 fiber，
+     * 只有 fiber 是最后一个引用时才会放回池中，否则只是释放引用
+     */
+    static void Put(Fiber::ptr& fiber);
+
+    // 从池中拿到协程的次数
+    static uint64_t HitCount();
+    // 池为空、新建协程的次数
+    static uint64_t MissCount();
+    // 所有线程的池中缓存的协程数
+    static uint64_t PooledCount();
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_FIBER_FIBER_POOL_H_
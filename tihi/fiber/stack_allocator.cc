@@ -0,0 +1,339 @@
+#include "stack_allocator.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "config/config.h"
+#include "log/log.h"
+#include "utils/macro.h"
+#include "utils/mutex.h"
+#include "utils/utils.h"
+
+namespace tihi {
+
+static Logger::ptr g_sys_logger = TIHI_LOG_LOGGER("system");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_local_capacity =
+    Config::Lookup<uint32_t>("fiber.stack_pool.local_capacity", 16,
+                             "stacks cached per thread per size class");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_global_capacity =
+    Config::Lookup<uint32_t>("fiber.stack_pool.global_capacity", 1024,
+                             "stacks cached globally per size class");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_trim_idle_ms =
+    Config::Lookup<uint32_t>(
+        "fiber.stack_pool.trim_idle_ms", 1000,
+        "release the memory of stacks idle in the global pool for this long "
+        "(MADV_DONTNEED), 0 disables automatic trimming");
+
+static std::atomic<uint64_t> s_in_use_counts{0};
+static std::atomic<uint64_t> s_pooled_counts{0};
+static std::atomic<uint64_t> s_trimmed_counts{0};
+// 下次 MaybeTrim() 检查的时间
+static std::atomic<uint64_t> s_next_trim_ms{0};
+
+static uint32_t s_local_capacity = 16;
+static uint32_t s_global_capacity = 1024;
+static uint32_t s_trim_idle_ms = 1000;
+
+struct __StackAllocatorIniter {
+    __StackAllocatorIniter() {
+        s_local_capacity = g_stack_pool_local_capacity->value();
+        s_global_capacity = g_stack_pool_global_capacity->value();
+        s_trim_idle_ms = g_stack_pool_trim_idle_ms->value();
+
+        g_stack_pool_local_capacity->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_local_capacity = new_value;
+            });
+        g_stack_pool_global_capacity->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_global_capacity = new_value;
+            });
+        g_stack_pool_trim_idle_ms->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_trim_idle_ms = new_value;
+            });
+    }
+};
+
+static __StackAllocatorIniter s_stack_allocator_initer;
+
+static size_t PageSize() {
+    static size_t s_page_size = sysconf(_SC_PAGESIZE);
+    return s_page_size;
+}
+
+static void* MapStack(size_t size) {
+    size_t page = PageSize();
+    void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        TIHI_LOG_ERROR(g_sys_logger)
+            << "mmap stack size=" << size << " errno=" << errno << " - "
+            << strerror(errno);
+        return nullptr;
+    }
+    /**
+     * 栈向低地址增长，保护页放在最低处
+     */
+    if (mprotect(base, page, PROT_NONE)) {
+        TIHI_LOG_ERROR(g_sys_logger)
+            << "mprotect guard page errno=" << errno << " - "
+            << strerror(errno);
+    }
+    return static_cast<char*>(base) + page;
+}
+
+static void UnmapStack(void* ptr, size_t size) {
+    size_t page = PageSize();
+    munmap(static_cast<char*>(ptr) - page, size + page);
+}
+
+class GlobalStackPool {
+public:
+    using mutex_type = Mutex;
+
+    /**
+     * 返回 false 表示全局池已满，需要调用者自己释放
+     */
+    bool push(size_t cls, void* ptr) {
+        uint64_t now = MS();
+        mutex_type::mutex lock(mutex_);
+        if (pools_[cls].size() >= s_global_capacity) {
+            return false;
+        }
+        pools_[cls].push_back(Entry{ptr, now, false});
+        return true;
+    }
+
+    /**
+     * 先取最近放进来的，裁剪过的都在最前面
+     */
+    void* pop(size_t cls) {
+        mutex_type::mutex lock(mutex_);
+        if (pools_[cls].empty()) {
+            return nullptr;
+        }
+        void* ptr = pools_[cls].back().ptr;
+        pools_[cls].pop_back();
+        return ptr;
+    }
+
+    size_t trim(uint32_t idle_ms) {
+        size_t counts = 0;
+        uint64_t now = MS();
+        std::vector<void*> stale;
+        for (size_t cls = 0; cls < StackAllocator::CLASS_COUNTS; ++cls) {
+            size_t size = StackAllocator::MIN_STACK_SIZE << cls;
+            stale.clear();
+            {
+                /**
+                 * 先拿出来，裁剪的时候不能被别的线程取走使用
+                 */
+                mutex_type::mutex lock(mutex_);
+                std::deque<Entry>& pool = pools_[cls];
+                std::deque<Entry> keep;
+                for (auto& e : pool) {
+                    if (!e.trimmed && now - e.since_ms >= idle_ms) {
+                        stale.push_back(e.ptr);
+                    } else {
+                        keep.push_back(e);
+                    }
+                }
+                pool.swap(keep);
+            }
+            if (stale.empty()) {
+                continue;
+            }
+            for (auto ptr : stale) {
+                madvise(ptr, size, MADV_DONTNEED);
+            }
+            counts += stale.size();
+            s_trimmed_counts += stale.size();
+
+            mutex_type::mutex lock(mutex_);
+            for (auto ptr : stale) {
+                if (pools_[cls].size() >= s_global_capacity) {
+                    UnmapStack(ptr, size);
+                    --s_pooled_counts;
+                } else {
+                    pools_[cls].push_front(Entry{ptr, now, true});
+                }
+            }
+        }
+        return counts;
+    }
+
+private:
+    struct Entry {
+        void* ptr;
+        // 放进全局池的时间
+        uint64_t since_ms;
+        bool trimmed;
+    };
+
+    std::deque<Entry> pools_[StackAllocator::CLASS_COUNTS];
+    mutex_type mutex_;
+};
+
+static GlobalStackPool& GlobalPool() {
+    static GlobalStackPool s_global_pool;
+    return s_global_pool;
+}
+
+/**
+ * 线程退出时各个 thread_local 对象的析构顺序不确定，
+ * 本地链表析构之后再归还的栈直接交给全局池
+ */
+static thread_local bool t_stack_cache_destroyed = false;
+
+/**
+ * 线程本地的空闲链表，线程退出时把缓存的栈交还给全局池
+ */
+class LocalStackCache {
+public:
+    ~LocalStackCache() {
+        flush();
+        t_stack_cache_destroyed = true;
+    }
+
+    bool push(size_t cls, void* ptr) {
+        if (caches_[cls].size() >= s_local_capacity) {
+            return false;
+        }
+        caches_[cls].push_back(ptr);
+        return true;
+    }
+
+    void* pop(size_t cls) {
+        if (caches_[cls].empty()) {
+            return nullptr;
+        }
+        void* ptr = caches_[cls].back();
+        caches_[cls].pop_back();
+        return ptr;
+    }
+
+    size_t flush() {
+        size_t counts = 0;
+        for (size_t cls = 0; cls < StackAllocator::CLASS_COUNTS; ++cls) {
+            size_t size = StackAllocator::MIN_STACK_SIZE << cls;
+            for (auto ptr : caches_[cls]) {
+                if (!GlobalPool().push(cls, ptr)) {
+                    UnmapStack(ptr, size);
+                    --s_pooled_counts;
+                }
+                ++counts;
+            }
+            caches_[cls].clear();
+        }
+        return counts;
+    }
+
+private:
+    std::vector<void*> caches_[StackAllocator::CLASS_COUNTS];
+};
+
+static thread_local LocalStackCache t_stack_cache;
+
+void* StackAllocator::Alloc(size_t size) {
+    size = RoundUp(size);
+    size_t cls = ClassOf(size);
+
+    void* ptr = nullptr;
+    if (cls < CLASS_COUNTS) {
+        if (!t_stack_cache_destroyed) {
+            ptr = t_stack_cache.pop(cls);
+        }
+        if (!ptr) {
+            ptr = GlobalPool().pop(cls);
+        }
+        if (ptr) {
+            --s_pooled_counts;
+        }
+    }
+
+    if (!ptr) {
+        ptr = MapStack(size);
+        TIHI_ASSERT2((ptr != nullptr), "StackAllocator::Alloc");
+    }
+
+    ++s_in_use_counts;
+    return ptr;
+}
+
+void StackAllocator::Dealloc(void* ptr, size_t size) {
+    if (!ptr) {
+        return;
+    }
+    size = RoundUp(size);
+    size_t cls = ClassOf(size);
+    --s_in_use_counts;
+
+    if (cls < CLASS_COUNTS) {
+        ++s_pooled_counts;
+        if ((!t_stack_cache_destroyed && t_stack_cache.push(cls, ptr)) ||
+            GlobalPool().push(cls, ptr)) {
+            return;
+        }
+        --s_pooled_counts;
+    }
+
+    UnmapStack(ptr, size);
+}
+
+size_t StackAllocator::RoundUp(size_t size) {
+    size_t cls = ClassOf(size);
+    if (cls < CLASS_COUNTS) {
+        return MIN_STACK_SIZE << cls;
+    }
+    size_t page = PageSize();
+    return (size + page - 1) / page * page;
+}
+
+size_t StackAllocator::ClassOf(size_t size) {
+    size_t cls = 0;
+    size_t class_size = MIN_STACK_SIZE;
+    while (class_size < size && cls < CLASS_COUNTS) {
+        class_size <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+
+size_t StackAllocator::Trim(uint32_t idle_ms) {
+    return GlobalPool().trim(idle_ms);
+}
+
+size_t StackAllocator::MaybeTrim() {
+    uint32_t idle_ms = s_trim_idle_ms;
+    if (!idle_ms) {
+        return 0;
+    }
+    uint64_t now = MS();
+    uint64_t next = s_next_trim_ms.load(std::memory_order_relaxed);
+    if (now < next ||
+        !s_next_trim_ms.compare_exchange_strong(next, now + idle_ms)) {
+        return 0;
+    }
+    return Trim(idle_ms);
+}
+
+size_t StackAllocator::Flush() {
+    return t_stack_cache_destroyed ? 0 : t_stack_cache.flush();
+}
+
+uint64_t StackAllocator::InUseCount() { return s_in_use_counts; }
+
+uint64_t StackAllocator::PooledCount() { return s_pooled_counts; }
+
+uint64_t StackAllocator::TrimmedCount() { return s_trimmed_counts; }
+
+}  // namespace tihi
@@ -0,0 +1,68 @@
+#ifndef TIHI_FIBER_STACK_ALLOCATOR_H_
+#define TIHI_FIBER_STACK_ALLOCATOR_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace tihi {
+
+/**
+ * 协程栈分配器
+ *
+ * 栈通过 mmap 分配，在低地址一侧（栈向低地址增长）预留一页 PROT_NONE 的保护页，
+ * 栈溢出会直接触发 SIGSEGV，而不是悄无声息地破坏堆。
+ *
+ * 栈大小向上取整到 2 的幂（不小于 MIN_STACK_SIZE），每个大小级别有一条线程本地的
+ * 空闲链表，协程创建/销毁时基本不需要加锁和系统调用；线程本地链表满了以后溢出到
+ * 全局池，全局池也满了才真正 munmap。
+ *
+ * 进出全局池不做系统调用。在全局池里闲置超过 fiber.stack_pool.trim_idle_ms
+ * 的栈由调度器的空闲线程（MaybeTrim()）或者显式的 Trim() 用 MADV_DONTNEED 裁剪，
+ * 物理内存归还给系统但保留地址空间；取栈时先取最近放进去的，裁剪过的最后才用。
+ */
+class StackAllocator {
+public:
+    static const size_t MIN_STACK_SIZE = 16 * 1024;
+    static const size_t CLASS_COUNTS = 11;  // 16K, 32K ... 16M
+
+    /**
+     * 分配一个可用大小为 RoundUp(size) 的栈，返回栈的低地址
+     */
+    static void* Alloc(size_t size);
+    /**
+     * 归还栈，size 必须与 Alloc 时传入的大小属于同一级别
+     */
+    static void Dealloc(void* ptr, size_t size);
+    /**
+     * 实际分配给调用者的栈大小
+     */
+    static size_t RoundUp(size_t size);
+    /**
+     * size 所属的大小级别，超出最大级别、不参与缓存时返回 CLASS_COUNTS
+     */
+    static size_t ClassOf(size_t size);
+    /**
+     * 裁剪全局池中闲置了至少 idle_ms 毫秒、还没裁剪过的栈，返回本次裁剪的栈数
+     */
+    static size_t Trim(uint32_t idle_ms = 0);
+    /**
+     * 距离上次检查超过 fiber.stack_pool.trim_idle_ms 时按这个时长 Trim() 一次，
+     * 否则什么也不做；配置为 0 时不自动裁剪。调度器的线程进入 idle 时调用
+     */
+    static size_t MaybeTrim();
+    /**
+     * 把当前线程缓存的栈交给全局池（全局池满了就释放），返回交出的栈数
+     */
+    static size_t Flush();
+
+    // 正在被协程使用的栈数
+    static uint64_t InUseCount();
+    // 缓存在线程本地链表与全局池中的栈数
+    static uint64_t PooledCount();
+    // 累计被 MADV_DONTNEED 裁剪的栈数
+    static uint64_t TrimmedCount();
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_FIBER_STACK_ALLOCATOR_H_
@@ -0,0 +1,339 @@
+#include "stack_profiler.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+
+#include "config/config.h"
+#include "fiber/stack_allocator.h"
+#include "log/log.h"
+#include "utils/mutex.h"
+
+namespace tihi {
+
+static Logger::ptr g_sys_logger = TIHI_LOG_LOGGER("system");
+
+static ConfigVar<std::string>::ptr g_stack_profile = Config::Lookup<std::string>(
+    "fiber.stack_profile", "off",
+    "fiber stack profiling mode: off, record or auto");
+
+static ConfigVar<uint32_t>::ptr g_auto_stack_min_size =
+    Config::Lookup<uint32_t>("fiber.auto_stack_min_size", 64 * 1024,
+                             "smallest stack size chosen in auto mode");
+
+static std::atomic<int> s_mode{StackProfiler::OFF};
+static std::atomic<uint32_t> s_auto_stack_min_size{64 * 1024};
+
+static StackProfiler::Mode ParseMode(const std::string& v) {
+    if (v == "record") {
+        return StackProfiler::RECORD;
+    } else if (v == "auto") {
+        return StackProfiler::AUTO;
+    } else if (v != "off") {
+        TIHI_LOG_ERROR(g_sys_logger) << "invalid fiber.stack_profile: " << v;
+    }
+    return StackProfiler::OFF;
+}
+
+struct __StackProfilerIniter {
+    __StackProfilerIniter() {
+        s_mode = ParseMode(g_stack_profile->value());
+        g_stack_profile->addListener(
+            [](const std::string& old_value, const std::string& new_value) {
+                s_mode = ParseMode(new_value);
+            });
+        s_auto_stack_min_size = g_auto_stack_min_size->value();
+        g_auto_stack_min_size->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_auto_stack_min_size = new_value;
+            });
+    }
+};
+
+static __StackProfilerIniter s_stack_profiler_initer;
+
+struct StackProfile {
+    uint64_t counts = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    size_t stack_size = 0;
+    uint64_t buckets[StackProfiler::BUCKET_COUNTS] = {0};
+
+    void add(size_t bucket, size_t peak, size_t size) {
+        ++counts;
+        sum += peak;
+        if (peak > max) {
+            max = peak;
+        }
+        stack_size = size;
+        ++buckets[bucket];
+    }
+
+    void merge(const StackProfile& other) {
+        counts += other.counts;
+        sum += other.sum;
+        if (other.max > max) {
+            max = other.max;
+        }
+        stack_size = other.stack_size;
+        for (size_t i = 0; i < StackProfiler::BUCKET_COUNTS; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+    }
+};
+
+using mutex_type = Mutex;
+
+static const char* TagName(const char* tag) { return tag ? tag : "<untagged>"; }
+
+static size_t SuggestedSize(uint64_t max) {
+    size_t size = StackAllocator::RoundUp(max * 2);
+    size_t min_size = StackAllocator::RoundUp(s_auto_stack_min_size);
+    return size < min_size ? min_size : size;
+}
+
+class LocalProfiles;
+
+/**
+ * 所有线程的统计，Report() 时逐个合并
+ */
+static mutex_type& RegistryMutex() {
+    static mutex_type s_mutex;
+    return s_mutex;
+}
+
+static std::set<LocalProfiles*>& Registry() {
+    static std::set<LocalProfiles*> s_registry;
+    return s_registry;
+}
+
+/**
+ * 已经退出的线程留下的统计
+ */
+static std::map<std::string, StackProfile>& Retired() {
+    static std::map<std::string, StackProfile> s_retired;
+    return s_retired;
+}
+
+/**
+ * 与 LocalStackCache 一样，析构之后的记录直接进 Retired()
+ */
+static thread_local bool t_local_profiles_destroyed = false;
+
+/**
+ * 线程本地的统计，按标签指针汇总，Record 只锁本线程的互斥量，
+ * 只有 Report()/Reset() 才会和它竞争
+ */
+class LocalProfiles {
+public:
+    LocalProfiles() {
+        mutex_type::mutex lock(RegistryMutex());
+        Registry().insert(this);
+    }
+
+    ~LocalProfiles() {
+        mutex_type::mutex lock(RegistryMutex());
+        Registry().erase(this);
+        mergeTo(Retired());
+        t_local_profiles_destroyed = true;
+    }
+
+    void record(const char* tag, size_t bucket, size_t peak, size_t size) {
+        mutex_type::mutex lock(mutex_);
+        profiles_[tag].add(bucket, peak, size);
+    }
+
+    void mergeTo(std::map<std::string, StackProfile>& profiles) {
+        mutex_type::mutex lock(mutex_);
+        for (auto& it : profiles_) {
+            profiles[TagName(it.first)].merge(it.second);
+        }
+    }
+
+    void clear() {
+        mutex_type::mutex lock(mutex_);
+        profiles_.clear();
+    }
+
+private:
+    mutex_type mutex_;
+    std::unordered_map<const char*, StackProfile> profiles_;
+};
+
+static thread_local LocalProfiles t_local_profiles;
+
+/**
+ * 按标签指针缓存的建议栈大小，调度器每次派发带标签的任务都要查，不加锁。
+ * 开放寻址，标签只增不删，表满之后新的标签不再给出建议
+ */
+struct SuggestSlot {
+    std::atomic<const char*> tag{nullptr};
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> max{0};
+    std::atomic<size_t> suggest{0};
+};
+
+static const size_t SUGGEST_SLOT_COUNTS = 1024;
+
+static SuggestSlot s_suggest_slots[SUGGEST_SLOT_COUNTS];
+
+static SuggestSlot* FindSlot(const char* tag, bool create) {
+    if (!tag) {
+        return nullptr;
+    }
+    size_t hash = (reinterpret_cast<uintptr_t>(tag) >> 3) * 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < SUGGEST_SLOT_COUNTS; ++i) {
+        SuggestSlot& slot = s_suggest_slots[(hash + i) % SUGGEST_SLOT_COUNTS];
+        const char* cur = slot.tag.load(std::memory_order_acquire);
+        if (!cur) {
+            if (!create) {
+                return nullptr;
+            }
+            if (slot.tag.compare_exchange_strong(cur, tag)) {
+                return &slot;
+            }
+        }
+        if (cur == tag) {
+            return &slot;
+        }
+    }
+    return nullptr;
+}
+
+static void UpdateSuggest(const char* tag, uint64_t peak) {
+    SuggestSlot* slot = FindSlot(tag, true);
+    if (!slot) {
+        return;
+    }
+    bool changed = false;
+    uint64_t samples = slot->samples.load(std::memory_order_relaxed);
+    if (samples < StackProfiler::MIN_SAMPLES) {
+        samples = slot->samples.fetch_add(1) + 1;
+        changed = true;
+    }
+    uint64_t max = slot->max.load(std::memory_order_relaxed);
+    while (peak > max) {
+        if (slot->max.compare_exchange_weak(max, peak)) {
+            changed = true;
+            break;
+        }
+    }
+    if (changed && samples >= StackProfiler::MIN_SAMPLES) {
+        slot->suggest.store(SuggestedSize(slot->max.load()),
+                            std::memory_order_relaxed);
+    }
+}
+
+StackProfiler::Mode StackProfiler::GetMode() {
+    return static_cast<Mode>(s_mode.load(std::memory_order_relaxed));
+}
+
+void StackProfiler::Paint(void* stack, size_t size) {
+    madvise(stack, size, MADV_DONTNEED);
+}
+
+size_t StackProfiler::Measure(void* stack, size_t size) {
+    char* begin = static_cast<char*>(stack);
+    char* end = begin + size;
+
+    /**
+     * 清零之后没碰过的页不在内存中，不用一个字一个字地看
+     */
+    size_t page = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> resident((size + page - 1) / page);
+    if (mincore(stack, size, resident.data()) == 0) {
+        size_t i = 0;
+        while (i < resident.size() && !(resident[i] & 1)) {
+            ++i;
+        }
+        begin += i * page;
+    }
+
+    const uint64_t* p = reinterpret_cast<const uint64_t*>(begin);
+    const uint64_t* e = reinterpret_cast<const uint64_t*>(end);
+    while (p < e && *p == 0) {
+        ++p;
+    }
+    return end - reinterpret_cast<const char*>(p);
+}
+
+void StackProfiler::Record(const char* tag, size_t peak, size_t stack_size) {
+    size_t bucket = 0;
+    size_t bound = MIN_BUCKET_SIZE;
+    while (bucket < BUCKET_COUNTS - 1 && peak >= bound) {
+        bound <<= 1;
+        ++bucket;
+    }
+
+    if (t_local_profiles_destroyed) {
+        mutex_type::mutex lock(RegistryMutex());
+        Retired()[TagName(tag)].add(bucket, peak, stack_size);
+    } else {
+        t_local_profiles.record(tag, bucket, peak, stack_size);
+    }
+    UpdateSuggest(tag, peak);
+}
+
+size_t StackProfiler::SuggestStackSize(const char* tag) {
+    SuggestSlot* slot = FindSlot(tag, false);
+    return slot ? slot->suggest.load(std::memory_order_relaxed) : 0;
+}
+
+std::string StackProfiler::Report() {
+    std::map<std::string, StackProfile> profiles;
+    {
+        mutex_type::mutex lock(RegistryMutex());
+        profiles = Retired();
+        for (LocalProfiles* local : Registry()) {
+            local->mergeTo(profiles);
+        }
+    }
+
+    std::stringstream ss;
+    for (auto& it : profiles) {
+        const StackProfile& profile = it.second;
+        ss << it.first << ": samples=" << profile.counts
+           << " avg=" << profile.sum / profile.counts
+           << " max=" << profile.max
+           << " stack_size=" << profile.stack_size;
+        if (profile.counts >= MIN_SAMPLES) {
+            ss << " suggest=" << SuggestedSize(profile.max);
+        }
+        ss << std::endl;
+
+        size_t bound = MIN_BUCKET_SIZE;
+        for (size_t i = 0; i < BUCKET_COUNTS; ++i, bound <<= 1) {
+            if (!profile.buckets[i]) {
+                continue;
+            }
+            if (i == BUCKET_COUNTS - 1) {
+                ss << "    >=" << (bound >> 1);
+            } else {
+                ss << "    <" << bound;
+            }
+            ss << ": " << profile.buckets[i] << std::endl;
+        }
+    }
+    return ss.str();
+}
+
+void StackProfiler::Reset() {
+    mutex_type::mutex lock(RegistryMutex());
+    Retired().clear();
+    for (LocalProfiles* local : Registry()) {
+        local->clear();
+    }
+    for (size_t i = 0; i < SUGGEST_SLOT_COUNTS; ++i) {
+        s_suggest_slots[i].suggest = 0;
+        s_suggest_slots[i].max = 0;
+        s_suggest_slots[i].samples = 0;
+    }
+}
+
+}  // namespace tihi
@@ -0,0 +1,69 @@
+#ifndef TIHI_FIBER_STACK_PROFILER_H_
+#define TIHI_FIBER_STACK_PROFILER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace tihi {
+
+/**
+ * 协程栈用量统计
+ *
+ * 由 fiber.stack_profile 控制：
+ *   off    不统计（默认）
+ *   record 协程开始执行前把私有栈清零（“涂色”），执行结束（TERM/EXCEP）时从栈底
+ *          往上找第一个非零的字，得到这次执行的栈峰值，按协程的标签汇总成直方图
+ *   auto   在 record 的基础上，调度器为带标签的任务按观测到的峰值选择栈大小，
+ *          不小于 fiber.auto_stack_min_size，给样本里没出现过的深调用留余量
+ *
+ * 涂色用 MADV_DONTNEED 完成，不会让整个栈都占用物理内存；栈峰值处恰好是 0 的字
+ * 会被漏掉，所以结果是近似值。标签是调度时传入的字符串（见 Scheduler::schedule），
+ * 必须在协程结束前一直有效，通常是字符串字面量。
+ *
+ * 统计记在线程本地，Report() 时按标签名合并；建议的栈大小按标签指针缓存，
+ * 同名但地址不同的标签各自积累样本
+ */
+class StackProfiler {
+public:
+    enum Mode {
+        OFF = 0,
+        RECORD = 1,
+        AUTO = 2,
+    };
+
+    // 直方图按 2 的幂分桶：<1K, <2K ... <16M, 更大
+    static const size_t MIN_BUCKET_SIZE = 1024;
+    static const size_t BUCKET_COUNTS = 16;
+    // 自动选择栈大小前同一个标签至少需要的样本数
+    static const uint64_t MIN_SAMPLES = 16;
+
+    static Mode GetMode();
+
+    /**
+     * 把栈清零，之后的用量才能测量
+     */
+    static void Paint(void* stack, size_t size);
+    /**
+     * 返回栈从顶部开始用到的字节数
+     */
+    static size_t Measure(void* stack, size_t size);
+
+    static void Record(const char* tag, size_t peak, size_t stack_size);
+    /**
+     * 根据 tag 的历史峰值建议的栈大小（峰值的两倍向上取整到栈大小级别，
+     * 不小于 fiber.auto_stack_min_size），样本不足时返回 0。不加锁
+     */
+    static size_t SuggestStackSize(const char* tag);
+
+    /**
+     * 每个标签一行汇总，后面跟非空的直方图桶
+     */
+    static std::string Report();
+    static void Reset();
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_FIBER_STACK_PROFILER_H_
@@ -40,7 +40,7 @@ void FdCtx::set_timeout(int type, uint64_t v) {
     if (SO_RCVTIMEO == type) {
         recv_timeout_ = v;
     } else if (SO_SNDTIMEO == type) {
-        recv_timeout_ = v;
+        send_timeout_ = v;
     }
 }
 
@@ -80,54 +80,56 @@ bool FdCtx::init() {
     return is_init_;
 }
 
+bool FdCtx::reset() {
+    is_init_ = false;
+    return init();
+}
+
 void FdCtx::close() {
     ::close(fd_);
     is_closed_ = true;
 }
 
-FdManager::FdManager() {
-    fds_.resize(32);
-}
+FdManager::FdManager() {}
 
-FdCtx::ptr FdManager::fd(int fd, bool auto_create) {
-    if (fd < 0) {
+FdCtx* FdManager::fd(int fd, bool auto_create) {
+    Slot* slot = auto_create ? fds_.getOrCreate(fd) : fds_.get(fd);
+    if (!slot) {
         return nullptr;
-    } 
-
-    rwmutex_type::read_lock lock(mutex_);
-    if (fds_.size() <= (size_t)fd) {
-        if (auto_create) {
-            lock.unlock();
-            rwmutex_type::write_lock lock2(mutex_);
-            fds_.resize(fd * 1.5);
-            FdCtx::ptr tmp(new FdCtx(fd));
-            fds_[fd] = tmp;
-            return fds_[fd];
-        }
-    } else {
-        if (fds_[fd]) {
-            return fds_[fd];
+    }
+    FdCtx* ctx = slot->ctx.load(std::memory_order_acquire);
+    if (ctx || !auto_create) {
+        return ctx;
+    }
+
+    /**
+     * 创建互斥：同一个 fd 只初始化一次
+     */
+    mutex_type::mutex lock(mutex_);
+    ctx = slot->ctx.load(std::memory_order_relaxed);
+    if (!ctx) {
+        if (slot->storage) {
+            slot->storage->reset();
         } else {
-            if (auto_create) {
-                lock.unlock();
-                rwmutex_type::write_lock lock2(mutex_);
-                FdCtx::ptr tmp(new FdCtx(fd));
-                fds_[fd] = tmp;
-                return fds_[fd];
-            }
+            slot->storage = new FdCtx(fd);
         }
+        ctx = slot->storage;
+        slot->ctx.store(ctx, std::memory_order_release);
     }
-
-    return nullptr;
+    return ctx;
 }
 
 void FdManager::delFd(int fd) {
-    rwmutex_type::write_lock lock(mutex_);
-    if (fds_.size() <= (size_t)fd) {
-        return ;
+    Slot* slot = fds_.get(fd);
+    if (!slot) {
+        return;
     }
 
-    fds_[fd].reset();
+    mutex_type::mutex lock(mutex_);
+    FdCtx* ctx = slot->ctx.exchange(nullptr, std::memory_order_acq_rel);
+    if (ctx) {
+        ctx->set_closed();
+    }
 }
 
 }  // namespace tihi
\ No newline at end of file
@@ -1,22 +1,25 @@
 #ifndef TIHI_HOOK_FD_MANAGER_H_
 #define TIHI_HOOK_FD_MANAGER_H_
 
-#include <memory>
-#include <vector>
+#include <atomic>
 
 #include "utils/mutex.h"
 #include "iomanager/iomanager.h"
+#include "utils/fd_table.h"
 #include "utils/singleton.h"
 
 namespace tihi {
 
-class FdCtx : public std::enable_shared_from_this<FdCtx> {
+class FdCtx {
 public:
-    using ptr = std::shared_ptr<FdCtx>;
     FdCtx(int fd);
     ~FdCtx();
 
     bool init();
+    /**
+     * fd 编号被复用时重新初始化
+     */
+    bool reset();
     bool is_init() const { return is_init_; }
     bool is_socket() const { return is_socket_; }
     void set_sys_nonblock(bool v) { sys_nonblock_ = v; }
@@ -25,6 +28,10 @@ public:
     bool user_nonblock() const { return user_nonblock_; }
     void close();
     bool is_closed() const { return is_closed_; }
+    /**
+     * fd 已经在别处关闭，只做标记，析构时不再关闭
+     */
+    void set_closed() { is_closed_ = true; }
 
     uint64_t timeout(int type);
     void set_timeout(int type, uint64_t v);
@@ -42,18 +49,42 @@ private:
     uint64_t send_timeout_;
 };
 
+/**
+ * 查找不加锁：槽位在 FdTable 中地址固定，槽位里的 FdCtx* 只做一次 acquire 读，
+ * 只有创建 FdCtx 时加锁
+ *
+ * FdCtx 分配后一直留在槽位里，直到 FdManager 析构。delFd 只把槽位置空，
+ * 同一个编号再创建时复用原来的对象。拿到的指针总能解引用，
+ * 但 fd 关闭后它描述的可能已经是复用这个编号的新 fd，和 fd 编号本身一样
+ */
 class FdManager {
 public:
-    using rwmutex_type = RWMutex;    
+    using mutex_type = Mutex;
     FdManager();
 
-    FdCtx::ptr fd(int fd, bool auto_create = false);
+    /**
+     * fd 超出 FdTable::MAX_FDS 时返回 nullptr
+     */
+    FdCtx* fd(int fd, bool auto_create = false);
     void delFd(int fd);
 
 private:
-    std::vector<FdCtx::ptr> fds_;
-
-    rwmutex_type mutex_;
+    struct Slot {
+        /**
+         * 对外可见的 FdCtx，delFd 后为 nullptr
+         */
+        std::atomic<FdCtx*> ctx{nullptr};
+        /**
+         * 这个槽位分配过的 FdCtx，只在持有 mutex_ 时访问
+         */
+        FdCtx* storage = nullptr;
+
+        ~Slot() { delete storage; }
+    };
+
+    FdTable<Slot> fds_;
+
+    mutex_type mutex_;
 };
 
 using FdMgr = SingletonPtr<FdManager>;
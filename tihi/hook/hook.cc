@@ -2,12 +2,17 @@
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <linux/io_uring.h>
+
+#include <algorithm>
 
 #include "fd_manager.h"
 #include "fiber/fiber.h"
+#include "hook/syscall_stats.h"
 #include "iomanager/iomanager.h"
 #include "log/log.h"
 #include "config/config.h"
+#include "sync/fiber_sync.h"
 
 namespace tihi {
 
@@ -74,19 +79,92 @@ struct timer_info {
     int cancelled = 0;
 };
 
+/**
+ * timeout 毫秒后取消 fd 上 type 类型的等待，并在 tinfo 中记下超时
+ */
+static Timer::ptr AddCancelTimer(IOManager *iom, int fd, uint32_t type,
+                                 uint64_t timeout,
+                                 std::shared_ptr<timer_info> tinfo) {
+    if ((uint64_t)-1 == timeout) {
+        return nullptr;
+    }
+    std::weak_ptr<timer_info> wtinfo(tinfo);
+    return iom->addConditionTimer(
+        timeout,
+        [wtinfo, fd, iom, type]() {
+            auto t = wtinfo.lock();
+            if (!t || t->cancelled) {
+                return;
+            }
+            t->cancelled = ETIMEDOUT;
+            iom->cancelEvent(fd, (tihi::IOManager::EventType)(type));
+        },
+        wtinfo);
+}
+
+static IOManager::IoRequest MakeRequest(uint8_t opcode, const void *addr,
+                                        size_t len, uint64_t off = 0,
+                                        uint32_t op_flags = 0) {
+    IOManager::IoRequest req;
+    req.opcode = opcode;
+    req.addr = (uint64_t)(uintptr_t)addr;
+    /**
+     * 超过 32 位的长度只读写一部分，和 socket 上的短读写一样
+     */
+    req.len = (uint32_t)std::min<size_t>(len, UINT32_MAX);
+    req.off = off;
+    req.op_flags = op_flags;
+    return req;
+}
+
+/**
+ * 当前协程挂起 ms 毫秒。定时器可能在协程真正切出之前就在别的线程到期，
+ * 所以用 FiberWaiter 等；reactor-per-thread 模式下醒来后回到原来的线程
+ */
+static void SleepFor(IOManager *iom, uint64_t ms) {
+    FiberWaiter waiter;
+    if (iom->sharded()) {
+        waiter.thread_id = ThreadId();
+    }
+    FiberWaiter *ptr = &waiter;
+    iom->addTimer(ms, [ptr]() { ptr->wake(); });
+    waiter.yield();
+}
+
+/**
+ * req 不为空时，io_uring 后端上第一次调用 EAGAIN 之后把 req 直接交给内核执行，
+ * 不再等就绪后重试
+ */
 template <typename OriginFun, typename... Args>
 ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t type,
-              int timeout_type, Args &&...args) {
+              int timeout_type, const IOManager::IoRequest *req,
+              Args &&...args) {
     if (!is_hook_enable()) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    FdCtx::ptr fdctx = FdMgr::GetInstance()->fd(fd);
+    FdCtx* fdctx = FdMgr::GetInstance()->fd(fd);
     if (!fdctx) {
         return fun(fd, std::forward<Args>(args)...);
     }
 
-    if (!fdctx->is_socket() || fdctx->user_nonblock()) {
+    if (!fdctx->is_socket()) {
+        return fun(fd, std::forward<Args>(args)...);
+    }
+    if (fdctx->user_nonblock()) {
+        /**
+         * multishot recv 已经在收这个 fd 的数据了，只能从它的接收队列中取
+         */
+        tihi::IOManager *iom = tihi::IOManager::This();
+        int64_t res = 0;
+        if (req && type == IOManager::READ && iom &&
+            iom->tryRecvQueued(fd, *req, res)) {
+            if (res < 0) {
+                errno = -res;
+                return -1;
+            }
+            return res;
+        }
         return fun(fd, std::forward<Args>(args)...);
     }
 
@@ -97,35 +175,58 @@ ssize_t do_io(int fd, OriginFun fun, const char *hook_fun_name, uint32_t type,
 
     uint64_t timeout = fdctx->timeout(timeout_type);
     std::shared_ptr<timer_info> tinfo(new timer_info);
+    tihi::IOManager *iom = tihi::IOManager::This();
+    bool submit =
+        req && iom && iom->backend() == tihi::IOManager::Backend::IO_URING;
+    SyscallStats::Type syscall_type =
+        type == IOManager::READ ? SyscallStats::READ : SyscallStats::WRITE;
+    /**
+     * multishot accept 接受的连接已经在队列里了，不用先进内核试一次；
+     * 有 multishot recv 的 fd 不能绕过接收队列直接读
+     */
+    bool try_first =
+        !(submit &&
+          ((req->opcode == IORING_OP_ACCEPT && iom->multishotAccept()) ||
+           (type == IOManager::READ && iom->multishotRecv() &&
+            iom->recvQueued(fd))));
 
 retry:
-    ssize_t n = fun(fd, std::forward<Args>(args)...);
-    while (-1 == n && EINTR == errno) {
-        n = fun(fd, std::forward<Args>(args)...);
+    ssize_t n = -1;
+    errno = EAGAIN;
+    if (try_first) {
+        do {
+            SyscallStats::Add(syscall_type);
+            n = fun(fd, std::forward<Args>(args)...);
+        } while (-1 == n && EINTR == errno);
     }
+    try_first = true;
     if (-1 == n && EAGAIN == errno) {
-        tihi::IOManager *iom = tihi::IOManager::This();
-        tihi::Timer::ptr timer;
-        std::weak_ptr<timer_info> wtinfo(tinfo);
-
-        if ((uint64_t)-1 != timeout) {
-            timer = iom->addConditionTimer(
-                timeout,
-                [wtinfo, fd, iom, type]() {
-                    auto t = wtinfo.lock();
-                    if (!t || t->cancelled) {
-                        return;
-                    }
-                    t->cancelled = ETIMEDOUT;
-                    iom->cancelEvent(fd, (tihi::IOManager::EventType)(type));
-                },
-                wtinfo);
+        tihi::Timer::ptr timer = AddCancelTimer(iom, fd, type, timeout, tinfo);
+
+        int64_t res = 0;
+        if (submit && iom->submitIo(fd, (tihi::IOManager::EventType)(type),
+                                    *req, res)) {
+            if (timer) {
+                timer->cancel();
+            }
+            /**
+             * 超时和完成同时发生时以完成的结果为准，数据不会丢
+             */
+            if (res >= 0) {
+                return res;
+            }
+            if (-ECANCELED == res && tinfo->cancelled) {
+                errno = tinfo->cancelled;
+                return -1;
+            }
+            if (-EAGAIN == res || -EINTR == res) {
+                goto retry;
+            }
+            errno = -res;
+            return -1;
         }
 
-        /**
-         * 回调函数为空则以当前协程为调度对象
-         */
-        int rt = iom->addEvent(fd, (tihi::IOManager::EventType)(type));
+        int rt = iom->waitEvent(fd, (tihi::IOManager::EventType)(type));
         if (rt) {
             TIHI_LOG_ERROR(g_sys_logger)
                 << hook_fun_name << "addEvent(fd=" << fd << ", type=" << type
@@ -135,9 +236,6 @@ retry:
             }
             return -1;
         } else {
-            // TIHI_LOG_DEBUG(g_sys_logger) << "<" << hook_fun_name << ">";
-            tihi::Fiber::YieldToHold();
-            // TIHI_LOG_DEBUG(g_sys_logger) << "<" << hook_fun_name << ">";
             if (timer) {
                 timer->cancel();
             }
@@ -161,7 +259,7 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     // TIHI_LOG_DEBUG(g_sys_logger) << "directly return";
     // return 1;
 
-    FdCtx::ptr fdctx = FdMgr::GetInstance()->fd(sockfd);
+    FdCtx* fdctx = FdMgr::GetInstance()->fd(sockfd);
     if (!fdctx) {
         return connect_f(sockfd, addr, addrlen);
     }
@@ -176,36 +274,45 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     }
 
     std::shared_ptr<timer_info> tinfo(new timer_info);
+    tihi::IOManager *iom = tihi::IOManager::This();
+
+    if (iom && iom->backend() == tihi::IOManager::Backend::IO_URING) {
+        /**
+         * 先调用一次 connect_f 的话，内核执行 CONNECT 时只会得到 EALREADY，
+         * 所以直接提交
+         */
+        IOManager::IoRequest req =
+            MakeRequest(IORING_OP_CONNECT, addr, 0, addrlen);
+        tihi::Timer::ptr timer =
+            AddCancelTimer(iom, sockfd, tihi::IOManager::WRITE, timeout, tinfo);
+        int64_t res = 0;
+        bool submitted =
+            iom->submitIo(sockfd, tihi::IOManager::WRITE, req, res);
+        if (timer) {
+            timer->cancel();
+        }
+        if (submitted) {
+            if (0 == res) {
+                return 0;
+            }
+            errno = (-ECANCELED == res && tinfo->cancelled) ? tinfo->cancelled
+                                                            : -res;
+            return -1;
+        }
+    }
 
+    SyscallStats::Add(SyscallStats::CONNECT);
     int n = connect_f(sockfd, addr, addrlen);
     if (n == 0) {
         return 0;
     } else if (n != -1 || EINPROGRESS != errno) {
         return n;
     }
-    
-    tihi::IOManager *iom = tihi::IOManager::This();
-    tihi::Timer::ptr timer;
-    std::weak_ptr<timer_info> wtinfo(tinfo);
 
-    if ((uint64_t)-1 != timeout) {
-        timer = iom->addConditionTimer(
-            timeout,
-            [wtinfo, sockfd, iom]() {
-                auto t = wtinfo.lock();
-                if (!t || t->cancelled) {
-                    return;
-                }
-                t->cancelled = ETIMEDOUT;
-                iom->cancelEvent(sockfd, tihi::IOManager::WRITE);
-            },
-            wtinfo);
-    }
+    tihi::Timer::ptr timer =
+        AddCancelTimer(iom, sockfd, tihi::IOManager::WRITE, timeout, tinfo);
 
-    /**
-     * 回调函数为空则以当前协程为调度对象
-     */
-    int rt = iom->addEvent(sockfd, tihi::IOManager::WRITE);
+    int rt = iom->waitEvent(sockfd, tihi::IOManager::WRITE);
     if (rt) {
         TIHI_LOG_ERROR(g_sys_logger)
             << "connect addEvent(fd=" << sockfd << ", type=" << tihi::IOManager::WRITE
@@ -214,7 +321,6 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
             timer->cancel();
         }
     } else {
-        tihi::Fiber::YieldToHold();
         if (timer) {
             timer->cancel();
         }
@@ -237,6 +343,23 @@ int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addr
     return error;
 }
 
+ssize_t read_fixed(int fd, void *buf, size_t count, uint16_t buf_index) {
+    IOManager::IoRequest req =
+        MakeRequest(IORING_OP_READ_FIXED, buf, count, (uint64_t)-1);
+    req.buf_index = buf_index;
+    return do_io(fd, read_f, "read_fixed", tihi::IOManager::READ, SO_RCVTIMEO,
+                 &req, buf, count);
+}
+
+ssize_t write_fixed(int fd, const void *buf, size_t count,
+                    uint16_t buf_index) {
+    IOManager::IoRequest req =
+        MakeRequest(IORING_OP_WRITE_FIXED, buf, count, (uint64_t)-1);
+    req.buf_index = buf_index;
+    return do_io(fd, write_f, "write_fixed", tihi::IOManager::WRITE,
+                 SO_SNDTIMEO, &req, buf, count);
+}
+
 }  // namespace tihi
 
 extern "C" {
@@ -247,54 +370,37 @@ HOOK_FUN(XX);
 #undef XX
 
 unsigned int sleep(unsigned int seconds) {
-    if (!tihi::is_hook_enable()) {
+    /**
+     * 普通的 Scheduler 也会打开 hook，但只有 IOManager 才有定时器
+     */
+    tihi::IOManager *iom = tihi::IOManager::This();
+    if (!tihi::is_hook_enable() || !iom) {
         return sleep_f(seconds);
     }
 
-    tihi::Fiber::ptr fiber = tihi::Fiber::This();
-    tihi::IOManager *iom = tihi::IOManager::This();
-    iom->addTimer(
-        seconds * 1000,
-        std::bind((void (tihi::Scheduler::*)(tihi::Fiber::ptr, pid_t))(
-                      &tihi::IOManager::schedule),
-                  iom, fiber, -1));
-    // iom->addTimer(seconds * 1000, [iom, fiber]() { iom->schedule(fiber); });
-    tihi::Fiber::YieldToHold();
+    tihi::SleepFor(iom, seconds * 1000);
     return 0;
 }
 
 int usleep(useconds_t usec) {
-    if (!tihi::is_hook_enable()) {
+    tihi::IOManager *iom = tihi::IOManager::This();
+    if (!tihi::is_hook_enable() || !iom) {
         return usleep_f(usec);
     }
 
-    tihi::Fiber::ptr fiber = tihi::Fiber::This();
-    tihi::IOManager *iom = tihi::IOManager::This();
-    iom->addTimer(
-        usec / 1000,
-        std::bind((void (tihi::IOManager::*)(tihi::Fiber::ptr, pid_t))(
-                      &tihi::IOManager::schedule),
-                  iom, fiber, -1));
-    // iom->addTimer(usec / 1000, [iom, fiber]() { iom->schedule(fiber); });
-    tihi::Fiber::YieldToHold();
+    tihi::SleepFor(iom, usec / 1000);
     return 0;
 }
 
 int nanosleep(const struct timespec *req, struct timespec *rem) {
-    if (!tihi::is_hook_enable()) {
+    tihi::IOManager *iom = tihi::IOManager::This();
+    if (!tihi::is_hook_enable() || !iom) {
         return nanosleep_f(req, rem);
     }
 
     uint64_t ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
 
-    tihi::Fiber::ptr fiber = tihi::Fiber::This();
-    tihi::IOManager *iom = tihi::IOManager::This();
-    iom->addTimer(
-        ms, std::bind((void (tihi::Scheduler::*)(tihi::Fiber::ptr, pid_t))(
-                          &tihi::IOManager::schedule),
-                      iom, fiber, -1));
-    // iom->addTimer(ms, [iom, fiber]() { iom->schedule(fiber); });
-    tihi::Fiber::YieldToHold();
+    tihi::SleepFor(iom, ms);
     return 0;
 }
 
@@ -316,64 +422,104 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int sockfd, struct sockaddr *addr, socklen_t *addrlen) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_ACCEPT, addr, 0, (uint64_t)addrlen);
     int fd = tihi::do_io(sockfd, accept_f, "accept", tihi::IOManager::READ,
-                         SO_RCVTIMEO, addr, addrlen);
+                         SO_RCVTIMEO, &req, addr, addrlen);
     if (fd >= 0) {
+        /**
+         * multishot accept 不带对端地址，要的话再查一次
+         */
+        tihi::IOManager *iom = tihi::IOManager::This();
+        if (addr && iom && iom->multishotAccept()) {
+            getpeername(fd, addr, addrlen);
+        }
         tihi::FdMgr::GetInstance()->fd(fd, true);
     }
     return fd;
 }
 
 ssize_t read(int fd, void *buf, size_t count) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_READ, buf, count, (uint64_t)-1);
     return tihi::do_io(fd, read_f, "read", tihi::IOManager::READ, SO_RCVTIMEO,
-                       buf, count);
+                       &req, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_READV, iov, iovcnt, (uint64_t)-1);
     return tihi::do_io(fd, readv_f, "readv", tihi::IOManager::READ, SO_RCVTIMEO,
-                       iov, iovcnt);
+                       &req, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_RECV, buf, len, 0, flags);
     return tihi::do_io(sockfd, recv_f, "recv", tihi::IOManager::READ,
-                       SO_RCVTIMEO, buf, len, flags);
+                       SO_RCVTIMEO, &req, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen) {
-    return tihi::do_io(sockfd, recvfrom_f, "recvfrom", tihi::IOManager::READ,
-                       SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    /**
+     * 不要地址时和 recv 一样；要地址时只有已经有接收队列的 stream socket
+     * 交给 io_uring，stream socket 本来也不返回地址
+     */
+    tihi::IOManager *iom = tihi::IOManager::This();
+    bool queued = src_addr && iom && iom->recvQueued(sockfd);
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_RECV, buf, len, 0, flags);
+    ssize_t n = tihi::do_io(sockfd, recvfrom_f, "recvfrom",
+                            tihi::IOManager::READ, SO_RCVTIMEO,
+                            (!src_addr || queued) ? &req : nullptr, buf, len,
+                            flags, src_addr, addrlen);
+    if (n >= 0 && queued && addrlen) {
+        *addrlen = 0;
+    }
+    return n;
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_RECVMSG, msg, 1, 0, flags);
     return tihi::do_io(sockfd, recvmsg_f, "readmsg", tihi::IOManager::READ,
-                       SO_RCVTIMEO, msg, flags);
+                       SO_RCVTIMEO, &req, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_WRITE, buf, count, (uint64_t)-1);
     return tihi::do_io(fd, write_f, "write", tihi::IOManager::WRITE,
-                       SO_SNDTIMEO, buf, count);
+                       SO_SNDTIMEO, &req, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_WRITEV, iov, iovcnt, (uint64_t)-1);
     return tihi::do_io(fd, writev_f, "writev", tihi::IOManager::WRITE,
-                       SO_SNDTIMEO, iov, iovcnt);
+                       SO_SNDTIMEO, &req, iov, iovcnt);
 }
 
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_SEND, buf, len, 0, flags);
     return tihi::do_io(sockfd, send_f, "send", tihi::IOManager::WRITE,
-                       SO_SNDTIMEO, buf, len, flags);
+                       SO_SNDTIMEO, &req, buf, len, flags);
 }
 
 ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
                const struct sockaddr *dest_addr, socklen_t addrlen) {
     return tihi::do_io(sockfd, sendto_f, "sendto", tihi::IOManager::WRITE,
-                       SO_SNDTIMEO, buf, len, flags, dest_addr, addrlen);
+                       SO_SNDTIMEO, nullptr, buf, len, flags, dest_addr,
+                       addrlen);
 }
 
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
+    tihi::IOManager::IoRequest req =
+        tihi::MakeRequest(IORING_OP_SENDMSG, msg, 1, 0, flags);
     return tihi::do_io(sockfd, sendmsg_f, "sendmsg", tihi::IOManager::WRITE,
-                       SO_SNDTIMEO, msg, flags);
+                       SO_SNDTIMEO, &req, msg, flags);
 }
 
 int close(int fd) {
@@ -381,12 +527,15 @@ int close(int fd) {
         return close_f(fd);
     }
 
-    tihi::FdCtx::ptr ctx = tihi::FdMgr::GetInstance()->fd(fd);
+    /**
+     * 不是 socket 的 fd 也可能在 epoll 中常驻注册，见 IOManager::persistent()
+     */
+    tihi::IOManager *iom = tihi::IOManager::This();
+    if (iom) {
+        iom->cancelAll(fd);
+    }
+    tihi::FdCtx* ctx = tihi::FdMgr::GetInstance()->fd(fd);
     if (ctx) {
-        tihi::IOManager *iom = tihi::IOManager::This();
-        if (iom) {
-            iom->cancelAll(fd);
-        }
         tihi::FdMgr::GetInstance()->delFd(fd);
     }
 
@@ -400,7 +549,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
         case F_SETFL: {
             int arg = va_arg(vl, int);
             va_end(vl);
-            tihi::FdCtx::ptr ctx = tihi::FdMgr::GetInstance()->fd(fd);
+            tihi::FdCtx* ctx = tihi::FdMgr::GetInstance()->fd(fd);
             if (!ctx || ctx->is_closed() || !ctx->is_socket()) {
                 return fcntl_f(fd, cmd, arg);
             }
@@ -415,7 +564,7 @@ int fcntl(int fd, int cmd, ... /* arg */) {
         case F_GETFL: {
             va_end(vl);
             int arg = fcntl_f(fd, cmd);
-            tihi::FdCtx::ptr ctx = tihi::FdMgr::GetInstance()->fd(fd);
+            tihi::FdCtx* ctx = tihi::FdMgr::GetInstance()->fd(fd);
             if (!ctx || ctx->is_closed() || !ctx->is_socket()) {
                 return arg;
             }
@@ -475,7 +624,7 @@ int ioctl(int d, long unsigned int request, ...) {
     va_end(vl);
 
     if (FIONBIO == request) {
-        tihi::FdCtx::ptr ctx = tihi::FdMgr::GetInstance()->fd(d);
+        tihi::FdCtx* ctx = tihi::FdMgr::GetInstance()->fd(d);
         if (!ctx || ctx->is_socket() || !ctx->is_socket()) {
             return ioctl_f(d, request, arg);
         }
@@ -499,10 +648,10 @@ int setsockopt(int sockfd, int level, int optname, const void *optval,
 
     if (SOL_SOCKET == level) {
         if (SO_RCVTIMEO == optname || SO_SNDTIMEO == optname) {
-            tihi::FdCtx::ptr ctx = tihi::FdMgr::GetInstance()->fd(sockfd);
+            tihi::FdCtx* ctx = tihi::FdMgr::GetInstance()->fd(sockfd);
             if (ctx) {
                 const struct timeval* tv = (const timeval*)optval;
-                ctx->set_timeout(level, tv->tv_sec * 1000 + tv->tv_usec / 1000);
+                ctx->set_timeout(optname, tv->tv_sec * 1000 + tv->tv_usec / 1000);
             }
         }
     }
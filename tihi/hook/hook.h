@@ -15,6 +15,12 @@ namespace tihi {
 bool is_hook_enable();
 void set_hook_enable(bool flag);
 int connect_with_timeout(int sockfd, const struct sockaddr *addr, socklen_t addrlen, uint64_t timeout);
+/**
+ * 用 IOManager::registerBuffers 注册的第 buf_index 块缓冲区读写，
+ * buf 必须落在那块缓冲区中；不是 io_uring 后端时和 read / write 一样
+ */
+ssize_t read_fixed(int fd, void *buf, size_t count, uint16_t buf_index);
+ssize_t write_fixed(int fd, const void *buf, size_t count, uint16_t buf_index);
 }  // namespace tihi
 
 extern "C" {
@@ -0,0 +1,124 @@
+#include "syscall_stats.h"
+
+#include <atomic>
+#include <set>
+#include <sstream>
+
+#include "utils/mutex.h"
+
+namespace tihi {
+
+namespace {
+
+struct ThreadCounts;
+
+/**
+ * 所有活着的线程的计数，以及已经退出的线程留下的累计值
+ */
+struct Registry {
+    Mutex mutex;
+    std::set<ThreadCounts*> threads;
+    uint64_t exited[SyscallStats::TYPE_COUNTS] = {0};
+};
+
+static Registry& GetRegistry() {
+    /**
+     * 线程退出时还要用，不能先于 thread_local 对象析构
+     */
+    static Registry* s_registry = new Registry;
+    return *s_registry;
+}
+
+struct ThreadCounts {
+    ThreadCounts() {
+        Registry& registry = GetRegistry();
+        Mutex::mutex lock(registry.mutex);
+        registry.threads.insert(this);
+    }
+
+    ~ThreadCounts() {
+        Registry& registry = GetRegistry();
+        Mutex::mutex lock(registry.mutex);
+        for (int i = 0; i < SyscallStats::TYPE_COUNTS; ++i) {
+            registry.exited[i] += counts[i].load(std::memory_order_relaxed);
+        }
+        registry.threads.erase(this);
+    }
+
+    std::atomic<uint64_t> counts[SyscallStats::TYPE_COUNTS] = {};
+};
+
+static thread_local ThreadCounts t_counts;
+
+}  // namespace
+
+void SyscallStats::Add(Type type, uint64_t v) {
+    /**
+     * 只有本线程会写，读加写就够了，不用原子加
+     */
+    std::atomic<uint64_t>& counter = t_counts.counts[type];
+    counter.store(counter.load(std::memory_order_relaxed) + v,
+                  std::memory_order_relaxed);
+}
+
+SyscallStats::Snapshot SyscallStats::Get() {
+    Snapshot snapshot;
+    Registry& registry = GetRegistry();
+    Mutex::mutex lock(registry.mutex);
+    for (int i = 0; i < TYPE_COUNTS; ++i) {
+        snapshot.counts[i] = registry.exited[i];
+    }
+    for (ThreadCounts* thread : registry.threads) {
+        for (int i = 0; i < TYPE_COUNTS; ++i) {
+            snapshot.counts[i] +=
+                thread->counts[i].load(std::memory_order_relaxed);
+        }
+    }
+    return snapshot;
+}
+
+const char* SyscallStats::ToString(Type type) {
+    switch (type) {
+#define XX(name)     \
+    case name:       \
+        return #name;
+        XX(READ);
+        XX(WRITE);
+        XX(CONNECT);
+        XX(EPOLL_CTL);
+        XX(EPOLL_WAIT);
+        XX(IO_URING_ENTER);
+        XX(TICKLE);
+#undef XX
+        default:
+            return "UNKNOWN";
+    }
+}
+
+uint64_t SyscallStats::Snapshot::total() const {
+    uint64_t sum = 0;
+    for (int i = 0; i < TYPE_COUNTS; ++i) {
+        sum += counts[i];
+    }
+    return sum;
+}
+
+SyscallStats::Snapshot SyscallStats::Snapshot::operator-(
+    const Snapshot& oth) const {
+    Snapshot diff;
+    for (int i = 0; i < TYPE_COUNTS; ++i) {
+        diff.counts[i] = counts[i] - oth.counts[i];
+    }
+    return diff;
+}
+
+std::string SyscallStats::Snapshot::toString() const {
+    std::stringstream ss;
+    for (int i = 0; i < TYPE_COUNTS; ++i) {
+        ss << SyscallStats::ToString((Type)i) << "=" << counts[i] << " ";
+    }
+    ss << "total=" << total();
+    return ss.str();
+}
+
+}  // namespace tihi
@@ -0,0 +1,51 @@
+#ifndef TIHI_HOOK_SYSCALL_STATS_H_
+#define TIHI_HOOK_SYSCALL_STATS_H_
+
+#include <stdint.h>
+
+#include <string>
+
+namespace tihi {
+
+/**
+ * 框架自己发起的系统调用计数，用来比较不同 IO 后端处理一个请求要花多少次系统调用
+ *
+ * 只统计 hook 接管的 socket IO（accept 算 READ）以及 IOManager 内部的 epoll、
+ * io_uring 和唤醒用的管道读写，不是进程全部的系统调用。
+ * 每个线程只写自己的计数，读的时候把所有线程（包括已经退出的）加起来
+ */
+class SyscallStats {
+public:
+    enum Type {
+        READ = 0,
+        WRITE,
+        CONNECT,
+        EPOLL_CTL,
+        EPOLL_WAIT,
+        IO_URING_ENTER,
+        TICKLE,
+        TYPE_COUNTS,
+    };
+
+    struct Snapshot {
+        uint64_t counts[TYPE_COUNTS] = {0};
+
+        uint64_t total() const;
+        /**
+         * 两次快照之间的差值
+         */
+        Snapshot operator-(const Snapshot& oth) const;
+        std::string toString() const;
+    };
+
+    /**
+     * 当前线程的计数加 v
+     */
+    static void Add(Type type, uint64_t v = 1);
+    static Snapshot Get();
+    static const char* ToString(Type type);
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_HOOK_SYSCALL_STATS_H_
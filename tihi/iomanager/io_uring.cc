@@ -0,0 +1,354 @@
+#include "io_uring.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "hook/syscall_stats.h"
+#include "log/log.h"
+
+namespace tihi {
+
+static Logger::ptr g_sys_logger = TIHI_LOG_LOGGER("system");
+
+static int Setup(uint32_t entries, io_uring_params* params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int Enter(int fd, uint32_t to_submit, uint32_t min_complete,
+                 uint32_t flags, void* arg, size_t arg_size) {
+    SyscallStats::Add(SyscallStats::IO_URING_ENTER);
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, arg, arg_size);
+}
+
+static int Register(int fd, uint32_t opcode, const void* arg,
+                    uint32_t counts) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, counts);
+}
+
+IoUring::IoUring(uint32_t entries, uint32_t sqpoll_idle_ms) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+    if (sqpoll_idle_ms) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll_idle_ms;
+    }
+    fd_ = Setup(entries, &params);
+    if (fd_ < 0 && sqpoll_idle_ms) {
+        /**
+         * 老内核的 SQPOLL 需要特权，退回到普通模式
+         */
+        TIHI_LOG_WARN(g_sys_logger)
+            << "io_uring_setup with SQPOLL failed, errno=" << errno << " - "
+            << strerror(errno);
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CLAMP;
+        fd_ = Setup(entries, &params);
+    }
+    if (fd_ < 0) {
+        TIHI_LOG_ERROR(g_sys_logger) << "io_uring_setup(" << entries
+                                     << ") errno=" << errno << " - "
+                                     << strerror(errno);
+        return;
+    }
+    sqpoll_ = params.flags & IORING_SETUP_SQPOLL;
+
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+    if (single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else if (sq_ring_ != MAP_FAILED) {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+    }
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    if (sq_ring_ != MAP_FAILED && cq_ring_ != MAP_FAILED) {
+        sqes_ = (io_uring_sqe*)mmap(nullptr, sqes_size_,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, fd_,
+                                    IORING_OFF_SQES);
+    }
+    if (sq_ring_ == MAP_FAILED || cq_ring_ == MAP_FAILED ||
+        sqes_ == MAP_FAILED) {
+        TIHI_LOG_ERROR(g_sys_logger)
+            << "io_uring mmap errno=" << errno << " - " << strerror(errno);
+        if (sq_ring_ == MAP_FAILED) {
+            sq_ring_ = nullptr;
+        }
+        if (cq_ring_ == MAP_FAILED) {
+            cq_ring_ = nullptr;
+        }
+        if (sqes_ == MAP_FAILED) {
+            sqes_ = nullptr;
+        }
+        release();
+        return;
+    }
+
+    char* sq = (char*)sq_ring_;
+    sq_head_ = (uint32_t*)(sq + params.sq_off.head);
+    sq_tail_ = (uint32_t*)(sq + params.sq_off.tail);
+    sq_flags_ = (uint32_t*)(sq + params.sq_off.flags);
+    sq_mask_ = *(uint32_t*)(sq + params.sq_off.ring_mask);
+    sq_entries_ = params.sq_entries;
+    /**
+     * sqe 的下标和提交队列的位置一一对应，之后不用再填
+     */
+    uint32_t* array = (uint32_t*)(sq + params.sq_off.array);
+    for (uint32_t i = 0; i < sq_entries_; ++i) {
+        array[i] = i;
+    }
+    sq_local_tail_ = *sq_tail_;
+
+    char* cq = (char*)cq_ring_;
+    cq_head_ = (uint32_t*)(cq + params.cq_off.head);
+    cq_tail_ = (uint32_t*)(cq + params.cq_off.tail);
+    cq_mask_ = *(uint32_t*)(cq + params.cq_off.ring_mask);
+    cqes_ = (io_uring_cqe*)(cq + params.cq_off.cqes);
+}
+
+IoUring::~IoUring() { release(); }
+
+void IoUring::release() {
+    if (sqes_) {
+        munmap(sqes_, sqes_size_);
+        sqes_ = nullptr;
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    cq_ring_ = nullptr;
+    if (sq_ring_) {
+        munmap(sq_ring_, sq_ring_size_);
+        sq_ring_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    /**
+     * 内核在 io_uring 关闭之后才放开这两块内存
+     */
+    if (buf_ring_) {
+        munmap(buf_ring_, buf_ring_size_);
+        buf_ring_ = nullptr;
+    }
+    if (buffers_) {
+        munmap(buffers_, buffers_size_);
+        buffers_ = nullptr;
+    }
+}
+
+bool IoUring::Supported() {
+    static bool s_supported = []() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = Setup(4, &params);
+        if (fd < 0) {
+            return false;
+        }
+        /**
+         * 带超时的等待要用 EXT_ARG（5.11），完成队列满了也不能丢事件
+         */
+        uint32_t features = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+        bool supported = (params.features & features) == features;
+
+        size_t size = sizeof(io_uring_probe) +
+                      IORING_OP_LAST * sizeof(io_uring_probe_op);
+        io_uring_probe* probe = (io_uring_probe*)calloc(1, size);
+        if (supported &&
+            Register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0) {
+            for (int op : {IORING_OP_NOP, IORING_OP_POLL_ADD,
+                           IORING_OP_ASYNC_CANCEL, IORING_OP_READ,
+                           IORING_OP_WRITE, IORING_OP_READV,
+                           IORING_OP_WRITEV, IORING_OP_RECV, IORING_OP_SEND,
+                           IORING_OP_RECVMSG, IORING_OP_SENDMSG,
+                           IORING_OP_ACCEPT, IORING_OP_CONNECT,
+                           IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED}) {
+                if (op > probe->last_op ||
+                    !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                    supported = false;
+                    break;
+                }
+            }
+        } else {
+            supported = false;
+        }
+        free(probe);
+        close(fd);
+        return supported;
+    }();
+    return s_supported;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    while (sq_local_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >=
+           sq_entries_) {
+        /**
+         * 不用 SQPOLL 时提交之后内核马上就取走了；
+         * 用 SQPOLL 时要等内核线程取走
+         */
+        submit();
+        if (sqpoll_) {
+            sched_yield();
+        }
+    }
+    io_uring_sqe* sqe = &sqes_[sq_local_tail_ & sq_mask_];
+    ++sq_local_tail_;
+    ++sq_pending_;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::submit() {
+    if (!sq_pending_) {
+        return 0;
+    }
+    /**
+     * sqe 填好之后才能让内核看到新的 tail
+     */
+    __atomic_store_n(sq_tail_, sq_local_tail_, __ATOMIC_RELEASE);
+    uint32_t counts = sq_pending_;
+    uint32_t flags = 0;
+    if (sqpoll_) {
+        sq_pending_ = 0;
+        /**
+         * 先发布 tail 再看内核线程是不是睡了，和内核那边的顺序相反
+         */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (!(__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) &
+              IORING_SQ_NEED_WAKEUP)) {
+            return counts;
+        }
+        flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+
+    int ret = 0;
+    do {
+        ret = Enter(fd_, sqpoll_ ? 0 : counts, 0, flags, nullptr, 0);
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0) {
+        TIHI_LOG_ERROR(g_sys_logger) << "io_uring_enter submit errno=" << errno
+                                     << " - " << strerror(errno);
+        return -errno;
+    }
+    if (!sqpoll_) {
+        /**
+         * 没有被取走的留到下次一起提交
+         */
+        sq_pending_ = counts - std::min<uint32_t>(counts, ret);
+    }
+    return sqpoll_ ? counts : ret;
+}
+
+int IoUring::wait(int timeout_ms, const sigset_t* sigmask) {
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000 * 1000ll;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask = (uint64_t)(uintptr_t)sigmask;
+    arg.sigmask_sz = _NSIG / 8;
+    arg.ts = (uint64_t)&ts;
+    int ret = Enter(fd_, 0, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                    &arg, sizeof(arg));
+    if (ret < 0 && errno == EINTR) {
+        return -EINTR;
+    }
+    if (ret < 0 && errno != ETIME && errno != EAGAIN && errno != EBUSY) {
+        TIHI_LOG_ERROR(g_sys_logger) << "io_uring_enter wait errno=" << errno
+                                     << " - " << strerror(errno);
+    }
+    return 0;
+}
+
+int IoUring::registerBuffers(const iovec* iovs, unsigned counts) {
+    int ret = Register(fd_, IORING_REGISTER_BUFFERS, iovs, counts);
+    return ret < 0 ? -errno : ret;
+}
+
+int IoUring::unregisterBuffers() {
+    int ret = Register(fd_, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+    return ret < 0 ? -errno : ret;
+}
+
+int IoUring::setupBufRing(uint16_t group, uint32_t counts, uint32_t size) {
+    if (buf_ring_ || !counts || (counts & (counts - 1)) || counts > 32768 ||
+        !size) {
+        return -EINVAL;
+    }
+    /**
+     * 环要按页对齐，缓冲区放在一起分配
+     */
+    size_t ring_size = counts * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return -errno;
+    }
+    size_t buffers_size = (size_t)counts * size;
+    void* buffers = mmap(nullptr, buffers_size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        int err = errno;
+        munmap(ring, ring_size);
+        return -err;
+    }
+
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring;
+    reg.ring_entries = counts;
+    reg.bgid = group;
+    if (Register(fd_, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        int err = errno;
+        munmap(ring, ring_size);
+        munmap(buffers, buffers_size);
+        return -err;
+    }
+
+    buf_ring_ = (io_uring_buf_ring*)ring;
+    buf_ring_size_ = ring_size;
+    buffers_ = (char*)buffers;
+    buffers_size_ = buffers_size;
+    buffer_size_ = size;
+    buf_mask_ = counts - 1;
+    for (uint32_t i = 0; i < counts; ++i) {
+        recycleBuffer((uint16_t)i);
+    }
+    return 0;
+}
+
+void IoUring::recycleBuffer(uint16_t id) {
+    /**
+     * 不用 bufs：头文件里的柔性数组在 C++ 中被放在了偏移 8 的位置，
+     * 环本身就是 io_uring_buf 数组，tail 和第一个元素的 resv 重叠
+     */
+    io_uring_buf& buf = ((io_uring_buf*)buf_ring_)[buf_tail_ & buf_mask_];
+    buf.addr = (uint64_t)(uintptr_t)buffer(id);
+    buf.len = buffer_size_;
+    buf.bid = id;
+    ++buf_tail_;
+    /**
+     * 填好之后才能让内核看到新的 tail
+     */
+    __atomic_store_n(&buf_ring_->tail, buf_tail_, __ATOMIC_RELEASE);
+}
+
+}  // namespace tihi
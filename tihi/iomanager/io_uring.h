@@ -0,0 +1,161 @@
+#ifndef TIHI_IOMANAGER_IO_URING_H_
+#define TIHI_IOMANAGER_IO_URING_H_
+
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "utils/mutex.h"
+#include "utils/noncopyable.h"
+
+namespace tihi {
+
+/**
+ * io_uring 实例，直接用系统调用实现（不依赖 liburing）
+ *
+ * 提交队列可以被多个线程使用：getSqe() 到 submit() 之间要持有 sq_mutex()；
+ * 完成队列用 reap() 取，同一时间只有一个线程在处理完成事件，
+ * 所以同一个请求的多个完成事件（multishot）按顺序处理
+ */
+class IoUring : public Noncopyable {
+public:
+    using mutex_type = Mutex;
+
+    /**
+     * entries 是提交队列的长度，完成队列是它的两倍；
+     * sqpoll_idle_ms 不为 0 时由内核线程轮询提交队列，提交一般不用系统调用，
+     * 内核线程空闲这么久之后睡眠，下次提交时再唤醒
+     */
+    explicit IoUring(uint32_t entries, uint32_t sqpoll_idle_ms = 0);
+    ~IoUring();
+
+    /**
+     * 内核支持 io_uring 以及 IOManager 用到的所有操作
+     */
+    static bool Supported();
+
+    bool valid() const { return fd_ >= 0; }
+    bool sqpoll() const { return sqpoll_; }
+
+    mutex_type& sq_mutex() { return sq_mutex_; }
+    /**
+     * 取一个清零的 sqe，提交队列满了先提交；调用时要持有 sq_mutex()
+     */
+    io_uring_sqe* getSqe();
+    /**
+     * 把填好的 sqe 交给内核，返回提交的个数，失败返回 -errno；
+     * 调用时要持有 sq_mutex()
+     */
+    int submit();
+
+    /**
+     * 等到至少有一个完成事件，最多 timeout_ms 毫秒，被信号打断或超时也返回。
+     * sigmask 不为空时等待期间换成这个信号掩码，同 epoll_pwait；
+     * 被信号打断时返回 -EINTR，否则返回 0
+     */
+    int wait(int timeout_ms, const sigset_t* sigmask = nullptr);
+    /**
+     * 取走所有已完成的事件，对每个事件调用 cb(user_data, res, flags)，
+     * 返回处理的个数；另一个线程正在处理时直接返回 0
+     */
+    template <typename F>
+    size_t reap(F cb);
+
+    /**
+     * 注册固定缓冲区，之后 READ_FIXED / WRITE_FIXED 用下标引用它们
+     */
+    int registerBuffers(const iovec* iovs, unsigned counts);
+    int unregisterBuffers();
+
+    /**
+     * 注册 provided buffer ring（5.19）：counts 个 size 字节的缓冲区，
+     * counts 是 2 的幂，最多 32768。带 IOSQE_BUFFER_SELECT 的请求由内核从中
+     * 挑一个装数据，完成事件的 flags 里带上它的下标。失败返回 -errno
+     */
+    int setupBufRing(uint16_t group, uint32_t counts, uint32_t size);
+    bool hasBufRing() const { return buf_ring_ != nullptr; }
+    char* buffer(uint16_t id) const {
+        return buffers_ + (size_t)id * buffer_size_;
+    }
+    /**
+     * 把用完的缓冲区还给内核，只能在 reap() 的回调中调用
+     */
+    void recycleBuffer(uint16_t id);
+
+private:
+    void release();
+
+    int fd_ = -1;
+    bool sqpoll_ = false;
+
+    void* sq_ring_ = nullptr;
+    size_t sq_ring_size_ = 0;
+    void* cq_ring_ = nullptr;
+    size_t cq_ring_size_ = 0;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqes_size_ = 0;
+
+    uint32_t* sq_head_ = nullptr;
+    uint32_t* sq_tail_ = nullptr;
+    uint32_t* sq_flags_ = nullptr;
+    uint32_t sq_mask_ = 0;
+    uint32_t sq_entries_ = 0;
+    /**
+     * 下一个 sqe 的位置，submit() 时才写回 sq_tail_ 让内核看到
+     */
+    uint32_t sq_local_tail_ = 0;
+    /**
+     * 已经放进提交队列、还没有交给内核的个数
+     */
+    uint32_t sq_pending_ = 0;
+
+    uint32_t* cq_head_ = nullptr;
+    uint32_t* cq_tail_ = nullptr;
+    uint32_t cq_mask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+
+    io_uring_buf_ring* buf_ring_ = nullptr;
+    size_t buf_ring_size_ = 0;
+    char* buffers_ = nullptr;
+    size_t buffers_size_ = 0;
+    uint32_t buffer_size_ = 0;
+    uint32_t buf_mask_ = 0;
+    /**
+     * 只有处理完成事件的线程会归还缓冲区，不用加锁
+     */
+    uint16_t buf_tail_ = 0;
+
+    mutex_type sq_mutex_;
+    mutex_type cq_mutex_;
+};
+
+template <typename F>
+size_t IoUring::reap(F cb) {
+    if (!cq_mutex_.tryLock()) {
+        return 0;
+    }
+    size_t counts = 0;
+    uint32_t head = __atomic_load_n(cq_head_, __ATOMIC_RELAXED);
+    while (true) {
+        uint32_t tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            break;
+        }
+        for (; head != tail; ++head) {
+            io_uring_cqe& cqe = cqes_[head & cq_mask_];
+            cb(cqe.user_data, cqe.res, cqe.flags);
+            ++counts;
+        }
+        /**
+         * 处理完再归还，cqe 在回调中一直有效
+         */
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+    cq_mutex_.unlock();
+    return counts;
+}
+
+}  // namespace tihi
+
+#endif  // TIHI_IOMANAGER_IO_URING_H_
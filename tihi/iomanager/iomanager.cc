@@ -1,17 +1,246 @@
 #include "iomanager.h"
 
-#include <fcntl.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cstring>
+#include <deque>
 
+#include "config/config.h"
+#include "hook/syscall_stats.h"
+#include "iomanager/io_uring.h"
 #include "log/log.h"
+#include "sync/fiber_sync.h"
 #include "utils/macro.h"
 
 namespace tihi {
 
 static Logger::ptr g_sys_logger = TIHI_LOG_LOGGER("system");
 
-void IOManager::Event::triggerEvent(IOManager::EventType type) {
+static ConfigVar<std::string>::ptr g_iomanager_backend =
+    Config::Lookup<std::string>(
+        "iomanager.backend", "epoll",
+        "io backend of IOManager: epoll or io_uring (falls back to epoll when "
+        "the kernel does not support it)");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_entries = Config::Lookup<uint32_t>(
+    "iomanager.io_uring.entries", 1024, "io_uring submission queue size");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_sqpoll_idle_ms =
+    Config::Lookup<uint32_t>(
+        "iomanager.io_uring.sqpoll_idle_ms", 0,
+        "poll the io_uring submission queue from a kernel thread that sleeps "
+        "after this many idle milliseconds, 0 disables SQPOLL");
+
+static ConfigVar<bool>::ptr g_reactor_per_thread = Config::Lookup<bool>(
+    "iomanager.reactor_per_thread", false,
+    "give every IOManager thread its own epoll instance and bind each fd to "
+    "one of them (epoll backend only)");
+
+static ConfigVar<bool>::ptr g_epoll_persistent = Config::Lookup<bool>(
+    "iomanager.epoll_persistent", false,
+    "register each fd once with EPOLLIN|EPOLLOUT|EPOLLET until it is closed "
+    "and keep sticky readiness flags instead of re-arming every event "
+    "(epoll backend only)");
+
+static ConfigVar<bool>::ptr g_io_uring_multishot_accept = Config::Lookup<bool>(
+    "iomanager.io_uring.multishot_accept", true,
+    "keep one multishot accept armed on each listening socket");
+
+static ConfigVar<bool>::ptr g_io_uring_multishot_recv = Config::Lookup<bool>(
+    "iomanager.io_uring.multishot_recv", true,
+    "keep one multishot recv armed on each stream socket after its first "
+    "blocking read, receiving into a provided buffer ring");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_recv_buffers =
+    Config::Lookup<uint32_t>(
+        "iomanager.io_uring.recv_buffers", 256,
+        "buffers in the provided buffer ring of multishot recv, rounded down "
+        "to a power of two");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_recv_buffer_size =
+    Config::Lookup<uint32_t>("iomanager.io_uring.recv_buffer_size", 4096,
+                             "size of each multishot recv buffer");
+
+static ConfigVar<uint32_t>::ptr g_io_uring_recv_queue_limit =
+    Config::Lookup<uint32_t>(
+        "iomanager.io_uring.recv_queue_limit", 256 * 1024,
+        "stop the multishot recv of a socket while this many received bytes "
+        "are waiting to be read");
+
+/**
+ * multishot recv 用的 provided buffer ring 的组号
+ */
+static const uint16_t RECV_BUFFER_GROUP = 0;
+
+/**
+ * io_uring 请求的 user_data，低 3 位是种类：
+ * POLL 是 addEvent 的就绪通知，高 32 位是 fd，中间是事件类型和序号；
+ * IO 是直接提交的操作，中间是等待者 IoWait 的地址，最高 16 位是序号，
+ * 地址被复用时取消不会误伤新的请求；
+ * ACCEPT 是 multishot accept，其余位是 AcceptQueue 的地址；
+ * RECV 是 multishot recv，其余位是 RecvQueue 的地址
+ */
+enum UringKind {
+    URING_IGNORE = 0,
+    URING_TICKLE = 1,
+    URING_POLL = 2,
+    URING_IO = 3,
+    URING_ACCEPT = 4,
+    URING_RECV = 5,
+};
+static const uint64_t URING_KIND_MASK = 0x7;
+static const uint64_t URING_PTR_MASK = 0x0000fffffffffff8ull;
+
+static uint64_t PollData(int fd, IOManager::EventType type, uint32_t seq) {
+    return (uint64_t)fd << 32 | (uint64_t)(seq & 0x0fffffff) << 4 |
+           (type == IOManager::WRITE ? 0x8 : 0) | URING_POLL;
+}
+
+/**
+ * 当前线程缓存的 reactor，只在 t_reactor_owner 是它所属的 IOManager 时有效
+ */
+static thread_local const IOManager* t_reactor_owner = nullptr;
+static thread_local void* t_reactor = nullptr;
+
+/**
+ * 等待直接提交的操作完成（或者 multishot accept 来了新连接）的协程
+ */
+struct IOManager::IoWait {
+    IoWait(int fd, EventType type) : fd(fd), type(type) {}
+
+    int fd;
+    EventType type;
+    int64_t res = 0;
+    FiberWaiter waiter;
+};
+
+/**
+ * 监听的 fd 上 multishot accept 接受的连接；请求还在内核中时 self 指向自己，
+ * 最后一个完成事件（没有 IORING_CQE_F_MORE）到达时才释放
+ */
+struct IOManager::AcceptQueue {
+    using ptr = std::shared_ptr<AcceptQueue>;
+
+    explicit AcceptQueue(int fd)
+        : fd(fd), data((uint64_t)(uintptr_t)this | URING_ACCEPT) {}
+    ~AcceptQueue() {
+        for (int conn : fds) {
+            ::close(conn);
+        }
+    }
+
+    Mutex mutex;
+    int fd;
+    uint64_t data;
+    std::deque<int> fds;
+    int error = 0;
+    bool armed = false;
+    bool accepted = false;
+    /**
+     * fd 已经关闭，请求取消之后还会来一个最后的完成事件
+     */
+    bool cancelled = false;
+    ptr self;
+};
+
+/**
+ * stream socket 上 multishot recv 收到、还没有被读走的数据；
+ * 生命周期和 AcceptQueue 相同
+ */
+struct IOManager::RecvQueue {
+    using ptr = std::shared_ptr<RecvQueue>;
+
+    explicit RecvQueue(int fd)
+        : fd(fd), data((uint64_t)(uintptr_t)this | URING_RECV) {}
+
+    size_t available() const { return buffer.size() - offset; }
+
+    void append(const char* buf, size_t len) {
+        /**
+         * 读走的部分超过一半时才挪动，均摊下来每个字节只挪一次
+         */
+        if (offset && offset >= buffer.size() / 2) {
+            buffer.erase(0, offset);
+            offset = 0;
+        }
+        buffer.append(buf, len);
+    }
+
+    /**
+     * 把数据按顺序拷到 iov 中，peek 时不取走，返回拷贝的字节数
+     */
+    size_t copyOut(const iovec* iov, int counts, bool peek) {
+        size_t pos = offset;
+        for (int i = 0; i < counts && pos < buffer.size(); ++i) {
+            size_t n = std::min(iov[i].iov_len, buffer.size() - pos);
+            memcpy(iov[i].iov_base, &buffer[pos], n);
+            pos += n;
+        }
+        size_t copied = pos - offset;
+        if (!peek) {
+            offset = pos;
+            if (offset == buffer.size()) {
+                buffer.clear();
+                offset = 0;
+            }
+        }
+        return copied;
+    }
+
+    Mutex mutex;
+    int fd;
+    uint64_t data;
+    std::string buffer;
+    size_t offset = 0;
+    int error = 0;
+    bool eof = false;
+    bool armed = false;
+    bool received = false;
+    /**
+     * 积压太多，已经取消了内核中的请求，读走之后再提交
+     */
+    bool throttled = false;
+    bool cancelled = false;
+    ptr self;
+};
+
+/**
+ * READ / READ_FIXED / READV / RECV / RECVMSG 请求的目标缓冲区，
+ * 其他操作返回 false
+ */
+static bool RequestIovecs(const IOManager::IoRequest& req, iovec& single,
+                          const iovec*& iov, int& counts) {
+    switch (req.opcode) {
+        case IORING_OP_READ:
+        case IORING_OP_READ_FIXED:
+        case IORING_OP_RECV:
+            single.iov_base = (void*)(uintptr_t)req.addr;
+            single.iov_len = req.len;
+            iov = &single;
+            counts = 1;
+            return true;
+        case IORING_OP_READV:
+            iov = (const iovec*)(uintptr_t)req.addr;
+            counts = req.len;
+            return true;
+        case IORING_OP_RECVMSG: {
+            const msghdr* msg = (const msghdr*)(uintptr_t)req.addr;
+            iov = msg->msg_iov;
+            counts = msg->msg_iovlen;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void IOManager::Event::triggerEvent(IOManager::EventType type,
+                                    pid_t thread_id) {
     TIHI_ASSERT((types_ & type));
     /**
      * 事件触发后需要将对应的事件取消掉，否则会有 errno: 2 - No such file or
@@ -27,10 +256,21 @@ void IOManager::Event::triggerEvent(IOManager::EventType type) {
      */
     types_ = static_cast<EventType>(types_ & ~type);
     EventContext& ectx = event_context(type);
+    ectx.uring_data_ = 0;
     if (ectx.cb_) {
-        ectx.scheduler_->schedule(&(ectx.cb_));
+        ectx.scheduler_->schedule(&(ectx.cb_), Scheduler::Priority::HIGH,
+                                  thread_id);
     } else if (ectx.fiber_) {
-        ectx.scheduler_->schedule((&ectx.fiber_));
+        ectx.scheduler_->schedule((&ectx.fiber_), Scheduler::Priority::HIGH,
+                                  thread_id);
+    } else if (ectx.wait_) {
+        /**
+         * 等待者在协程栈上，唤醒之后就不能再碰了
+         */
+        IoWait* wait = ectx.wait_;
+        ectx.wait_ = nullptr;
+        wait->waiter.thread_id = thread_id;
+        wait->waiter.wake();
     }
 
     ectx.scheduler_ = nullptr;
@@ -56,56 +296,212 @@ void IOManager::Event::resetEventContext(IOManager::Event::EventContext& ectx) {
     ectx.fiber_.reset();
     ectx.cb_ = nullptr;
     ectx.scheduler_ = nullptr;
+    ectx.uring_data_ = 0;
+    ectx.wait_ = nullptr;
 }
 
-IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    : Scheduler(threads, use_caller, name) {
-    epfd_ = epoll_create(5000);
-    TIHI_ASSERT((epfd_ >= 0));
+/**
+ * 默认模式下点名唤醒用的信号。和 Go 运行时的抢占一样借用 SIGURG：
+ * 默认动作是忽略，一般程序用不到；不是实时信号，连发几次也只挂起一个
+ */
+static int WakeupSignal() { return SIGURG; }
 
-    int ret = pipe(pipefd_);
-    TIHI_ASSERT((ret == 0));
+static void WakeupHandler(int sig) {}
 
-    struct epoll_event event;
-    memset(&event, 0, sizeof(event));
+static bool InstallWakeupHandler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &WakeupHandler;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(WakeupSignal(), &sa, nullptr)) {
+        TIHI_LOG_ERROR(g_sys_logger)
+            << "sigaction failed, errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
 
-    ret = fcntl(pipefd_[0], F_SETFL, O_NONBLOCK);
-    TIHI_ASSERT(ret == 0);
-    event.data.fd = pipefd_[0];
-    event.events = EPOLLIN | EPOLLET;
+static bool WakeupHandlerInstalled() {
+    static bool s_installed = InstallWakeupHandler();
+    return s_installed;
+}
 
-    ret = epoll_ctl(epfd_, EPOLL_CTL_ADD, pipefd_[0], &event);
-    TIHI_ASSERT((ret == 0));
+IOManager::IOManager(size_t threads, bool use_caller, const std::string& name,
+                     Backend backend)
+    : Scheduler(threads, use_caller, name),
+      backend_(backend),
+      events_([](Event& event, int fd) { event.fd_ = fd; }) {
+    if (backend_ == Backend::IO_URING) {
+        if (IoUring::Supported()) {
+            ring_.reset(new IoUring(g_io_uring_entries->value(),
+                                    g_io_uring_sqpoll_idle_ms->value()));
+        }
+        if (ring_ && ring_->valid()) {
+            if (g_reactor_per_thread->value()) {
+                TIHI_LOG_WARN(g_sys_logger)
+                    << "iomanager.reactor_per_thread only applies to the "
+                       "epoll backend, IOManager "
+                    << name << " shares one io_uring";
+            }
+            if (g_epoll_persistent->value()) {
+                TIHI_LOG_WARN(g_sys_logger)
+                    << "iomanager.epoll_persistent only applies to the epoll "
+                       "backend, IOManager "
+                    << name << " re-arms every poll";
+            }
+            multishot_accept_ = g_io_uring_multishot_accept->value();
+            signal_wakeup_ = WakeupHandlerInstalled();
+            if (g_io_uring_multishot_recv->value()) {
+                uint32_t counts = g_io_uring_recv_buffers->value();
+                while (counts & (counts - 1)) {
+                    counts &= counts - 1;
+                }
+                int rt = ring_->setupBufRing(
+                    RECV_BUFFER_GROUP, std::min<uint32_t>(counts, 32768),
+                    g_io_uring_recv_buffer_size->value());
+                if (rt) {
+                    TIHI_LOG_WARN(g_sys_logger)
+                        << "provided buffer ring is not available ("
+                        << strerror(-rt) << "), IOManager " << name
+                        << " does not use multishot recv";
+                } else {
+                    multishot_recv_ = true;
+                    recv_queue_limit_ = g_io_uring_recv_queue_limit->value();
+                }
+            }
+            start();
+            return;
+        }
+        TIHI_LOG_WARN(g_sys_logger)
+            << "io_uring is not supported, IOManager " << name
+            << " falls back to epoll";
+        ring_.reset();
+        backend_ = Backend::EPOLL;
+    }
+
+    sharded_ = g_reactor_per_thread->value();
+    persistent_ = g_epoll_persistent->value();
+    /**
+     * 调度线程加上 caller 线程
+     */
+    size_t reactor_counts =
+        sharded_ ? thread_count_ + (root_thread_id_ != -1 ? 1 : 0) : 1;
+    for (size_t i = 0; i < reactor_counts; ++i) {
+        Reactor* reactor = new Reactor;
+        reactors_.emplace_back(reactor);
+        reactor->index = i;
+        reactor->epfd = epoll_create(5000);
+        TIHI_ASSERT((reactor->epfd >= 0));
+
+        reactor->wakefd =
+            eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE);
+        TIHI_ASSERT((reactor->wakefd >= 0));
 
-    resize(32);
+        /**
+         * 水平触发：一个线程取走一次唤醒后还有剩下的，epoll 会接着叫醒别的线程
+         */
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.data.fd = reactor->wakefd;
+        event.events = EPOLLIN;
+
+        int ret = epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, reactor->wakefd,
+                            &event);
+        TIHI_ASSERT((ret == 0));
+    }
+    if (sharded_) {
+        /**
+         * reactor 和线程一一对应，线程不能增减
+         */
+        disableElastic();
+    } else {
+        signal_wakeup_ = WakeupHandlerInstalled();
+    }
 
     start();
+
+    if (sharded_) {
+        /**
+         * start() 之后 thread_ids_ 不再变化，caller 线程在最前面
+         */
+        for (size_t i = 0; i < reactors_.size(); ++i) {
+            reactors_[i]->thread_id = thread_ids_[i];
+        }
+    }
 }
 
 IOManager::~IOManager() {
     stop();
-    close(epfd_);
-    close(pipefd_[0]);
-    close(pipefd_[1]);
+    if (ring_) {
+        /**
+         * 还挂在监听 fd 上的 multishot accept / recv 随 io_uring 一起销毁
+         */
+        events_.forEach([](Event& e) {
+            if (e.accepts_) {
+                e.accepts_->self.reset();
+            }
+            if (e.recvs_) {
+                e.recvs_->self.reset();
+            }
+        });
+        ring_.reset();
+    }
+    for (auto& reactor : reactors_) {
+        close(reactor->epfd);
+        close(reactor->wakefd);
+    }
+    if (t_reactor_owner == this) {
+        t_reactor_owner = nullptr;
+        t_reactor = nullptr;
+    }
+}
 
-    for (auto e : events_) {
-        if (e) {
-            delete (e);
-        }
+IOManager::Backend IOManager::DefaultBackend() {
+    return BackendFromString(g_iomanager_backend->value());
+}
+
+const char* IOManager::BackendToString(Backend backend) {
+    switch (backend) {
+        case Backend::IO_URING:
+            return "io_uring";
+        default:
+            return "epoll";
     }
 }
 
-int IOManager::addEvent(int fd, EventType type, std::function<void()> cb) {
-    mutex_type::read_lock lock(mutex_);
-    Event* event = nullptr;
-    if (events_.size() > (size_t)fd) {
-        event = events_[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        mutex_type::write_lock lock2(mutex_);
-        resize(fd * 1.5);
-        event = events_[fd];
+IOManager::Backend IOManager::BackendFromString(const std::string& str) {
+    if (str == "io_uring") {
+        return Backend::IO_URING;
+    }
+    return Backend::EPOLL;
+}
+
+IOManager::Event* IOManager::getEvent(int fd, bool auto_create) {
+    return auto_create ? events_.getOrCreate(fd) : events_.get(fd);
+}
+
+int IOManager::addEvent(int fd, EventType type, Task cb) {
+    return addEvent(fd, type, std::move(cb), nullptr);
+}
+
+int IOManager::waitEvent(int fd, EventType type) {
+    IoWait wait(fd, type);
+    int rt = addEvent(fd, type, nullptr, &wait);
+    if (rt < 0) {
+        return -1;
+    }
+    if (rt == 0) {
+        wait.waiter.yield();
+    }
+    return 0;
+}
+
+int IOManager::addEvent(int fd, EventType type, Task cb, IoWait* wait) {
+    Event* event = getEvent(fd, true);
+    if (!event) {
+        TIHI_LOG_ERROR(g_sys_logger) << "addEvent error: fd: " << fd
+                                     << " is out of range";
+        return -1;
     }
 
     Event::mutex_type::mutex lock2(event->mutex_);
@@ -116,35 +512,72 @@ int IOManager::addEvent(int fd, EventType type, std::function<void()> cb) {
         TIHI_ASSERT(((event->types_ & type) == 0));
     }
 
-    int op = event->types_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    memset(&epevent, 0, sizeof(epevent));
-    epevent.data.ptr = event;
-    epevent.events = event->types_ | EPOLLET | type;
-    int rt = epoll_ctl(epfd_, op, fd, &epevent);
-    if (rt) {
-        TIHI_LOG_ERROR(g_sys_logger)
-            << "rt: " << rt << " epoll_ctl(" << epfd_ << ", " << op << ", "
-            << fd << ", " << epevent.events << ") errno: " << errno << " - "
-            << strerror(errno);
-        return -1;
+    event->fd_ = fd;
+    bool ready = false;
+    if (ring_) {
+        if (addUringEvent(event, type)) {
+            return -1;
+        }
+    } else {
+        if (!event->owner_) {
+            event->owner_ = bindingReactor();
+        }
+        /**
+         * 常驻注册模式下只在第一次注册，之后只看就绪标志
+         */
+        if (!persistent_ || !event->registered_) {
+            int epfd = event->owner_->epfd;
+            int op = event->types_ ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+            epoll_event epevent;
+            memset(&epevent, 0, sizeof(epevent));
+            epevent.data.ptr = event;
+            epevent.events = persistent_ ? EPOLLIN | EPOLLOUT | EPOLLET
+                                         : event->types_ | EPOLLET | type;
+            SyscallStats::Add(SyscallStats::EPOLL_CTL);
+            int rt = epoll_ctl(epfd, op, fd, &epevent);
+            if (rt) {
+                TIHI_LOG_ERROR(g_sys_logger)
+                    << "rt: " << rt << " epoll_ctl(" << epfd << ", " << op
+                    << ", " << fd << ", " << epevent.events
+                    << ") errno: " << errno << " - " << strerror(errno);
+                return -1;
+            }
+            event->registered_ = persistent_;
+        }
+        if (event->ready_ & type) {
+            event->ready_ &= ~type;
+            if (wait) {
+                return 1;
+            }
+            ready = true;
+        } else {
+            ++pending_event_counts_;
+        }
     }
 
-    ++pending_event_counts_;
     event->types_ = (EventType)(event->types_ | type);
-    event->fd_ = fd;
     Event::EventContext& event_context = event->event_context(type);
-    TIHI_ASSERT((event_context.cb_ == nullptr &&
+    TIHI_ASSERT((!event_context.cb_ &&
                  event_context.fiber_ == nullptr &&
                  event_context.scheduler_ == nullptr));
     event_context.scheduler_ = Scheduler::This();
     if (cb) {
-        event_context.cb_.swap(cb);
+        event_context.cb_ = std::move(cb);
+    } else if (wait) {
+        event_context.wait_ = wait;
     } else {
         event_context.fiber_ = Fiber::This();
         TIHI_ASSERT((event_context.fiber_->state() == Fiber::EXEC));
     }
 
+    if (ready) {
+        /**
+         * 当前协程还没有切出，只能放回本线程，切出之后才会被执行
+         */
+        event->triggerEvent(type, event_context.fiber_ ? ThreadId()
+                                                       : resumeThread(event));
+    }
+
     return 0;
 }
 
@@ -152,12 +585,10 @@ int IOManager::addEvent(int fd, EventType type, std::function<void()> cb) {
  * type 中要删掉的类型，位为 1
  */
 bool IOManager::delEvent(int fd, EventType type) {
-    mutex_type::read_lock lock(mutex_);
-    if (events_.size() <= (size_t)fd) {
+    Event* event = getEvent(fd, false);
+    if (!event) {
         return false;
     }
-    Event* event = events_[fd];
-    lock.unlock();
 
     Event::mutex_type::mutex lock2(event->mutex_);
     /**
@@ -167,26 +598,36 @@ bool IOManager::delEvent(int fd, EventType type) {
     if (!(event->types_ & type)) {
         return false;
     }
+    if (ring_) {
+        return cancelUringEvent(event, type, false);
+    }
 
     /**
      * 设定要删除的位在 new_type 中会为 0，其他位保持不变
      */
     EventType new_types = (EventType)(event->types_ & ~type);
     /**
-     * EPOLL_CTL_DEL 会忽略 event（第四个参数）
+     * 常驻注册的 fd 不改注册，之后到来的边沿记成就绪标志
      */
-    int op = new_types ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    memset(&epevent, 0, sizeof(epevent));
-    epevent.events = EPOLLET | new_types;
-    epevent.data.ptr = event;
-    int rt = epoll_ctl(epfd_, op, fd, &epevent);
-    if (rt) {
-        TIHI_LOG_ERROR(g_sys_logger)
-            << "rt: " << rt << " epoll_ctl(" << epfd_ << ", " << op << ", "
-            << fd << ", " << epevent.events << ") errno: " << errno << " - "
-            << strerror(errno);
-        return false;
+    if (!event->registered_) {
+        /**
+         * EPOLL_CTL_DEL 会忽略 event（第四个参数）
+         */
+        int op = new_types ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        memset(&epevent, 0, sizeof(epevent));
+        epevent.events = EPOLLET | new_types;
+        epevent.data.ptr = event;
+        int epfd = event->owner_->epfd;
+        SyscallStats::Add(SyscallStats::EPOLL_CTL);
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt) {
+            TIHI_LOG_ERROR(g_sys_logger)
+                << "rt: " << rt << " epoll_ctl(" << epfd << ", " << op << ", "
+                << fd << ", " << epevent.events << ") errno: " << errno
+                << " - " << strerror(errno);
+            return false;
+        }
     }
 
     --pending_event_counts_;
@@ -198,12 +639,10 @@ bool IOManager::delEvent(int fd, EventType type) {
 }
 
 bool IOManager::cancelEvent(int fd, EventType type) {
-    mutex_type::read_lock lock(mutex_);
-    if (events_.size() <= (size_t)fd) {
+    Event* event = getEvent(fd, false);
+    if (!event) {
         return false;
     }
-    Event* event = events_[fd];
-    lock.unlock();
 
     Event::mutex_type::mutex lock2(event->mutex_);
     /**
@@ -213,74 +652,136 @@ bool IOManager::cancelEvent(int fd, EventType type) {
     if (!(event->types_ & type)) {
         return false;
     }
+    if (ring_) {
+        return cancelUringEvent(event, type, true);
+    }
 
     /**
      * 设定要删除的位在 new_type 中会为 0，其他位保持不变
      */
     EventType new_types = (EventType)(event->types_ & ~type);
     /**
-     * EPOLL_CTL_DEL 会忽略 event（第四个参数）
+     * 常驻注册的 fd 不改注册，之后到来的边沿记成就绪标志
      */
-    int op = new_types ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    memset(&epevent, 0, sizeof(epevent));
-    epevent.events = EPOLLET | new_types;
-    epevent.data.ptr = event;
-    int rt = epoll_ctl(epfd_, op, fd, &epevent);
-    if (rt) {
-        TIHI_LOG_ERROR(g_sys_logger)
-            << "rt: " << rt << " epoll_ctl(" << epfd_ << ", " << op << ", "
-            << fd << ", " << epevent.events << ") errno: " << errno << " - "
-            << strerror(errno);
-        return false;
+    if (!event->registered_) {
+        /**
+         * EPOLL_CTL_DEL 会忽略 event（第四个参数）
+         */
+        int op = new_types ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        memset(&epevent, 0, sizeof(epevent));
+        epevent.events = EPOLLET | new_types;
+        epevent.data.ptr = event;
+        int epfd = event->owner_->epfd;
+        SyscallStats::Add(SyscallStats::EPOLL_CTL);
+        int rt = epoll_ctl(epfd, op, fd, &epevent);
+        if (rt) {
+            TIHI_LOG_ERROR(g_sys_logger)
+                << "rt: " << rt << " epoll_ctl(" << epfd << ", " << op << ", "
+                << fd << ", " << epevent.events << ") errno: " << errno
+                << " - " << strerror(errno);
+            return false;
+        }
     }
 
-    event->triggerEvent(type);
+    event->triggerEvent(type, resumeThread(event));
     --pending_event_counts_;
 
     return true;
 }
 
 bool IOManager::cancelAll(int fd) {
-    mutex_type::read_lock lock(mutex_);
-    if (events_.size() <= static_cast<size_t>(fd)) {
+    Event* event = getEvent(fd, false);
+    if (!event) {
         return false;
     }
-    Event* event = events_[fd];
-    lock.unlock();
 
     Event::mutex_type::mutex lock2(event->mutex_);
+    if (ring_) {
+        bool cancelled = false;
+        if (event->accepts_) {
+            /**
+             * 取消 multishot accept，还没被取走的连接随队列一起关闭
+             */
+            AcceptQueue::ptr queue;
+            queue.swap(event->accepts_);
+            Mutex::mutex lock3(queue->mutex);
+            queue->cancelled = true;
+            if (queue->armed) {
+                ++pending_event_counts_;
+                cancelUringRequest(queue->data);
+            }
+            cancelled = true;
+        }
+        if (event->recvs_) {
+            /**
+             * 没有读走的数据随队列一起丢掉
+             */
+            RecvQueue::ptr queue;
+            queue.swap(event->recvs_);
+            Mutex::mutex lock3(queue->mutex);
+            queue->cancelled = true;
+            if (queue->armed) {
+                ++pending_event_counts_;
+                cancelUringRequest(queue->data);
+            }
+            cancelled = true;
+        }
+        event->recv_single_ = false;
+        if (event->types_ & READ) {
+            cancelUringEvent(event, READ, true);
+            cancelled = true;
+        }
+        if (event->types_ & WRITE) {
+            cancelUringEvent(event, WRITE, true);
+            cancelled = true;
+        }
+        event->fd_ = -1;
+        return cancelled;
+    }
     /**
      * 该描述符本来就不存在
      */
-    if (!(event->types_)) {
+    if (!event->types_ && !event->registered_) {
+        event->owner_ = nullptr;
         return false;
     }
 
-    int rt = epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, NULL);
+    bool cancelled = event->types_ != NONE;
+    int epfd = event->owner_->epfd;
+    SyscallStats::Add(SyscallStats::EPOLL_CTL);
+    int rt = epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
     if (rt) {
         TIHI_LOG_ERROR(g_sys_logger)
-            << "rt: " << rt << " epoll_ctl(" << epfd_ << ", " << EPOLL_CTL_DEL
+            << "rt: " << rt << " epoll_ctl(" << epfd << ", " << EPOLL_CTL_DEL
             << ", " << fd << ", " << 0 << ") errno: " << errno << " - "
             << strerror(errno);
         return false;
     }
 
+    event->registered_ = false;
+    event->ready_ = NONE;
+
+    pid_t thread_id = resumeThread(event);
     if (event->types_ & READ) {
-        event->triggerEvent(READ);
+        event->triggerEvent(READ, thread_id);
         --pending_event_counts_;
     }
     if (event->types_ & WRITE) {
-        event->triggerEvent(WRITE);
+        event->triggerEvent(WRITE, thread_id);
 
         --pending_event_counts_;
     }
 
     event->fd_ = -1;
+    /**
+     * fd 要被关闭了，编号复用时重新绑定
+     */
+    event->owner_ = nullptr;
 
     TIHI_ASSERT((event->types_ == 0));
 
-    return true;
+    return cancelled;
 }
 
 IOManager* IOManager::This() {
@@ -288,10 +789,191 @@ IOManager* IOManager::This() {
 }
 
 void IOManager::tickle() {
-    if (hasIdleThread()) {
-        int ret = ::write(pipefd_[1], "T", 1);
-        TIHI_ASSERT((ret == 1));
+    if (!hasIdleThread() || skipTickle()) {
+        return;
+    }
+    wakeIdleThread();
+}
+
+void IOManager::tickleThread(pid_t thread_id) {
+    if (sharded_) {
+        Reactor* reactor = findReactor(thread_id);
+        if (reactor) {
+            wakeReactor(reactor);
+        }
+        return;
+    }
+    if (signal_wakeup_ && thread_id != -1) {
+        /**
+         * 信号只打断目标线程的 epoll_pwait / io_uring_enter
+         */
+        SyscallStats::Add(SyscallStats::TICKLE);
+        if (syscall(SYS_tgkill, getpid(), thread_id, WakeupSignal()) == 0) {
+            countTickleSent();
+            return;
+        }
+    }
+    wakeIdleThread();
+}
+
+/**
+ * 抢到发出唤醒的资格返回 true；已经有 limit 次唤醒没被收走时返回 false，
+ * 这次唤醒和它们合并。先读一次，避免每次都独占缓存行
+ */
+static bool ClaimWakeup(std::atomic<uint32_t>& pending, uint32_t limit) {
+    uint32_t counts = pending.load(std::memory_order_relaxed);
+    while (counts < limit) {
+        if (pending.compare_exchange_weak(counts, counts + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t IOManager::wakeupLimit() const {
+    return std::max<uint32_t>(idle_thread_count_, 1);
+}
+
+void IOManager::wakeReactor(Reactor* reactor, uint32_t limit) {
+    if (!ClaimWakeup(reactor->wakeup_pending, limit)) {
+        countTickleCoalesced();
+        return;
+    }
+    SyscallStats::Add(SyscallStats::TICKLE);
+    uint64_t one = 1;
+    int ret = ::write(reactor->wakefd, &one, sizeof(one));
+    TIHI_ASSERT((ret == sizeof(one)));
+    countTickleSent();
+}
+
+void IOManager::wakeIdleThread() {
+    if (!hasIdleThread()) {
+        return;
+    }
+    if (sharded_) {
+        /**
+         * 只有空闲线程自己的 epoll_wait 能被它的 eventfd 叫醒
+         */
+        Reactor* reactor = findReactor(idleThread());
+        if (reactor) {
+            wakeReactor(reactor);
+        }
+        return;
+    }
+    if (ring_) {
+        /**
+         * 空操作的完成事件会叫醒等在 io_uring_enter 里的线程
+         */
+        if (!ClaimWakeup(uring_wakeup_pending_, wakeupLimit())) {
+            countTickleCoalesced();
+            return;
+        }
+        IoUring::mutex_type::mutex lock(ring_->sq_mutex());
+        io_uring_sqe* sqe = ring_->getSqe();
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = URING_TICKLE;
+        ring_->submit();
+        countTickleSent();
+    } else {
+        /**
+         * 每个空闲线程都可以有一次唤醒在路上，一连串的 tickle 能叫醒多个线程
+         */
+        wakeReactor(reactors_[0].get(), wakeupLimit());
+    }
+}
+
+IOManager::Reactor* IOManager::localReactor() {
+    if (!sharded_) {
+        return reactors_.empty() ? nullptr : reactors_[0].get();
+    }
+    if (t_reactor_owner == this) {
+        return static_cast<Reactor*>(t_reactor);
+    }
+    Reactor* reactor = findReactor(ThreadId());
+    if (reactor) {
+        t_reactor_owner = this;
+        t_reactor = reactor;
+    }
+    return reactor;
+}
+
+IOManager::Reactor* IOManager::findReactor(pid_t thread_id) {
+    if (thread_id == -1 || !sharded_) {
+        return nullptr;
     }
+    /**
+     * 调度线程开始运行时 start() 已经登记完 thread_ids_，
+     * 这时构造函数可能还没来得及设置 Reactor::thread_id
+     */
+    for (size_t i = 0; i < thread_ids_.size() && i < reactors_.size(); ++i) {
+        if (thread_ids_[i] == thread_id) {
+            reactors_[i]->thread_id = thread_id;
+            return reactors_[i].get();
+        }
+    }
+    return nullptr;
+}
+
+IOManager::Reactor* IOManager::nextReactor() {
+    size_t counts = reactors_.size();
+    /**
+     * caller 线程在最前面
+     */
+    size_t skip = (root_thread_id_ != -1 && counts > 1) ? 1 : 0;
+    size_t index = next_reactor_.fetch_add(1, std::memory_order_relaxed);
+    return reactors_[skip + index % (counts - skip)].get();
+}
+
+IOManager::Reactor* IOManager::bindingReactor() {
+    Reactor* reactor = localReactor();
+    return reactor ? reactor : nextReactor();
+}
+
+pid_t IOManager::resumeThread(Event* event) {
+    if (!sharded_ || !event->owner_) {
+        return -1;
+    }
+    return event->owner_->thread_id;
+}
+
+int IOManager::bindFd(int fd, int index) {
+    if (!sharded_) {
+        return -1;
+    }
+    Event* event = getEvent(fd, true);
+    if (!event) {
+        return -1;
+    }
+    Reactor* reactor = (index >= 0 && (size_t)index < reactors_.size())
+                           ? reactors_[index].get()
+                           : nextReactor();
+    Event::mutex_type::mutex lock(event->mutex_);
+    /**
+     * 没有事件（也没有常驻注册）时 fd 不在任何 epoll 实例中，可以直接换
+     */
+    if (!event->types_ && !event->registered_) {
+        event->owner_ = reactor;
+    }
+    return event->owner_->index;
+}
+
+int IOManager::fdReactor(int fd) {
+    if (fd < 0) {
+        return -1;
+    }
+    Event* event = getEvent(fd, false);
+    if (!event) {
+        return -1;
+    }
+    Event::mutex_type::mutex lock(event->mutex_);
+    return event->owner_ ? (int)event->owner_->index : -1;
+}
+
+pid_t IOManager::reactorThread(int index) const {
+    if (!sharded_ || index < 0 || (size_t)index >= reactors_.size()) {
+        return -1;
+    }
+    return reactors_[index]->thread_id;
 }
 
 bool IOManager::stopping(uint64_t& timeout) {
@@ -309,6 +991,29 @@ void IOManager::idle() {
     epoll_event* events = new epoll_event[64]();
     std::shared_ptr<epoll_event> shared_event(
         events, [](epoll_event* ptr) { delete[] ptr; });
+    /**
+     * 放在循环外面，每轮复用同一块内存
+     */
+    std::vector<Task> cbs;
+    Reactor* reactor = ring_ ? nullptr : localReactor();
+    TIHI_ASSERT((ring_ || reactor));
+    /**
+     * 点名唤醒的信号平时屏蔽掉，只在等待期间放开：
+     * 等待之前到的信号挂起着，一进入等待就返回，不会丢
+     */
+    sigset_t old_mask;
+    sigset_t wait_mask;
+    sigemptyset(&old_mask);
+    sigemptyset(&wait_mask);
+    if (signal_wakeup_) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, WakeupSignal());
+        pthread_sigmask(SIG_BLOCK, &set, &old_mask);
+        wait_mask = old_mask;
+        sigdelset(&wait_mask, WakeupSignal());
+    }
+    const sigset_t* sigmask = signal_wakeup_ ? &wait_mask : nullptr;
 
     while (true) {
         int ret = 0;
@@ -316,104 +1021,716 @@ void IOManager::idle() {
 
         if (stopping(time_out) && time_out == ~0ul) {
             TIHI_LOG_INFO(g_sys_logger) << "idle exits";
+            /**
+             * stop() 发出的唤醒可能被自旋的线程或者先退出的线程读走了，
+             * 退出前再叫醒一个还在 epoll_wait 里的线程，让它也看到要停止；
+             * sharded 模式下每个线程等自己的 epoll，全部叫一遍
+             */
+            if (sharded_) {
+                for (auto& other : reactors_) {
+                    if (other.get() != reactor) {
+                        wakeReactor(other.get());
+                    }
+                }
+            } else {
+                wakeIdleThread();
+            }
+            break;
+        }
+        if (retiring()) {
+            TIHI_LOG_INFO(g_sys_logger) << "idle retires";
             break;
         }
 
         do {
             static const int MAX_TIMEOUT = 3000;
+            /**
+             * 弹性模式下要定期醒来看看是不是空闲太久了
+             */
+            int max_timeout = MAX_TIMEOUT;
+            if (retireCheckMs()) {
+                max_timeout = std::min((int)retireCheckMs(), MAX_TIMEOUT);
+            }
 
             if (time_out != ~0ul) {
-                time_out = std::min((int)time_out, MAX_TIMEOUT);
+                time_out = std::min((int)time_out, max_timeout);
             } else {
-                time_out = MAX_TIMEOUT;
+                time_out = max_timeout;
             }
 
-            ret = epoll_wait(epfd_, events, 64, (int)time_out);
+            if (ring_) {
+                if (ring_->wait((int)time_out, sigmask) == -EINTR &&
+                    signal_wakeup_) {
+                    countTickleReceived();
+                }
+                break;
+            }
+            SyscallStats::Add(SyscallStats::EPOLL_WAIT);
+            ret = epoll_pwait(reactor->epfd, events, 64, (int)time_out,
+                              sigmask);
             if (ret == -1 && errno == EINTR) {
+                /**
+                 * 被点名唤醒，回调度协程看信箱
+                 */
+                if (signal_wakeup_) {
+                    ret = 0;
+                    countTickleReceived();
+                    break;
+                }
             } else {
                 break;
             }
         } while (true);
 
+        scheduleExpiredTimers(cbs);
+        if (ring_) {
+            handleCompletions();
+        } else {
+            handleEvents(reactor, events, ret);
+        }
+
+        Fiber::ptr curr = Fiber::This();
+        Fiber* raw_ptr = curr.get();
+        curr.reset();
+
+        raw_ptr->swapOut();
+    }
+    if (signal_wakeup_) {
+        pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+}
+
+bool IOManager::poll() {
+    std::vector<Task> cbs;
+    if (ring_) {
         /**
-         * 将所有超时任务加入任务队列
+         * 完成队列是共享内存，不用系统调用
          */
-        std::vector<std::function<void()>> cbs;
-        expiredTimerCb(cbs);
-        if (!cbs.empty()) {
-            // TIHI_LOG_DEBUG(g_sys_logger) << "size = " << cbs.size();
-            schedule(cbs.begin(), cbs.end());
-            cbs.clear();
-        }
-
-        for (int i = 0; i < ret; ++i) {
-            epoll_event& event = events[i];
-            if (event.data.fd == pipefd_[0]) {
-                char dummy;
-                while ((read(pipefd_[0], &dummy, 1) == 1))
-                    ;
+        bool scheduled = scheduleExpiredTimers(cbs);
+        return handleCompletions() > 0 || scheduled;
+    }
+    Reactor* reactor = localReactor();
+    if (!reactor) {
+        return scheduleExpiredTimers(cbs);
+    }
+    epoll_event events[64];
+    SyscallStats::Add(SyscallStats::EPOLL_WAIT);
+    int ret = epoll_wait(reactor->epfd, events, 64, 0);
+    bool scheduled = scheduleExpiredTimers(cbs);
+    return handleEvents(reactor, events, ret) > 0 || scheduled;
+}
+
+bool IOManager::scheduleExpiredTimers(std::vector<Task>& cbs) {
+    /**
+     * 将所有超时任务加入任务队列
+     */
+    expiredTimerCb(cbs);
+    if (cbs.empty()) {
+        return false;
+    }
+    schedule(cbs.begin(), cbs.end(), Priority::HIGH);
+    cbs.clear();
+    return true;
+}
+
+size_t IOManager::handleEvents(Reactor* reactor, epoll_event* events,
+                               int counts) {
+    size_t triggered = 0;
+    /**
+     * 事件都在本线程的 reactor 上，sharded 模式下协程就在本线程恢复
+     */
+    pid_t thread_id = sharded_ ? (pid_t)reactor->thread_id : -1;
+    for (int i = 0; i < counts; ++i) {
+        epoll_event& event = events[i];
+        if (event.data.fd == reactor->wakefd) {
+            /**
+             * 一次 read 取走一次唤醒，读完再减计数：减之前合并掉的唤醒由这次
+             * 代表，减之后的会重新写 eventfd；fetch_sub 和发出方的 CAS 配对，
+             * 合并掉的那些唤醒之前放进队列的任务在这之后都能看到。
+             * 水平触发下别的线程可能先读走了，这时什么也不做
+             */
+            uint64_t counts;
+            SyscallStats::Add(SyscallStats::TICKLE);
+            int ret = ::read(reactor->wakefd, &counts, sizeof(counts));
+            if (ret != sizeof(counts)) {
+                TIHI_ASSERT((errno == EAGAIN));
                 continue;
             }
+            reactor->wakeup_pending.fetch_sub(1);
+            countTickleReceived();
+            continue;
+        }
 
-            Event* e = (Event*)event.data.ptr;
-            Event::mutex_type::mutex lock(e->mutex_);
+        Event* e = (Event*)event.data.ptr;
+        Event::mutex_type::mutex lock(e->mutex_);
+        /**
+         * fd 已经关闭并且编号换绑到了别的 reactor，这是旧的事件
+         */
+        if (e->owner_ != reactor) {
+            continue;
+        }
 
-            if (event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= EPOLLIN | EPOLLOUT;
-            }
+        if (event.events & (EPOLLERR | EPOLLHUP)) {
+            event.events |= EPOLLIN | EPOLLOUT;
+        }
 
-            int real_types = NONE;
-            if (event.events & EPOLLIN) {
-                real_types |= READ;
-            }
-            if (event.events & EPOLLOUT) {
-                real_types |= WRITE;
-            }
+        int real_types = NONE;
+        if (event.events & EPOLLIN) {
+            real_types |= READ;
+        }
+        if (event.events & EPOLLOUT) {
+            real_types |= WRITE;
+        }
 
-            if ((e->types_ & real_types) == NONE) {
-                continue;
-            }
+        /**
+         * 常驻注册的 fd 上没人等的方向记下来，留给之后来等的
+         */
+        if (e->registered_) {
+            e->ready_ |= real_types & ~e->types_;
+        }
+        /**
+         * EPOLLERR / EPOLLHUP 时两种都算就绪，只触发真正在等的
+         */
+        real_types &= e->types_;
+        if (real_types == NONE) {
+            continue;
+        }
 
+        if (!e->registered_) {
             int left_type = e->types_ & ~real_types;
             int op = left_type ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
             event.events = EPOLLET | left_type;
-            int ret2 = epoll_ctl(epfd_, op, e->fd_, &event);
+            SyscallStats::Add(SyscallStats::EPOLL_CTL);
+            int ret2 = epoll_ctl(reactor->epfd, op, e->fd_, &event);
             if (ret2) {
                 TIHI_LOG_ERROR(g_sys_logger)
-                    << "rt: " << ret2 << " epoll_ctl(" << epfd_ << ", " << op
-                    << ", " << e->fd_ << ", " << event.events
+                    << "rt: " << ret2 << " epoll_ctl(" << reactor->epfd
+                    << ", " << op << ", " << e->fd_ << ", " << event.events
                     << ") errno: " << errno << " - " << strerror(errno);
                 continue;
             }
+        }
 
-            if (real_types & READ) {
-                e->triggerEvent(READ);
+        if (real_types & READ) {
+            e->triggerEvent(READ, thread_id);
+            --pending_event_counts_;
+            ++triggered;
+        }
+        if (real_types & WRITE) {
+            e->triggerEvent(WRITE, thread_id);
+            --pending_event_counts_;
+            ++triggered;
+        }
+    }
+    return triggered;
+}
+
+int IOManager::addUringEvent(Event* event, EventType type) {
+    uint64_t data = PollData(event->fd_, type, ++io_seq_);
+    ++pending_event_counts_;
+    IoUring::mutex_type::mutex lock(ring_->sq_mutex());
+    io_uring_sqe* sqe = ring_->getSqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = event->fd_;
+    /**
+     * EPOLLIN / EPOLLOUT 和 POLLIN / POLLOUT 的值相同
+     */
+    sqe->poll32_events = type;
+    sqe->user_data = data;
+    int rt = ring_->submit();
+    if (rt < 0) {
+        --pending_event_counts_;
+        return -1;
+    }
+    event->event_context(type).uring_data_ = data;
+    return 0;
+}
+
+void IOManager::cancelUringRequest(uint64_t data) {
+    IoUring::mutex_type::mutex lock(ring_->sq_mutex());
+    io_uring_sqe* sqe = ring_->getSqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->user_data = URING_IGNORE;
+    ring_->submit();
+}
+
+bool IOManager::cancelUringEvent(Event* event, EventType type, bool trigger) {
+    Event::EventContext& ectx = event->event_context(type);
+    uint64_t kind = ectx.uring_data_ & URING_KIND_MASK;
+    if (kind == URING_POLL) {
+        cancelUringRequest(ectx.uring_data_);
+        --pending_event_counts_;
+        if (trigger) {
+            event->triggerEvent(type);
+        } else {
+            event->types_ = (EventType)(event->types_ & ~type);
+            event->resetEventContext(ectx);
+        }
+        return true;
+    }
+    if (!trigger) {
+        return false;
+    }
+    if (kind == URING_IO) {
+        /**
+         * 操作还在内核中，等它的完成事件到了再唤醒协程；
+         * 这里就把位置让出来，fd 关闭后编号被复用也不会冲突
+         */
+        cancelUringRequest(ectx.uring_data_);
+        event->types_ = (EventType)(event->types_ & ~type);
+        event->resetEventContext(ectx);
+        return true;
+    }
+    /**
+     * 在等 multishot accept 的新连接或者 multishot recv 的数据，
+     * 内核中的请求留着给下一次用
+     */
+    ectx.wait_->res = -ECANCELED;
+    --pending_event_counts_;
+    event->triggerEvent(type);
+    return true;
+}
+
+bool IOManager::submitIo(int fd, EventType type, const IoRequest& req,
+                         int64_t& result) {
+    if (!ring_ || !getEvent(fd, true)) {
+        return false;
+    }
+    if (req.opcode == IORING_OP_ACCEPT && multishot_accept_) {
+        return acceptMultishot(fd, result);
+    }
+    if (type == READ && multishot_recv_ &&
+        recvMultishot(fd, req, false, result)) {
+        return true;
+    }
+
+    Event* event = getEvent(fd, false);
+    IoWait wait(fd, type);
+    uint64_t seq = ++io_seq_;
+    uint64_t data = (seq & 0xffff) << 48 | (uint64_t)(uintptr_t)&wait |
+                    URING_IO;
+    {
+        Event::mutex_type::mutex lock(event->mutex_);
+        if (event->types_ & type) {
+            TIHI_LOG_ERROR(g_sys_logger)
+                << "submitIo error: fd: " << fd
+                << " event.type: " << event->types_ << " type: " << type;
+            return false;
+        }
+
+        ++pending_event_counts_;
+        {
+            IoUring::mutex_type::mutex lock2(ring_->sq_mutex());
+            io_uring_sqe* sqe = ring_->getSqe();
+            sqe->opcode = req.opcode;
+            sqe->fd = fd;
+            sqe->addr = req.addr;
+            sqe->len = req.len;
+            sqe->off = req.off;
+            sqe->msg_flags = req.op_flags;
+            sqe->buf_index = req.buf_index;
+            sqe->user_data = data;
+            if (ring_->submit() < 0) {
                 --pending_event_counts_;
+                return false;
             }
-            if (real_types & WRITE) {
-                e->triggerEvent(WRITE);
-                --pending_event_counts_;
+        }
+
+        event->fd_ = fd;
+        event->types_ = (EventType)(event->types_ | type);
+        Event::EventContext& ectx = event->event_context(type);
+        ectx.scheduler_ = Scheduler::This();
+        ectx.uring_data_ = data;
+        ectx.wait_ = &wait;
+    }
+
+    wait.waiter.yield();
+    result = wait.res;
+    return true;
+}
+
+bool IOManager::acceptMultishot(int fd, int64_t& result) {
+    Event* event = getEvent(fd, true);
+    IoWait wait(fd, READ);
+    while (true) {
+        {
+            Event::mutex_type::mutex lock(event->mutex_);
+            if (!event->accepts_) {
+                event->accepts_.reset(new AcceptQueue(fd));
             }
+            AcceptQueue::ptr queue = event->accepts_;
+            Mutex::mutex lock2(queue->mutex);
+            if (!queue->fds.empty()) {
+                result = queue->fds.front();
+                queue->fds.pop_front();
+                return true;
+            }
+            if (queue->error) {
+                if (queue->error == -EINVAL && !queue->accepted) {
+                    /**
+                     * 内核不支持 multishot accept（5.19 之前）
+                     */
+                    TIHI_LOG_WARN(g_sys_logger)
+                        << "multishot accept is not supported";
+                    multishot_accept_ = false;
+                    lock2.unlock();
+                    event->accepts_.reset();
+                    return false;
+                }
+                result = queue->error;
+                queue->error = 0;
+                return true;
+            }
+            if (event->types_ & READ) {
+                TIHI_LOG_ERROR(g_sys_logger)
+                    << "acceptMultishot error: fd: " << fd
+                    << " is already being waited";
+                return false;
+            }
+            if (!queue->armed) {
+                IoUring::mutex_type::mutex lock3(ring_->sq_mutex());
+                io_uring_sqe* sqe = ring_->getSqe();
+                sqe->opcode = IORING_OP_ACCEPT;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+                sqe->user_data = queue->data;
+                if (ring_->submit() < 0) {
+                    return false;
+                }
+                queue->armed = true;
+                queue->self = queue;
+            }
+
+            ++pending_event_counts_;
+            event->fd_ = fd;
+            event->types_ = (EventType)(event->types_ | READ);
+            Event::EventContext& ectx = event->event_context(READ);
+            ectx.scheduler_ = Scheduler::This();
+            ectx.uring_data_ = queue->data;
+            ectx.wait_ = &wait;
         }
 
-        Fiber::ptr curr = Fiber::This();
-        Fiber* raw_ptr = curr.get();
-        curr.reset();
+        wait.waiter.yield();
+        if (wait.res < 0) {
+            result = wait.res;
+            return true;
+        }
+        wait.waiter.reset();
+    }
+}
 
-        raw_ptr->swapOut();
+bool IOManager::recvQueued(int fd) {
+    Event* event = ring_ ? getEvent(fd, false) : nullptr;
+    if (!event) {
+        return false;
     }
+    Event::mutex_type::mutex lock(event->mutex_);
+    return event->recvs_ != nullptr;
 }
 
-void IOManager::resize(size_t size) {
-    size_t old_size = events_.size();
+bool IOManager::tryRecvQueued(int fd, const IoRequest& req,
+                              int64_t& result) {
+    if (!ring_ || !getEvent(fd, false)) {
+        return false;
+    }
+    return recvMultishot(fd, req, true, result);
+}
 
-    events_.resize(size);
+bool IOManager::recvMultishot(int fd, const IoRequest& req, bool nonblock,
+                              int64_t& result) {
+    iovec single;
+    const iovec* iov = nullptr;
+    int counts = 0;
+    if (!RequestIovecs(req, single, iov, counts)) {
+        return false;
+    }
+    int flags = (req.opcode == IORING_OP_RECV ||
+                 req.opcode == IORING_OP_RECVMSG)
+                    ? (int)req.op_flags
+                    : 0;
+    size_t total = 0;
+    for (int i = 0; i < counts; ++i) {
+        total += iov[i].iov_len;
+    }
+    /**
+     * MSG_WAITALL 要攒够了才返回
+     */
+    size_t need = (flags & MSG_WAITALL) ? total : 1;
 
-    for (size_t i = old_size; i < events_.size(); ++i) {
-        if (!events_[i]) {
-            events_[i] = new Event;
-            events_[i]->fd_ = i;
+    Event* event = getEvent(fd, true);
+    IoWait wait(fd, READ);
+    while (true) {
+        {
+            Event::mutex_type::mutex lock(event->mutex_);
+            if (!event->recvs_) {
+                /**
+                 * 带标志的读不知道怎么和队列配合，READ_FIXED 要用注册的缓冲区，
+                 * 都不用来创建队列；队列建好之后它们也从队列中取
+                 */
+                if (nonblock || flags || event->recv_single_ ||
+                    req.opcode == IORING_OP_READ_FIXED) {
+                    return false;
+                }
+                int type = 0;
+                socklen_t len = sizeof(type);
+                if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) ||
+                    type != SOCK_STREAM) {
+                    event->recv_single_ = true;
+                    return false;
+                }
+                event->recvs_.reset(new RecvQueue(fd));
+            }
+            RecvQueue::ptr queue = event->recvs_;
+            Mutex::mutex lock2(queue->mutex);
+            size_t available = queue->available();
+            if (!total ||
+                (available &&
+                 (available >= need || queue->eof || queue->error))) {
+                result = queue->copyOut(iov, counts, flags & MSG_PEEK);
+                if (req.opcode == IORING_OP_RECVMSG) {
+                    msghdr* msg = (msghdr*)(uintptr_t)req.addr;
+                    msg->msg_namelen = 0;
+                    msg->msg_controllen = 0;
+                    msg->msg_flags = 0;
+                }
+                return true;
+            }
+            if (queue->eof) {
+                result = 0;
+                return true;
+            }
+            if (queue->error) {
+                if (queue->error == -EINVAL && !queue->received) {
+                    /**
+                     * 内核不支持 multishot recv（6.0 之前）
+                     */
+                    TIHI_LOG_WARN(g_sys_logger)
+                        << "multishot recv is not supported";
+                    multishot_recv_ = false;
+                    lock2.unlock();
+                    event->recvs_.reset();
+                    return false;
+                }
+                result = queue->error;
+                queue->error = 0;
+                return true;
+            }
+            if (nonblock) {
+                result = -EAGAIN;
+                return true;
+            }
+            if (event->types_ & READ) {
+                TIHI_LOG_ERROR(g_sys_logger)
+                    << "recvMultishot error: fd: " << fd
+                    << " is already being waited";
+                return false;
+            }
+            if (!queue->armed) {
+                IoUring::mutex_type::mutex lock3(ring_->sq_mutex());
+                io_uring_sqe* sqe = ring_->getSqe();
+                sqe->opcode = IORING_OP_RECV;
+                sqe->fd = fd;
+                sqe->ioprio = IORING_RECV_MULTISHOT;
+                sqe->flags = IOSQE_BUFFER_SELECT;
+                sqe->buf_group = RECV_BUFFER_GROUP;
+                sqe->user_data = queue->data;
+                if (ring_->submit() < 0) {
+                    return false;
+                }
+                queue->armed = true;
+                queue->throttled = false;
+                queue->self = queue;
+            }
+
+            ++pending_event_counts_;
+            event->fd_ = fd;
+            event->types_ = (EventType)(event->types_ | READ);
+            Event::EventContext& ectx = event->event_context(READ);
+            ectx.scheduler_ = Scheduler::This();
+            ectx.uring_data_ = queue->data;
+            ectx.wait_ = &wait;
+        }
+
+        wait.waiter.yield();
+        if (wait.res < 0) {
+            result = wait.res;
+            return true;
         }
+        wait.waiter.reset();
+    }
+}
+
+int IOManager::registerBuffers(const iovec* iovs, unsigned counts) {
+    if (!ring_) {
+        return -EOPNOTSUPP;
+    }
+    return ring_->registerBuffers(iovs, counts);
+}
+
+int IOManager::unregisterBuffers() {
+    if (!ring_) {
+        return -EOPNOTSUPP;
+    }
+    return ring_->unregisterBuffers();
+}
+
+size_t IOManager::handleCompletions() {
+    size_t triggered = 0;
+    ring_->reap([this, &triggered](uint64_t data, int32_t res,
+                                   uint32_t flags) {
+        handleCompletion(data, res, flags, triggered);
+    });
+    return triggered;
+}
+
+void IOManager::handleCompletion(uint64_t data, int32_t res, uint32_t flags,
+                                 size_t& triggered) {
+    switch (data & URING_KIND_MASK) {
+        case URING_TICKLE: {
+            uring_wakeup_pending_.fetch_sub(1);
+            countTickleReceived();
+            return;
+        }
+        case URING_POLL: {
+            int fd = data >> 32;
+            EventType type = (data & 0x8) ? WRITE : READ;
+            Event* event = getEvent(fd, false);
+            if (!event) {
+                return;
+            }
+            Event::mutex_type::mutex lock(event->mutex_);
+            /**
+             * 已经被取消或者 fd 换了主人的旧请求
+             */
+            if (!(event->types_ & type) ||
+                event->event_context(type).uring_data_ != data) {
+                return;
+            }
+            event->triggerEvent(type);
+            --pending_event_counts_;
+            ++triggered;
+            return;
+        }
+        case URING_IO: {
+            IoWait* wait = (IoWait*)(uintptr_t)(data & URING_PTR_MASK);
+            Event* event = getEvent(wait->fd, false);
+            {
+                Event::mutex_type::mutex lock(event->mutex_);
+                Event::EventContext& ectx = event->event_context(wait->type);
+                if ((event->types_ & wait->type) && ectx.uring_data_ == data) {
+                    event->types_ = (EventType)(event->types_ & ~wait->type);
+                    event->resetEventContext(ectx);
+                }
+            }
+            wait->res = res;
+            --pending_event_counts_;
+            ++triggered;
+            wait->waiter.wake();
+            return;
+        }
+        case URING_ACCEPT: {
+            AcceptQueue* queue = (AcceptQueue*)(uintptr_t)(data & URING_PTR_MASK);
+            AcceptQueue::ptr keep;
+            bool cancelled = false;
+            {
+                Mutex::mutex lock(queue->mutex);
+                if (res >= 0) {
+                    if (queue->cancelled) {
+                        ::close(res);
+                    } else {
+                        queue->fds.push_back(res);
+                        queue->accepted = true;
+                    }
+                } else if (!queue->cancelled) {
+                    queue->error = res;
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    queue->armed = false;
+                    keep.swap(queue->self);
+                }
+                cancelled = queue->cancelled;
+            }
+            if (cancelled) {
+                if (keep) {
+                    --pending_event_counts_;
+                }
+                return;
+            }
+
+            Event* event = getEvent(queue->fd, false);
+            Event::mutex_type::mutex lock(event->mutex_);
+            if ((event->types_ & READ) &&
+                event->event_context(READ).uring_data_ == data) {
+                event->triggerEvent(READ);
+                --pending_event_counts_;
+                ++triggered;
+            }
+            return;
+        }
+        case URING_RECV: {
+            RecvQueue* queue = (RecvQueue*)(uintptr_t)(data & URING_PTR_MASK);
+            RecvQueue::ptr keep;
+            bool cancelled = false;
+            {
+                Mutex::mutex lock(queue->mutex);
+                /**
+                 * 数据拷出来之后马上把缓冲区还回去，慢的连接不会占着它们
+                 */
+                if (flags & IORING_CQE_F_BUFFER) {
+                    uint16_t id = flags >> IORING_CQE_BUFFER_SHIFT;
+                    if (res > 0 && !queue->cancelled) {
+                        queue->append(ring_->buffer(id), res);
+                    }
+                    ring_->recycleBuffer(id);
+                }
+                if (res > 0) {
+                    queue->received = true;
+                    if ((flags & IORING_CQE_F_MORE) && !queue->cancelled &&
+                        !queue->throttled &&
+                        queue->available() >= recv_queue_limit_) {
+                        /**
+                         * 没人读的时候停下来，让 TCP 的流量控制生效
+                         */
+                        queue->throttled = true;
+                        cancelUringRequest(queue->data);
+                    }
+                } else if (res == 0) {
+                    queue->eof = true;
+                } else if (res != -ENOBUFS && res != -ECANCELED &&
+                           !queue->cancelled) {
+                    /**
+                     * 缓冲区暂时用完或者因为积压被取消时不算错误，
+                     * 下次等待时重新提交
+                     */
+                    queue->error = res;
+                }
+                if (!(flags & IORING_CQE_F_MORE)) {
+                    queue->armed = false;
+                    keep.swap(queue->self);
+                }
+                cancelled = queue->cancelled;
+            }
+            if (cancelled) {
+                if (keep) {
+                    --pending_event_counts_;
+                }
+                return;
+            }
+
+            Event* event = getEvent(queue->fd, false);
+            Event::mutex_type::mutex lock(event->mutex_);
+            if ((event->types_ & READ) &&
+                event->event_context(READ).uring_data_ == data) {
+                event->triggerEvent(READ);
+                --pending_event_counts_;
+                ++triggered;
+            }
+            return;
+        }
+        default:
+            return;
     }
 }
 
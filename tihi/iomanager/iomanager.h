@@ -2,12 +2,16 @@
 #define TIHI_IOMANAGER_IOMANAGER_H_
 
 #include <sys/epoll.h>
+#include <sys/uio.h>
 
 #include "scheduler/scheduler.h"
 #include "timer/timer.h"
+#include "utils/fd_table.h"
 
 namespace tihi {
 
+class IoUring;
+
 class IOManager : public Scheduler, public TimerManager {
 public:
     using ptr = std::shared_ptr<IOManager>;
@@ -19,52 +23,325 @@ public:
         WRITE = EPOLLOUT,
     };
 
+    /**
+     * EPOLL：等 fd 就绪后由协程自己重试系统调用
+     * IO_URING：就绪通知用 POLL_ADD，hook 的读写、accept、connect
+     * 直接交给内核执行（见 submitIo），内核不支持时退回 EPOLL
+     */
+    enum class Backend {
+        EPOLL = 0,
+        IO_URING = 1,
+    };
+
+    /**
+     * 直接交给 io_uring 执行的操作，字段和 io_uring_sqe 中的同名字段对应，
+     * ACCEPT / CONNECT 的 addr2 放在 off 中
+     */
+    struct IoRequest {
+        uint8_t opcode = 0;
+        uint64_t addr = 0;
+        uint32_t len = 0;
+        uint64_t off = 0;
+        uint32_t op_flags = 0;
+        uint16_t buf_index = 0;
+    };
+
     IOManager(size_t threads = 1, bool use_caller = true,
-              const std::string& name = "");
+              const std::string& name = "",
+              Backend backend = DefaultBackend());
     ~IOManager();
 
-    int addEvent(int fd, EventType type, std::function<void()> cb = nullptr);
+    int addEvent(int fd, EventType type, Task cb = nullptr);
+    /**
+     * 当前协程挂起，直到 fd 上的 type 事件就绪或者被取消，添加事件失败返回 -1。
+     * 和 addEvent() 之后 YieldToHold() 不同，事件在协程真正切出之前就在别的
+     * 线程触发也没有问题
+     */
+    int waitEvent(int fd, EventType type);
+    /**
+     * io_uring 后端上只能删除 addEvent 添加的事件
+     */
     bool delEvent(int fd, EventType type);
+    /**
+     * 直接提交的操作会被异步取消，等它真正结束后协程才恢复
+     */
     bool cancelEvent(int fd, EventType type);
 
     bool cancelAll(int fd);
 
+    /**
+     * io_uring 后端：把 req 交给内核执行，当前协程挂起直到它完成，
+     * result 是系统调用的返回值，失败时为 -errno，被取消时一般是 -ECANCELED。
+     * 开启 multishot accept 时 ACCEPT 从内核不断接受的连接队列中取；
+     * 开启 multishot recv 时 stream socket 上不带标志的 READ / READV / RECV /
+     * RECVMSG 第一次提交时在 fd 上挂一个一直接收的 multishot recv，数据进接收队列，
+     * 之后这个 fd 上所有的读都从队列中取，直到 cancelAll()（hook 的 close 会调用）。
+     * 返回 false 表示没有提交（不是 io_uring 后端，或者同一类型已经有协程在等），
+     * 调用方应该退回到 addEvent 的方式
+     */
+    bool submitIo(int fd, EventType type, const IoRequest& req,
+                  int64_t& result);
+    /**
+     * 注册 READ_FIXED / WRITE_FIXED 用的缓冲区，只有 io_uring 后端支持，
+     * 失败返回 -errno
+     */
+    int registerBuffers(const iovec* iovs, unsigned counts);
+    int unregisterBuffers();
+
+    Backend backend() const { return backend_; }
+    bool multishotAccept() const { return multishot_accept_; }
+    bool multishotRecv() const { return multishot_recv_; }
+    /**
+     * fd 上有 multishot recv 的接收队列，读的时候不能再直接调用系统调用
+     */
+    bool recvQueued(int fd);
+    /**
+     * 不挂起地从接收队列取数据，没有数据时 result 为 -EAGAIN；
+     * fd 上没有接收队列返回 false
+     */
+    bool tryRecvQueued(int fd, const IoRequest& req, int64_t& result);
+
+    /**
+     * reactor-per-thread 模式（iomanager.reactor_per_thread，只支持 epoll 后端）：
+     * 每个调度线程有自己的 epoll 实例和唤醒用的 eventfd，fd 绑定到其中一个 reactor，
+     * 它上面的事件只由这个线程等待，唤醒的协程和回调也回到这个线程执行，
+     * 连接的状态留在同一个线程的缓存里。其他线程交给它的任务走调度器的信箱
+     * （schedule 时指定 reactorThread()）。这个模式下线程数固定，不使用弹性模式
+     */
+    bool sharded() const { return sharded_; }
+    size_t reactorCount() const { return reactors_.size(); }
+    /**
+     * 把 fd 绑定到第 index 个 reactor，index 为 -1 时轮流选一个
+     * （有其他线程时不选 caller 线程，它只在 stop() 时才参与调度）。
+     * fd 上还有事件在等待时不换绑，返回实际绑定的 reactor；不是 sharded 模式返回 -1。
+     * 没有绑定的 fd 在第一次添加事件时绑定到当前线程的 reactor，
+     * close 之后解除绑定
+     */
+    int bindFd(int fd, int index = -1);
+    /**
+     * fd 绑定的 reactor，没有绑定返回 -1
+     */
+    int fdReactor(int fd);
+    /**
+     * 第 index 个 reactor 所在的线程，可以作为 schedule 的 thread_id；
+     * 不是 sharded 模式或者 index 无效时返回 -1
+     */
+    pid_t reactorThread(int index) const;
+
+    /**
+     * 常驻注册模式（iomanager.epoll_persistent，只支持 epoll 后端）：
+     * fd 第一次添加事件时以 EPOLLIN | EPOLLOUT | EPOLLET 注册，直到 cancelAll()
+     * （hook 的 close 会调用）才删除，事件触发和删除都不再调用 epoll_ctl。
+     * 没有人等的方向上来的边沿记为粘滞的就绪标志，之后来等这个方向的立即触发
+     * 并清掉标志；标志可能已经过时，调用方醒来后照常重试，再遇到 EAGAIN 时会真正等待。
+     * 不经过 hook 关闭的 fd 要先调用 cancelAll()，否则编号复用时收不到事件
+     */
+    bool persistent() const { return persistent_; }
+
     static IOManager* This();
+    /**
+     * 配置 iomanager.backend 指定的后端
+     */
+    static Backend DefaultBackend();
+    static const char* BackendToString(Backend backend);
+    static Backend BackendFromString(const std::string& str);
 
 protected:
+    /**
+     * 有线程在自旋时不写 eventfd，见 Scheduler::skipTickle()
+     */
     void tickle() override;
+    /**
+     * 点名唤醒的线程不在自旋，不能因为别的线程在自旋就省掉。
+     * sharded 模式下写这个线程的 eventfd；默认模式下所有线程等在同一个
+     * epoll 实例（或 io_uring）上，写 eventfd 叫不醒指定的线程，
+     * 改为给它发 SIGURG，打断它的 epoll_pwait / io_uring_enter
+     */
+    void tickleThread(pid_t thread_id) override;
     bool stopping() override;
     bool stopping(uint64_t& timeout);
     void idle() override;
-    void resize(size_t size);
     void onTimerInsertedAtFront() override;
+    /**
+     * 不等待地取一次就绪事件（io_uring 后端是完成事件），
+     * 再把到期的定时器放进任务队列
+     */
+    bool poll() override;
 
 private:
+    struct IoWait;
+    struct AcceptQueue;
+    struct RecvQueue;
+
+    /**
+     * 一个 epoll 实例和唤醒它的 eventfd；不是 sharded 模式时只有一个，所有线程共用。
+     * eventfd 是 EFD_SEMAPHORE、水平触发的，每次 read 取走一次唤醒，
+     * 每次唤醒只叫醒一个线程
+     */
+    struct Reactor {
+        size_t index = 0;
+        int epfd = -1;
+        int wakefd = -1;
+        /**
+         * 写过 wakefd 而还没被读走的唤醒次数，达到等待它的空闲线程数之后
+         * 新的唤醒都合并掉
+         */
+        std::atomic<uint32_t> wakeup_pending{0};
+        /**
+         * 等待它的线程，sharded 模式下 start() 之后才知道
+         */
+        std::atomic<pid_t> thread_id{-1};
+    };
+
     struct Event {
         using mutex_type = Mutex;
         struct EventContext {
             Scheduler* scheduler_ = nullptr;
             Fiber::ptr fiber_;
-            std::function<void()> cb_;
+            Task cb_;
+            /**
+             * io_uring 后端：这个类型正在等的请求，以及等它的协程
+             * （直接提交的操作和 multishot accept）
+             */
+            uint64_t uring_data_ = 0;
+            IoWait* wait_ = nullptr;
         };
 
         EventContext& event_context(EventType type);
         void resetEventContext(EventContext& ectx);
-        void triggerEvent(EventType type);
+        /**
+         * thread_id 不为 -1 时等待的协程或回调放到这个线程上执行
+         */
+        void triggerEvent(EventType type, pid_t thread_id = -1);
 
 
         int fd_ = -1;
         EventType types_ = NONE;
+        /**
+         * epoll 后端：fd 注册在哪个 reactor 上，还没有绑定时为空
+         */
+        Reactor* owner_ = nullptr;
+        /**
+         * 常驻注册模式：fd 已经注册在 owner_ 上，以及没人等时到来的就绪方向
+         */
+        bool registered_ = false;
+        int ready_ = NONE;
         EventContext read_;
         EventContext write_;
+        /**
+         * 监听的 fd 上 multishot accept 接受的连接
+         */
+        std::shared_ptr<AcceptQueue> accepts_;
+        /**
+         * multishot recv 的接收队列，以及 fd 不是 stream socket、不用它
+         */
+        std::shared_ptr<RecvQueue> recvs_;
+        bool recv_single_ = false;
         mutex_type mutex_;
     };
 
-    int epfd_;
-    int pipefd_[2];
+    /**
+     * cb 和 wait 都为空时以当前协程为调度对象。
+     * 常驻注册模式下已经就绪时，cb 和当前协程立即被调度，
+     * wait 不登记，返回 1，调用方不用挂起
+     */
+    int addEvent(int fd, EventType type, Task cb, IoWait* wait);
+    /**
+     * fd 对应的 Event，不加锁；auto_create 时按需分配所在的段，
+     * 否则不存在返回 nullptr。fd 超出 FdTable::MAX_FDS 时总是返回 nullptr
+     */
+    Event* getEvent(int fd, bool auto_create);
+    /**
+     * io_uring 后端的 addEvent / delEvent / cancelEvent / cancelAll，
+     * 调用时持有 event 的锁
+     */
+    int addUringEvent(Event* event, EventType type);
+    bool cancelUringEvent(Event* event, EventType type, bool trigger);
+    /**
+     * 提交一个不关心结果的 ASYNC_CANCEL
+     */
+    void cancelUringRequest(uint64_t data);
+    bool acceptMultishot(int fd, int64_t& result);
+    /**
+     * 从接收队列取数据，队列是空的就挂起等待（nonblock 时结果为 -EAGAIN）；
+     * 返回 false 表示这个请求不用 multishot recv
+     */
+    bool recvMultishot(int fd, const IoRequest& req, bool nonblock,
+                       int64_t& result);
+    /**
+     * 处理 io_uring 的完成事件，返回唤醒的协程和回调个数（不算 tickle）
+     */
+    size_t handleCompletions();
+    void handleCompletion(uint64_t data, int32_t res, uint32_t flags,
+                          size_t& triggered);
+
+    /**
+     * 有空闲线程时叫醒一个，sharded 模式下写这个空闲线程的 eventfd
+     */
+    void wakeIdleThread();
+    /**
+     * 没被收走的唤醒少于 limit 次时写一次 eventfd
+     */
+    void wakeReactor(Reactor* reactor, uint32_t limit = 1);
+    /**
+     * 默认模式下可以同时在路上的唤醒次数：空闲线程数，至少为 1
+     */
+    uint32_t wakeupLimit() const;
+    /**
+     * 当前线程的 reactor，当前线程不是调度线程时返回 nullptr
+     */
+    Reactor* localReactor();
+    Reactor* findReactor(pid_t thread_id);
+    /**
+     * 轮流选一个给新 fd 绑定的 reactor
+     */
+    Reactor* nextReactor();
+    /**
+     * fd 第一次添加事件时绑定的 reactor：当前线程的，不是调度线程时轮流选
+     */
+    Reactor* bindingReactor();
+    /**
+     * event 上等待的协程应该在哪个线程恢复，不是 sharded 模式时为 -1
+     */
+    pid_t resumeThread(Event* event);
+    /**
+     * 处理 epoll_wait 返回的事件，返回触发的事件个数（不算 eventfd）
+     */
+    size_t handleEvents(Reactor* reactor, epoll_event* events, int counts);
+    /**
+     * 到期的定时器回调放进任务队列，cbs 只是复用的缓冲区
+     */
+    bool scheduleExpiredTimers(std::vector<Task>& cbs);
+
+    Backend backend_;
+    bool sharded_ = false;
+    bool persistent_ = false;
+    /**
+     * 默认模式下点名唤醒用信号，见 tickleThread()
+     */
+    bool signal_wakeup_ = false;
+    /**
+     * epoll 后端的 reactor，sharded 模式下第 i 个对应 thread_ids_[i]
+     */
+    std::vector<std::unique_ptr<Reactor>> reactors_;
+    std::atomic<size_t> next_reactor_{0};
+    std::unique_ptr<IoUring> ring_;
+    /**
+     * io_uring 后端发出而还没完成的空操作个数，同 Reactor::wakeup_pending
+     */
+    std::atomic<uint32_t> uring_wakeup_pending_{0};
+    std::atomic<bool> multishot_accept_{false};
+    std::atomic<bool> multishot_recv_{false};
+    size_t recv_queue_limit_ = 0;
+    /**
+     * 直接提交的操作的序号，区分先后复用同一个地址的等待者
+     */
+    std::atomic<uint32_t> io_seq_{0};
     std::atomic<size_t> pending_event_counts_{0};
-    std::vector<Event*> events_;
-    mutex_type mutex_;    
+    /**
+     * 以 fd 为下标，Event 分配后地址不再变化
+     */
+    FdTable<Event> events_;
 };
 
 } // namespace tihi
@@ -1,16 +1,396 @@
 #include "scheduler.h"
 
+#include <sched.h>
+
+#include <algorithm>
+#include <sstream>
+
+#include "config/config.h"
+#include "fiber/fiber_pool.h"
+#include "fiber/stack_allocator.h"
+#include "fiber/stack_profiler.h"
 #include "hook/hook.h"
 #include "log/log.h"
+#include "scheduler/work_stealing_queue.h"
+#include "thread/affinity.h"
 #include "utils/macro.h"
+#include "utils/utils.h"
 
 namespace tihi {
 
 static Logger::ptr g_sys_logger = TIHI_LOG_LOGGER("system");
 
+static ConfigVar<std::string>::ptr g_scheduler_run_queue =
+    Config::Lookup<std::string>(
+        "scheduler.run_queue", "steal",
+        "scheduler run queue: steal (per-thread queues with work stealing) "
+        "or global (one shared queue)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_local_queue_capacity =
+    Config::Lookup<uint32_t>("scheduler.local_queue_capacity", 256,
+                             "capacity of each scheduler thread's run queue");
+
+static ConfigVar<std::vector<uint32_t>>::ptr g_scheduler_lane_weights =
+    Config::Lookup<std::vector<uint32_t>>(
+        "scheduler.lane_weights", {8, 4, 1},
+        "weights of the high/normal/low priority lanes; when every lane has "
+        "work, a lane gets at least weight/sum of the dequeues");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_stats_sample_period =
+    Config::Lookup<uint32_t>(
+        "scheduler.stats_sample_period", 8,
+        "time the queue delay and run slice of one in every n tasks, "
+        "0 disables all timing statistics");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_watchdog_ms =
+    Config::Lookup<uint32_t>(
+        "scheduler.watchdog_ms", 0,
+        "log the fiber, tag and backtrace of a scheduler thread that has been "
+        "running one task for longer than this many milliseconds, 0 disables");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_preempt_ms =
+    Config::Lookup<uint32_t>(
+        "scheduler.preempt_ms", 0,
+        "make Scheduler::ShouldYield() return true in a task that has been "
+        "running for longer than this many milliseconds, 0 disables");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_spin_us =
+    Config::Lookup<uint32_t>(
+        "scheduler.spin_us", 0,
+        "an idle scheduler thread polls the run queues (and epoll) for up to "
+        "this many microseconds before blocking, 0 disables spinning");
+
+static bool s_work_stealing = true;
+static uint32_t s_local_queue_capacity = 256;
+static std::vector<uint32_t> s_lane_weights;
+static uint32_t s_stats_sample_period = 8;
+static uint32_t s_watchdog_ms = 0;
+static uint32_t s_preempt_ms = 0;
+static uint32_t s_spin_us = 0;
+
+struct __SchedulerIniter {
+    __SchedulerIniter() {
+        s_work_stealing = g_scheduler_run_queue->value() != "global";
+        s_local_queue_capacity = g_scheduler_local_queue_capacity->value();
+        s_lane_weights = g_scheduler_lane_weights->value();
+        s_stats_sample_period = g_scheduler_stats_sample_period->value();
+        s_watchdog_ms = g_scheduler_watchdog_ms->value();
+        s_preempt_ms = g_scheduler_preempt_ms->value();
+        s_spin_us = g_scheduler_spin_us->value();
+        g_scheduler_run_queue->addListener(
+            [](const std::string& old_value, const std::string& new_value) {
+                s_work_stealing = new_value != "global";
+            });
+        g_scheduler_local_queue_capacity->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_local_queue_capacity = new_value;
+            });
+        g_scheduler_lane_weights->addListener(
+            [](const std::vector<uint32_t>& old_value,
+               const std::vector<uint32_t>& new_value) {
+                s_lane_weights = new_value;
+            });
+        g_scheduler_stats_sample_period->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_stats_sample_period = new_value;
+            });
+        g_scheduler_watchdog_ms->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_watchdog_ms = new_value;
+            });
+        g_scheduler_preempt_ms->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_preempt_ms = new_value;
+            });
+        g_scheduler_spin_us->addListener(
+            [](const uint32_t old_value, const uint32_t new_value) {
+                s_spin_us = new_value;
+            });
+    }
+};
+
+static __SchedulerIniter s_scheduler_initer;
+
+/**
+ * 调度器线程的摆放方式，按调度器的名字配置：
+ * scheduler:
+ *   placement:
+ *     io:
+ *       cpus: 0-7        # 也可以写成 [0-3, 8]，第 i 个线程绑到第 i % n 个 CPU
+ *       numa: local      # none / local / bind
+ */
+struct SchedulerPlacement {
+    std::string cpus;
+    std::string numa = "none";
+
+    bool operator==(const SchedulerPlacement& oth) const {
+        return cpus == oth.cpus && numa == oth.numa;
+    }
+};
+
+template <>
+class LexicalCast<std::string, SchedulerPlacement> {
+public:
+    SchedulerPlacement operator()(const std::string& v) {
+        YAML::Node node = YAML::Load(v);
+        SchedulerPlacement ret;
+        if (node["cpus"].IsSequence()) {
+            for (size_t i = 0; i < node["cpus"].size(); ++i) {
+                ret.cpus += (i ? "," : "") + node["cpus"][i].as<std::string>();
+            }
+        } else if (node["cpus"].IsDefined()) {
+            ret.cpus = node["cpus"].as<std::string>();
+        }
+        if (node["numa"].IsDefined()) {
+            ret.numa = node["numa"].as<std::string>();
+        }
+        return ret;
+    }
+};
+
+template <>
+class LexicalCast<SchedulerPlacement, std::string> {
+public:
+    std::string operator()(const SchedulerPlacement& v) {
+        YAML::Node node;
+        node["cpus"] = v.cpus;
+        node["numa"] = v.numa;
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
+static ConfigVar<std::map<std::string, SchedulerPlacement>>::ptr
+    g_scheduler_placement =
+        Config::Lookup<std::map<std::string, SchedulerPlacement>>(
+            "scheduler.placement", {},
+            "cpu affinity and numa memory policy of scheduler threads, "
+            "keyed by scheduler name");
+
+/**
+ * 弹性线程池，按调度器的名字配置：
+ * scheduler:
+ *   elastic:
+ *     io:
+ *       min_threads: 2     # 和构造函数的 threads 一样，包括 caller 线程
+ *       max_threads: 16
+ *       delay_ms: 10       # 排队延迟超过它时增加一个线程
+ *       idle_ms: 3000      # 空闲超过它的线程退出
+ * 启动时仍然是构造函数指定的线程数，min_threads 不会大于它
+ */
+struct SchedulerElastic {
+    uint32_t min_threads = 1;
+    uint32_t max_threads = 0;
+    uint32_t delay_ms = 10;
+    uint32_t idle_ms = 3000;
+
+    bool operator==(const SchedulerElastic& oth) const {
+        return min_threads == oth.min_threads &&
+               max_threads == oth.max_threads && delay_ms == oth.delay_ms &&
+               idle_ms == oth.idle_ms;
+    }
+};
+
+template <>
+class LexicalCast<std::string, SchedulerElastic> {
+public:
+    SchedulerElastic operator()(const std::string& v) {
+        YAML::Node node = YAML::Load(v);
+        SchedulerElastic ret;
+        if (node["min_threads"].IsDefined()) {
+            ret.min_threads = node["min_threads"].as<uint32_t>();
+        }
+        if (node["max_threads"].IsDefined()) {
+            ret.max_threads = node["max_threads"].as<uint32_t>();
+        }
+        if (node["delay_ms"].IsDefined()) {
+            ret.delay_ms = node["delay_ms"].as<uint32_t>();
+        }
+        if (node["idle_ms"].IsDefined()) {
+            ret.idle_ms = node["idle_ms"].as<uint32_t>();
+        }
+        return ret;
+    }
+};
+
+template <>
+class LexicalCast<SchedulerElastic, std::string> {
+public:
+    std::string operator()(const SchedulerElastic& v) {
+        YAML::Node node;
+        node["min_threads"] = v.min_threads;
+        node["max_threads"] = v.max_threads;
+        node["delay_ms"] = v.delay_ms;
+        node["idle_ms"] = v.idle_ms;
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
+static ConfigVar<std::map<std::string, SchedulerElastic>>::ptr
+    g_scheduler_elastic =
+        Config::Lookup<std::map<std::string, SchedulerElastic>>(
+            "scheduler.elastic", {},
+            "min/max thread counts of elastic schedulers, keyed by scheduler "
+            "name");
+
+// 一次最多从全局队列或者别的线程拿走的任务数
+static const size_t BATCH_SIZE = 32;
+// 每执行这么多个任务先看一次全局队列，避免外部提交的任务被本地任务饿死
+static const uint32_t GLOBAL_CHECK_INTERVAL = 61;
+// 每执行这么多个任务从本地队列头部取一次，避免 LIFO 把老任务饿死
+static const uint32_t LOCAL_FIFO_INTERVAL = 64;
+
+/**
+ * 只有一个线程写的计数器，其他线程用 relaxed 读，不需要原子加
+ */
+static void Increase(std::atomic<uint64_t>& counter, uint64_t v = 1) {
+    counter.store(counter.load(std::memory_order_relaxed) + v,
+                  std::memory_order_relaxed);
+}
+
+struct Scheduler::Worker {
+    enum State {
+        // 还没有线程
+        EMPTY = 0,
+        RUNNING = 1,
+        // 决定退出，正在交出任务
+        RETIRING = 2,
+        // 线程已经退出 run()，等待被 join
+        EXITED = 3,
+    };
+
+    Worker(size_t capacity, uint32_t seed) : batch(BATCH_SIZE), seed(seed) {
+        for (size_t i = 0; i < PRIORITY_COUNTS; ++i) {
+            local[i].reset(new WorkStealingQueue<FiberOrFunction>(capacity));
+        }
+    }
+
+    /**
+     * 统计都只有本线程写，laneStats() 和 stats() 在其他线程读。
+     * 任务被抽中计时的话返回开始执行的时间，否则返回 0
+     */
+    uint64_t record(const FiberOrFunction& fof) {
+        LaneCounters& c = lane_stats[(size_t)fof.lane];
+        Increase(c.dequeued);
+        if (!fof.enqueue_us) {
+            return 0;
+        }
+
+        uint64_t now = US();
+        uint64_t delay = now > fof.enqueue_us ? now - fof.enqueue_us : 0;
+        Increase(c.sampled);
+        Increase(c.total_delay_us, delay);
+        queue_delay.record(delay);
+        if (delay > c.max_delay_us.load(std::memory_order_relaxed)) {
+            c.max_delay_us.store(delay, std::memory_order_relaxed);
+        }
+        return now;
+    }
+
+    /**
+     * 开始执行一个任务，watchdog 线程据此判断任务执行了多久
+     */
+    void beginSlice(Fiber* fiber) {
+        running_tag.store(fiber->tag(), std::memory_order_relaxed);
+        preempt.store(false, std::memory_order_relaxed);
+        running_fiber_id.store(fiber->id(), std::memory_order_release);
+    }
+
+    uint32_t random() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    }
+
+    // 每条 lane 一个本地队列
+    std::unique_ptr<WorkStealingQueue<FiberOrFunction>> local[PRIORITY_COUNTS];
+    // 指定在这个线程上执行的任务，只有本线程会取
+    MPMCQueue<FiberOrFunction> mailbox;
+    std::atomic<pid_t> thread_id{-1};
+    // 是否在 idle 中等待，自旋时 spinning 也为 true
+    std::atomic<bool> idle{false};
+    std::atomic<bool> spinning{false};
+    /**
+     * 这一轮 idle 里给本线程发过的定向唤醒：发过之后再往信箱放任务不用重复唤醒，
+     * 唤醒被别的线程接走时每次放任务最多转发一次。本线程进入 idle 时清掉
+     */
+    enum Wake { WAKE_NONE = 0, WAKE_SENT = 1, WAKE_FORWARDED = 2 };
+    std::atomic<int> wake{WAKE_NONE};
+    // 下次自旋的时长，只有本线程读写
+    uint32_t spin_budget_us = 0;
+    NumaPolicy numa_policy = NumaPolicy::NONE;
+    Thread::ptr thread;
+    // 批量搬运任务时的临时缓冲区
+    std::vector<FiberOrFunction> batch;
+    uint32_t ticks = 0;
+    uint32_t seed;
+    // 每条 lane 在这一轮里还能取几次
+    uint32_t credits[PRIORITY_COUNTS] = {0};
+
+    struct LaneCounters {
+        std::atomic<uint64_t> dequeued{0};
+        std::atomic<uint64_t> sampled{0};
+        std::atomic<uint64_t> total_delay_us{0};
+        std::atomic<uint64_t> max_delay_us{0};
+        std::atomic<uint64_t> expired{0};
+    };
+    LaneCounters lane_stats[PRIORITY_COUNTS];
+    Histogram queue_delay;
+    Histogram run_slice;
+    Histogram idle_time;
+    std::atomic<uint64_t> run_slices{0};
+    std::atomic<uint64_t> context_switches{0};
+    std::atomic<uint64_t> tickles_sent{0};
+    std::atomic<uint64_t> tickles_received{0};
+    std::atomic<uint64_t> spins{0};
+    std::atomic<uint64_t> spin_hits{0};
+
+    // 正在执行的任务，不在执行任务时 running_fiber_id 为 0，watchdog 线程读
+    std::atomic<uint64_t> running_fiber_id{0};
+    std::atomic<const char*> running_tag{nullptr};
+    // 软抢占标志，见 Scheduler::ShouldYield()
+    std::atomic<bool> preempt{false};
+    std::atomic<pthread_t> pthread{0};
+    std::atomic<int> state{EMPTY};
+    // 弹性模式下空闲的开始时间，执行任务后清零，只有本线程读写
+    uint64_t idle_since_ms = 0;
+    // 以下只有监控线程读写
+    std::atomic<uint64_t> watchdog_stalls{0};
+    std::atomic<uint64_t> preempt_requests{0};
+    uint64_t watched_slice = 0;
+    uint64_t watched_fiber_id = 0;
+    uint64_t watched_since_ms = 0;
+    bool reported = false;
+    bool preempted = false;
+};
+
+struct Scheduler::DeadlineQueue {
+    /**
+     * std::push_heap 默认是最大堆，截止时间晚的排在后面
+     */
+    static bool Later(const FiberOrFunction& a, const FiberOrFunction& b) {
+        return a.deadline_us > b.deadline_us;
+    }
+
+    mutex_type mutex;
+    std::vector<FiberOrFunction> heap;
+};
+
 /**/
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+/**
+ * 当前线程在 t_scheduler 中对应的 Worker，只在 run() 执行期间有效
+ */
+static thread_local void* t_worker = nullptr;
+/**
+ * 本线程入队的任务数，用来决定哪些任务要计时
+ */
+static thread_local uint32_t t_sample_ticks = 0;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     : name_(name) {
@@ -37,6 +417,54 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         root_thread_id_ = -1;
     }
     thread_count_ = threads;
+    min_threads_ = thread_count_;
+    max_threads_ = thread_count_;
+    auto elastics = g_scheduler_elastic->value();
+    auto elastic_it = elastics.find(name_);
+    if (elastic_it != elastics.end()) {
+        /**
+         * 配置的线程数包括 caller 线程，这里换算成要创建的线程数
+         */
+        size_t caller = use_caller ? 1 : 0;
+        const SchedulerElastic& elastic = elastic_it->second;
+        if (elastic.max_threads > caller) {
+            max_threads_ =
+                std::max<size_t>(elastic.max_threads - caller, thread_count_);
+        }
+        if (elastic.min_threads > caller) {
+            min_threads_ =
+                std::min<size_t>(elastic.min_threads - caller, thread_count_);
+        } else {
+            min_threads_ = 0;
+        }
+        elastic_ = max_threads_ > min_threads_;
+        elastic_delay_us_ = elastic.delay_ms * 1000ull;
+        elastic_idle_ms_ = std::max<uint32_t>(elastic.idle_ms, 1);
+    }
+
+    work_stealing_ = s_work_stealing;
+    watchdog_ms_ = s_watchdog_ms;
+    preempt_ms_ = s_preempt_ms;
+    stats_sample_period_ = s_stats_sample_period;
+    spin_us_ = s_spin_us;
+    for (size_t i = 0; i < PRIORITY_COUNTS; ++i) {
+        lane_weights_[i] = i < s_lane_weights.size()
+                               ? std::max<uint32_t>(s_lane_weights[i], 1)
+                               : 1;
+        deadlines_[i].reset(new DeadlineQueue);
+    }
+    /**
+     * 至少要放得下一批偷来的任务
+     */
+    size_t capacity = std::max<size_t>(s_local_queue_capacity, BATCH_SIZE);
+    size_t worker_counts = max_threads_ + (use_caller ? 1 : 0);
+    for (size_t i = 0; i < worker_counts; ++i) {
+        workers_.emplace_back(new Worker(capacity, 2654435761u * (i + 1)));
+    }
+    if (use_caller) {
+        workers_.back()->thread_id = root_thread_id_;
+        workers_.back()->state = Worker::RUNNING;
+    }
 }
 
 Scheduler::~Scheduler() {
@@ -48,6 +476,11 @@ Scheduler::~Scheduler() {
 
 Scheduler* Scheduler::This() { return t_scheduler; }
 
+bool Scheduler::ShouldYield() {
+    Worker* worker = static_cast<Worker*>(t_worker);
+    return worker && worker->preempt.load(std::memory_order_relaxed);
+}
+
 Fiber* Scheduler::MainFiber() { return t_scheduler_fiber; }
 
 void Scheduler::start() {
@@ -56,16 +489,47 @@ void Scheduler::start() {
         return;
     }
     stopping_ = false;
+
+    SchedulerPlacement placement;
+    auto placements = g_scheduler_placement->value();
+    auto it = placements.find(name_);
+    if (it != placements.end()) {
+        placement = it->second;
+    }
+    cpus_ = ParseCpuList(placement.cpus);
+    numa_policy_ = NumaPolicyFromString(placement.numa);
+
     TIHI_ASSERT((threads_.empty()));
-    threads_.resize(thread_count_);
     for (size_t i = 0; i < thread_count_; ++i) {
-        threads_[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                                     name_ + "_" + std::to_string(i)));
-        thread_ids_.push_back(threads_[i]->id());
+        startThread(i);
+    }
+    if (watchdog_ms_ || preempt_ms_ || elastic_) {
+        monitor_stopping_ = false;
+        monitor_thread_.reset(new Thread(std::bind(&Scheduler::monitor, this),
+                                         name_ + "_monitor"));
     }
     lock.unlock();
 }
 
+void Scheduler::startThread(size_t index) {
+    Worker* worker = workers_[index].get();
+    Thread::ptr thread(new Thread(std::bind(&Scheduler::run, this),
+                                  name_ + "_" + std::to_string(index)));
+    threads_.push_back(thread);
+    thread_ids_.push_back(thread->id());
+    worker->thread = thread;
+    worker->thread_id = thread->id();
+    worker->numa_policy = numa_policy_;
+    worker->state = Worker::RUNNING;
+    ++running_threads_;
+    /**
+     * 新线程在 run() 里等 mutex_，绑核之后才会开始分配协程栈
+     */
+    if (!cpus_.empty()) {
+        thread->setAffinity(cpus_[index % cpus_.size()]);
+    }
+}
+
 void Scheduler::stop() {
     auto_stop_ = true;
 
@@ -73,7 +537,7 @@ void Scheduler::stop() {
     use_caller == true 且只有一个线程的情况
     那就是当前线程要结束自己
     */
-    if (root_fiber_ && thread_count_ == 0 &&
+    if (root_fiber_ && max_threads_ == 0 &&
         (root_fiber_->state() == Fiber::TERM ||
          root_fiber_->state() == Fiber::INIT)) {
         stopping_ = true;
@@ -81,6 +545,7 @@ void Scheduler::stop() {
         给线程机会去处理后事
         */
         if (stopping()) {
+            stopMonitor();
             return;
         }
     }
@@ -105,7 +570,7 @@ void Scheduler::stop() {
     /*
     调度器通知自己管理的所有线程自己要停止了
     */
-    for (size_t i = 0; i < thread_count_; ++i) {
+    for (size_t i = 0; i < running_threads_; ++i) {
         tickle();
     }
     /*
@@ -139,6 +604,7 @@ void Scheduler::stop() {
     for (auto t : thrs) {
         t->join();
     }
+    stopMonitor();
 }
 
 void Scheduler::run() {
@@ -156,72 +622,112 @@ void Scheduler::run() {
         t_scheduler_fiber = Fiber::This().get();
     }
 
+    /**
+     * 等 start() 把所有线程的 id 登记完
+     */
+    { mutex_type::mutex lock(mutex_); }
+    Worker* worker = findWorker(ThreadId());
+    TIHI_ASSERT(worker);
+    t_worker = worker;
+    worker->pthread = pthread_self();
+    bool watched = watchdog_ms_ || preempt_ms_;
+    if (worker->numa_policy != NumaPolicy::NONE) {
+        int cpu = Thread::This() ? Thread::This()->cpu() : -1;
+        SetMemPolicy(worker->numa_policy, CpuNode(cpu < 0 ? sched_getcpu() : cpu));
+    }
+
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber = nullptr;
 
     FiberOrFunction fof;
+    // 被抽中计时的任务开始执行的时间，没抽中时为 0
+    uint64_t slice_start = 0;
     while (true) {
         fof.clear();
-        bool tickle_other = false;
-        bool is_active = false;
-        {
-            mutex_type::mutex lock(mutex_);
-            auto it = fibers_.begin();
-            for (; it != fibers_.end(); ++it) {
-                if (it->specific_thread_id != -1 &&
-                    it->specific_thread_id != ThreadId()) {
-                    tickle_other = true;
-                    continue;
+        bool is_active = dequeue(worker, fof);
+        if (is_active) {
+            slice_start = worker->record(fof);
+            if (elastic_) {
+                worker->idle_since_ms = 0;
+                if (slice_start &&
+                    slice_start - fof.enqueue_us >= elastic_delay_us_ &&
+                    !grow_requested_.load(std::memory_order_relaxed)) {
+                    grow_requested_.store(true, std::memory_order_relaxed);
                 }
-
-                TIHI_ASSERT((it->fiber || it->cb));
-                if (it->fiber) {
-                    TIHI_ASSERT((it->fiber->state() != Fiber::EXEC));
-                }
-
-                fof = *it;
-                fibers_.erase(it);
-                ++active_thread_count_;
-                is_active = true;
-                break;
             }
-        }
-
-        if (tickle_other) {
-            tickle();
-
-            /**
-             * 这里不能直接走，对于线程来说虽然当前的任务（Fiber or
-             * Function）自己不能 执行但是自己应该去执行 idle
-             */
-            // continue ;
+            TIHI_ASSERT((fof.fiber || fof.cb));
+            if (fof.fiber) {
+                TIHI_ASSERT((fof.fiber->state() != Fiber::EXEC));
+            }
+            ++active_thread_count_;
         }
 
         if (fof.fiber && fof.fiber->state() != Fiber::TERM &&
             fof.fiber->state() != Fiber::EXCEP) {
+            if (watched) {
+                worker->beginSlice(fof.fiber.get());
+            }
             fof.fiber->swapIn();
             --active_thread_count_;
+            endSlice(worker, slice_start);
 
             if (fof.fiber->state() == Fiber::READY) {
-                schedule(fof.fiber);
+                if (enqueue(fof, true)) {
+                    tickle();
+                }
             } else if (fof.fiber->state() != Fiber::TERM &&
                        fof.fiber->state() != Fiber::EXCEP) {
                 fof.fiber->set_state(Fiber::HOLD);
+            } else {
+                FiberPool::Put(fof.fiber);
             }
             fof.clear();
+            --task_counts_;
+            /**
+             * 协程的状态处理完之后才能让它被别的线程唤醒
+             */
+            Fiber::RunAfterSwitch();
         } else if (fof.cb) {
+            size_t stack_size = Fiber::DefaultStackSize();
+            if (!shared_stack_ && fof.tag &&
+                StackProfiler::GetMode() == StackProfiler::AUTO) {
+                size_t suggest = StackProfiler::SuggestStackSize(fof.tag);
+                if (suggest) {
+                    stack_size = suggest;
+                }
+            }
+            if (cb_fiber && !shared_stack_ &&
+                cb_fiber->stack_size() != stack_size) {
+                FiberPool::Put(cb_fiber);
+            }
+
             if (cb_fiber) {
-                cb_fiber->reset(fof.cb);
+                cb_fiber->reset(std::move(fof.cb));
+            } else if (shared_stack_) {
+                cb_fiber.reset(new Fiber(std::move(fof.cb), 0, false, true));
             } else {
-                cb_fiber.reset(new Fiber(fof.cb));
+                cb_fiber = FiberPool::Get(std::move(fof.cb), stack_size);
             }
+            cb_fiber->set_tag(fof.tag);
+            Priority lane = fof.lane;
             fof.clear();
 
+            if (watched) {
+                worker->beginSlice(cb_fiber.get());
+            }
             cb_fiber->swapIn();
             --active_thread_count_;
+            endSlice(worker, slice_start);
 
             if (cb_fiber->state() == Fiber::READY) {
-                schedule(cb_fiber);
+                /**
+                 * 协程已经交给任务队列了，不能再拿来执行别的任务
+                 */
+                FiberOrFunction ff(&cb_fiber, -1);
+                ff.lane = lane;
+                if (enqueue(ff, true)) {
+                    tickle();
+                }
             } else if (cb_fiber->state() == Fiber::TERM ||
                        cb_fiber->state() == Fiber::EXCEP) {
                 cb_fiber->reset(nullptr);
@@ -229,20 +735,67 @@ void Scheduler::run() {
                 cb_fiber->set_state(Fiber::HOLD);
                 cb_fiber.reset();
             }
+            --task_counts_;
+            Fiber::RunAfterSwitch();
         } else {
             if (is_active) {
                 --active_thread_count_;
+                --task_counts_;
                 continue;
             }
 
             if (idle_fiber->state() == Fiber::TERM) {
                 TIHI_LOG_INFO(g_sys_logger) << "idle fiber term";
+                if (worker->state == Worker::RETIRING &&
+                    Fiber::BoundSharedCounts()) {
+                    /**
+                     * 决定退出之后又执行了任务，有共享栈协程绑定到了本线程，
+                     * 不能再退出
+                     */
+                    worker->state = Worker::RUNNING;
+                    worker->idle_since_ms = 0;
+                    ++running_threads_;
+                    idle_fiber->reset(std::bind(&Scheduler::idle, this));
+                    continue;
+                }
+                if (worker->state == Worker::RETIRING) {
+                    retire(worker);
+                }
+                t_worker = nullptr;
                 break;
             }
 
+            /**
+             * 没有任务可做，顺便把全局池里闲置久了的栈还给系统
+             */
+            StackAllocator::MaybeTrim();
             ++idle_thread_count_;
+            worker->wake = Worker::WAKE_NONE;
+            worker->idle = true;
+            /**
+             * 和 enqueuePinned 先放任务再看 idle 的顺序相反，
+             * 两边至少有一边能看到对方，不会漏掉唤醒
+             */
+            if (!worker->mailbox.empty() || (spin_us_ && spin(worker))) {
+                worker->idle = false;
+                --idle_thread_count_;
+                continue;
+            }
+            forwardTickle(worker);
+            if (elastic_ && !worker->idle_since_ms) {
+                worker->idle_since_ms = MS();
+            }
+            /**
+             * 进出 idle 本来就慢，每次都计时
+             */
+            uint64_t idle_start = stats_sample_period_ ? US() : 0;
             idle_fiber->swapIn();
+            worker->idle = false;
             --idle_thread_count_;
+            Increase(worker->context_switches);
+            if (idle_start) {
+                worker->idle_time.record(US() - idle_start);
+            }
             if (idle_fiber->state() != Fiber::TERM &&
                 idle_fiber->state() != Fiber::EXCEP) {
                 idle_fiber->set_state(Fiber::HOLD);
@@ -251,18 +804,811 @@ void Scheduler::run() {
     }
 }
 
-void Scheduler::tickle() { TIHI_LOG_INFO(g_sys_logger) << "tickle"; }
+void Scheduler::tickle() {
+    TIHI_LOG_INFO(g_sys_logger) << "tickle";
+    countTickleSent();
+}
+
+void Scheduler::tickleThread(pid_t thread_id) { tickle(); }
 
 bool Scheduler::stopping() {
+    return auto_stop_ && stopping_ && task_counts_ == 0;
+}
+
+bool Scheduler::enqueue(FiberOrFunction& ff, bool yielded) {
+    if (!ff.fiber && !ff.cb) {
+        return false;
+    }
+    /**
+     * 共享栈协程只能回到它绑定的线程上执行，指定了别的线程也不行
+     */
+    if (ff.fiber && ff.fiber->bound_thread() != -1) {
+        ff.specific_thread_id = ff.fiber->bound_thread();
+    }
+    ff.enqueue_us = sampleTask() ? US() : 0;
+    ++task_counts_;
+    if (ff.specific_thread_id != -1) {
+        return enqueuePinned(ff);
+    }
+    if (ff.deadline_us) {
+        return enqueueDeadline(ff);
+    }
+
+    size_t lane = (size_t)ff.lane;
+    Worker* worker =
+        t_scheduler == this ? static_cast<Worker*>(t_worker) : nullptr;
+    if (work_stealing_ && worker) {
+        WorkStealingQueue<FiberOrFunction>& local = *worker->local[lane];
+        bool was_empty = local.empty();
+        bool ok = yielded ? local.pushFront(std::move(ff))
+                          : local.pushBack(std::move(ff));
+        if (ok) {
+            /**
+             * 本地队列原来就有任务时，空闲线程要么已经被叫醒过，要么本线程
+             * 很快就会处理到，不用每次都叫
+             */
+            return was_empty && hasIdleThread();
+        }
+
+        /**
+         * 本地队列满了，把最老的一批任务连同这个任务一起挪到全局队列
+         */
+        size_t counts = local.popFront(worker->batch.data(), BATCH_SIZE);
+        fibers_[lane].pushBulk(worker->batch.data(), counts);
+        fibers_[lane].push(std::move(ff));
+        return true;
+    }
+
+    bool need_tickle = fibers_[lane].empty();
+    fibers_[lane].push(std::move(ff));
+    return need_tickle;
+}
+
+bool Scheduler::enqueueBulk(FiberOrFunction* items, size_t counts,
+                            Priority lane) {
+    bool need_tickle = false;
+    size_t unpinned = 0;
+    uint64_t now = 0;
+    for (size_t i = 0; i < counts; ++i) {
+        FiberOrFunction& ff = items[i];
+        if (!ff.fiber && !ff.cb) {
+            continue;
+        }
+        if (ff.fiber && ff.fiber->bound_thread() != -1) {
+            ff.specific_thread_id = ff.fiber->bound_thread();
+        }
+        ff.lane = lane;
+        ff.enqueue_us = 0;
+        if (sampleTask()) {
+            now = now ? now : US();
+            ff.enqueue_us = now;
+        }
+        ++task_counts_;
+        if (ff.specific_thread_id != -1) {
+            need_tickle = enqueuePinned(ff) || need_tickle;
+        } else if (unpinned != i) {
+            items[unpinned++] = std::move(ff);
+        } else {
+            ++unpinned;
+        }
+    }
+
+    if (unpinned > 0) {
+        MPMCQueue<FiberOrFunction>& global = fibers_[(size_t)lane];
+        need_tickle = global.empty() || need_tickle;
+        global.pushBulk(items, unpinned);
+    }
+    return need_tickle;
+}
+
+bool Scheduler::enqueuePinned(FiberOrFunction& ff) {
+    Worker* target = findWorker(ff.specific_thread_id);
+    if (!target) {
+        TIHI_LOG_WARN(g_sys_logger)
+            << "thread " << ff.specific_thread_id
+            << " is not a thread of scheduler " << name_;
+        ff.specific_thread_id = -1;
+        MPMCQueue<FiberOrFunction>& global = fibers_[(size_t)ff.lane];
+        bool need_tickle = global.empty();
+        global.push(std::move(ff));
+        return need_tickle;
+    }
+
+    ++mailbox_counts_;
+    target->mailbox.push(std::move(ff));
+    /**
+     * 目标线程正在退出，它交出任务时可能已经看过信箱了，
+     * 和 retire() 两边都挪一次，任务不会留在没有线程的信箱里
+     */
+    if (target->state != Worker::RUNNING) {
+        return drainMailbox(target) > 0;
+    }
+    /**
+     * 目标就是当前线程时（比如在 idle 里处理 IO 事件），
+     * 它切回调度协程后马上会看信箱，不用叫醒自己
+     */
+    if (target->idle && !target->spinning &&
+        target->thread_id != ThreadId()) {
+        if (target->wake.exchange(Worker::WAKE_SENT) != Worker::WAKE_NONE) {
+            countTickleCoalesced();
+        } else {
+            tickleThread(target->thread_id);
+        }
+    }
+    return false;
+}
+
+bool Scheduler::enqueueDeadline(FiberOrFunction& ff) {
+    DeadlineQueue& queue = *deadlines_[(size_t)ff.lane];
+    bool was_empty = false;
+    {
+        mutex_type::mutex lock(queue.mutex);
+        was_empty = queue.heap.empty();
+        queue.heap.push_back(std::move(ff));
+        std::push_heap(queue.heap.begin(), queue.heap.end(),
+                       &DeadlineQueue::Later);
+    }
+    ++deadline_counts_;
+    return was_empty;
+}
+
+bool Scheduler::dequeueDeadline(Worker* worker, size_t lane,
+                                FiberOrFunction& fof) {
+    DeadlineQueue& queue = *deadlines_[lane];
+    uint64_t now = 0;
+    while (true) {
+        bool more = false;
+        {
+            mutex_type::mutex lock(queue.mutex);
+            if (queue.heap.empty()) {
+                return false;
+            }
+            std::pop_heap(queue.heap.begin(), queue.heap.end(),
+                          &DeadlineQueue::Later);
+            fof = std::move(queue.heap.back());
+            queue.heap.pop_back();
+            more = !queue.heap.empty();
+        }
+        --deadline_counts_;
+
+        if (!now) {
+            now = US();
+        }
+        /**
+         * 已经执行过的协程不能丢，只能让它继续执行
+         */
+        if (fof.deadline_us >= now ||
+            (fof.fiber && fof.fiber->state() != Fiber::INIT)) {
+            fof.deadline_us = 0;
+            fof.on_expired.reset();
+            /**
+             * 堆里的任务都在这里一个一个取，取走一个后再叫醒一个空闲线程来分担
+             */
+            if (more && hasIdleThread()) {
+                tickle();
+            }
+            return true;
+        }
+
+        Increase(worker->lane_stats[lane].expired);
+        if (fof.on_expired) {
+            Task cb = std::move(*fof.on_expired);
+            fof.fiber = nullptr;
+            fof.cb = std::move(cb);
+            fof.tag = nullptr;
+            fof.deadline_us = 0;
+            fof.on_expired.reset();
+            return true;
+        }
+        fof.clear();
+        --task_counts_;
+    }
+}
+
+bool Scheduler::dequeue(Worker* worker, FiberOrFunction& fof) {
+    /**
+     * 信箱里多是被唤醒的协程，不分 lane，最先处理
+     */
+    if (!worker->mailbox.empty() && worker->mailbox.pop(fof)) {
+        --mailbox_counts_;
+        return true;
+    }
+
+    ++worker->ticks;
+    for (int round = 0; round < 2; ++round) {
+        for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+            if (worker->credits[lane] > 0 && dequeueLane(worker, lane, fof)) {
+                --worker->credits[lane];
+                return true;
+            }
+        }
+        /**
+         * 还有额度的 lane 都没有任务了，开始新的一轮
+         */
+        for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+            worker->credits[lane] = lane_weights_[lane];
+        }
+    }
+    return steal(worker, fof);
+}
+
+bool Scheduler::dequeueLane(Worker* worker, size_t lane,
+                            FiberOrFunction& fof) {
+    if (deadline_counts_ && dequeueDeadline(worker, lane, fof)) {
+        return true;
+    }
+
+    if (worker->ticks % GLOBAL_CHECK_INTERVAL == 0 &&
+        dequeueGlobal(worker, lane, fof)) {
+        return true;
+    }
+
+    WorkStealingQueue<FiberOrFunction>& local = *worker->local[lane];
+    if (worker->ticks % LOCAL_FIFO_INTERVAL == 0) {
+        if (local.popFront(fof)) {
+            return true;
+        }
+    } else if (local.popBack(fof)) {
+        return true;
+    }
+
+    return dequeueGlobal(worker, lane, fof);
+}
+
+bool Scheduler::dequeueGlobal(Worker* worker, size_t lane,
+                              FiberOrFunction& fof) {
+    MPMCQueue<FiberOrFunction>& global = fibers_[lane];
+    if (global.empty() || !global.pop(fof)) {
+        return false;
+    }
+
+    /**
+     * 按全局队列的长度平分给各个线程，一次最多 BATCH_SIZE 个
+     */
+    if (work_stealing_) {
+        size_t threads = running_threads_ + (root_thread_id_ != -1 ? 1 : 0);
+        size_t counts =
+            std::min(global.size() / std::max<size_t>(threads, 1),
+                     BATCH_SIZE - 1);
+        FiberOrFunction& tmp = worker->batch[0];
+        for (size_t i = 0; i < counts && global.pop(tmp); ++i) {
+            if (!worker->local[lane]->pushBack(std::move(tmp))) {
+                global.push(std::move(tmp));
+                break;
+            }
+        }
+        tmp.clear();
+    }
+    return true;
+}
+
+bool Scheduler::steal(Worker* worker, FiberOrFunction& fof) {
+    size_t worker_counts = workers_.size();
+    if (!work_stealing_ || worker_counts < 2) {
+        return false;
+    }
+
+    size_t start = worker->random() % worker_counts;
+    for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+        for (size_t i = 0; i < worker_counts; ++i) {
+            Worker* victim = workers_[(start + i) % worker_counts].get();
+            WorkStealingQueue<FiberOrFunction>& from = *victim->local[lane];
+            if (victim == worker || from.empty()) {
+                continue;
+            }
+            size_t counts = from.popFront(worker->batch.data(), BATCH_SIZE);
+            if (counts == 0) {
+                continue;
+            }
+
+            fof = std::move(worker->batch[0]);
+            for (size_t j = 1; j < counts; ++j) {
+                worker->local[lane]->pushBack(std::move(worker->batch[j]));
+            }
+            /**
+             * 被偷的线程还有剩下的任务，再叫醒一个空闲线程来分担
+             */
+            if (!from.empty() && hasIdleThread()) {
+                tickle();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+std::vector<Scheduler::LaneStats> Scheduler::laneStats() {
+    std::vector<LaneStats> stats(PRIORITY_COUNTS);
+    for (auto& worker : workers_) {
+        for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+            Worker::LaneCounters& c = worker->lane_stats[lane];
+            stats[lane].dequeued += c.dequeued.load(std::memory_order_relaxed);
+            stats[lane].sampled += c.sampled.load(std::memory_order_relaxed);
+            stats[lane].total_delay_us +=
+                c.total_delay_us.load(std::memory_order_relaxed);
+            stats[lane].max_delay_us =
+                std::max(stats[lane].max_delay_us,
+                         (uint64_t)c.max_delay_us.load(std::memory_order_relaxed));
+            stats[lane].expired += c.expired.load(std::memory_order_relaxed);
+        }
+    }
+    return stats;
+}
+
+Scheduler::Stats Scheduler::stats() {
+    Stats stats;
+    for (auto& worker : workers_) {
+        stats.run_slices += worker->run_slices.load(std::memory_order_relaxed);
+        stats.context_switches +=
+            worker->context_switches.load(std::memory_order_relaxed);
+        stats.tickles_sent += worker->tickles_sent.load(std::memory_order_relaxed);
+        stats.tickles_received +=
+            worker->tickles_received.load(std::memory_order_relaxed);
+        stats.spins += worker->spins.load(std::memory_order_relaxed);
+        stats.spin_hits += worker->spin_hits.load(std::memory_order_relaxed);
+        stats.watchdog_stalls +=
+            worker->watchdog_stalls.load(std::memory_order_relaxed);
+        stats.preempt_requests +=
+            worker->preempt_requests.load(std::memory_order_relaxed);
+        stats.queue_delay_us.merge(worker->queue_delay);
+        stats.run_slice_us.merge(worker->run_slice);
+        stats.idle_us.merge(worker->idle_time);
+    }
+    stats.tickles_sent += external_tickles_sent_.load(std::memory_order_relaxed);
+    stats.tickles_skipped = tickles_skipped_.load(std::memory_order_relaxed);
+    stats.tickles_coalesced =
+        tickles_coalesced_.load(std::memory_order_relaxed);
+    stats.tickles_requested = stats.tickles_sent + stats.tickles_coalesced;
+    stats.spin_budget_us = spin_us_;
+    stats.threads = running_threads_ + (root_thread_id_ != -1 ? 1 : 0);
+    stats.threads_started = threads_started_;
+    stats.threads_retired = threads_retired_;
+    stats.active_threads = active_thread_count_;
+    stats.idle_threads = idle_thread_count_;
+    stats.lanes = laneStats();
+    return stats;
+}
+
+double Scheduler::Stats::utilization() const {
+    /**
+     * 只有抽中的任务计了时，按执行次数放大
+     */
+    double busy = run_slice_us.mean() * run_slices;
+    double total = busy + idle_us.sum();
+    return total > 0 ? busy / total : 0;
+}
+
+std::string Scheduler::Stats::toString() const {
+    static const char* s_lane_names[PRIORITY_COUNTS] = {"high", "normal",
+                                                        "low"};
+    std::stringstream ss;
+    ss << "run_slices=" << run_slices
+       << " context_switches=" << context_switches
+       << " tickles_requested=" << tickles_requested
+       << " tickles_sent=" << tickles_sent
+       << " tickles_coalesced=" << tickles_coalesced
+       << " tickles_received=" << tickles_received
+       << " tickles_skipped=" << tickles_skipped
+       << " spins=" << spins << " spin_hits=" << spin_hits
+       << " spin_budget_us=" << spin_budget_us
+       << " watchdog_stalls=" << watchdog_stalls
+       << " preempt_requests=" << preempt_requests
+       << " threads=" << threads << " threads_started=" << threads_started
+       << " threads_retired=" << threads_retired
+       << " active_threads=" << active_threads
+       << " idle_threads=" << idle_threads
+       << " utilization=" << utilization() << std::endl
+       << "queue_delay_us: " << queue_delay_us.toString() << std::endl
+       << "run_slice_us: " << run_slice_us.toString() << std::endl
+       << "idle_us: " << idle_us.toString();
+    for (size_t i = 0; i < lanes.size() && i < PRIORITY_COUNTS; ++i) {
+        ss << std::endl
+           << "lane " << s_lane_names[i] << ": dequeued=" << lanes[i].dequeued
+           << " sampled=" << lanes[i].sampled << " mean_delay_us="
+           << (lanes[i].sampled
+                   ? (double)lanes[i].total_delay_us / lanes[i].sampled
+                   : 0)
+           << " max_delay_us=" << lanes[i].max_delay_us
+           << " expired=" << lanes[i].expired;
+    }
+    return ss.str();
+}
+
+void Scheduler::countTickleSent() {
+    Worker* worker =
+        t_scheduler == this ? static_cast<Worker*>(t_worker) : nullptr;
+    if (worker) {
+        Increase(worker->tickles_sent);
+    } else {
+        external_tickles_sent_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void Scheduler::countTickleCoalesced() {
+    tickles_coalesced_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Scheduler::skipTickle() {
+    if (stopping_ || spinning_threads_ == 0) {
+        return false;
+    }
+    tickles_skipped_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+pid_t Scheduler::idleThread() {
+    size_t counts = workers_.size();
+    size_t start = idle_cursor_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < counts; ++i) {
+        Worker* worker = workers_[(start + i) % counts].get();
+        if (worker->state == Worker::RUNNING && worker->idle &&
+            !worker->spinning) {
+            return worker->thread_id;
+        }
+    }
+    return -1;
+}
+
+void Scheduler::disableElastic() {
+    TIHI_ASSERT((stopping_));
+    elastic_ = false;
+    min_threads_ = thread_count_;
+    max_threads_ = thread_count_;
+}
+
+void Scheduler::countTickleReceived() {
+    Worker* worker =
+        t_scheduler == this ? static_cast<Worker*>(t_worker) : nullptr;
+    if (worker) {
+        Increase(worker->tickles_received);
+    }
+}
+
+void Scheduler::monitor() {
+    /**
+     * 发现得晚一点没关系，最多晚一个检查间隔
+     */
+    uint32_t interval_ms = ~0u;
+    if (watchdog_ms_) {
+        interval_ms = std::min(interval_ms, watchdog_ms_ / 4);
+    }
+    if (preempt_ms_) {
+        interval_ms = std::min(interval_ms, preempt_ms_ / 4);
+    }
+    if (elastic_) {
+        interval_ms =
+            std::min(interval_ms, (uint32_t)(elastic_delay_us_ / 1000 / 2));
+    }
+    interval_ms = std::max<uint32_t>(interval_ms, 1);
+
+    while (!monitor_stopping_) {
+        ::usleep(interval_ms * 1000);
+        uint64_t now = MS();
+        if (watchdog_ms_ || preempt_ms_) {
+            for (auto& worker : workers_) {
+                checkWorker(worker.get(), now);
+            }
+        }
+        if (elastic_) {
+            checkLoad(now);
+        }
+    }
+}
+
+void Scheduler::checkLoad(uint64_t now_ms) {
+    /**
+     * 两种情况加线程：调度线程抽样看到的排队延迟超过阈值；
+     * 或者有任务在排队、却一直没有空闲线程（比如所有线程都被长任务占着，
+     * 没有机会取任务，也就看不到排队延迟）
+     */
+    bool grow = grow_requested_.exchange(false, std::memory_order_relaxed);
+    size_t tasks = task_counts_;
+    size_t active = active_thread_count_;
+    if (tasks > active && idle_thread_count_ == 0) {
+        if (!busy_since_ms_) {
+            busy_since_ms_ = now_ms;
+        } else if ((now_ms - busy_since_ms_) * 1000 >= elastic_delay_us_) {
+            grow = true;
+        }
+    } else {
+        busy_since_ms_ = 0;
+    }
+
+    if (grow && addThread()) {
+        busy_since_ms_ = 0;
+        TIHI_LOG_INFO(g_sys_logger)
+            << "scheduler " << name_ << " adds a thread, threads="
+            << running_threads_;
+    }
+}
+
+bool Scheduler::addThread() {
     mutex_type::mutex lock(mutex_);
-    return auto_stop_ && stopping_ && fibers_.empty() &&
-           active_thread_count_ == 0;
+    /**
+     * stop() 先设置 stopping_，再在 mutex_ 下取走 threads_ 去 join，
+     * 这里看到 stopping_ 为 false 时加的线程一定会被 stop() join
+     */
+    if (stopping_ || running_threads_ >= max_threads_) {
+        return false;
+    }
+    for (size_t i = 0; i < max_threads_; ++i) {
+        Worker* worker = workers_[i].get();
+        int state = worker->state;
+        if (state != Worker::EMPTY && state != Worker::EXITED) {
+            continue;
+        }
+        if (state == Worker::EXITED) {
+            worker->thread->join();
+            threads_.erase(
+                std::find(threads_.begin(), threads_.end(), worker->thread));
+            thread_ids_.erase(std::find(thread_ids_.begin(), thread_ids_.end(),
+                                        worker->thread->id()));
+            worker->thread.reset();
+        }
+        startThread(i);
+        ++threads_started_;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::retiring() {
+    Worker* worker =
+        t_scheduler == this ? static_cast<Worker*>(t_worker) : nullptr;
+    if (!elastic_ || !worker || stopping_ ||
+        (root_thread_id_ != -1 && worker == workers_.back().get())) {
+        return false;
+    }
+    if (worker->state == Worker::RETIRING) {
+        return true;
+    }
+    /**
+     * 绑定在本线程的共享栈协程只能在这里恢复，线程退出后共享栈也没了
+     */
+    if (Fiber::BoundSharedCounts()) {
+        return false;
+    }
+    if (!worker->idle_since_ms ||
+        MS() - worker->idle_since_ms < elastic_idle_ms_) {
+        return false;
+    }
+
+    size_t running = running_threads_;
+    while (running > min_threads_) {
+        if (running_threads_.compare_exchange_weak(running, running - 1)) {
+            worker->state = Worker::RETIRING;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::retire(Worker* worker) {
+    /**
+     * 之后本线程提交的任务都放进全局队列
+     */
+    t_worker = nullptr;
+    worker->thread_id = -1;
+
+    size_t moved = drainMailbox(worker);
+    for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+        WorkStealingQueue<FiberOrFunction>& local = *worker->local[lane];
+        while (!local.empty()) {
+            size_t counts = local.popFront(worker->batch.data(), BATCH_SIZE);
+            fibers_[lane].pushBulk(worker->batch.data(), counts);
+            moved += counts;
+        }
+    }
+    for (auto& fof : worker->batch) {
+        fof.clear();
+    }
+    worker->idle_since_ms = 0;
+    worker->ticks = 0;
+    for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+        worker->credits[lane] = 0;
+    }
+    ++threads_retired_;
+    TIHI_LOG_INFO(g_sys_logger)
+        << "scheduler " << name_ << " retires a thread, threads="
+        << running_threads_ << " handed off " << moved << " tasks";
+    if (moved > 0) {
+        tickle();
+    }
+    worker->state = Worker::EXITED;
+}
+
+size_t Scheduler::drainMailbox(Worker* worker) {
+    size_t moved = 0;
+    FiberOrFunction ff;
+    while (worker->mailbox.pop(ff)) {
+        --mailbox_counts_;
+        /**
+         * 指定的线程已经不在了，交给任意线程执行
+         */
+        ff.specific_thread_id = -1;
+        fibers_[(size_t)ff.lane].push(std::move(ff));
+        ++moved;
+    }
+    return moved;
+}
+
+void Scheduler::checkWorker(Worker* worker, uint64_t now_ms) {
+    /**
+     * run_slices 在每个任务切回来时加一，两次检查之间它没变、
+     * running_fiber_id 也没变，说明还是同一次执行
+     */
+    uint64_t slice = worker->run_slices.load(std::memory_order_relaxed);
+    uint64_t fiber_id = worker->running_fiber_id.load(std::memory_order_acquire);
+    if (!fiber_id || slice != worker->watched_slice ||
+        fiber_id != worker->watched_fiber_id) {
+        worker->watched_slice = slice;
+        worker->watched_fiber_id = fiber_id;
+        worker->watched_since_ms = now_ms;
+        worker->reported = false;
+        worker->preempted = false;
+        return;
+    }
+
+    uint64_t running_ms = now_ms - worker->watched_since_ms;
+    if (preempt_ms_ && running_ms >= preempt_ms_ && !worker->preempted) {
+        worker->preempted = true;
+        worker->preempt.store(true, std::memory_order_relaxed);
+        Increase(worker->preempt_requests);
+    }
+
+    if (watchdog_ms_ && running_ms >= watchdog_ms_ && !worker->reported) {
+        worker->reported = true;
+        Increase(worker->watchdog_stalls);
+        const char* tag = worker->running_tag.load(std::memory_order_relaxed);
+        std::string backtrace = ThreadBacktrace(worker->pthread, 64, "    ");
+        /**
+         * 取栈的时候任务可能刚好结束了
+         */
+        bool still_running =
+            worker->run_slices.load(std::memory_order_relaxed) == slice;
+        TIHI_LOG_WARN(g_sys_logger)
+            << "scheduler " << name_ << " thread " << worker->thread_id
+            << " has been running fiber " << fiber_id << " tag "
+            << (tag ? tag : "(none)") << " for at least " << running_ms
+            << "ms without returning to Scheduler::run"
+            << (still_running ? "" : " (finished while capturing backtrace)")
+            << "\nbacktrace: " << backtrace;
+    }
+}
+
+void Scheduler::stopMonitor() {
+    Thread::ptr monitor;
+    {
+        mutex_type::mutex lock(mutex_);
+        monitor.swap(monitor_thread_);
+    }
+    if (monitor) {
+        monitor_stopping_ = true;
+        monitor->join();
+    }
+}
+
+bool Scheduler::sampleTask() {
+    return stats_sample_period_ &&
+           ++t_sample_ticks % stats_sample_period_ == 0;
+}
+
+void Scheduler::endSlice(Worker* worker, uint64_t slice_start) {
+    if (watchdog_ms_ || preempt_ms_) {
+        worker->running_fiber_id.store(0, std::memory_order_relaxed);
+    }
+    Increase(worker->run_slices);
+    Increase(worker->context_switches);
+    if (slice_start) {
+        worker->run_slice.record(US() - slice_start);
+    }
+}
+
+Scheduler::Worker* Scheduler::findWorker(pid_t thread_id) {
+    for (auto& worker : workers_) {
+        if (worker->thread_id == thread_id) {
+            return worker.get();
+        }
+    }
+    return nullptr;
+}
+
+void Scheduler::forwardTickle(Worker* self) {
+    if (mailbox_counts_ == 0) {
+        return;
+    }
+    for (auto& worker : workers_) {
+        if (worker.get() == self || !worker->idle || worker->spinning ||
+            worker->mailbox.empty()) {
+            continue;
+        }
+        /**
+         * 放进信箱之后最多转发一次，否则进出 idle 的线程会把同一次唤醒来回传
+         */
+        int wake = Worker::WAKE_SENT;
+        if (worker->wake.compare_exchange_strong(wake,
+                                                 Worker::WAKE_FORWARDED)) {
+            tickleThread(worker->thread_id);
+        }
+    }
+}
+
+bool Scheduler::spin(Worker* worker) {
+    /**
+     * 最多一半的线程同时自旋，剩下的 CPU 留给干活的线程
+     */
+    size_t threads = running_threads_ + (root_thread_id_ != -1 ? 1 : 0);
+    if (stopping_ || spinning_threads_ * 2 >= std::max<size_t>(threads, 2)) {
+        return false;
+    }
+    if (!worker->spin_budget_us) {
+        worker->spin_budget_us = spin_us_;
+    }
+
+    ++spinning_threads_;
+    worker->spinning = true;
+    Increase(worker->spins);
+    bool hit = false;
+    uint64_t end = US() + worker->spin_budget_us;
+    do {
+        if (hasWork(worker) || poll()) {
+            hit = true;
+            break;
+        }
+        /**
+         * 把 CPU 让给可能正要提交任务的线程
+         */
+        sched_yield();
+    } while (US() < end && !stopping_);
+    worker->spinning = false;
+    --spinning_threads_;
+    /**
+     * 和 skipTickle() 先放任务再看有没有线程在自旋的顺序相反，
+     * 撤掉自旋标记之后再看一次，被省掉的唤醒不会漏掉任务
+     */
+    if (!hit) {
+        hit = hasWork(worker);
+    }
+
+    /**
+     * 等到了就恢复到上限，没等到就减半，最少是上限的 1/16
+     */
+    if (hit) {
+        Increase(worker->spin_hits);
+        worker->spin_budget_us = spin_us_;
+    } else {
+        worker->spin_budget_us = std::max<uint32_t>(
+            worker->spin_budget_us / 2, std::max<uint32_t>(spin_us_ / 16, 1));
+    }
+    return hit;
+}
+
+bool Scheduler::hasWork(Worker* worker) {
+    if (!worker->mailbox.empty() || deadline_counts_) {
+        return true;
+    }
+    for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+        if (!fibers_[lane].empty()) {
+            return true;
+        }
+    }
+    if (!work_stealing_) {
+        return false;
+    }
+    for (auto& victim : workers_) {
+        for (size_t lane = 0; lane < PRIORITY_COUNTS; ++lane) {
+            if (!victim->local[lane]->empty()) {
+                return true;
+            }
+        }
+    }
+    return false;
 }
 
 void Scheduler::set_this() { t_scheduler = this; }
 
 void Scheduler::idle() {
-    while (!stopping()) {
+    while (!stopping() && !retiring()) {
         Fiber::YieldToHold();
     }
     TIHI_LOG_INFO(g_sys_logger) << "idle";
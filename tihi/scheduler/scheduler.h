@@ -1,56 +1,219 @@
 #ifndef TIHI_SCHEDULER_SCHEDULER_H_
 #define TIHI_SCHEDULER_SCHEDULER_H_
 
-#include <list>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "fiber/fiber.h"
+#include "thread/affinity.h"
 #include "thread/thread.h"
+#include "utils/histogram.h"
+#include "utils/mpmc_queue.h"
 #include "utils/mutex.h"
+#include "utils/task.h"
 
 namespace tihi {
 
+template <typename T>
+class FiberFuture;
+
 class Scheduler {
 public:
     using ptr = std::shared_ptr<Scheduler>;
     using mutex_type = Mutex;
 
+    /**
+     * 任务的优先级，每个优先级一条队列（lane）。
+     * 几条队列都有任务时按 scheduler.lane_weights 的权重轮流取，
+     * 低优先级的任务不会被饿死
+     */
+    enum class Priority : uint8_t {
+        // 定时器到期和 IO 事件唤醒的任务
+        HIGH = 0,
+        // 默认
+        NORMAL = 1,
+        // 后台任务
+        LOW = 2,
+    };
+    static const size_t PRIORITY_COUNTS = 3;
+
+    /**
+     * 一条队列的统计，delay 是任务从入队到开始执行的时间，
+     * 只统计被抽中计时的 sampled 个任务（见 Stats）
+     */
+    struct LaneStats {
+        uint64_t dequeued = 0;
+        uint64_t sampled = 0;
+        uint64_t total_delay_us = 0;
+        uint64_t max_delay_us = 0;
+        // 取出时已经过了截止时间的任务。丢弃的不计入 dequeued，
+        // 换成 on_expired 执行的计入
+        uint64_t expired = 0;
+    };
+
+    /**
+     * 调度器的统计快照，由 stats() 合并所有调度线程的计数得到，时间都是微秒。
+     * queue_delay 是任务从入队到开始执行的时间，run_slice 是任务每次被切入
+     * 到切回调度协程的时间，idle 是每次在 idle 协程里等待的时间。
+     *
+     * 每个任务都读两次时钟的开销太大，入队时每 scheduler.stats_sample_period
+     * 个任务抽一个计时，queue_delay 和 run_slice 只包含抽中的任务，
+     * 次数类的统计都是精确的；设为 0 时不计时
+     */
+    struct Stats {
+        // 任务被切入执行的次数
+        uint64_t run_slices = 0;
+        // 调度协程切到任务协程或 idle 协程的次数
+        uint64_t context_switches = 0;
+        // 要求唤醒的次数，等于 tickles_sent 加上 tickles_coalesced
+        uint64_t tickles_requested = 0;
+        // 实际发出的唤醒次数，IOManager 只在有空闲线程时才写 eventfd
+        uint64_t tickles_sent = 0;
+        // 目标线程还有一次唤醒没有收到，合并掉的唤醒次数
+        uint64_t tickles_coalesced = 0;
+        // 空闲线程被唤醒的次数，多次 tickle 可能只唤醒一次
+        uint64_t tickles_received = 0;
+        // 有线程在自旋等任务，省掉的唤醒次数
+        uint64_t tickles_skipped = 0;
+        // 配置的自旋时长上限，见 scheduler.spin_us
+        uint32_t spin_budget_us = 0;
+        // 进入自旋的次数，以及自旋期间等到任务的次数
+        uint64_t spins = 0;
+        uint64_t spin_hits = 0;
+        // watchdog 发现一个任务执行超过 scheduler.watchdog_ms 的次数
+        uint64_t watchdog_stalls = 0;
+        // 任务执行超过 scheduler.preempt_ms、被要求让出的次数
+        uint64_t preempt_requests = 0;
+        // 当前的调度线程数（包括 caller 线程）
+        size_t threads = 0;
+        // 弹性模式下新启动、退出的线程数
+        uint64_t threads_started = 0;
+        uint64_t threads_retired = 0;
+        size_t active_threads = 0;
+        size_t idle_threads = 0;
+        Histogram queue_delay_us;
+        Histogram run_slice_us;
+        Histogram idle_us;
+        std::vector<LaneStats> lanes;
+
+        /**
+         * 执行任务的时间（按抽样估计）占执行任务和空闲时间之和的比例
+         */
+        double utilization() const;
+        /**
+         * 自旋等到任务的比例，一直很低说明自旋只是在浪费 CPU
+         */
+        double spinHitRate() const {
+            return spins ? (double)spin_hits / spins : 0;
+        }
+        std::string toString() const;
+    };
+
+    /**
+     * threads 是调度线程数，包括 caller 线程。scheduler.elastic 中配置了
+     * 这个调度器的名字时进入弹性模式：排队延迟过高时增加线程，空闲的线程
+     * 过一段时间后退出，线程数在配置的上下限之间变化。
+     * 共享栈的协程只能在原来的线程上恢复，还有这样的协程挂起的线程不会退出
+     */
     Scheduler(size_t threads = 1, bool use_caller = true,
               const std::string& name = "");
     virtual ~Scheduler();
 
     const std::string& name() const { return name_; }
 
+    /**
+     * 为 true 时，调度器为回调任务创建的协程使用共享栈，
+     * 见 Fiber 构造函数的说明
+     */
+    bool shared_stack() const { return shared_stack_; }
+    void set_shared_stack(bool v) { shared_stack_ = v; }
+
     static Scheduler* This();
     static Fiber* MainFiber();
+    /**
+     * 软抢占：当前任务这次执行超过 scheduler.preempt_ms 后返回 true。
+     * 调度是协作式的，长时间计算的任务可以在合适的位置检查它，
+     * 为 true 时调用 Fiber::YieldToReady() 让其他任务先执行
+     */
+    static bool ShouldYield();
 
     void start();
     void stop();
     void run_and_stop();
 
+    /**
+     * tag 标记任务的入口，开启栈用量统计时按 tag 汇总，
+     * fiber.stack_profile 为 auto 时按 tag 的历史峰值选择栈大小。
+     * tag 要在任务结束前一直有效，通常传字符串字面量
+     */
     template <typename F>
-    void schedule(F fc, pid_t thread_id = -1) {
-        bool need_tickle = false;
-        {
-            mutex_type::mutex lock(mutex_);
-            need_tickle = scheduleNoLock(fc, thread_id);
+    void schedule(F fc, pid_t thread_id = -1, const char* tag = nullptr) {
+        schedule(std::move(fc), Priority::NORMAL, thread_id, tag);
+    }
+
+    template <typename F>
+    void schedule(F fc, Priority priority, pid_t thread_id = -1,
+                  const char* tag = nullptr) {
+        FiberOrFunction ff(std::move(fc), thread_id);
+        ff.tag = tag;
+        ff.lane = priority;
+        if (enqueue(ff)) {
+            tickle();
         }
+    }
 
-        if (need_tickle) {
+    /**
+     * 带截止时间的任务，deadline_us 是 US() 的时间。
+     * 同一条 lane 里有截止时间的任务按截止时间从早到晚执行，排在没有截止时间的
+     * 任务前面（EDF）。取出时已经过了截止时间就不再执行：on_expired 不为空时
+     * 改为执行 on_expired（快速失败，比如回复超时），否则直接丢弃。
+     * 截止时间只在第一次执行前检查，协程已经开始执行过的话照常执行
+     */
+    template <typename F>
+    void scheduleWithDeadline(F fc, uint64_t deadline_us,
+                              Task on_expired = nullptr,
+                              Priority priority = Priority::NORMAL,
+                              const char* tag = nullptr) {
+        FiberOrFunction ff(std::move(fc), -1);
+        ff.tag = tag;
+        ff.lane = priority;
+        ff.deadline_us = deadline_us;
+        if (on_expired) {
+            ff.on_expired.reset(new Task(std::move(on_expired)));
+        }
+        if (enqueue(ff)) {
             tickle();
         }
     }
 
+    /**
+     * 与 schedule 相同，但返回一个可以在其他协程中等待结果的 FiberFuture，
+     * 定义在 sync/fiber_future.h 中
+     */
+    template <typename F>
+    FiberFuture<typename std::result_of<F()>::type> scheduleFuture(
+        F fc, pid_t thread_id = -1);
+
+    /**
+     * 批量调度，元素（Fiber::ptr 或回调）会被移走。
+     * 每 BULK_SIZE 个任务一次性放进全局队列，定时器到期的回调走这里
+     */
     template <typename InputIterator>
-    void schedule(InputIterator begin, InputIterator end) {
+    void schedule(InputIterator begin, InputIterator end,
+                  Priority priority = Priority::NORMAL) {
         bool need_tickle = false;
-        {
-            mutex_type::mutex lock(mutex_);
-            while (begin != end) {
-                need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                ++begin;
+        FiberOrFunction items[BULK_SIZE];
+        size_t counts = 0;
+        while (begin != end) {
+            items[counts++] = FiberOrFunction(&*begin, -1);
+            ++begin;
+            if (counts == BULK_SIZE || begin == end) {
+                need_tickle =
+                    enqueueBulk(items, counts, priority) || need_tickle;
+                counts = 0;
             }
         }
 
@@ -59,54 +222,255 @@ public:
         }
     }
 
+    /**
+     * 每条队列的统计快照，按 Priority 的顺序排列
+     */
+    std::vector<LaneStats> laneStats();
+    /**
+     * 合并各个调度线程的统计，不会阻塞调度线程，读到的计数可能稍旧
+     */
+    Stats stats();
+
 protected:
     virtual void tickle();
+    /**
+     * 只唤醒 thread_id 对应的调度线程，默认和 tickle() 相同
+     */
+    virtual void tickleThread(pid_t thread_id);
     void run();
     virtual bool stopping();
     virtual void idle();
     void set_this();
 
     bool hasIdleThread() { return idle_thread_count_ > 0; }
+    /**
+     * 弹性模式下由 idle 协程调用：当前线程空闲够久、线程数也多于下限时返回 true，
+     * idle 协程应当结束，线程交出本地任务后退出
+     */
+    bool retiring();
+    /**
+     * 弹性模式下空闲线程最久多长时间检查一次 retiring()，不是弹性模式时为 0
+     */
+    uint32_t retireCheckMs() const { return elastic_ ? elastic_idle_ms_ : 0; }
+    /**
+     * 子类真正发出、收到一次唤醒时调用，计入 stats()
+     */
+    void countTickleSent();
+    void countTickleReceived();
+    /**
+     * 已经有一次唤醒在路上，这次不再发出时调用
+     */
+    void countTickleCoalesced();
+    /**
+     * 有调度线程在自旋时它自己会看到新任务，tickle() 不用再唤醒空闲线程。
+     * 返回 true 时记一次省掉的唤醒；调度器正在停止时总是返回 false
+     */
+    bool skipTickle();
+    /**
+     * 轮流挑一个在 idle 中等待（没有自旋）的调度线程，没有返回 -1
+     */
+    pid_t idleThread();
+    /**
+     * 关闭弹性模式，线程数固定为构造时的 threads，要在 start() 之前调用。
+     * 子类的状态和线程一一对应时使用
+     */
+    void disableElastic();
+    /**
+     * 空闲线程自旋时反复调用，不阻塞地检查一次有没有新的任务来源
+     * （比如 IO 事件、到期的定时器），放进了任务时返回 true。默认什么也不做
+     */
+    virtual bool poll() { return false; }
 private:
-    template <typename F>
-    bool scheduleNoLock(F fc, pid_t thread_id) {
-        bool need_tickle = fibers_.empty();
-        FiberOrFunction ff(fc, thread_id);
-        if (ff.fiber || ff.cb) {
-            fibers_.push_back(ff);
-        }
+    struct FiberOrFunction;
+    struct Worker;
 
-        return need_tickle;
-    }
+    static const size_t BULK_SIZE = 32;
 
+    /**
+     * 把任务放进合适的队列，返回是否需要 tickle。
+     * 调度线程自己产生的任务放进它的本地队列，其他线程提交的任务放进全局队列，
+     * 指定了线程的任务放进目标线程的信箱；yielded 为 true 表示让出的协程重新排队，
+     * 放到本地队列的另一头，不让它插到已经在排队的任务前面
+     */
+    bool enqueue(FiberOrFunction& ff, bool yielded = false);
+    /**
+     * 批量放进 lane 对应的全局队列，items 中的任务会被移走
+     */
+    bool enqueueBulk(FiberOrFunction* items, size_t counts, Priority lane);
+    /**
+     * 指定了线程的任务放进目标线程的信箱，目标线程空闲时只唤醒它，
+     * 返回是否还需要 tickle
+     */
+    bool enqueuePinned(FiberOrFunction& ff);
+    /**
+     * 有截止时间的任务放进 lane 对应的最小堆，所有线程共用
+     */
+    bool enqueueDeadline(FiberOrFunction& ff);
+    /**
+     * 取截止时间最早的任务，过期的任务丢弃或者换成 on_expired
+     */
+    bool dequeueDeadline(Worker* worker, size_t lane, FiberOrFunction& fof);
+    /**
+     * 先取信箱，再按权重选一条 lane，依次从截止时间堆、本地队列、全局队列取一个任务，
+     * 都没有时从其他线程的本地队列偷
+     */
+    bool dequeue(Worker* worker, FiberOrFunction& fof);
+    bool dequeueLane(Worker* worker, size_t lane, FiberOrFunction& fof);
+    /**
+     * 从全局队列取一个任务，顺便再拿一批放进本地队列
+     */
+    bool dequeueGlobal(Worker* worker, size_t lane, FiberOrFunction& fof);
+    bool steal(Worker* worker, FiberOrFunction& fof);
+    Worker* findWorker(pid_t thread_id);
+    /**
+     * 为第 index 个 Worker 启动线程，要持有 mutex_
+     */
+    void startThread(size_t index);
+    /**
+     * 弹性模式下再启动一个线程，调度器正在停止或者已经到上限时返回 false
+     */
+    bool addThread();
+    /**
+     * 退出前把本地队列和信箱里的任务交给全局队列
+     */
+    void retire(Worker* worker);
+    /**
+     * 把信箱里的任务挪到全局队列，返回挪走的个数
+     */
+    size_t drainMailbox(Worker* worker);
+    /**
+     * 后台监控线程：watchdog 检查每个调度线程是否还在执行同一个任务，
+     * 弹性模式下根据排队情况增加线程
+     */
+    void monitor();
+    void checkWorker(Worker* worker, uint64_t now_ms);
+    void checkLoad(uint64_t now_ms);
+    void stopMonitor();
+    /**
+     * 入队时决定这个任务要不要计时
+     */
+    bool sampleTask();
+    /**
+     * 任务切回调度协程后记一次切换，slice_start 不为 0 时记下这次执行的时间
+     */
+    void endSlice(Worker* worker, uint64_t slice_start);
+    /**
+     * 当前线程准备进入 idle 前，发现有空闲线程的信箱里还有任务
+     * （唤醒被别的空闲线程接走了），再唤醒一次；每次放进信箱只转发一次
+     */
+    void forwardTickle(Worker* self);
+    /**
+     * 进入 idle 前先自旋一会儿，期间等到任务返回 true。
+     * 自旋时长按命中情况在 (0, spin_us_] 之间调整
+     */
+    bool spin(Worker* worker);
+    /**
+     * 当前线程能不能取到任务：自己的信箱、全局队列或者别的线程的本地队列不为空
+     */
+    bool hasWork(Worker* worker);
 
 private:
     struct FiberOrFunction {
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        Task cb;
         pid_t specific_thread_id;  // fiber 或 cb 要在线程id 为 specific_thread_id 的线程上执行
+        const char* tag = nullptr;
+        Priority lane = Priority::NORMAL;
+        // 入队的时间，用来统计排队延迟，没有抽中计时为 0
+        uint64_t enqueue_us = 0;
+        // 截止时间，为 0 时没有截止时间
+        uint64_t deadline_us = 0;
+        // 过了截止时间时代替任务执行，很少用到，单独分配
+        std::unique_ptr<Task> on_expired;
 
         FiberOrFunction() : specific_thread_id(-1) {}
-        FiberOrFunction(Fiber::ptr f, pid_t tid) : fiber(f), specific_thread_id(tid) {}
+        FiberOrFunction(Fiber::ptr f, pid_t tid)
+            : fiber(std::move(f)), specific_thread_id(tid) {}
         FiberOrFunction(Fiber::ptr* f, pid_t tid) : specific_thread_id(tid) {
             fiber.swap(*f);
         }
-        FiberOrFunction(std::function<void()> f, pid_t tid)
-            : cb(f), specific_thread_id(tid) {}
-        FiberOrFunction(std::function<void()>* f, pid_t tid) : specific_thread_id(tid) {
+        FiberOrFunction(Task* f, pid_t tid) : specific_thread_id(tid) {
             cb.swap(*f);
         }
+        FiberOrFunction(std::function<void()>* f, pid_t tid)
+            : cb(std::move(*f)), specific_thread_id(tid) {
+            *f = nullptr;
+        }
+        /**
+         * 其他可调用对象直接放进 Task 的内联缓冲区，一般不用分配内存
+         */
+        template <typename F>
+        FiberOrFunction(F&& f, pid_t tid)
+            : cb(std::forward<F>(f)), specific_thread_id(tid) {}
 
         void clear() {
             fiber = nullptr;
             cb = nullptr;
             specific_thread_id = -1;
+            tag = nullptr;
+            lane = Priority::NORMAL;
+            enqueue_us = 0;
+            deadline_us = 0;
+            on_expired.reset();
         }
     };
 
 private:
     std::vector<Thread::ptr> threads_;
-    std::list<FiberOrFunction> fibers_;
+    // 全局队列，调度线程以外提交的任务和本地队列放不下的任务
+    MPMCQueue<FiberOrFunction> fibers_[PRIORITY_COUNTS];
+    uint32_t lane_weights_[PRIORITY_COUNTS];
+    // 所有信箱中的任务数
+    std::atomic<size_t> mailbox_counts_{0};
+    struct DeadlineQueue;
+    std::unique_ptr<DeadlineQueue> deadlines_[PRIORITY_COUNTS];
+    // 所有截止时间堆中的任务数，为 0 时不用去锁堆
+    std::atomic<size_t> deadline_counts_{0};
+    /**
+     * 每个调度线程一个，使用 caller 线程时它的 Worker 在最后。
+     * 弹性模式下按线程数上限预先分配好，不会变化，没有线程的 Worker 队列为空
+     */
+    std::vector<std::unique_ptr<Worker>> workers_;
+    bool work_stealing_ = true;
+    uint32_t stats_sample_period_ = 8;
+    // 为 0 时不检查
+    uint32_t watchdog_ms_ = 0;
+    uint32_t preempt_ms_ = 0;
+    // 空闲线程最多自旋多久，为 0 时直接进入 idle
+    uint32_t spin_us_ = 0;
+    std::atomic<size_t> spinning_threads_{0};
+    // idleThread() 下次从哪个 Worker 开始找
+    std::atomic<size_t> idle_cursor_{0};
+    std::atomic<uint64_t> tickles_skipped_{0};
+    std::atomic<uint64_t> tickles_coalesced_{0};
+    Thread::ptr monitor_thread_;
+    std::atomic<bool> monitor_stopping_{false};
+    /**
+     * 弹性模式，线程数在 [min_threads_, max_threads_] 之间变化，
+     * 都不包括 caller 线程。不是弹性模式时都等于 thread_count_
+     */
+    bool elastic_ = false;
+    size_t min_threads_ = 0;
+    size_t max_threads_ = 0;
+    // 排队延迟超过它时增加线程
+    uint64_t elastic_delay_us_ = 0;
+    // 空闲超过它的线程退出
+    uint32_t elastic_idle_ms_ = 0;
+    // 正在运行的线程数，不包括 caller 线程
+    std::atomic<size_t> running_threads_{0};
+    // 调度线程看到排队延迟超过阈值
+    std::atomic<bool> grow_requested_{false};
+    // 有任务排队、又没有空闲线程的开始时间，只有监控线程读写
+    uint64_t busy_since_ms_ = 0;
+    std::atomic<uint64_t> threads_started_{0};
+    std::atomic<uint64_t> threads_retired_{0};
+    // 线程绑核和内存策略，见 scheduler.placement
+    std::vector<int> cpus_;
+    NumaPolicy numa_policy_ = NumaPolicy::NONE;
+    // 不是由调度线程发出的唤醒
+    std::atomic<uint64_t> external_tickles_sent_{0};
+    // 所有队列中的任务数加上正在执行的任务数
+    std::atomic<size_t> task_counts_{0};
     Fiber::ptr root_fiber_;
     std::string name_;
 
@@ -119,6 +483,7 @@ protected:
     std::atomic<size_t> idle_thread_count_{0};
     bool stopping_ = true;
     bool auto_stop_ = false;
+    bool shared_stack_ = false;
     /**
      * 当创建调度器的线程也要被调度器调度时，
      * 使用此变量记录是谁创建了自己
@@ -0,0 +1,108 @@
+#ifndef TIHI_SCHEDULER_WORK_STEALING_QUEUE_H_
+#define TIHI_SCHEDULER_WORK_STEALING_QUEUE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include "utils/mutex.h"
+#include "utils/noncopyable.h"
+
+namespace tihi {
+
+/**
+ * 调度线程私有的有界任务队列
+ *
+ * 所属线程从尾部放入、从尾部取出（LIFO，刚产生的任务趁热执行），
+ * 其他空闲线程从头部批量偷走最老的任务（FIFO）。
+ * 每个队列一把锁，只有所属线程和偶尔来偷的线程会争用，
+ * 元素保存在预先分配好的环形数组里，入队出队都不分配内存
+ */
+template <typename T>
+class WorkStealingQueue : public Noncopyable {
+public:
+    using mutex_type = Mutex;
+
+    explicit WorkStealingQueue(size_t capacity)
+        : capacity_(capacity), items_(capacity) {}
+
+    size_t capacity() const { return capacity_; }
+    /**
+     * 不加锁读取，只能作为提示
+     */
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+    bool empty() const { return size() == 0; }
+
+    /**
+     * 放到尾部，最先被所属线程取出；队列满时返回 false，v 不变
+     */
+    bool pushBack(T&& v) {
+        mutex_type::mutex lock(mutex_);
+        size_t size = size_.load(std::memory_order_relaxed);
+        if (size == capacity_) {
+            return false;
+        }
+        items_[(head_ + size) % capacity_] = std::move(v);
+        size_.store(size + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * 放到头部，排在队列中所有任务之后才会被所属线程取出
+     */
+    bool pushFront(T&& v) {
+        mutex_type::mutex lock(mutex_);
+        size_t size = size_.load(std::memory_order_relaxed);
+        if (size == capacity_) {
+            return false;
+        }
+        head_ = (head_ + capacity_ - 1) % capacity_;
+        items_[head_] = std::move(v);
+        size_.store(size + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool popBack(T& v) {
+        mutex_type::mutex lock(mutex_);
+        size_t size = size_.load(std::memory_order_relaxed);
+        if (size == 0) {
+            return false;
+        }
+        v = std::move(items_[(head_ + size - 1) % capacity_]);
+        size_.store(size - 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool popFront(T& v) { return popFront(&v, 1) == 1; }
+
+    /**
+     * 从头部取走最多 max 个、且不超过一半（向上取整）的任务，返回取走的个数
+     */
+    size_t popFront(T* out, size_t max) {
+        mutex_type::mutex lock(mutex_);
+        size_t size = size_.load(std::memory_order_relaxed);
+        size_t counts = (size + 1) / 2;
+        if (counts > max) {
+            counts = max;
+        }
+        for (size_t i = 0; i < counts; ++i) {
+            out[i] = std::move(items_[head_]);
+            head_ = (head_ + 1) % capacity_;
+        }
+        size_.store(size - counts, std::memory_order_relaxed);
+        return counts;
+    }
+
+private:
+    const size_t capacity_;
+    std::vector<T> items_;
+    size_t head_ = 0;
+    std::atomic<size_t> size_{0};
+    mutex_type mutex_;
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_SCHEDULER_WORK_STEALING_QUEUE_H_
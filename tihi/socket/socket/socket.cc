@@ -58,7 +58,7 @@ Socket::Socket(int family, int type, int protocol)
 Socket::~Socket() { close(); }
 
 uint64_t Socket::send_timeout() const {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->fd(sockfd());
+    FdCtx* ctx = FdMgr::GetInstance()->fd(sockfd());
     if (ctx) {
         return ctx->timeout(SO_SNDTIMEO);
     }
@@ -72,7 +72,7 @@ void Socket::set_send_timeout(uint64_t timeout) {
 }
 
 uint64_t Socket::recv_timeout() const {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->fd(sockfd());
+    FdCtx* ctx = FdMgr::GetInstance()->fd(sockfd());
     if (ctx) {
         return ctx->timeout(SO_RCVTIMEO);
     }
@@ -112,7 +112,7 @@ bool Socket::set_option(int level, int op, void* val, long unsigned int len) {
 }
 
 bool Socket::init(int sockfd) {
-    FdCtx::ptr ctx = FdMgr::GetInstance()->fd(sockfd);
+    FdCtx* ctx = FdMgr::GetInstance()->fd(sockfd);
     if (ctx && ctx->is_socket()) {
         sockfd_ = sockfd;
         is_connected_ = true;
@@ -0,0 +1,248 @@
+#include "channel.h"
+
+#include "iomanager/iomanager.h"
+#include "utils/macro.h"
+#include "utils/utils.h"
+
+namespace tihi {
+
+/**
+ * 返回还能等待的毫秒数，已经超时返回 0
+ */
+static uint64_t Remaining(uint64_t timeout_ms, uint64_t deadline) {
+    if (timeout_ms == FiberWaitQueue::NO_TIMEOUT) {
+        return FiberWaitQueue::NO_TIMEOUT;
+    }
+    uint64_t now = MS();
+    return now >= deadline ? 0 : deadline - now;
+}
+
+void ChannelBase::close() {
+    Mutex::mutex lock(mutex_);
+    closed_ = true;
+    send_waiters_.notifyAll();
+    recv_waiters_.notifyAll();
+}
+
+void ChannelBase::notify(bool send) {
+    std::atomic<uint32_t>& waiting = send ? send_waiting_ : recv_waiting_;
+    /**
+     * 与等待方“先加计数再重试”对应，队列的修改必须在读计数之前可见
+     */
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (waiting.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    Mutex::mutex lock(mutex_);
+    (send ? send_waiters_ : recv_waiters_).notifyOne();
+}
+
+bool ChannelBase::trySendValue(void* value) {
+    if (closed_ || !pushValue(value)) {
+        return false;
+    }
+    notify(false);
+    return true;
+}
+
+bool ChannelBase::tryRecvValue(void* value) {
+    if (!popValue(value)) {
+        return false;
+    }
+    notify(true);
+    return true;
+}
+
+bool ChannelBase::sendValue(void* value, uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms == NO_TIMEOUT ? 0 : MS() + timeout_ms;
+    while (true) {
+        if (closed_) {
+            return false;
+        }
+        if (trySendValue(value)) {
+            return true;
+        }
+
+        Mutex::mutex lock(mutex_);
+        ++send_waiting_;
+        if (closed_) {
+            --send_waiting_;
+            return false;
+        }
+        if (pushValue(value)) {
+            --send_waiting_;
+            lock.unlock();
+            notify(false);
+            return true;
+        }
+        uint64_t wait_ms = Remaining(timeout_ms, deadline);
+        bool rt = wait_ms != 0 && send_waiters_.wait(lock, wait_ms);
+        --send_waiting_;
+        if (!rt) {
+            return false;
+        }
+    }
+}
+
+bool ChannelBase::recvValue(void* value, uint64_t timeout_ms) {
+    uint64_t deadline = timeout_ms == NO_TIMEOUT ? 0 : MS() + timeout_ms;
+    while (true) {
+        if (tryRecvValue(value)) {
+            return true;
+        }
+        if (closed_) {
+            return tryRecvValue(value);
+        }
+
+        Mutex::mutex lock(mutex_);
+        ++recv_waiting_;
+        if (popValue(value)) {
+            --recv_waiting_;
+            lock.unlock();
+            notify(true);
+            return true;
+        }
+        if (closed_) {
+            --recv_waiting_;
+            lock.unlock();
+            return tryRecvValue(value);
+        }
+        uint64_t wait_ms = Remaining(timeout_ms, deadline);
+        bool rt = wait_ms != 0 && recv_waiters_.wait(lock, wait_ms);
+        --recv_waiting_;
+        if (!rt) {
+            return false;
+        }
+    }
+}
+
+void ChannelBase::addWaiter(const FiberWaiter::ptr& waiter, bool send) {
+    Mutex::mutex lock(mutex_);
+    if (send) {
+        send_waiters_.add(waiter);
+        ++send_waiting_;
+    } else {
+        recv_waiters_.add(waiter);
+        ++recv_waiting_;
+    }
+}
+
+void ChannelBase::removeWaiter(const FiberWaiter::ptr& waiter, bool send) {
+    Mutex::mutex lock(mutex_);
+    if (send) {
+        send_waiters_.remove(waiter);
+        --send_waiting_;
+    } else {
+        recv_waiters_.remove(waiter);
+        --recv_waiting_;
+    }
+}
+
+bool ChannelBase::trySelect(SelectCase& c) {
+    if (c.send) {
+        if (closed_) {
+            c.ok = false;
+            return true;
+        }
+        c.ok = trySendValue(c.value);
+        return c.ok;
+    }
+
+    if (tryRecvValue(c.value)) {
+        c.ok = true;
+        return true;
+    }
+    if (closed_) {
+        c.ok = tryRecvValue(c.value);
+        return true;
+    }
+    return false;
+}
+
+static void SelectTimeout(FiberWaiter::ptr waiter) {
+    if (waiter->fire()) {
+        waiter->timeout = true;
+        waiter->resume();
+    }
+}
+
+int Select(std::vector<SelectCase>& cases, uint64_t timeout_ms) {
+    uint64_t deadline =
+        timeout_ms == FiberWaitQueue::NO_TIMEOUT ? 0 : MS() + timeout_ms;
+    /**
+     * 被某个通道唤醒过，但最后没有用上这次唤醒
+     */
+    bool notified = false;
+    int index = -1;
+
+    while (index == -1) {
+        for (size_t i = 0; i < cases.size(); ++i) {
+            if (cases[i].channel->trySelect(cases[i])) {
+                index = i;
+                break;
+            }
+        }
+        if (index != -1) {
+            break;
+        }
+        uint64_t wait_ms = Remaining(timeout_ms, deadline);
+        if (wait_ms == 0) {
+            break;
+        }
+
+        /**
+         * 先在所有通道上登记再重试一遍，之后的唤醒都不会丢
+         */
+        FiberWaiter::ptr waiter(new FiberWaiter);
+        for (auto& c : cases) {
+            c.channel->addWaiter(waiter, c.send);
+        }
+        for (size_t i = 0; i < cases.size(); ++i) {
+            if (cases[i].channel->trySelect(cases[i])) {
+                index = i;
+                break;
+            }
+        }
+
+        Timer::ptr timer;
+        if (index == -1) {
+            if (wait_ms != FiberWaitQueue::NO_TIMEOUT) {
+                IOManager* iom = IOManager::This();
+                TIHI_ASSERT2((iom != nullptr), "timed select requires an IOManager");
+                timer = iom->addTimer(wait_ms, std::bind(SelectTimeout, waiter));
+            }
+            waiter->yield();
+            notified = notified || !waiter->timeout;
+        } else if (!waiter->fire()) {
+            /**
+             * 重试成功之前已经有通道来唤醒了，要等它把协程 schedule 回来
+             */
+            waiter->yield();
+            notified = true;
+        }
+
+        for (auto& c : cases) {
+            c.channel->removeWaiter(waiter, c.send);
+        }
+        if (timer) {
+            timer->cancel();
+        }
+        if (waiter->timeout) {
+            break;
+        }
+    }
+
+    /**
+     * 唤醒可能是别的等待者的，转给各个通道上的下一个等待者
+     */
+    if (notified) {
+        for (size_t i = 0; i < cases.size(); ++i) {
+            if ((int)i != index) {
+                cases[i].channel->notify(cases[i].send);
+            }
+        }
+    }
+    return index;
+}
+
+}  // namespace tihi
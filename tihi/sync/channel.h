@@ -0,0 +1,246 @@
+#ifndef TIHI_SYNC_CHANNEL_H_
+#define TIHI_SYNC_CHANNEL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "sync/fiber_sync.h"
+#include "utils/mpmc_queue.h"
+
+namespace tihi {
+
+class ChannelBase;
+
+/**
+ * Select 的一个分支，用 SendCase/RecvCase 构造
+ */
+struct SelectCase {
+    SelectCase(ChannelBase* c, bool s, void* v)
+        : channel(c), send(s), value(v) {}
+
+    ChannelBase* channel;
+    bool send;
+    void* value;
+    /**
+     * 分支被选中之后设置，false 表示通道已经关闭
+     */
+    bool ok = false;
+};
+
+/**
+ * 同时等待多个通道，返回第一个完成的分支下标，超时返回 -1；
+ * timeout_ms 为 0 时只尝试一遍，不挂起
+ */
+int Select(std::vector<SelectCase>& cases,
+           uint64_t timeout_ms = FiberWaitQueue::NO_TIMEOUT);
+
+/**
+ * 通道中与元素类型无关的部分：等待、唤醒和关闭
+ *
+ * 收发双方各有一个等待计数，对端计数为 0 时收发完成后不用加锁；
+ * 挂起前先在锁内增加计数再重试一次，与对端“先改队列再看计数”配合不会丢失唤醒
+ */
+class ChannelBase : public Noncopyable {
+    friend int Select(std::vector<SelectCase>& cases, uint64_t timeout_ms);
+
+public:
+    using ptr = std::shared_ptr<ChannelBase>;
+
+    static const uint64_t NO_TIMEOUT = FiberWaitQueue::NO_TIMEOUT;
+
+    ChannelBase() : send_waiters_(mutex_), recv_waiters_(mutex_) {}
+    virtual ~ChannelBase() {}
+
+    /**
+     * 关闭之后发送全部失败，接收取完剩余的元素之后失败，等待中的协程全部被唤醒
+     */
+    void close();
+    bool closed() const { return closed_; }
+
+protected:
+    /**
+     * 不挂起的入队/出队，value 指向一个 T，入队成功时 *value 被 move 走
+     */
+    virtual bool pushValue(void* value) = 0;
+    virtual bool popValue(void* value) = 0;
+
+    bool trySendValue(void* value);
+    bool tryRecvValue(void* value);
+    bool sendValue(void* value, uint64_t timeout_ms);
+    bool recvValue(void* value, uint64_t timeout_ms);
+
+private:
+    void notify(bool send);
+    void addWaiter(const FiberWaiter::ptr& waiter, bool send);
+    void removeWaiter(const FiberWaiter::ptr& waiter, bool send);
+    /**
+     * Select 尝试一个分支，返回 true 表示分支已经完成（包括通道已关闭）
+     */
+    bool trySelect(SelectCase& c);
+
+private:
+    Mutex mutex_;
+    FiberWaitQueue send_waiters_;
+    FiberWaitQueue recv_waiters_;
+    std::atomic<uint32_t> send_waiting_{0};
+    std::atomic<uint32_t> recv_waiting_{0};
+    std::atomic<bool> closed_{false};
+};
+
+/**
+ * 协程间的多生产者多消费者通道
+ *
+ * capacity 为 UNBOUNDED 时没有容量上限，否则通道满时 send 挂起当前协程，
+ * 通道空时 recv 挂起当前协程。有界通道使用 Vyukov 的环形队列，
+ * 无界通道使用 MPMCQueue，两者都不加锁
+ */
+template <typename T>
+class Channel : public ChannelBase {
+public:
+    using ptr = std::shared_ptr<Channel>;
+
+    static const size_t UNBOUNDED = 0;
+
+    explicit Channel(size_t capacity = UNBOUNDED) : capacity_(capacity) {
+        if (capacity_ == UNBOUNDED) {
+            queue_ = new MPMCQueue<T>();
+        } else {
+            cells_ = new Cell[capacity_];
+            for (size_t i = 0; i < capacity_; ++i) {
+                cells_[i].seq.store(2 * i, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    ~Channel() {
+        delete queue_;
+        if (cells_) {
+            size_t end = enqueue_pos_.load(std::memory_order_relaxed);
+            for (size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+                 pos != end; ++pos) {
+                reinterpret_cast<T*>(&cells_[pos % capacity_].storage)->~T();
+            }
+            delete[] cells_;
+        }
+    }
+
+    size_t capacity() const { return capacity_; }
+
+    /**
+     * 返回 false 表示通道已经关闭（或者超时）
+     */
+    bool send(T v) { return sendValue(&v, NO_TIMEOUT); }
+    bool trySend(T v) { return trySendValue(&v); }
+    bool sendFor(T v, uint64_t ms) { return sendValue(&v, ms); }
+
+    /**
+     * 返回 false 表示通道已经关闭并且没有剩余元素（或者超时）
+     */
+    bool recv(T& v) { return recvValue(&v, NO_TIMEOUT); }
+    bool tryRecv(T& v) { return tryRecvValue(&v); }
+    bool recvFor(T& v, uint64_t ms) { return recvValue(&v, ms); }
+
+protected:
+    bool pushValue(void* value) override {
+        T* v = static_cast<T*>(value);
+        if (queue_) {
+            queue_->push(std::move(*v));
+            return true;
+        }
+
+        Cell* cell = nullptr;
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos % capacity_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(2 * pos);
+            if (dif == 0) {
+                if (enqueue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        new (&cell->storage) T(std::move(*v));
+        cell->seq.store(2 * pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool popValue(void* value) override {
+        T* v = static_cast<T*>(value);
+        if (queue_) {
+            return queue_->pop(*v);
+        }
+
+        Cell* cell = nullptr;
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos % capacity_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t dif = (intptr_t)seq - (intptr_t)(2 * pos + 1);
+            if (dif == 0) {
+                if (dequeue_pos_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        T* p = reinterpret_cast<T*>(&cell->storage);
+        *v = std::move(*p);
+        p->~T();
+        cell->seq.store(2 * (pos + capacity_), std::memory_order_release);
+        return true;
+    }
+
+private:
+    /**
+     * seq 为 2 * pos 时位置 pos 可以写入，为 2 * pos + 1 时可以读出。
+     * 原始算法用 pos 和 pos + 1，容量为 1 时写满的格子和下一圈的空格子分不开
+     */
+    struct Cell {
+        std::atomic<size_t> seq;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    const size_t capacity_;
+    Cell* cells_ = nullptr;
+    /**
+     * 生产者和消费者的下标放在不同的缓存行上
+     */
+    char pad0_[64];
+    std::atomic<size_t> enqueue_pos_{0};
+    char pad1_[64];
+    std::atomic<size_t> dequeue_pos_{0};
+    char pad2_[64];
+
+    MPMCQueue<T>* queue_ = nullptr;
+};
+
+template <typename T>
+SelectCase SendCase(Channel<T>& channel, T& value) {
+    return SelectCase(&channel, true, &value);
+}
+
+template <typename T>
+SelectCase RecvCase(Channel<T>& channel, T& value) {
+    return SelectCase(&channel, false, &value);
+}
+
+}  // namespace tihi
+
+#endif  // TIHI_SYNC_CHANNEL_H_
@@ -0,0 +1,122 @@
+#include "fiber_future.h"
+
+#include <memory>
+
+#include "utils/macro.h"
+
+namespace tihi {
+
+void FiberFutureStateBase::wait() {
+    if (ready_) {
+        return;
+    }
+    Mutex::mutex lock(mutex_);
+    if (ready_) {
+        return;
+    }
+    if (FiberWaiter::CanPark()) {
+        waiters_.wait(lock);
+        return;
+    }
+    /**
+     * 不在协程里（比如 main 函数中等待结果），只能阻塞线程
+     */
+    Semaphore sem;
+    thread_waiters_.push_back(&sem);
+    lock.unlock();
+    sem.wait();
+}
+
+bool FiberFutureStateBase::waitFor(uint64_t ms) {
+    if (ready_) {
+        return true;
+    }
+    Mutex::mutex lock(mutex_);
+    if (ready_) {
+        return true;
+    }
+    return waiters_.wait(lock, ms);
+}
+
+void FiberFutureStateBase::then(std::function<void()> cb) {
+    {
+        Mutex::mutex lock(mutex_);
+        if (!ready_) {
+            callbacks_.push_back(cb);
+            return;
+        }
+    }
+    cb();
+}
+
+void FiberFutureStateBase::setException(std::exception_ptr e) {
+    exception_ = e;
+    markReady();
+}
+
+void FiberFutureStateBase::rethrow() const {
+    if (exception_) {
+        std::rethrow_exception(exception_);
+    }
+}
+
+void FiberFutureStateBase::markReady() {
+    std::vector<std::function<void()>> callbacks;
+    {
+        Mutex::mutex lock(mutex_);
+        TIHI_ASSERT2(!ready_, "FiberFuture result set twice");
+        ready_ = true;
+        waiters_.notifyAll();
+        for (auto sem : thread_waiters_) {
+            sem->notify();
+        }
+        thread_waiters_.clear();
+        callbacks.swap(callbacks_);
+    }
+    for (auto& cb : callbacks) {
+        cb();
+    }
+}
+
+FiberFuture<void> WhenAllStates(const std::vector<FiberFutureStateBase*>& states) {
+    FiberFutureState<void>* result = new FiberFutureState<void>;
+    FiberFuture<void> future(result);
+    if (states.empty()) {
+        result->setValue();
+        return future;
+    }
+
+    std::shared_ptr<std::atomic<size_t>> remain(
+        new std::atomic<size_t>(states.size()));
+    for (auto state : states) {
+        result->ref();
+        state->then([result, remain]() {
+            if (--*remain == 0) {
+                result->setValue();
+            }
+            result->unref();
+        });
+    }
+    return future;
+}
+
+FiberFuture<size_t> WhenAnyStates(
+    const std::vector<FiberFutureStateBase*>& states) {
+    FiberFutureState<size_t>* result = new FiberFutureState<size_t>;
+    FiberFuture<size_t> future(result);
+    TIHI_ASSERT2(!states.empty(), "WhenAny on nothing");
+
+    std::shared_ptr<std::atomic<bool>> done(new std::atomic<bool>(false));
+    for (size_t i = 0; i < states.size(); ++i) {
+        result->ref();
+        states[i]->then([result, done, i]() {
+            if (!done->exchange(true)) {
+                result->setValue(i);
+            }
+            result->unref();
+        });
+    }
+    return future;
+}
+
+}  // namespace tihi
@@ -0,0 +1,285 @@
+#ifndef TIHI_SYNC_FIBER_FUTURE_H_
+#define TIHI_SYNC_FIBER_FUTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "scheduler/scheduler.h"
+#include "sync/fiber_sync.h"
+
+namespace tihi {
+
+/**
+ * FiberFuture 的共享状态，与结果类型无关的部分
+ *
+ * 引用计数是侵入式的，Scheduler::scheduleFuture 把任务、结果和等待队列
+ * 放在同一次分配里
+ */
+class FiberFutureStateBase : public Noncopyable {
+public:
+    FiberFutureStateBase() : waiters_(mutex_) {}
+    virtual ~FiberFutureStateBase() {}
+
+    void ref() { ++refs_; }
+    void unref() {
+        if (--refs_ == 0) {
+            delete this;
+        }
+    }
+
+    bool ready() const { return ready_; }
+    /**
+     * 在协程中挂起当前协程，在普通线程中阻塞线程
+     */
+    void wait();
+    /**
+     * 只能在 IOManager 调度的协程中使用，返回 false 表示超时
+     */
+    bool waitFor(uint64_t ms);
+
+    /**
+     * 结果就绪之后调用 cb，已经就绪时立即调用
+     */
+    void then(std::function<void()> cb);
+
+    void setException(std::exception_ptr e);
+    /**
+     * 任务抛出过异常时重新抛出
+     */
+    void rethrow() const;
+
+    /**
+     * 执行任务，只有 scheduleFuture 创建的状态才有任务
+     */
+    virtual void run() {}
+
+protected:
+    void markReady();
+
+private:
+    std::atomic<int> refs_{1};
+    std::atomic<bool> ready_{false};
+    Mutex mutex_;
+    FiberWaitQueue waiters_;
+    std::vector<Semaphore*> thread_waiters_;
+    std::vector<std::function<void()>> callbacks_;
+    std::exception_ptr exception_;
+};
+
+template <typename T>
+class FiberFutureState : public FiberFutureStateBase {
+public:
+    ~FiberFutureState() {
+        if (has_value_) {
+            reinterpret_cast<T*>(&storage_)->~T();
+        }
+    }
+
+    template <typename U>
+    void setValue(U&& v) {
+        new (&storage_) T(std::forward<U>(v));
+        has_value_ = true;
+        markReady();
+    }
+
+    T& value() { return *reinterpret_cast<T*>(&storage_); }
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_;
+    bool has_value_ = false;
+};
+
+template <>
+class FiberFutureState<void> : public FiberFutureStateBase {
+public:
+    void setValue() { markReady(); }
+    void value() {}
+};
+
+template <typename T>
+struct FiberFutureInvoker {
+    template <typename F>
+    static void Invoke(FiberFutureState<T>* state, F& f) {
+        state->setValue(f());
+    }
+};
+
+template <>
+struct FiberFutureInvoker<void> {
+    template <typename F>
+    static void Invoke(FiberFutureState<void>* state, F& f) {
+        f();
+        state->setValue();
+    }
+};
+
+template <typename T, typename F>
+class FiberFutureTask : public FiberFutureState<T> {
+public:
+    explicit FiberFutureTask(F&& f) : fn_(std::move(f)) {}
+
+    void run() override {
+        try {
+            FiberFutureInvoker<T>::Invoke(this, fn_);
+        } catch (...) {
+            this->setException(std::current_exception());
+        }
+    }
+
+private:
+    F fn_;
+};
+
+/**
+ * 交给调度器的回调，只有一个指针，可以直接存放在 Task 内部；
+ * 只会执行一次，执行完释放任务持有的那份引用。
+ * 只能移动，没有执行就被销毁时（比如调度器丢弃了任务）以 broken_promise
+ * 完成结果，等待的一方不会一直挂起
+ */
+class FiberFutureRunner {
+public:
+    explicit FiberFutureRunner(FiberFutureStateBase* state) : state_(state) {}
+    FiberFutureRunner(FiberFutureRunner&& other) noexcept
+        : state_(other.state_) {
+        other.state_ = nullptr;
+    }
+    FiberFutureRunner(const FiberFutureRunner&) = delete;
+    FiberFutureRunner& operator=(const FiberFutureRunner&) = delete;
+    FiberFutureRunner& operator=(FiberFutureRunner&&) = delete;
+
+    ~FiberFutureRunner() {
+        if (state_) {
+            state_->setException(std::make_exception_ptr(
+                std::future_error(std::future_errc::broken_promise)));
+            state_->unref();
+        }
+    }
+
+    void operator()() {
+        FiberFutureStateBase* state = state_;
+        state_ = nullptr;
+        state->run();
+        state->unref();
+    }
+
+private:
+    FiberFutureStateBase* state_;
+};
+
+/**
+ * 可以在其他协程中等待的任务结果，复制之后共享同一个结果
+ */
+template <typename T>
+class FiberFuture {
+public:
+    using reference = typename std::add_lvalue_reference<T>::type;
+
+    FiberFuture() {}
+    /**
+     * 接管 state 的一份引用
+     */
+    explicit FiberFuture(FiberFutureState<T>* state) : state_(state) {}
+    FiberFuture(const FiberFuture& other) : state_(other.state_) {
+        if (state_) {
+            state_->ref();
+        }
+    }
+    FiberFuture(FiberFuture&& other) : state_(other.state_) {
+        other.state_ = nullptr;
+    }
+    FiberFuture& operator=(FiberFuture other) {
+        std::swap(state_, other.state_);
+        return *this;
+    }
+    ~FiberFuture() {
+        if (state_) {
+            state_->unref();
+        }
+    }
+
+    bool valid() const { return state_ != nullptr; }
+    bool ready() const { return state_->ready(); }
+    void wait() const { state_->wait(); }
+    bool waitFor(uint64_t ms) const { return state_->waitFor(ms); }
+
+    /**
+     * 等待并返回结果，任务抛出的异常在这里重新抛出
+     */
+    reference get() const {
+        state_->wait();
+        state_->rethrow();
+        return state_->value();
+    }
+
+    FiberFutureStateBase* state() const { return state_; }
+
+private:
+    FiberFutureState<T>* state_ = nullptr;
+};
+
+FiberFuture<void> WhenAllStates(const std::vector<FiberFutureStateBase*>& states);
+FiberFuture<size_t> WhenAnyStates(
+    const std::vector<FiberFutureStateBase*>& states);
+
+/**
+ * 所有 future 都就绪之后就绪，结果（包括异常）仍然从各自的 future 中获取
+ */
+template <typename T>
+FiberFuture<void> WhenAll(const std::vector<FiberFuture<T>>& futures) {
+    std::vector<FiberFutureStateBase*> states;
+    for (auto& f : futures) {
+        states.push_back(f.state());
+    }
+    return WhenAllStates(states);
+}
+
+template <typename... Ts>
+FiberFuture<void> WhenAll(const FiberFuture<Ts>&... futures) {
+    std::vector<FiberFutureStateBase*> states{futures.state()...};
+    return WhenAllStates(states);
+}
+
+/**
+ * 任意一个 future 就绪之后就绪，结果是第一个就绪的 future 的下标
+ */
+template <typename T>
+FiberFuture<size_t> WhenAny(const std::vector<FiberFuture<T>>& futures) {
+    std::vector<FiberFutureStateBase*> states;
+    for (auto& f : futures) {
+        states.push_back(f.state());
+    }
+    return WhenAnyStates(states);
+}
+
+template <typename... Ts>
+FiberFuture<size_t> WhenAny(const FiberFuture<Ts>&... futures) {
+    std::vector<FiberFutureStateBase*> states{futures.state()...};
+    return WhenAnyStates(states);
+}
+
+template <typename F>
+FiberFuture<typename std::result_of<F()>::type> Scheduler::scheduleFuture(
+    F fc, pid_t thread_id) {
+    using result_type = typename std::result_of<F()>::type;
+    FiberFutureTask<result_type, F>* task =
+        new FiberFutureTask<result_type, F>(std::move(fc));
+    /**
+     * 一份引用给返回的 future，一份给调度出去的任务
+     */
+    task->ref();
+    schedule(FiberFutureRunner(task), thread_id);
+    return FiberFuture<result_type>(task);
+}
+
+}  // namespace tihi
+
+#endif  // TIHI_SYNC_FIBER_FUTURE_H_
@@ -0,0 +1,283 @@
+#include "fiber_sync.h"
+
+#include "iomanager/iomanager.h"
+#include "utils/macro.h"
+
+namespace tihi {
+
+FiberWaiter::FiberWaiter()
+    : fiber(Fiber::This()), scheduler(Scheduler::This()) {}
+
+bool FiberWaiter::CanPark() {
+    if (!Scheduler::This()) {
+        return false;
+    }
+    Fiber* fiber = Fiber::Current();
+    return fiber != Scheduler::MainFiber() && !fiber->is_main();
+}
+
+void FiberWaiter::resume() {
+    if (state.exchange(NOTIFIED) == PARKED) {
+        scheduler->schedule(fiber, thread_id);
+    }
+}
+
+bool FiberWaiter::wake() {
+    if (!fire()) {
+        return false;
+    }
+    resume();
+    return true;
+}
+
+static void ParkAfterSwitch(void* arg) {
+    FiberWaiter* waiter = static_cast<FiberWaiter*>(arg);
+    /**
+     * 切出之前已经被唤醒了，唤醒的一方把 schedule 留给了这里
+     */
+    if (waiter->state.exchange(FiberWaiter::PARKED) == FiberWaiter::NOTIFIED) {
+        waiter->scheduler->schedule(waiter->fiber, waiter->thread_id);
+    }
+}
+
+void FiberWaiter::yield() {
+    TIHI_ASSERT2(CanPark(),
+                 "fiber sync primitives must be used inside a scheduled fiber");
+    Fiber::YieldToHold(ParkAfterSwitch, this);
+}
+
+void FiberWaiter::reset() {
+    fired = false;
+    state = RUNNING;
+    timeout = false;
+}
+
+bool FiberWaitQueue::wait(mutex_type::mutex& lock, uint64_t timeout_ms) {
+    FiberWaiter::ptr waiter(new FiberWaiter);
+    waiters_.push_back(waiter);
+
+    Timer::ptr timer;
+    if (timeout_ms != NO_TIMEOUT) {
+        IOManager* iom = IOManager::This();
+        TIHI_ASSERT2((iom != nullptr), "timed wait requires an IOManager");
+        timer = iom->addTimer(
+            timeout_ms, std::bind(&FiberWaitQueue::onTimeout, this, waiter));
+    }
+
+    lock.unlock();
+    waiter->yield();
+
+    if (timer) {
+        timer->cancel();
+    }
+    return !waiter->timeout;
+}
+
+void FiberWaitQueue::onTimeout(FiberWaiter::ptr waiter) {
+    if (!waiter->fire()) {
+        return;
+    }
+    {
+        mutex_type::mutex lock(mutex_);
+        waiters_.remove(waiter);
+        waiter->timeout = true;
+        if (on_timeout_) {
+            on_timeout_();
+        }
+    }
+    waiter->resume();
+}
+
+bool FiberWaitQueue::notifyOne() {
+    while (!waiters_.empty()) {
+        FiberWaiter::ptr waiter = waiters_.front();
+        waiters_.pop_front();
+        /**
+         * 抢不到唤醒权说明它已经超时了，只是还没来得及把自己从队列中移走
+         */
+        if (waiter->wake()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t FiberWaitQueue::notifyAll() {
+    size_t counts = 0;
+    while (notifyOne()) {
+        ++counts;
+    }
+    return counts;
+}
+
+void FiberMutex::lock() {
+    Mutex::mutex guard(mutex_);
+    if (!locked_) {
+        locked_ = true;
+        return;
+    }
+    waiters_.wait(guard);
+}
+
+bool FiberMutex::tryLock() {
+    Mutex::mutex guard(mutex_);
+    if (locked_) {
+        return false;
+    }
+    locked_ = true;
+    return true;
+}
+
+bool FiberMutex::tryLockFor(uint64_t ms) {
+    Mutex::mutex guard(mutex_);
+    if (!locked_) {
+        locked_ = true;
+        return true;
+    }
+    return waiters_.wait(guard, ms);
+}
+
+void FiberMutex::unlock() {
+    Mutex::mutex guard(mutex_);
+    TIHI_ASSERT(locked_);
+    if (!waiters_.notifyOne()) {
+        locked_ = false;
+    }
+}
+
+void FiberConditionVariable::wait(FiberMutex::mutex& lock) {
+    {
+        Mutex::mutex guard(mutex_);
+        lock.unlock();
+        waiters_.wait(guard);
+    }
+    lock.lock();
+}
+
+bool FiberConditionVariable::waitFor(FiberMutex::mutex& lock, uint64_t ms) {
+    bool rt = false;
+    {
+        Mutex::mutex guard(mutex_);
+        lock.unlock();
+        rt = waiters_.wait(guard, ms);
+    }
+    lock.lock();
+    return rt;
+}
+
+void FiberConditionVariable::notifyOne() {
+    Mutex::mutex guard(mutex_);
+    waiters_.notifyOne();
+}
+
+void FiberConditionVariable::notifyAll() {
+    Mutex::mutex guard(mutex_);
+    waiters_.notifyAll();
+}
+
+void FiberSemaphore::wait() {
+    Mutex::mutex guard(mutex_);
+    if (count_ > 0) {
+        --count_;
+        return;
+    }
+    waiters_.wait(guard);
+}
+
+bool FiberSemaphore::tryWait() {
+    Mutex::mutex guard(mutex_);
+    if (count_ > 0) {
+        --count_;
+        return true;
+    }
+    return false;
+}
+
+bool FiberSemaphore::waitFor(uint64_t ms) {
+    Mutex::mutex guard(mutex_);
+    if (count_ > 0) {
+        --count_;
+        return true;
+    }
+    return waiters_.wait(guard, ms);
+}
+
+void FiberSemaphore::notify() {
+    Mutex::mutex guard(mutex_);
+    if (!waiters_.notifyOne()) {
+        ++count_;
+    }
+}
+
+FiberRWMutex::FiberRWMutex()
+    : read_waiters_(mutex_), write_waiters_(mutex_) {
+    /**
+     * 读者可能是因为这个写者才排队的，写者超时走了要重新看看能不能放读者进来
+     */
+    write_waiters_.set_timeout_callback([this]() {
+        if (write_waiters_.empty()) {
+            wakeReaders();
+        }
+    });
+}
+
+void FiberRWMutex::rdlock() {
+    Mutex::mutex guard(mutex_);
+    if (!writer_ && write_waiters_.empty()) {
+        ++readers_;
+        return;
+    }
+    read_waiters_.wait(guard);
+}
+
+void FiberRWMutex::wrlock() {
+    Mutex::mutex guard(mutex_);
+    if (!writer_ && readers_ == 0) {
+        writer_ = true;
+        return;
+    }
+    write_waiters_.wait(guard);
+}
+
+bool FiberRWMutex::tryRdlockFor(uint64_t ms) {
+    Mutex::mutex guard(mutex_);
+    if (!writer_ && write_waiters_.empty()) {
+        ++readers_;
+        return true;
+    }
+    return read_waiters_.wait(guard, ms);
+}
+
+bool FiberRWMutex::tryWrlockFor(uint64_t ms) {
+    Mutex::mutex guard(mutex_);
+    if (!writer_ && readers_ == 0) {
+        writer_ = true;
+        return true;
+    }
+    return write_waiters_.wait(guard, ms);
+}
+
+void FiberRWMutex::unlock() {
+    Mutex::mutex guard(mutex_);
+    if (writer_) {
+        writer_ = false;
+        wakeReaders();
+    } else {
+        TIHI_ASSERT((readers_ > 0));
+        --readers_;
+    }
+    if (readers_ == 0 && write_waiters_.notifyOne()) {
+        writer_ = true;
+    }
+}
+
+void FiberRWMutex::wakeReaders() {
+    if (!writer_) {
+        /**
+         * 被唤醒的读者已经替它们计数了
+         */
+        readers_ += read_waiters_.notifyAll();
+    }
+}
+
+}  // namespace tihi
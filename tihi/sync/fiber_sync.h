@@ -0,0 +1,224 @@
+#ifndef TIHI_SYNC_FIBER_SYNC_H_
+#define TIHI_SYNC_FIBER_SYNC_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+
+#include "fiber/fiber.h"
+#include "scheduler/scheduler.h"
+#include "utils/mutex.h"
+#include "utils/noncopyable.h"
+
+namespace tihi {
+
+/**
+ * 协程同步原语
+ *
+ * 与 utils/mutex.h 中包装 pthread 的锁不同，这里的锁在竞争时只挂起当前协程
+ * （Fiber::YieldToHold），线程继续执行别的协程；释放时把等待的协程 schedule
+ * 回它所在的调度器。只能在调度器调度的协程中使用，带超时的版本还要求调度器是
+ * IOManager（超时由 TimerManager 的定时器实现）。
+ */
+
+/**
+ * 挂在等待队列上的协程
+ *
+ * fired 保证唤醒和超时只有一方生效；抢到唤醒权的一方调用 resume()，
+ * 如果协程此时还没有真正切出，就由它切出之后自己 schedule，
+ * 所以登记等待和切出之间不需要一直持有锁（Select 同时等待多个队列时也一样）
+ */
+struct FiberWaiter {
+    using ptr = std::shared_ptr<FiberWaiter>;
+
+    enum State {
+        RUNNING = 0,
+        PARKED = 1,
+        NOTIFIED = 2,
+    };
+
+    FiberWaiter();
+
+    /**
+     * 当前是否运行在调度器调度的协程中，只有这时才能挂起等待
+     */
+    static bool CanPark();
+
+    /**
+     * 抢唤醒权，返回 false 表示已经被别人抢走了
+     */
+    bool fire() { return !fired.exchange(true); }
+    /**
+     * 抢到唤醒权之后让协程恢复执行
+     */
+    void resume();
+    /**
+     * fire() + resume()
+     */
+    bool wake();
+    /**
+     * 当前协程挂起，直到 resume()
+     */
+    void yield();
+    /**
+     * 被唤醒之后回到初始状态，同一个协程可以用它再等一次；
+     * 调用时不能还有别人持有它准备唤醒
+     */
+    void reset();
+
+    Fiber::ptr fiber;
+    Scheduler* scheduler;
+    /**
+     * 恢复时放到这个线程上执行，-1 表示不指定；要在 resume() 之前设置
+     */
+    pid_t thread_id = -1;
+    std::atomic<bool> fired{false};
+    std::atomic<int> state{RUNNING};
+    bool timeout = false;
+};
+
+/**
+ * 协程等待队列，所有操作都必须在持有构造时传入的 mutex 时进行
+ */
+class FiberWaitQueue : public Noncopyable {
+public:
+    using mutex_type = Mutex;
+
+    static const uint64_t NO_TIMEOUT = ~0ull;
+
+    explicit FiberWaitQueue(mutex_type& mutex) : mutex_(mutex) {}
+
+    /**
+     * 挂起当前协程直到被唤醒，返回时 lock 处于释放状态；返回 false 表示超时
+     */
+    bool wait(mutex_type::mutex& lock, uint64_t timeout_ms = NO_TIMEOUT);
+
+    /**
+     * 只登记/移除等待者，不挂起，用于同时等待多个队列
+     */
+    void add(const FiberWaiter::ptr& waiter) { waiters_.push_back(waiter); }
+    void remove(const FiberWaiter::ptr& waiter) { waiters_.remove(waiter); }
+
+    /**
+     * 唤醒最早等待的一个协程，返回 false 表示没有可以唤醒的协程
+     */
+    bool notifyOne();
+    size_t notifyAll();
+
+    bool empty() const { return waiters_.empty(); }
+
+    /**
+     * 协程超时离开队列之后、持有 mutex 时调用，
+     * 用于某些等待者离开后需要重新判断能否唤醒其他协程的情况
+     */
+    void set_timeout_callback(std::function<void()> cb) { on_timeout_ = cb; }
+
+private:
+    void onTimeout(FiberWaiter::ptr waiter);
+
+private:
+    mutex_type& mutex_;
+    std::list<FiberWaiter::ptr> waiters_;
+    std::function<void()> on_timeout_;
+};
+
+class FiberMutex : public Noncopyable {
+public:
+    using mutex = ScopedLock<FiberMutex>;
+
+    FiberMutex() : waiters_(mutex_) {}
+
+    void lock();
+    bool tryLock();
+    /**
+     * 返回 false 表示 ms 毫秒内没有拿到锁
+     */
+    bool tryLockFor(uint64_t ms);
+    /**
+     * 有协程在等待时锁直接交给它，不会被后来的协程抢走
+     */
+    void unlock();
+
+private:
+    Mutex mutex_;
+    bool locked_ = false;
+    FiberWaitQueue waiters_;
+};
+
+class FiberConditionVariable : public Noncopyable {
+public:
+    FiberConditionVariable() : waiters_(mutex_) {}
+
+    void wait(FiberMutex::mutex& lock);
+    /**
+     * 返回 false 表示超时，无论是否超时返回时 lock 都重新持有
+     */
+    bool waitFor(FiberMutex::mutex& lock, uint64_t ms);
+
+    template <typename Predicate>
+    void wait(FiberMutex::mutex& lock, Predicate pred) {
+        while (!pred()) {
+            wait(lock);
+        }
+    }
+
+    void notifyOne();
+    void notifyAll();
+
+private:
+    Mutex mutex_;
+    FiberWaitQueue waiters_;
+};
+
+class FiberSemaphore : public Noncopyable {
+public:
+    explicit FiberSemaphore(uint32_t count = 0)
+        : count_(count), waiters_(mutex_) {}
+
+    void wait();
+    bool tryWait();
+    bool waitFor(uint64_t ms);
+    void notify();
+
+    uint32_t count() const { return count_; }
+
+private:
+    Mutex mutex_;
+    uint32_t count_;
+    FiberWaitQueue waiters_;
+};
+
+/**
+ * 写锁释放时优先唤醒所有等待的读者，最后一个读者释放时唤醒一个写者；
+ * 有写者在等待时新来的读者也要排队，读写双方都不会饿死
+ */
+class FiberRWMutex : public Noncopyable {
+public:
+    using read_lock = ScopedReadLock<FiberRWMutex>;
+    using write_lock = ScopedWriteLock<FiberRWMutex>;
+
+    FiberRWMutex();
+
+    void rdlock();
+    void wrlock();
+    bool tryRdlockFor(uint64_t ms);
+    bool tryWrlockFor(uint64_t ms);
+    void unlock();
+
+private:
+    void wakeReaders();
+
+private:
+    Mutex mutex_;
+    uint32_t readers_ = 0;
+    bool writer_ = false;
+    FiberWaitQueue read_waiters_;
+    FiberWaitQueue write_waiters_;
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_SYNC_FIBER_SYNC_H_
@@ -69,8 +69,28 @@ void TcpServer::startAccepet(Socket::ptr sock) {
     while (!is_stop_) {
         Socket::ptr client = sock->accept();
         if (client) {
-            worker_->schedule(std::bind(&TcpServer::handleClient,
-                                        shared_from_this(), client));
+            /**
+             * 不经过 std::function，绑定对象可以直接放进 Task 的内联缓冲区
+             */
+            auto cb = std::bind(&TcpServer::handleClient, shared_from_this(),
+                                client);
+            /**
+             * reactor-per-thread 模式下连接绑定到一个 reactor，
+             * handleClient 从头到尾都在那个线程上执行
+             */
+            pid_t thread_id = -1;
+            if (worker_->sharded()) {
+                thread_id = worker_->reactorThread(
+                    worker_->bindFd(client->sockfd()));
+            }
+            if (shared_stack_) {
+                Fiber::ptr fiber(new Fiber(std::move(cb), 0, false, true));
+                fiber->set_tag("tcp_server.client");
+                worker_->schedule(fiber, thread_id);
+            } else {
+                worker_->schedule(std::move(cb), thread_id,
+                                  "tcp_server.client");
+            }
         } else {
             TIHI_LOG_ERROR(g_sys_logger)
                 << "accept(" << *sock << ") errno=" << errno
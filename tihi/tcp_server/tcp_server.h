@@ -36,6 +36,13 @@ public:
 
     bool is_stop() const { return is_stop_; }
 
+    /**
+     * 为 true 时每个连接的 handleClient 在共享栈协程中运行，
+     * 大量空闲长连接挂起时只占用实际用到的那部分栈
+     */
+    bool shared_stack() const { return shared_stack_; }
+    void set_shared_stack(bool v) { shared_stack_ = v; }
+
 protected:
     virtual void handleClient(Socket::ptr sock);
     virtual void startAccepet(Socket::ptr sock);
@@ -47,6 +54,7 @@ private:
     uint64_t read_timeout_;
     std::string name_;
     bool is_stop_;
+    bool shared_stack_ = false;
 };
 
 }  // namespace tihi
@@ -0,0 +1,126 @@
+#include "affinity.h"
+
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "log/log.h"
+
+namespace tihi {
+
+static Logger::ptr g_logger = TIHI_LOG_LOGGER("system");
+
+NumaPolicy NumaPolicyFromString(const std::string& str) {
+    if (str == "local") {
+        return NumaPolicy::LOCAL;
+    }
+    if (str == "bind") {
+        return NumaPolicy::BIND;
+    }
+    return NumaPolicy::NONE;
+}
+
+const char* NumaPolicyToString(NumaPolicy policy) {
+    switch (policy) {
+        case NumaPolicy::LOCAL:
+            return "local";
+        case NumaPolicy::BIND:
+            return "bind";
+        default:
+            return "none";
+    }
+}
+
+std::vector<int> ParseCpuList(const std::string& str) {
+    std::vector<int> cpus;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int first = -1;
+        int last = -1;
+        int n = sscanf(item.c_str(), "%d-%d", &first, &last);
+        if (n < 1 || first < 0) {
+            continue;
+        }
+        if (n == 1) {
+            last = first;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.push_back(cpu);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * 从 /sys/devices/system/node/node<N>/cpulist 读出 CPU 到节点的映射，
+ * 只在第一次调用时读一次
+ */
+static const std::map<int, int>& CpuNodeMap() {
+    static std::map<int, int> s_map = []() {
+        std::map<int, int> ret;
+        for (int node = 0;; ++node) {
+            std::ifstream ifs("/sys/devices/system/node/node" +
+                              std::to_string(node) + "/cpulist");
+            if (!ifs) {
+                break;
+            }
+            std::string list;
+            std::getline(ifs, list);
+            for (int cpu : ParseCpuList(list)) {
+                ret[cpu] = node;
+            }
+        }
+        return ret;
+    }();
+    return s_map;
+}
+
+int CpuNode(int cpu) {
+    if (cpu < 0) {
+        return -1;
+    }
+    const std::map<int, int>& m = CpuNodeMap();
+    if (m.empty()) {
+        return 0;
+    }
+    auto it = m.find(cpu);
+    return it == m.end() ? -1 : it->second;
+}
+
+bool SetMemPolicy(NumaPolicy policy, int node) {
+    long rt = 0;
+    switch (policy) {
+        case NumaPolicy::NONE:
+            return true;
+        case NumaPolicy::LOCAL:
+            rt = syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0);
+            break;
+        case NumaPolicy::BIND: {
+            if (node < 0 || node >= (int)sizeof(unsigned long) * 8) {
+                TIHI_LOG_ERROR(g_logger) << "set_mempolicy invalid node " << node;
+                return false;
+            }
+            unsigned long mask = 1ul << node;
+            rt = syscall(SYS_set_mempolicy, MPOL_BIND, &mask,
+                         sizeof(mask) * 8);
+            break;
+        }
+    }
+    if (rt) {
+        TIHI_LOG_ERROR(g_logger)
+            << "set_mempolicy(" << NumaPolicyToString(policy) << ", " << node
+            << ") errno=" << errno << " errstr=" << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+}  // namespace tihi
@@ -0,0 +1,39 @@
+#ifndef TIHI_THREAD_AFFINITY_H_
+#define TIHI_THREAD_AFFINITY_H_
+
+#include <string>
+#include <vector>
+
+namespace tihi {
+
+/**
+ * 线程的内存分配策略
+ *   NONE：不修改，沿用进程的策略
+ *   LOCAL：优先从线程当前所在 CPU 的 NUMA 节点分配，不够时用其他节点
+ *   BIND：只从指定的节点分配
+ * 策略只对设置之后第一次访问的页生效，协程栈和 ByteArray 的内存块都是
+ * 由调度线程自己第一次写入的，所以会落在线程所在的节点上
+ */
+enum class NumaPolicy { NONE, LOCAL, BIND };
+
+NumaPolicy NumaPolicyFromString(const std::string& str);
+const char* NumaPolicyToString(NumaPolicy policy);
+
+/**
+ * 解析 "0-3,8,10-11" 这样的 CPU 列表，格式错误的部分被忽略
+ */
+std::vector<int> ParseCpuList(const std::string& str);
+
+/**
+ * CPU 所在的 NUMA 节点，没有 NUMA 信息时返回 0，cpu 无效时返回 -1
+ */
+int CpuNode(int cpu);
+
+/**
+ * 设置当前线程的内存分配策略，node 只对 BIND 有意义
+ */
+bool SetMemPolicy(NumaPolicy policy, int node);
+
+}  // namespace tihi
+
+#endif  // TIHI_THREAD_AFFINITY_H_
@@ -1,5 +1,7 @@
 #include "thread.h"
 
+#include <sched.h>
+
 #include "log/log.h"
 #include "utils/utils.h"
 
@@ -43,6 +45,36 @@ void Thread::SetName(const std::string& name) {
     t_thread_name = name;
 }
 
+bool Thread::setAffinity(int cpu) {
+    if (cpu < 0) {
+        TIHI_LOG_ERROR(g_logger) << "Thread set affinity failed. name: "
+                                 << name_ << " invalid cpu: " << cpu;
+        return false;
+    }
+    /**
+     * cpu_set_t 只有 CPU_SETSIZE 位，按 cpu 的大小分配，
+     * 编号超过 CPU_SETSIZE 的 CPU 也能绑，不会写出界
+     */
+    cpu_set_t* set = CPU_ALLOC(cpu + 1);
+    if (!set) {
+        TIHI_LOG_ERROR(g_logger) << "Thread set affinity failed. name: "
+                                 << name_ << " CPU_ALLOC failed, cpu: " << cpu;
+        return false;
+    }
+    size_t size = CPU_ALLOC_SIZE(cpu + 1);
+    CPU_ZERO_S(size, set);
+    CPU_SET_S(cpu, size, set);
+    int rt = pthread_setaffinity_np(thread_, size, set);
+    CPU_FREE(set);
+    if (rt) {
+        TIHI_LOG_ERROR(g_logger) << "Thread set affinity failed. rt: " << rt
+                                 << " name: " << name_ << " cpu: " << cpu;
+        return false;
+    }
+    cpu_ = cpu;
+    return true;
+}
+
 void Thread::join() {
     if (thread_) {
         int rt = pthread_join(thread_, nullptr);
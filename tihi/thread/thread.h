@@ -22,6 +22,15 @@ public:
 
     pid_t id() const { return id_; }
     const std::string& name() const { return name_; }
+    /**
+     * 绑定的 CPU，没有绑定时为 -1
+     */
+    int cpu() const { return cpu_; }
+
+    /**
+     * 把线程绑定到一个 CPU 上，可以在其他线程中调用
+     */
+    bool setAffinity(int cpu);
 
 
     static Thread* This();
@@ -38,6 +47,7 @@ private:
     std::string name_;
     pid_t id_ = -1;
     pthread_t thread_ = 0;
+    int cpu_ = -1;
 
     Semaphore semaphore_;
 };
@@ -1,13 +1,17 @@
 #include "timer.h"
+
 #include "log/log.h"
+#include "utils/macro.h"
 
 namespace tihi {
 
 static Logger::ptr g_sys_logger = TIHI_LOG_LOGGER("system");
 
-Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
-             TimerManager* timer_manager)
-    : ms_(ms), cb_(cb), recurring_(recurring), timer_manager_(timer_manager) {
+Timer::Timer(uint64_t ms, Task cb, bool recurring, TimerManager* timer_manager)
+    : ms_(ms),
+      cb_(std::move(cb)),
+      recurring_(recurring),
+      timer_manager_(timer_manager) {
     next_ = MS() + ms_;
 }
 
@@ -98,7 +102,7 @@ bool Timer::Cmp::operator()(const Timer::ptr& lhs,
     return lhs.get() < rhs.get();
 }
 
-TimerManager::TimerManager() {}
+TimerManager::TimerManager() : probe_(new Timer(0)) {}
 
 TimerManager::~TimerManager() {}
 
@@ -120,9 +124,10 @@ void TimerManager::addTimer(Timer::ptr timer,
 }
 
 
-Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,
-                                  bool recurring) {
-    Timer::ptr timer(new Timer(ms, cb, recurring, this));
+Timer::ptr TimerManager::addTimer(uint64_t ms, Task cb, bool recurring) {
+    TIHI_ASSERT2((!recurring || cb.copyable()),
+                 "recurring timer requires a copyable callback");
+    Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
     rwmutex_type::write_lock lock(mutex_);
     
     addTimer(timer, lock);
@@ -132,18 +137,35 @@ Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,
     return timer;
 }
 
-static void onTimer(std::weak_ptr<void> cond, std::function<void()> cb) {
-    std::shared_ptr<void> tmp = cond.lock();
-    if (tmp) {
-        cb();
+/**
+ * 条件定时器的回调，cond 已经释放时不执行 cb。
+ * 复制时复制 cb，这样可复制的回调也能用在循环定时器上
+ */
+struct ConditionTimerCb {
+    ConditionTimerCb(std::weak_ptr<void> c, Task&& f)
+        : cond(std::move(c)), cb(std::move(f)) {}
+    ConditionTimerCb(ConditionTimerCb&& other) = default;
+    ConditionTimerCb(const ConditionTimerCb& other)
+        : cond(other.cond), cb(other.cb.clone()) {}
+
+    void operator()() {
+        std::shared_ptr<void> tmp = cond.lock();
+        if (tmp) {
+            cb();
+        }
     }
-}
 
-Timer::ptr TimerManager::addConditionTimer(uint64_t ms,
-                                           std::function<void()> cb,
+    std::weak_ptr<void> cond;
+    Task cb;
+};
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms, Task cb,
                                            std::weak_ptr<void> cond,
                                            bool recurring) {
-    return addTimer(ms, std::bind(&onTimer, cond, cb), recurring);
+    TIHI_ASSERT2((!recurring || cb.copyable()),
+                 "recurring timer requires a copyable callback");
+    return addTimer(ms, ConditionTimerCb(std::move(cond), std::move(cb)),
+                    recurring);
 }
 
 uint64_t TimerManager::nextTimerTime() {
@@ -162,7 +184,7 @@ uint64_t TimerManager::nextTimerTime() {
     }
 }
 
-void TimerManager::expiredTimerCb(std::vector<std::function<void()>>& cbs) {
+void TimerManager::expiredTimerCb(std::vector<Task>& cbs) {
     uint64_t now_time = MS();
     {
         rwmutex_type::read_lock lock(mutex_);
@@ -174,26 +196,33 @@ void TimerManager::expiredTimerCb(std::vector<std::function<void()>>& cbs) {
     std::vector<Timer::ptr> expired;
 
     rwmutex_type::write_lock lock(mutex_);
-    Timer::ptr now(new Timer(now_time));
+    /**
+     * 换写锁的间隙里别的线程可能已经把定时器都取走了
+     */
+    if (timers_.empty()) {
+        return;
+    }
+    probe_->next_ = now_time;
 
     bool rollover = detectRollOver(now_time);
     if (!rollover && (*timers_.begin())->next_ > now_time) {
         return ;
     }
 
-    auto it = rollover ? timers_.end() : timers_.upper_bound(now);
+    auto it = rollover ? timers_.end() : timers_.upper_bound(probe_);
     // auto it = timers_.end();
 
     expired.insert(expired.begin(), timers_.begin(), it);    
     timers_.erase(timers_.begin(), it);
-    cbs.reserve(expired.size());
+    cbs.reserve(cbs.size() + expired.size());
 
     for (auto& pt : expired) {
-        cbs.push_back(pt->cb_);
         if (pt->recurring_) {
+            cbs.push_back(pt->cb_.clone());
             pt->next_ = now_time + pt->ms_;
             timers_.insert(pt);
         } else {
+            cbs.push_back(std::move(pt->cb_));
             pt->cb_ = nullptr;
         }
     }
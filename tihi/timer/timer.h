@@ -6,6 +6,7 @@
 #include <set>
 
 #include "utils/mutex.h"
+#include "utils/task.h"
 #include "utils/utils.h"
 
 namespace tihi {
@@ -23,8 +24,7 @@ public:
     bool reset(uint64_t ms, bool from_now = true);
 
 private:
-    Timer(uint64_t ms, std::function<void()> cb, bool recurring,
-          TimerManager* timer_manager);
+    Timer(uint64_t ms, Task cb, bool recurring, TimerManager* timer_manager);
     Timer(uint64_t next);
 
     struct Cmp {
@@ -33,7 +33,7 @@ private:
 
 private:
     uint64_t ms_ = 0;
-    std::function<void()> cb_;
+    Task cb_;
     bool recurring_ = false;
     TimerManager* timer_manager_ = nullptr;
 
@@ -50,14 +50,18 @@ public:
     virtual ~TimerManager();
 
     void addTimer(Timer::ptr timer, rwmutex_type::write_lock& lock);
-    Timer::ptr addTimer(uint64_t ms, std::function<void()> cb,
-                        bool recurring = false);
-    Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
-                                 std::weak_ptr<void> cond,
+    /**
+     * 循环定时器每次到期都复制一份回调，所以回调必须可以复制
+     */
+    Timer::ptr addTimer(uint64_t ms, Task cb, bool recurring = false);
+    Timer::ptr addConditionTimer(uint64_t ms, Task cb, std::weak_ptr<void> cond,
                                  bool recurring = false);
 
     uint64_t nextTimerTime();
-    void expiredTimerCb(std::vector<std::function<void()>>& cbs);
+    /**
+     * 取出到期的回调追加到 cbs 中，一次性定时器的回调直接移出，不复制
+     */
+    void expiredTimerCb(std::vector<Task>& cbs);
 
     bool detectRollOver(uint64_t now_time);
     bool hasTimer();
@@ -66,6 +70,8 @@ protected:
 
 private:
     std::set<Timer::ptr, Timer::Cmp> timers_;
+    // 在 timers_ 中查找到期定时器用的哨兵，持有写锁时才能修改
+    Timer::ptr probe_;
     rwmutex_type mutex_;
     bool tickled_ = false;
     uint64_t previouseTime = MS();
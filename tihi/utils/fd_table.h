@@ -0,0 +1,130 @@
+#ifndef TIHI_UTILS_FD_TABLE_H_
+#define TIHI_UTILS_FD_TABLE_H_
+
+#include <stddef.h>
+
+#include <atomic>
+#include <functional>
+
+#include "utils/noncopyable.h"
+
+namespace tihi {
+
+/**
+ * 以 fd 为下标的两级表，查找不加锁
+ *
+ * 第一级是定长的段指针数组，第二级是 SEGMENT_SIZE 个元素的段，
+ * 第一次用到某个段时才分配，用 CAS 装进第一级，抢输的一方释放自己分配的段。
+ * 段一旦装上就不再移动也不释放，直到表析构，拿到的元素指针一直有效，
+ * 扩容不需要拷贝已有的元素，也不用和查找互斥。
+ *
+ * 元素本身的并发访问由使用者负责
+ */
+template <typename T>
+class FdTable : public Noncopyable {
+public:
+    static const size_t SEGMENT_SHIFT = 8;
+    static const size_t SEGMENT_SIZE = 1 << SEGMENT_SHIFT;
+    static const size_t SEGMENT_COUNTS = 4096;
+    /**
+     * 能容纳的最大 fd 加一，和 fs.nr_open 的默认值相同
+     */
+    static const size_t MAX_FDS = SEGMENT_SIZE * SEGMENT_COUNTS;
+
+    /**
+     * 分配新段时对其中每个元素调用一次 init
+     */
+    using InitFunc = std::function<void(T& item, int fd)>;
+
+    explicit FdTable(InitFunc init = nullptr) : init_(std::move(init)) {
+        for (size_t i = 0; i < SEGMENT_COUNTS; ++i) {
+            segments_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable() {
+        for (size_t i = 0; i < SEGMENT_COUNTS; ++i) {
+            delete[] segments_[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * fd 所在的段还没有分配或者 fd 超出范围时返回 nullptr
+     */
+    T* get(int fd) const {
+        if (fd < 0 || (size_t)fd >= MAX_FDS) {
+            return nullptr;
+        }
+        T* segment = segments_[(size_t)fd >> SEGMENT_SHIFT].load(
+            std::memory_order_acquire);
+        return segment ? &segment[fd & (SEGMENT_SIZE - 1)] : nullptr;
+    }
+
+    /**
+     * 段不存在时分配，只有 fd 超出范围时返回 nullptr
+     */
+    T* getOrCreate(int fd) {
+        T* item = get(fd);
+        if (item || fd < 0 || (size_t)fd >= MAX_FDS) {
+            return item;
+        }
+        size_t index = (size_t)fd >> SEGMENT_SHIFT;
+        T* segment = new T[SEGMENT_SIZE];
+        if (init_) {
+            for (size_t i = 0; i < SEGMENT_SIZE; ++i) {
+                init_(segment[i], (int)(index * SEGMENT_SIZE + i));
+            }
+        }
+        T* expected = nullptr;
+        if (!segments_[index].compare_exchange_strong(
+                expected, segment, std::memory_order_acq_rel,
+                std::memory_order_acquire)) {
+            delete[] segment;
+            segment = expected;
+        } else {
+            segment_counts_.fetch_add(1, std::memory_order_relaxed);
+        }
+        return &segment[fd & (SEGMENT_SIZE - 1)];
+    }
+
+    /**
+     * 依次访问所有已经分配的元素，f(T& item)
+     */
+    template <typename Func>
+    void forEach(Func f) {
+        for (size_t i = 0; i < SEGMENT_COUNTS; ++i) {
+            T* segment = segments_[i].load(std::memory_order_acquire);
+            if (!segment) {
+                continue;
+            }
+            for (size_t j = 0; j < SEGMENT_SIZE; ++j) {
+                f(segment[j]);
+            }
+        }
+    }
+
+    /**
+     * 已经分配的元素个数
+     */
+    size_t capacity() const {
+        return segment_counts_.load(std::memory_order_relaxed) * SEGMENT_SIZE;
+    }
+
+private:
+    InitFunc init_;
+    std::atomic<T*> segments_[SEGMENT_COUNTS];
+    std::atomic<size_t> segment_counts_{0};
+};
+
+template <typename T>
+const size_t FdTable<T>::SEGMENT_SHIFT;
+template <typename T>
+const size_t FdTable<T>::SEGMENT_SIZE;
+template <typename T>
+const size_t FdTable<T>::SEGMENT_COUNTS;
+template <typename T>
+const size_t FdTable<T>::MAX_FDS;
+
+} // namespace tihi
+
+#endif // TIHI_UTILS_FD_TABLE_H_
@@ -0,0 +1,80 @@
+#include "histogram.h"
+
+#include <sstream>
+
+namespace tihi {
+
+void Histogram::merge(const Histogram& oth) {
+    for (size_t i = 0; i < BUCKET_COUNTS; ++i) {
+        Add(buckets_[i], Load(oth.buckets_[i]));
+    }
+    Add(counts_, oth.count());
+    Add(sum_, oth.sum());
+    if (oth.max() > max()) {
+        Store(max_, oth.max());
+    }
+}
+
+void Histogram::reset() {
+    for (size_t i = 0; i < BUCKET_COUNTS; ++i) {
+        Store(buckets_[i], 0);
+    }
+    Store(counts_, 0);
+    Store(sum_, 0);
+    Store(max_, 0);
+}
+
+double Histogram::mean() const {
+    uint64_t counts = count();
+    return counts ? (double)sum() / counts : 0;
+}
+
+uint64_t Histogram::percentile(double p) const {
+    /**
+     * 各个桶和 counts_ 不是同时读到的，以桶的总数为准
+     */
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKET_COUNTS; ++i) {
+        total += Load(buckets_[i]);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    if (p < 0) {
+        p = 0;
+    } else if (p > 1) {
+        p = 1;
+    }
+
+    uint64_t rank = (uint64_t)(p * (total - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNTS; ++i) {
+        seen += Load(buckets_[i]);
+        if (seen >= rank) {
+            uint64_t bound = BucketUpperBound(i);
+            return bound < max() ? bound : max();
+        }
+    }
+    return max();
+}
+
+std::string Histogram::toString() const {
+    std::stringstream ss;
+    ss << "count=" << count() << " mean=" << mean()
+       << " p50=" << percentile(0.5) << " p90=" << percentile(0.9)
+       << " p99=" << percentile(0.99) << " p999=" << percentile(0.999)
+       << " max=" << max();
+    return ss.str();
+}
+
+uint64_t Histogram::BucketUpperBound(size_t index) {
+    if (index < 2 * SUB_BUCKETS) {
+        return index;
+    }
+    size_t k = index - 2 * SUB_BUCKETS;
+    size_t shift = k / SUB_BUCKETS + 1;
+    uint64_t lower = (uint64_t)(SUB_BUCKETS + k % SUB_BUCKETS) << shift;
+    return lower + (1ull << shift) - 1;
+}
+
+}  // namespace tihi
@@ -0,0 +1,107 @@
+#ifndef TIHI_UTILS_HISTOGRAM_H_
+#define TIHI_UTILS_HISTOGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace tihi {
+
+/**
+ * HDR 风格的直方图，记录非负整数（调度器里都是微秒）
+ *
+ * 小于 2 * SUB_BUCKETS 的值每个值一个桶；更大的值每个 2 的幂区间再平分成
+ * SUB_BUCKETS 个桶，相对误差不超过 1 / SUB_BUCKETS。超过 2^MAX_BITS 的值
+ * 记到最后一个桶里，max() 仍然是真实的最大值。
+ *
+ * record() 只能由一个线程调用（计数用 relaxed 的读加写，不用原子加），
+ * 其他线程可以随时 merge() 或复制出一份快照，读到的值可能稍旧。
+ * 计数是普通的 uint64_t，用 __atomic 内建函数读写，调度器每个任务都要记两次，
+ * 内建函数在 -O0 下也不会变成函数调用
+ */
+class Histogram {
+public:
+    static const size_t SUB_BUCKET_BITS = 4;
+    static const size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const size_t MAX_BITS = 40;
+    static const size_t BUCKET_COUNTS =
+        2 * SUB_BUCKETS + (MAX_BITS - SUB_BUCKET_BITS - 1) * SUB_BUCKETS;
+
+    Histogram() { reset(); }
+    Histogram(const Histogram& oth) {
+        reset();
+        merge(oth);
+    }
+    Histogram& operator=(const Histogram& oth) {
+        if (this != &oth) {
+            reset();
+            merge(oth);
+        }
+        return *this;
+    }
+
+    void record(uint64_t v) {
+        Add(buckets_[BucketIndex(v)], 1);
+        Add(counts_, 1);
+        Add(sum_, v);
+        if (v > Load(max_)) {
+            Store(max_, v);
+        }
+    }
+
+    /**
+     * 把 oth 的计数加到自己身上，只能在自己没有其他写者时调用
+     */
+    void merge(const Histogram& oth);
+    void reset();
+
+    uint64_t count() const { return Load(counts_); }
+    uint64_t sum() const { return Load(sum_); }
+    uint64_t max() const { return Load(max_); }
+    double mean() const;
+    /**
+     * p 取 [0, 1]，返回第 p 分位所在桶的上界（不超过 max()），没有数据时返回 0
+     */
+    uint64_t percentile(double p) const;
+
+    /**
+     * count mean p50 p90 p99 p999 max
+     */
+    std::string toString() const;
+
+    static size_t BucketIndex(uint64_t v) {
+        if (v < 2 * SUB_BUCKETS) {
+            return v;
+        }
+        if (v >> MAX_BITS) {
+            v = (1ull << MAX_BITS) - 1;
+        }
+        size_t msb = 63 - __builtin_clzll(v);
+        size_t shift = msb - SUB_BUCKET_BITS;
+        size_t sub = (v >> shift) - SUB_BUCKETS;
+        return 2 * SUB_BUCKETS + (msb - SUB_BUCKET_BITS - 1) * SUB_BUCKETS + sub;
+    }
+    /**
+     * 第 index 个桶能放下的最大值
+     */
+    static uint64_t BucketUpperBound(size_t index);
+
+private:
+    static uint64_t Load(const uint64_t& a) {
+        return __atomic_load_n(&a, __ATOMIC_RELAXED);
+    }
+    static void Store(uint64_t& a, uint64_t v) {
+        __atomic_store_n(&a, v, __ATOMIC_RELAXED);
+    }
+    static void Add(uint64_t& a, uint64_t v) { Store(a, Load(a) + v); }
+
+    uint64_t counts_;
+    uint64_t sum_;
+    uint64_t max_;
+    uint64_t buckets_[BUCKET_COUNTS];
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_UTILS_HISTOGRAM_H_
@@ -0,0 +1,364 @@
+#ifndef TIHI_UTILS_MPMC_QUEUE_H_
+#define TIHI_UTILS_MPMC_QUEUE_H_
+
+#include <sched.h>
+#include <stddef.h>
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "utils/noncopyable.h"
+
+namespace tihi {
+
+/**
+ * 无锁、无界的多生产者多消费者队列
+ *
+ * 元素放在一段段固定大小的块（segment）里，块用链表串起来。
+ * 生产者用一次 CAS 在尾部块里占下一个或一批位置，消费者用一次 CAS 从头部块里
+ * 取走一个位置，平时只有块用完的时候才分配和释放内存。
+ *
+ * 下标的低 SHIFT 位是标志位（只有头下标用到，表示后面已经有下一个块），
+ * 每 LAP 个下标对应一个块，每块的最后一个下标不存元素，
+ * 表示"正在安装下一个块"，此时其他线程稍等即可。
+ * 一个块的所有位置都被读过之后由最后一个读者释放，不需要 hazard pointer
+ * （算法来自 crossbeam 的 SegQueue）
+ */
+template <typename T>
+class MPMCQueue : public Noncopyable {
+public:
+    MPMCQueue() {}
+
+    ~MPMCQueue() {
+        size_t head = head_.index.load(std::memory_order_relaxed) & ~HAS_NEXT;
+        size_t tail = tail_.index.load(std::memory_order_relaxed) & ~HAS_NEXT;
+        Block* block = head_.block.load(std::memory_order_relaxed);
+        while (head != tail) {
+            size_t offset = (head >> SHIFT) % LAP;
+            if (offset < BLOCK_CAP) {
+                block->slots[offset].get()->~T();
+            } else {
+                Block* next = block->next.load(std::memory_order_relaxed);
+                delete block;
+                block = next;
+            }
+            head += 1 << SHIFT;
+        }
+        delete block;
+    }
+
+    void push(T&& v) { pushBulk(&v, 1); }
+
+    /**
+     * 依次移动 items 中的 counts 个元素入队。同一个块里的位置一次 CAS 占完，
+     * 一批元素在队列里是连续的（跨块时除外）
+     */
+    void pushBulk(T* items, size_t counts) {
+        Backoff backoff;
+        size_t tail = tail_.index.load(std::memory_order_acquire);
+        Block* block = tail_.block.load(std::memory_order_acquire);
+        Block* next_block = nullptr;
+
+        while (counts > 0) {
+            size_t offset = (tail >> SHIFT) % LAP;
+            /**
+             * 别的线程正在安装下一个块
+             */
+            if (offset == BLOCK_CAP) {
+                backoff.snooze();
+                tail = tail_.index.load(std::memory_order_acquire);
+                block = tail_.block.load(std::memory_order_acquire);
+                continue;
+            }
+
+            size_t n = std::min(counts, BLOCK_CAP - offset);
+            /**
+             * 会用完当前块，先把下一个块分配好，缩短其他线程等待的时间
+             */
+            if (offset + n == BLOCK_CAP && !next_block) {
+                next_block = new Block;
+            }
+
+            /**
+             * 第一次入队，安装第一个块
+             */
+            if (!block) {
+                Block* first = new Block;
+                if (tail_.block.compare_exchange_strong(
+                        block, first, std::memory_order_release,
+                        std::memory_order_relaxed)) {
+                    head_.block.store(first, std::memory_order_release);
+                    block = first;
+                } else {
+                    delete first;
+                    tail = tail_.index.load(std::memory_order_acquire);
+                    block = tail_.block.load(std::memory_order_acquire);
+                    continue;
+                }
+            }
+
+            size_t new_tail = tail + (n << SHIFT);
+            if (!tail_.index.compare_exchange_weak(tail, new_tail,
+                                                   std::memory_order_seq_cst,
+                                                   std::memory_order_acquire)) {
+                block = tail_.block.load(std::memory_order_acquire);
+                backoff.spin();
+                continue;
+            }
+
+            if (offset + n == BLOCK_CAP) {
+                size_t next_index = new_tail + (1 << SHIFT);
+                tail_.block.store(next_block, std::memory_order_release);
+                tail_.index.store(next_index, std::memory_order_release);
+                block->next.store(next_block, std::memory_order_release);
+                next_block = nullptr;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                Slot& slot = block->slots[offset + i];
+                new (&slot.storage) T(std::move(items[i]));
+                slot.state.fetch_or(WRITE, std::memory_order_release);
+            }
+            items += n;
+            counts -= n;
+            if (counts > 0) {
+                backoff.reset();
+                tail = tail_.index.load(std::memory_order_acquire);
+                block = tail_.block.load(std::memory_order_acquire);
+            }
+        }
+        delete next_block;
+    }
+
+    /**
+     * 队列为空时返回 false
+     */
+    bool pop(T& v) {
+        Backoff backoff;
+        size_t head = head_.index.load(std::memory_order_acquire);
+        Block* block = head_.block.load(std::memory_order_acquire);
+
+        while (true) {
+            size_t offset = (head >> SHIFT) % LAP;
+            if (offset == BLOCK_CAP) {
+                backoff.snooze();
+                head = head_.index.load(std::memory_order_acquire);
+                block = head_.block.load(std::memory_order_acquire);
+                continue;
+            }
+
+            size_t new_head = head + (1 << SHIFT);
+            /**
+             * 不确定后面还有没有块时，要和尾下标比较
+             */
+            if ((new_head & HAS_NEXT) == 0) {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                size_t tail = tail_.index.load(std::memory_order_relaxed);
+                if ((head >> SHIFT) == (tail >> SHIFT)) {
+                    return false;
+                }
+                if ((head >> SHIFT) / LAP != (tail >> SHIFT) / LAP) {
+                    new_head |= HAS_NEXT;
+                }
+            }
+
+            /**
+             * 第一个块还没有装好
+             */
+            if (!block) {
+                backoff.snooze();
+                head = head_.index.load(std::memory_order_acquire);
+                block = head_.block.load(std::memory_order_acquire);
+                continue;
+            }
+
+            if (!head_.index.compare_exchange_weak(head, new_head,
+                                                   std::memory_order_seq_cst,
+                                                   std::memory_order_acquire)) {
+                block = head_.block.load(std::memory_order_acquire);
+                backoff.spin();
+                continue;
+            }
+
+            if (offset + 1 == BLOCK_CAP) {
+                Block* next = block->waitNext();
+                size_t next_index = (new_head & ~HAS_NEXT) + (1 << SHIFT);
+                if (next->next.load(std::memory_order_relaxed)) {
+                    next_index |= HAS_NEXT;
+                }
+                head_.block.store(next, std::memory_order_release);
+                head_.index.store(next_index, std::memory_order_release);
+            }
+
+            Slot& slot = block->slots[offset];
+            slot.waitWrite();
+            v = std::move(*slot.get());
+            slot.get()->~T();
+
+            if (offset + 1 == BLOCK_CAP) {
+                Block::Destroy(block, 0);
+            } else if (slot.state.fetch_or(READ, std::memory_order_acq_rel) &
+                       DESTROY) {
+                Block::Destroy(block, offset + 1);
+            }
+            return true;
+        }
+    }
+
+    /**
+     * 不加锁的快照，只能作为提示
+     */
+    bool empty() const {
+        size_t head = head_.index.load(std::memory_order_seq_cst);
+        size_t tail = tail_.index.load(std::memory_order_seq_cst);
+        return (head >> SHIFT) == (tail >> SHIFT);
+    }
+
+    size_t size() const {
+        while (true) {
+            size_t tail = tail_.index.load(std::memory_order_seq_cst);
+            size_t head = head_.index.load(std::memory_order_seq_cst);
+            if (tail_.index.load(std::memory_order_seq_cst) != tail) {
+                continue;
+            }
+
+            tail &= ~HAS_NEXT;
+            head &= ~HAS_NEXT;
+            /**
+             * 停在块末尾的下标算作下一个块的开头
+             */
+            if (((tail >> SHIFT) & (LAP - 1)) == LAP - 1) {
+                tail += 1 << SHIFT;
+            }
+            if (((head >> SHIFT) & (LAP - 1)) == LAP - 1) {
+                head += 1 << SHIFT;
+            }
+            size_t lap = (head >> SHIFT) / LAP;
+            tail = (tail >> SHIFT) - lap * LAP;
+            head = (head >> SHIFT) - lap * LAP;
+            return tail - head - tail / LAP;
+        }
+    }
+
+private:
+    static const size_t SHIFT = 1;
+    static const size_t HAS_NEXT = 1;
+    // 每块的下标个数，必须是 2 的幂
+    static const size_t LAP = 32;
+    static const size_t BLOCK_CAP = LAP - 1;
+
+    // 元素已经写入
+    static const uint32_t WRITE = 1;
+    // 元素已经被读走
+    static const uint32_t READ = 2;
+    // 块由读这个位置的线程负责释放
+    static const uint32_t DESTROY = 4;
+
+    /**
+     * 先自旋，再让出 CPU
+     */
+    class Backoff {
+    public:
+        void spin() {
+            uint32_t step = step_ < SPIN_LIMIT ? step_ : SPIN_LIMIT;
+            for (uint32_t i = 0; i < (1u << step); ++i) {
+                Pause();
+            }
+            if (step_ <= SPIN_LIMIT) {
+                ++step_;
+            }
+        }
+
+        void snooze() {
+            if (step_ <= SPIN_LIMIT) {
+                for (uint32_t i = 0; i < (1u << step_); ++i) {
+                    Pause();
+                }
+            } else {
+                sched_yield();
+            }
+            if (step_ <= YIELD_LIMIT) {
+                ++step_;
+            }
+        }
+
+        void reset() { step_ = 0; }
+
+    private:
+        static void Pause() {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_ia32_pause();
+#endif
+        }
+
+        static const uint32_t SPIN_LIMIT = 6;
+        static const uint32_t YIELD_LIMIT = 10;
+        uint32_t step_ = 0;
+    };
+
+    struct Slot {
+        T* get() { return reinterpret_cast<T*>(&storage); }
+
+        void waitWrite() {
+            Backoff backoff;
+            while (!(state.load(std::memory_order_acquire) & WRITE)) {
+                backoff.snooze();
+            }
+        }
+
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+        std::atomic<uint32_t> state{0};
+    };
+
+    struct Block {
+        Block* waitNext() {
+            Backoff backoff;
+            while (true) {
+                Block* n = next.load(std::memory_order_acquire);
+                if (n) {
+                    return n;
+                }
+                backoff.snooze();
+            }
+        }
+
+        /**
+         * 从 start 开始还有位置没读完时，把释放的责任交给那个位置的读者
+         */
+        static void Destroy(Block* block, size_t start) {
+            for (size_t i = start; i < BLOCK_CAP - 1; ++i) {
+                Slot& slot = block->slots[i];
+                if (!(slot.state.load(std::memory_order_acquire) & READ) &&
+                    !(slot.state.fetch_or(DESTROY, std::memory_order_acq_rel) &
+                      READ)) {
+                    return;
+                }
+            }
+            delete block;
+        }
+
+        std::atomic<Block*> next{nullptr};
+        Slot slots[BLOCK_CAP];
+    };
+
+    struct Position {
+        std::atomic<size_t> index{0};
+        std::atomic<Block*> block{nullptr};
+    };
+
+    /**
+     * 生产者和消费者的下标放在不同的缓存行上
+     */
+    char pad0_[64];
+    Position head_;
+    char pad1_[64];
+    Position tail_;
+    char pad2_[64];
+};
+
+}  // namespace tihi
+
+#endif  // TIHI_UTILS_MPMC_QUEUE_H_
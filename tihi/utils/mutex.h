@@ -148,6 +148,8 @@ public:
 
     void lock() { pthread_mutex_lock(&mutex_); }
 
+    bool tryLock() { return pthread_mutex_trylock(&mutex_) == 0; }
+
     void unlock() { pthread_mutex_unlock(&mutex_); }
 
 private:
@@ -0,0 +1,217 @@
+#ifndef TIHI_UTILS_TASK_H_
+#define TIHI_UTILS_TASK_H_
+
+#include <stddef.h>
+
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "utils/macro.h"
+
+namespace tihi {
+
+/**
+ * 只能移动的 void() 回调，调度器任务、IO 事件和定时器回调都用它保存
+ *
+ * 与 std::function 的区别：
+ *   1. 内联缓冲区有 INLINE_SIZE 字节，std::bind(成员函数, shared_ptr, shared_ptr)
+ *      这样的回调也不用分配内存（libstdc++ 的 std::function 只能放下 16 字节）
+ *   2. 只能移动，任务在队列、协程之间转交时不会复制捕获的对象；
+ *      可复制的回调仍然可以用 clone() 显式复制一份（循环定时器需要）
+ *   3. 可以保存只能移动的回调，比如捕获了 std::unique_ptr 的 lambda
+ *
+ * 放不下或者移动构造可能抛异常的回调放在堆上，缓冲区里只存一个指针
+ */
+class Task {
+public:
+    static const size_t INLINE_SIZE = 64;
+
+    Task() {}
+    Task(std::nullptr_t) {}
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<
+                  typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using functor_type = typename std::decay<F>::type;
+        if (IsNull(f)) {
+            return;
+        }
+        Ops<functor_type>::Init(&storage_, std::forward<F>(f));
+        ops_ = &Ops<functor_type>::table;
+    }
+
+    Task(Task&& other) noexcept { moveFrom(other); }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            clear();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task& operator=(std::nullptr_t) {
+        clear();
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() { clear(); }
+
+    explicit operator bool() const { return ops_ != nullptr; }
+
+    void operator()() {
+        TIHI_ASSERT2(ops_, "call an empty Task");
+        ops_->invoke(&storage_);
+    }
+
+    void swap(Task& other) {
+        Task tmp(std::move(other));
+        other = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+    /**
+     * 回调是否放在内联缓冲区里
+     */
+    bool stored_inline() const { return ops_ && ops_->stored_inline; }
+    /**
+     * 回调本身是否可以复制
+     */
+    bool copyable() const { return ops_ && ops_->clone; }
+    /**
+     * 复制一份回调，回调不可复制时断言失败
+     */
+    Task clone() const {
+        Task task;
+        if (ops_) {
+            TIHI_ASSERT2(ops_->clone, "clone a move-only Task");
+            ops_->clone(&task.storage_, &storage_);
+            task.ops_ = ops_;
+        }
+        return task;
+    }
+
+private:
+    using storage_type = std::aligned_storage<INLINE_SIZE>::type;
+    using clone_func = void (*)(void* dst, const void* src);
+
+    struct OpsTable {
+        void (*invoke)(void* storage);
+        // 从 src 移动构造到 dst，并析构 src
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void* storage);
+        // 回调不可复制时为 nullptr
+        clone_func clone;
+        bool stored_inline;
+    };
+
+    template <typename F>
+    static bool IsNull(const F&) {
+        return false;
+    }
+    template <typename F>
+    static bool IsNull(F* const& f) {
+        return f == nullptr;
+    }
+    template <typename R, typename... Args>
+    static bool IsNull(const std::function<R(Args...)>& f) {
+        return !f;
+    }
+
+    template <typename F,
+              bool Inline = sizeof(F) <= INLINE_SIZE &&
+                            alignof(F) <= alignof(storage_type) &&
+                            std::is_nothrow_move_constructible<F>::value>
+    struct Ops;
+
+    template <typename F>
+    struct Ops<F, true> {
+        template <typename U>
+        static void Init(void* storage, U&& f) {
+            new (storage) F(std::forward<U>(f));
+        }
+        static F* Get(void* storage) { return static_cast<F*>(storage); }
+        static void Invoke(void* storage) { (*Get(storage))(); }
+        static void Relocate(void* dst, void* src) {
+            new (dst) F(std::move(*Get(src)));
+            Get(src)->~F();
+        }
+        static void Destroy(void* storage) { Get(storage)->~F(); }
+        static void Clone(void* dst, const void* src) {
+            new (dst) F(*static_cast<const F*>(src));
+        }
+
+        static const OpsTable table;
+    };
+
+    template <typename F>
+    struct Ops<F, false> {
+        template <typename U>
+        static void Init(void* storage, U&& f) {
+            *static_cast<F**>(storage) = new F(std::forward<U>(f));
+        }
+        static F* Get(void* storage) { return *static_cast<F**>(storage); }
+        static void Invoke(void* storage) { (*Get(storage))(); }
+        static void Relocate(void* dst, void* src) {
+            *static_cast<F**>(dst) = Get(src);
+        }
+        static void Destroy(void* storage) { delete Get(storage); }
+        static void Clone(void* dst, const void* src) {
+            *static_cast<F**>(dst) = new F(**static_cast<F* const*>(src));
+        }
+
+        static const OpsTable table;
+    };
+
+    template <typename F>
+    static constexpr clone_func CloneOf() {
+        return CloneOf<F>(std::is_copy_constructible<F>());
+    }
+    template <typename F>
+    static constexpr clone_func CloneOf(std::true_type) {
+        return &Ops<F>::Clone;
+    }
+    template <typename F>
+    static constexpr clone_func CloneOf(std::false_type) {
+        return nullptr;
+    }
+
+    void moveFrom(Task& other) {
+        if (other.ops_) {
+            other.ops_->relocate(&storage_, &other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    void clear() {
+        if (ops_) {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    storage_type storage_;
+    const OpsTable* ops_ = nullptr;
+};
+
+template <typename F>
+const Task::OpsTable Task::Ops<F, true>::table = {
+    &Ops<F, true>::Invoke, &Ops<F, true>::Relocate, &Ops<F, true>::Destroy,
+    Task::CloneOf<F>(), true};
+
+template <typename F>
+const Task::OpsTable Task::Ops<F, false>::table = {
+    &Ops<F, false>::Invoke, &Ops<F, false>::Relocate, &Ops<F, false>::Destroy,
+    Task::CloneOf<F>(), false};
+
+}  // namespace tihi
+
+#endif  // TIHI_UTILS_TASK_H_
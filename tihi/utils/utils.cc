@@ -1,10 +1,18 @@
 #include "utils.h"
 
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
 #include <sys/syscall.h>
 #include <execinfo.h>
 
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+
 #include "log/log.h"
 #include "fiber/fiber.h"
+#include "utils/mutex.h"
 
 namespace tihi {
 
@@ -23,28 +31,26 @@ uint32_t FiberId() {
     return Fiber::FiberId();
 }
 
-void Backtrace(std::vector<std::string>& res, int offset, int size) {
-    int total_size = offset + size;
-
-    void** buffer = (void**)(malloc(sizeof(void*) * total_size));
-    int nptrs = ::backtrace(buffer, total_size);
+/**
+ * 解析 buffer 中从 offset 开始的地址
+ */
+static void BacktraceSymbols(std::vector<std::string>& res, void** buffer,
+                             int offset, int nptrs) {
     char** strings = ::backtrace_symbols(buffer, nptrs);
     if (strings == NULL) {
         TIHI_LOG_ERROR(g_sys_logger) << "backtrace_symbols";
         return ;
     }
 
-    for (int j = offset + 1; j < nptrs; ++j) {
+    for (int j = offset; j < nptrs; ++j) {
         res.push_back(strings[j]);
     }
 
     free(strings);
-    free(buffer);
 }
 
-std::string Backtrace(int offset, int size, const std::string& prefix) {
-    std::vector<std::string> res;
-    Backtrace(res, offset + 1, size);
+static std::string FormatBacktrace(const std::vector<std::string>& res,
+                                   const std::string& prefix) {
     std::stringstream ss;
     for (const auto& s : res) {
         ss << std::endl << prefix << s;
@@ -53,6 +59,142 @@ std::string Backtrace(int offset, int size, const std::string& prefix) {
     return ss.str();
 }
 
+void Backtrace(std::vector<std::string>& res, int offset, int size) {
+    int total_size = offset + size;
+
+    void** buffer = (void**)(malloc(sizeof(void*) * total_size));
+    int nptrs = ::backtrace(buffer, total_size);
+    BacktraceSymbols(res, buffer, offset + 1, nptrs);
+    free(buffer);
+}
+
+std::string Backtrace(int offset, int size, const std::string& prefix) {
+    std::vector<std::string> res;
+    Backtrace(res, offset + 1, size);
+    return FormatBacktrace(res, prefix);
+}
+
+/**
+ * ThreadBacktrace 一次只取一个线程，信号处理函数不能分配内存，
+ * 结果放在固定的缓冲区里
+ */
+struct ThreadBacktraceState {
+    enum State {
+        IDLE = 0,
+        // 信号已经发出，等目标线程处理
+        PENDING = 1,
+        // 目标线程正在写缓冲区
+        CAPTURING = 2,
+        DONE = 3,
+    };
+    static const int MAX_FRAMES = 128;
+
+    /**
+     * 低 2 位是 State，其余是请求的序号，信号也带着序号
+     */
+    static uint64_t Make(uint64_t seq, State state) { return seq << 2 | state; }
+
+    std::atomic<uint64_t> state{IDLE};
+    // 上一个请求的序号，只在 ThreadBacktrace 的锁内访问
+    uint64_t seq = 0;
+    void* frames[MAX_FRAMES];
+    int size = 0;
+    int max_size = 0;
+};
+
+static ThreadBacktraceState s_thread_backtrace;
+
+static void ThreadBacktraceHandler(int sig, siginfo_t* info, void* context) {
+    /**
+     * 只接受自己这个请求：等待方超时放弃之后才到的信号，
+     * 不能写进下一个请求的缓冲区
+     */
+    uint64_t seq = (uint64_t)(uintptr_t)info->si_value.sival_ptr;
+    uint64_t expected =
+        ThreadBacktraceState::Make(seq, ThreadBacktraceState::PENDING);
+    if (!s_thread_backtrace.state.compare_exchange_strong(
+            expected, ThreadBacktraceState::Make(
+                          seq, ThreadBacktraceState::CAPTURING))) {
+        return;
+    }
+    int saved_errno = errno;
+    s_thread_backtrace.size =
+        ::backtrace(s_thread_backtrace.frames, s_thread_backtrace.max_size);
+    errno = saved_errno;
+    s_thread_backtrace.state =
+        ThreadBacktraceState::Make(seq, ThreadBacktraceState::DONE);
+}
+
+static int ThreadBacktraceSignal() { return SIGRTMIN; }
+
+static bool InstallThreadBacktraceHandler() {
+    /**
+     * 第一次调用 ::backtrace 会加载 libgcc，不能发生在信号处理函数里
+     */
+    void* dummy[1];
+    ::backtrace(dummy, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &ThreadBacktraceHandler;
+    sa.sa_flags = SA_RESTART | SA_SIGINFO;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(ThreadBacktraceSignal(), &sa, nullptr)) {
+        TIHI_LOG_ERROR(g_sys_logger)
+            << "sigaction failed, errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+std::string ThreadBacktrace(pthread_t thread, int size,
+                            const std::string& prefix, uint32_t timeout_ms) {
+    static Mutex s_mutex;
+    Mutex::mutex lock(s_mutex);
+    static bool s_installed = InstallThreadBacktraceHandler();
+    if (!s_installed) {
+        return "";
+    }
+
+    ThreadBacktraceState& st = s_thread_backtrace;
+    uint64_t seq = ++st.seq;
+    /**
+     * 多取一帧，跳过信号处理函数自己
+     */
+    st.max_size = std::min(size + 1, (int)ThreadBacktraceState::MAX_FRAMES);
+    st.size = 0;
+    st.state = ThreadBacktraceState::Make(seq, ThreadBacktraceState::PENDING);
+    sigval value;
+    value.sival_ptr = (void*)(uintptr_t)seq;
+    if (pthread_sigqueue(thread, ThreadBacktraceSignal(), value)) {
+        st.state = ThreadBacktraceState::Make(seq, ThreadBacktraceState::IDLE);
+        return "";
+    }
+
+    uint64_t done = ThreadBacktraceState::Make(seq, ThreadBacktraceState::DONE);
+    uint64_t deadline = MS() + timeout_ms;
+    while (st.state != done) {
+        if (MS() >= deadline) {
+            uint64_t expected =
+                ThreadBacktraceState::Make(seq, ThreadBacktraceState::PENDING);
+            if (st.state.compare_exchange_strong(
+                    expected, ThreadBacktraceState::Make(
+                                  seq, ThreadBacktraceState::IDLE))) {
+                return "";
+            }
+            /**
+             * 目标线程已经在写了，很快就能写完
+             */
+        }
+        usleep(100);
+    }
+
+    std::vector<std::string> res;
+    BacktraceSymbols(res, st.frames, 1, st.size);
+    st.state = ThreadBacktraceState::Make(seq, ThreadBacktraceState::IDLE);
+    return FormatBacktrace(res, prefix);
+}
+
 uint64_t MS() {
     timeval tv;
     ::gettimeofday(&tv, NULL);
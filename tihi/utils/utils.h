@@ -1,6 +1,7 @@
 #ifndef TIHI_UTILS_H_
 #define TIHI_UTILS_H_
 
+#include <pthread.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <sys/time.h>
@@ -13,6 +14,16 @@ pid_t ThreadId();
 uint32_t FiberId();
 void Backtrace(std::vector<std::string>& res, int offset, int size);
 std::string Backtrace(int offset, int size, const std::string& prefix = "");
+/**
+ * 取另一个线程当前的调用栈，格式与 Backtrace 相同。
+ * 用信号让 thread 自己调用 ::backtrace 把地址写进预先准备好的缓冲区，
+ * 符号在调用线程里解析；thread 在 timeout_ms 内没有响应时返回空字符串。
+ * 信号带 SA_RESTART，被打断的阻塞调用大多会自动重启，sleep 一类的调用会提前返回。
+ * 信号带着请求的序号，超时之后才到的信号会被忽略
+ */
+std::string ThreadBacktrace(pthread_t thread, int size,
+                            const std::string& prefix = "",
+                            uint32_t timeout_ms = 100);
 uint64_t MS();
 uint64_t US();
 }  // namespace tihi